@@ -0,0 +1,196 @@
+// Micro-benchmarks for SilkCast's per-frame hot paths at 480p, 720p and
+// 1080p. Inputs come from the synthetic test pattern, so runs are
+// reproducible without a camera.
+//
+//   silkcast_bench [filter]   e.g. `silkcast_bench yuyv` or `silkcast_bench 720`
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "capture_pattern.hpp"
+#include "encoder_h264.hpp"
+#include "mp4_frag.hpp"
+#include "stream_utils.hpp"
+#include "types.hpp"
+#include "yuv_convert.hpp"
+
+namespace {
+struct Resolution {
+  const char *name;
+  int width;
+  int height;
+};
+constexpr Resolution kResolutions[] = {
+    {"480p", 640, 480}, {"720p", 1280, 720}, {"1080p", 1920, 1080}};
+
+// Runs `fn` until at least `kMinIterations` calls and `kMinTime` have
+// passed, after a short warm-up, and prints the mean time per call and the
+// throughput over `bytes` per call.
+constexpr int kMinIterations = 20;
+constexpr auto kMinTime = std::chrono::milliseconds(500);
+
+std::string filter;
+
+void run(const std::string &name, const Resolution &res, size_t bytes,
+         const std::function<void()> &fn) {
+  const std::string label = name + " " + res.name;
+  if (!filter.empty() && label.find(filter) == std::string::npos)
+    return;
+  for (int i = 0; i < 3; ++i)
+    fn();
+  const auto start = std::chrono::steady_clock::now();
+  auto now = start;
+  int iterations = 0;
+  while (iterations < kMinIterations || now - start < kMinTime) {
+    fn();
+    ++iterations;
+    now = std::chrono::steady_clock::now();
+  }
+  const double us =
+      std::chrono::duration<double, std::micro>(now - start).count() /
+      iterations;
+  std::printf("%-34s %10.1f us/op %9.1f MB/s %8d iters\n", label.c_str(), us,
+              bytes / us, iterations);
+}
+
+std::vector<uint8_t> pattern(PixelFormat fmt, const Resolution &res,
+                             int stride, uint64_t index = 0) {
+  std::vector<uint8_t> frame(test_pattern_size(fmt, stride, res.height));
+  render_test_pattern(fmt, res.width, res.height, stride, index,
+                      frame.data());
+  return frame;
+}
+
+// The configured H.264 backend at `res`, or nullptr without one.
+std::unique_ptr<H264Encoder> make_encoder(const Resolution &res) {
+  CaptureParams params;
+  params.codec = "h264";
+  params.width = res.width;
+  params.height = res.height;
+  params.fps = 30;
+  params.bitrate_kbps = res.width * res.height * 30 / 10000; // ~0.1 bpp
+  params.latency = "low";
+  stream::apply_latency_preset(params);
+  return create_h264_encoder({}, params, {PixelFormat::I420, res.width});
+}
+
+// Annex-B access unit with SPS/PPS and IDR slices: encoded when an encoder
+// exists, otherwise synthetic (valid start codes and NAL headers, noise
+// payload, about 0.1 bytes per pixel).
+std::string sample_access_unit(const Resolution &res) {
+  if (auto encoder = make_encoder(res)) {
+    const auto frame = pattern(PixelFormat::I420, res, res.width);
+    const uint8_t *y = frame.data();
+    const uint8_t *u = y + res.width * res.height;
+    const uint8_t *v = u + res.width * res.height / 4;
+    EncodedFrame out;
+    encoder->force_idr();
+    if (encoder->encode_i420(y, u, v, res.width, res.width / 2, out) &&
+        !out.data.empty())
+      return out.data;
+  }
+  static const char kStartCode[] = {0, 0, 0, 1};
+  std::string au;
+  const uint8_t sps[] = {0x67, 0x42, 0xC0, 0x1F, 0x8C, 0x8D, 0x40};
+  const uint8_t pps[] = {0x68, 0xCE, 0x3C, 0x80};
+  au.append(kStartCode, 4);
+  au.append(reinterpret_cast<const char *>(sps), sizeof(sps));
+  au.append(kStartCode, 4);
+  au.append(reinterpret_cast<const char *>(pps), sizeof(pps));
+  const size_t slice_bytes = static_cast<size_t>(res.width) * res.height / 40;
+  uint32_t noise = 0x12345678;
+  for (int slice = 0; slice < 4; ++slice) {
+    au.append(kStartCode, 4);
+    au.push_back(static_cast<char>(0x65));
+    for (size_t i = 0; i < slice_bytes; ++i) {
+      noise = noise * 1664525u + 1013904223u;
+      // Keep 0x000001 out of the payload, as emulation prevention would.
+      au.push_back(static_cast<char>((noise >> 24) | 0x01));
+    }
+  }
+  return au;
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc > 1)
+    filter = argv[1];
+  std::printf("YUV kernels: %s\n", yuv_convert_backend());
+
+  for (const auto &res : kResolutions) {
+    const int w = res.width;
+    const int h = res.height;
+    std::vector<uint8_t> i420(static_cast<size_t>(w) * h * 3 / 2);
+    uint8_t *dy = i420.data();
+    uint8_t *du = dy + w * h;
+    uint8_t *dv = du + w * h / 4;
+
+    const auto yuyv = pattern(PixelFormat::YUYV, res, w * 2);
+    run("yuyv_to_i420", res, yuyv.size(), [&] {
+      yuyv_to_i420(yuyv.data(), w * 2, w, h, dy, w, du, w / 2, dv, w / 2);
+    });
+
+    const auto nv12 = pattern(PixelFormat::NV12, res, w);
+    run("nv12_to_i420", res, nv12.size(), [&] {
+      nv12_to_i420(nv12.data(), w, nv12.data() + w * h, w, w, h, dy, w, du,
+                   w / 2, dv, w / 2);
+    });
+
+    // Worst case for the static-scene test: identical frames, so every
+    // block is compared and none exits early.
+    const auto yuyv_copy = yuyv;
+    std::vector<uint32_t> block_sums;
+    run("blocks_differ (yuyv, unchanged)", res, yuyv.size(), [&] {
+      blocks_differ(yuyv.data(), w * 2, yuyv_copy.data(), w * 2, w * 2, h, 4,
+                    block_sums);
+    });
+
+    const std::string au = sample_access_unit(res);
+    std::string avcc;
+    run("annexb_to_avcc", res, au.size(),
+        [&] { avcc = stream::annexb_to_avcc(au); });
+
+    std::vector<uint8_t> sps;
+    std::vector<uint8_t> pps;
+    run("extract_sps_pps", res, au.size(),
+        [&] { stream::extract_sps_pps(au, sps, pps); });
+
+    if (!sps.empty() && !pps.empty()) {
+      Mp4Fragmenter mux(w, h, 30, sps, pps);
+      uint32_t seq = 1;
+      std::string fragment;
+      run("Mp4Fragmenter::build_fragment", res, avcc.size(), [&] {
+        fragment = mux.build_fragment(avcc, seq, seq * 3000ull, 3000, true);
+        ++seq;
+      });
+    }
+
+    auto encoder = make_encoder(res);
+    if (!encoder) {
+      std::printf("%-34s skipped (no H.264 encoder)\n",
+                  (std::string("H264Encoder::encode_i420 ") + res.name)
+                      .c_str());
+      continue;
+    }
+    // A fresh frame each call so the encoder sees motion, not a static
+    // picture it can skip.
+    std::vector<std::vector<uint8_t>> frames;
+    for (uint64_t i = 0; i < 8; ++i)
+      frames.push_back(pattern(PixelFormat::I420, res, w, i));
+    size_t next = 0;
+    run(std::string("H264Encoder::encode_i420 (") + encoder->name() + ")",
+        res, i420.size(), [&] {
+          const auto &f = frames[next++ % frames.size()];
+          const uint8_t *y = f.data();
+          EncodedFrame out;
+          encoder->encode_i420(y, y + w * h, y + w * h + w * h / 4, w, w / 2,
+                               out);
+        });
+  }
+  return 0;
+}
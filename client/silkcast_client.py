@@ -18,9 +18,46 @@ except ImportError:
 logging.basicConfig(level=logging.INFO)
 logger = logging.getLogger("SilkCastClient")
 
-# Header structure: [frame_id:4][frag_id:2][num_frags:2][data_size:4]
-HEADER_FORMAT = "<IHHI"
+# Header structure: [frame_id:4][frag_id:2][num_frags:2][data_size:2][flags:1][fec_span:1]
+HEADER_FORMAT = "<IHHHBB"
 HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+FLAG_RETRANSMIT = 0x01
+FLAG_PARITY = 0x02
+# Header followed by the capture time (u32, 90 kHz); requested with ts=1.
+FLAG_TIMESTAMP = 0x04
+TIMESTAMP_FORMAT = "<I"
+TIMESTAMP_SIZE = struct.calcsize(TIMESTAMP_FORMAT)
+# Frames kept open for late fragments (retransmits, parity) before they
+# count as lost.
+REORDER_WINDOW = 3
+
+class _PendingFrame:
+    def __init__(self, num_frags):
+        self.num_frags = num_frags
+        self.fragments = {}  # frag_id -> payload
+        self.parity = {}     # first covered frag_id -> (span, sizes, payload)
+        self.nacked = False
+
+    def complete(self):
+        return len(self.fragments) == self.num_frags
+
+    def recover(self):
+        """Rebuilds a single missing fragment from each parity group."""
+        for first, (span, sizes, payload) in self.parity.items():
+            group = range(first, min(first + span, self.num_frags))
+            missing = [f for f in group if f not in self.fragments]
+            if len(missing) != 1:
+                continue
+            rebuilt = bytearray(payload)
+            for f in group:
+                if f in self.fragments:
+                    sizes ^= len(self.fragments[f])
+                    for i, b in enumerate(self.fragments[f]):
+                        rebuilt[i] ^= b
+            self.fragments[missing[0]] = bytes(rebuilt[:sizes])
+
+    def missing(self):
+        return [f for f in range(self.num_frags) if f not in self.fragments]
 
 class SilkCastReceiver:
     def __init__(self, host, port=8080, device_id="video0", codec="mjpeg"):
@@ -35,15 +72,23 @@ class SilkCastReceiver:
         self.latest_frame = None
         self.lock = threading.Lock()
         
-        # Reassembly state
-        self.current_frame_id = -1
-        self.fragments = {} # frag_id -> data
-        self.expected_frags = 0
+        # Reassembly state: frame_id -> _PendingFrame
+        self.pending = {}
         
         # Stats / Feedback
         self.last_frame_seq = -1
         self.last_idr_req_time = 0
         self.frames_received = 0
+        # Receiver report window (H.264): sent once a second so the server
+        # can adapt bitrate and frame rate to this link.
+        self.report_start = time.time()
+        self.report_expected = 0
+        self.report_received = 0
+        self.report_bytes = 0
+        self.last_arrival = None
+        self.interarrival = None
+        self.last_transit = None
+        self.jitter_ms = 0.0
         
         # H264 Decoder
         self.av_codec_ctx = None
@@ -63,11 +108,13 @@ class SilkCastReceiver:
         
         # 2. Call API to start stream
         url = f"http://{self.host}:{self.api_port}/stream/udp/{self.device_id}"
+        self.stream_size = {"w": 1280, "h": 720, "fps": 30}  # Default params, can be parameterized
         params = {
             "target": local_ip,
             "port": actual_port,
             "codec": self.codec,
-            "w": 1280, "h": 720, "fps": 30, # Default params, can be parameterized
+            **self.stream_size,
+            "ts": 1,  # capture time per frame, for jitter
             "duration": 999999 # Long duration
         }
         logger.info(f"Requesting stream: {url} with {params}")
@@ -102,6 +149,21 @@ class SilkCastReceiver:
         except Exception as e:
             logger.error(f"Failed to send feedback: {e}")
 
+    def request_nack(self, frame_id, frags):
+        """Asks the server to resend lost fragments of a recent H.264 frame."""
+        def send():
+            try:
+                url = f"http://{self.host}:{self.api_port}/stream/{self.device_id}/feedback"
+                res = requests.post(url, params={
+                    "type": "nack", "frame": frame_id,
+                    "frags": ",".join(str(f) for f in frags)}, timeout=1)
+                if res.status_code != 200:
+                    self.request_idr()
+            except Exception as e:
+                logger.error(f"Failed to send NACK: {e}")
+        # Off the receive thread, which must keep draining the socket.
+        threading.Thread(target=send, daemon=True).start()
+
     def _recv_loop(self):
         self.udp_sock.settimeout(1.0)
         while self.running:
@@ -119,28 +181,107 @@ class SilkCastReceiver:
             return
 
         # Parse Header
-        frame_id, frag_id, num_frags, data_len = struct.unpack(HEADER_FORMAT, data[:HEADER_SIZE])
+        frame_id, frag_id, num_frags, data_len, flags, fec_span = struct.unpack(
+            HEADER_FORMAT, data[:HEADER_SIZE])
         payload = data[HEADER_SIZE:]
+        pts = None
+        if flags & FLAG_TIMESTAMP:
+            if len(payload) < TIMESTAMP_SIZE:
+                return
+            (pts,) = struct.unpack(TIMESTAMP_FORMAT, payload[:TIMESTAMP_SIZE])
+            payload = payload[TIMESTAMP_SIZE:]
+        parity = flags & FLAG_PARITY
         
-        if len(payload) != data_len:
+        if not parity and len(payload) != data_len:
             # logger.warning("Packet truncated")
             return
+        if frame_id <= self.last_frame_seq:
+            return  # already delivered or given up on (late retransmit)
 
-        # Check for new frame
-        if frame_id != self.current_frame_id:
-            # If we were building a frame and didn't finish, it's lost.
-            if self.fragments:
-                # Dropped frame logic
-                logger.debug(f"Dropped frame {self.current_frame_id} (incomplete)")
-                if self.codec == "h264":
-                    # If we dropped a frame in H264, we likely need IDR if it was a reference frame.
-                    # Simple heuristic: lost frames -> bad.
-                    pass
+        self.report_bytes += len(data)
+        if not parity and not flags & FLAG_RETRANSMIT:
+            self.report_received += 1
+        frame = self.pending.get(frame_id)
+        if frame is None:
+            if flags & FLAG_RETRANSMIT:
+                return  # answer for a frame we already gave up on
+            frame = self.pending[frame_id] = _PendingFrame(num_frags)
+            self.report_expected += num_frags
+            self._track_arrival(pts)
+            # A frame still open this far behind the newest one is lost:
+            # ask for its missing fragments while the server has them.
+            for old_id, old in self.pending.items():
+                if old_id < frame_id and not old.nacked and not old.complete():
+                    old.nacked = True
+                    if self.codec == "h264":
+                        old.recover()
+                        if not old.complete():
+                            self.request_nack(old_id, old.missing())
             
-            # Start new frame
-            self.current_frame_id = frame_id
-            self.fragments = {}
-            self.expected_frags = num_frags
+        if parity:
+            frame.parity[frag_id] = (fec_span, data_len, payload)
+        else:
+            frame.fragments[frag_id] = payload
+        if not frame.complete():
+            frame.recover()
+        self._deliver()
+
+    def _track_arrival(self, pts=None):
+        """Jitter: smoothed deviation of the frame interarrival time, or with
+        capture times, of the transit time (RFC 3550), so an irregular
+        camera or encoder does not count as network jitter."""
+        now = time.time()
+        if pts is not None:
+            transit = now * 1000.0 - pts / 90.0
+            if self.last_transit is not None:
+                d = abs(transit - self.last_transit)
+                if d < 10000:  # not a 90 kHz wrap
+                    self.jitter_ms += (d - self.jitter_ms) / 16.0
+            self.last_transit = transit
+        elif self.last_arrival is not None:
+            gap = (now - self.last_arrival) * 1000.0
+            if self.interarrival is None:
+                self.interarrival = gap
+            self.jitter_ms += (abs(gap - self.interarrival) - self.jitter_ms) / 16.0
+            self.interarrival += (gap - self.interarrival) / 16.0
+        self.last_arrival = now
+        if self.codec == "h264" and now - self.report_start >= 1.0:
+            self._send_report(now)
+
+    def _send_report(self, now):
+        elapsed = now - self.report_start
+        expected = max(self.report_expected, 1)
+        loss = max(0.0, 1.0 - self.report_received / expected)
+        params = {
+            "type": "report", "loss": f"{loss:.3f}",
+            "jitter": f"{self.jitter_ms:.1f}",
+            "rate": int(self.report_bytes * 8 / 1000 / elapsed),
+            **self.stream_size,  # names our rendition
+        }
+        self.report_start = now
+        self.report_expected = self.report_received = self.report_bytes = 0
+        def send():
+            try:
+                url = f"http://{self.host}:{self.api_port}/stream/{self.device_id}/feedback"
+                requests.post(url, params=params, timeout=1)
+            except Exception as e:
+                logger.error(f"Failed to send report: {e}")
+        threading.Thread(target=send, daemon=True).start()
+
+    def _deliver(self):
+        """Hands complete frames over in order; drops those out of time."""
+        while self.pending:
+            frame_id = min(self.pending)
+            frame = self.pending[frame_id]
+            if not frame.complete():
+                if len(self.pending) <= REORDER_WINDOW:
+                    return
+                logger.debug(f"Dropped frame {frame_id} (incomplete)")
+                if self.codec == "h264":
+                    self.request_idr()
+                del self.pending[frame_id]
+                continue
+            del self.pending[frame_id]
             
             # Gap check
             if self.last_frame_seq != -1 and frame_id > self.last_frame_seq + 1:
@@ -149,22 +290,11 @@ class SilkCastReceiver:
                     self.request_idr()
             self.last_frame_seq = frame_id
 
-        # Store fragment
-        self.fragments[frag_id] = payload
-        
-        # Check if complete
-        if len(self.fragments) == self.expected_frags:
             # Reassemble
             full_data = bytearray()
-            try:
-                for i in range(self.expected_frags):
-                    full_data.extend(self.fragments[i])
-                
-                self._decode_frame(full_data)
-            except KeyError:
-                logger.warning("Missing fragment during reassembly?")
-            
-            self.fragments = {} # Clear
+            for i in range(frame.num_frags):
+                full_data.extend(frame.fragments[i])
+            self._decode_frame(full_data)
 
     def _decode_frame(self, data):
         if self.codec == "mjpeg":
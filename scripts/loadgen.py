@@ -0,0 +1,257 @@
+#!/usr/bin/env python3
+"""Load generator for SilkCast: opens N viewers of each kind and reports
+throughput, server CPU per viewer and capture-to-socket latency percentiles.
+
+Run the server with synthetic devices so no camera is needed:
+
+    ./build/silkcast --test-devices &
+    scripts/loadgen.py --mjpeg 10 --h264 10 --fmp4 10 --udp 4 --duration 20
+
+H.264 viewers (raw, fMP4, UDP) share one session on --device. MJPEG viewers
+use --mjpeg-device, because a session's codec is fixed by its first viewer.
+Latency and frame counts come from the server's /metrics (per-viewer
+`total` stage histograms). Throughput is what this client received. CPU is
+the server's process_cpu_seconds_total, so run both on the same host only
+if you account for the client's own load.
+"""
+
+import argparse
+import http.client
+import re
+import socket
+import threading
+import time
+import urllib.parse
+from collections import defaultdict
+
+KINDS = ("mjpeg", "h264", "fmp4", "udp")
+
+
+class Viewer(threading.Thread):
+    def __init__(self, kind, host, port, path, stop):
+        super().__init__(daemon=True)
+        self.kind = kind
+        self.host, self.port, self.path = host, port, path
+        self.stop = stop
+        self.bytes = 0
+        self.error = None
+        self.first_byte = None
+
+    def run(self):
+        started = time.time()
+        try:
+            conn = http.client.HTTPConnection(self.host, self.port, timeout=10)
+            conn.request("GET", self.path)
+            res = conn.getresponse()
+            if res.status != 200:
+                self.error = f"HTTP {res.status}: {res.read(200)!r}"
+                return
+            while not self.stop.is_set():
+                data = res.read1(65536)
+                if not data:
+                    break
+                if self.first_byte is None:
+                    self.first_byte = time.time() - started
+                self.bytes += len(data)
+            conn.close()
+        except Exception as e:  # a failed viewer is reported, not fatal
+            self.error = str(e)
+
+
+class UdpViewer(threading.Thread):
+    def __init__(self, host, port, device, params, duration, stop):
+        super().__init__(daemon=True)
+        self.kind = "udp"
+        self.host, self.port = host, port
+        self.device, self.params = device, params
+        self.duration, self.stop = duration, stop
+        self.bytes = 0
+        self.datagrams = 0
+        self.error = None
+        self.first_byte = None
+
+    def run(self):
+        sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        sock.bind(("0.0.0.0", 0))
+        sock.settimeout(0.5)
+        query = dict(self.params, target=_local_ip(self.host),
+                     port=sock.getsockname()[1], duration=self.duration + 5)
+        started = time.time()
+        try:
+            conn = http.client.HTTPConnection(self.host, self.port, timeout=10)
+            conn.request("GET", f"/stream/udp/{self.device}?"
+                         + urllib.parse.urlencode(query))
+            res = conn.getresponse()
+            body = res.read()
+            if res.status != 200:
+                self.error = f"HTTP {res.status}: {body[:200]!r}"
+                return
+            while not self.stop.is_set():
+                try:
+                    data = sock.recv(65536)
+                except socket.timeout:
+                    continue
+                if self.first_byte is None:
+                    self.first_byte = time.time() - started
+                self.bytes += len(data)
+                self.datagrams += 1
+        except Exception as e:
+            self.error = str(e)
+        finally:
+            sock.close()
+
+
+def _local_ip(host):
+    s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    try:
+        s.connect((socket.gethostbyname(host), 1))
+        return s.getsockname()[0]
+    except OSError:
+        return "127.0.0.1"
+    finally:
+        s.close()
+
+
+SAMPLE = re.compile(r'^([a-zA-Z_:][\w:]*)(?:\{(.*)\})? (\S+)$')
+LABEL = re.compile(r'(\w+)="((?:[^"\\]|\\.)*)"')
+
+
+def scrape(host, port):
+    """Parses /metrics into [(name, {labels}, value)]."""
+    conn = http.client.HTTPConnection(host, port, timeout=5)
+    conn.request("GET", "/metrics")
+    text = conn.getresponse().read().decode()
+    samples = []
+    for line in text.splitlines():
+        m = SAMPLE.match(line)
+        if m and not line.startswith("#"):
+            samples.append((m.group(1), dict(LABEL.findall(m.group(2) or "")),
+                            float(m.group(3))))
+    return samples
+
+
+def cpu_seconds(samples):
+    return next((v for n, _, v in samples if n == "process_cpu_seconds_total"),
+                0.0)
+
+
+def per_kind(samples, name, stage=None):
+    """Sums a per-viewer metric over viewers of each kind.
+
+    A histogram is read from its name_bucket samples, keyed by `le`.
+    """
+    out = defaultdict(lambda: defaultdict(float))
+    for n, labels, v in samples:
+        if n not in (name, name + "_bucket") or "kind" not in labels:
+            continue
+        if stage and labels.get("stage") != stage:
+            continue
+        out[labels["kind"]][labels.get("le", "")] += v
+    return out
+
+
+def percentile(buckets, q):
+    """Quantile (seconds) from merged cumulative Prometheus buckets."""
+    bounds = sorted((float(le), c) for le, c in buckets.items()
+                    if le not in ("", "+Inf"))
+    total = buckets.get("+Inf", 0)
+    if total <= 0:
+        return None
+    rank = q * total
+    prev_bound, prev_count = 0.0, 0.0
+    for bound, count in bounds:
+        if count >= rank:
+            frac = (rank - prev_count) / max(count - prev_count, 1e-9)
+            return prev_bound + (bound - prev_bound) * frac
+        prev_bound, prev_count = bound, count
+    return bounds[-1][0] if bounds else None
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("--host", default="127.0.0.1")
+    ap.add_argument("--port", type=int, default=8080)
+    ap.add_argument("--device", default="test:pattern")
+    ap.add_argument("--mjpeg-device", default="test:pattern-yuyv")
+    for kind in KINDS:
+        ap.add_argument(f"--{kind}", type=int, default=0,
+                        help=f"{kind} viewers to open")
+    ap.add_argument("--duration", type=float, default=10.0)
+    ap.add_argument("--w", type=int, default=1280)
+    ap.add_argument("--h", type=int, default=720)
+    ap.add_argument("--fps", type=int, default=30)
+    ap.add_argument("--bitrate", type=int, default=2000)
+    ap.add_argument("--latency", default="low")
+    args = ap.parse_args()
+
+    params = {"w": args.w, "h": args.h, "fps": args.fps,
+              "bitrate": args.bitrate, "latency": args.latency}
+    h264 = dict(params, codec="h264")
+
+    def live(device, query):
+        return (f"/stream/live/{urllib.parse.quote(device)}?"
+                + urllib.parse.urlencode(query))
+
+    stop = threading.Event()
+    viewers = []
+    for _ in range(args.mjpeg):
+        viewers.append(Viewer("mjpeg", args.host, args.port,
+                              live(args.mjpeg_device,
+                                   dict(params, codec="mjpeg")), stop))
+    for _ in range(args.h264):
+        viewers.append(Viewer("h264", args.host, args.port,
+                              live(args.device, h264), stop))
+    for _ in range(args.fmp4):
+        viewers.append(Viewer("fmp4", args.host, args.port,
+                              live(args.device, dict(h264, container="mp4")),
+                              stop))
+    for _ in range(args.udp):
+        viewers.append(UdpViewer(args.host, args.port, args.device, h264,
+                                 args.duration, stop))
+    if not viewers:
+        ap.error("open at least one viewer (--mjpeg/--h264/--fmp4/--udp)")
+
+    for v in viewers:
+        v.start()
+    time.sleep(1.0)  # let sessions open and the first GOPs flow
+    before = scrape(args.host, args.port)
+    bytes_before = {id(v): v.bytes for v in viewers}
+    start = time.time()
+    time.sleep(args.duration)
+    after = scrape(args.host, args.port)
+    elapsed = time.time() - start
+    received = {id(v): v.bytes - bytes_before[id(v)] for v in viewers}
+    stop.set()
+
+    cpu = cpu_seconds(after) - cpu_seconds(before)
+    frames_before = per_kind(before, "silkcast_viewer_frames_sent_total")
+    frames_after = per_kind(after, "silkcast_viewer_frames_sent_total")
+    latency = per_kind(after, "silkcast_viewer_stage_seconds", "total")
+
+    print(f"{len(viewers)} viewers for {elapsed:.1f}s; server CPU "
+          f"{100 * cpu / elapsed:.1f}% "
+          f"({1000 * cpu / elapsed / len(viewers):.2f} ms/s per viewer)")
+    print(f"{'kind':6} {'n':>4} {'ok':>4} {'Mbit/s':>9} {'fps/viewer':>11} "
+          f"{'p50 ms':>8} {'p90 ms':>8} {'p99 ms':>8}")
+    for kind in KINDS:
+        group = [v for v in viewers if v.kind == kind]
+        if not group:
+            continue
+        ok = [v for v in group if v.error is None and v.first_byte is not None]
+        mbit = sum(received[id(v)] for v in group) * 8 / 1e6 / elapsed
+        frames = (frames_after[kind].get("", 0)
+                  - frames_before[kind].get("", 0))
+        fps = frames / elapsed / max(len(ok), 1)
+        pct = [percentile(latency[kind], q) for q in (0.5, 0.9, 0.99)]
+        cells = " ".join(f"{1000 * p:8.2f}" if p is not None else f"{'-':>8}"
+                         for p in pct)
+        print(f"{kind:6} {len(group):4d} {len(ok):4d} {mbit:9.2f} "
+              f"{fps:11.1f} {cells}")
+        for v in group:
+            if v.error:
+                print(f"  {kind} viewer failed: {v.error}")
+                break
+
+
+if __name__ == "__main__":
+    main()
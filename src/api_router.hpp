@@ -150,6 +150,8 @@ public:
         svr.Get(regex_path, route.handler);
       } else if (route.method == "POST") {
         svr.Post(regex_path, route.handler);
+      } else if (route.method == "DELETE") {
+        svr.Delete(regex_path, route.handler);
       }
     }
 
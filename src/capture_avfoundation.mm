@@ -9,12 +9,29 @@
 #import <ImageIO/ImageIO.h>
 
 #include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <vector>
 
 namespace {
+// The sample's presentation time on the steady clock. The capture session
+// stamps samples with the host time clock, which is read next to
+// steady_clock here; an implausible stamp falls back to now.
+std::chrono::steady_clock::time_point sample_time(CMSampleBufferRef sample) {
+  const auto now = std::chrono::steady_clock::now();
+  const CMTime pts = CMSampleBufferGetPresentationTimeStamp(sample);
+  if (!CMTIME_IS_NUMERIC(pts))
+    return now;
+  const double age = CMTimeGetSeconds(
+      CMTimeSubtract(CMClockGetTime(CMClockGetHostTimeClock()), pts));
+  if (!(age >= 0.0 && age < 1.0))
+    return now;
+  return now - std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                   std::chrono::duration<double>(age));
+}
+
 bool parse_index(const std::string &id, int &index) {
   size_t pos = std::string::npos;
   if (id.rfind("video", 0) == 0) {
@@ -144,7 +161,7 @@ struct CaptureV4L2::Impl {
   bool want_mjpeg = false;
 };
 
-CaptureV4L2::CaptureV4L2() = default;
+CaptureV4L2::CaptureV4L2(const CaptureOptions &) {}
 
 CaptureV4L2::~CaptureV4L2() { stop(); }
 
@@ -263,16 +280,29 @@ void CaptureV4L2::stop() {
     }
     impl_.reset();
   }
-  std::lock_guard<std::mutex> lock(buf_mu_);
-  buffer_.clear();
+  publish(nullptr);
 }
 
-bool CaptureV4L2::latest_frame(std::string &out) {
-  std::lock_guard<std::mutex> lock(buf_mu_);
-  if (buffer_.empty())
-    return false;
-  out = buffer_;
-  return true;
+FrameRef CaptureV4L2::latest_frame() const {
+  std::lock_guard<std::mutex> lock(latest_mu_);
+  return latest_;
+}
+
+FrameRef CaptureV4L2::wait_frame(uint64_t after_seq,
+                                 std::chrono::milliseconds timeout) const {
+  std::unique_lock<std::mutex> lock(latest_mu_);
+  auto fresh = [&] { return latest_ && latest_->seq > after_seq; };
+  latest_cv_.wait_for(lock, timeout, fresh);
+  return fresh() ? latest_ : nullptr;
+}
+
+void CaptureV4L2::publish(FrameRef frame) {
+  {
+    std::lock_guard<std::mutex> lock(latest_mu_);
+    latest_.swap(frame);
+  }
+  latest_cv_.notify_all();
+  listeners_.notify();
 }
 
 void CaptureV4L2::handle_sample(void *sample_buffer) {
@@ -280,6 +310,7 @@ void CaptureV4L2::handle_sample(void *sample_buffer) {
     return;
   @autoreleasepool {
     auto *sample = reinterpret_cast<CMSampleBufferRef>(sample_buffer);
+    const auto captured_at = sample_time(sample);
     CVImageBufferRef image_buffer = CMSampleBufferGetImageBuffer(sample);
     if (!image_buffer)
       return;
@@ -307,9 +338,12 @@ void CaptureV4L2::handle_sample(void *sample_buffer) {
                                      (__bridge CFDictionaryRef)props);
           CGImageDestinationFinalize(dest);
           CFRelease(dest);
-          std::lock_guard<std::mutex> lock(buf_mu_);
-          buffer_.assign(reinterpret_cast<const char *>(data.bytes),
-                         data.length);
+          auto frame = pool_->acquire(data.length);
+          std::memcpy(frame->storage.data(), data.bytes, data.length);
+          frame->seq = ++frame_seq_;
+          frame->captured_at = captured_at;
+          frame->dequeued_at = std::chrono::steady_clock::now();
+          publish(std::move(frame));
         }
         CGImageRelease(cg_image);
       }
@@ -329,9 +363,8 @@ void CaptureV4L2::handle_sample(void *sample_buffer) {
           CVPixelBufferGetBytesPerRowOfPlane(image_buffer, 1);
       const size_t y_size = width * height;
       const size_t uv_size = y_size / 2;
-      std::string local;
-      local.resize(y_size + uv_size);
-      uint8_t *dst = reinterpret_cast<uint8_t *>(local.data());
+      auto frame = pool_->acquire(y_size + uv_size);
+      uint8_t *dst = frame->storage.data();
       uint8_t *dst_y = dst;
       uint8_t *dst_uv = dst + y_size;
       for (size_t y = 0; y < height; ++y) {
@@ -340,8 +373,10 @@ void CaptureV4L2::handle_sample(void *sample_buffer) {
       for (size_t y = 0; y < height / 2; ++y) {
         std::memcpy(dst_uv + y * width, src_uv + y * stride_uv, width);
       }
-      std::lock_guard<std::mutex> lock(buf_mu_);
-      buffer_ = std::move(local);
+      frame->seq = ++frame_seq_;
+      frame->captured_at = captured_at;
+      frame->dequeued_at = std::chrono::steady_clock::now();
+      publish(std::move(frame));
     }
 
     CVPixelBufferUnlockBaseAddress(image_buffer, kCVPixelBufferLock_ReadOnly);
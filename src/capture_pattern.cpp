@@ -0,0 +1,185 @@
+#include "capture_pattern.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+struct TestDevice {
+  const char *id;
+  PixelFormat format;
+};
+constexpr TestDevice kTestDevices[] = {
+    {"test:pattern", PixelFormat::I420},
+    {"test:pattern-nv12", PixelFormat::NV12},
+    {"test:pattern-yuyv", PixelFormat::YUYV},
+};
+
+// Minimal 1x1 white JPEG (valid).
+constexpr unsigned char kTinyJpeg[] = {
+    0xFF, 0xD8, 0xFF, 0xDB, 0x00, 0x43, 0x00, 0x03, 0x02, 0x02, 0x03, 0x02,
+    0x02, 0x03, 0x03, 0x03, 0x03, 0x04, 0x03, 0x03, 0x04, 0x05, 0x08, 0x05,
+    0x05, 0x04, 0x04, 0x05, 0x0A, 0x07, 0x07, 0x06, 0x08, 0x0C, 0x0A, 0x0C,
+    0x0C, 0x0B, 0x0A, 0x0B, 0x0B, 0x0D, 0x0E, 0x12, 0x10, 0x0D, 0x0E, 0x11,
+    0x0E, 0x0B, 0x0B, 0x10, 0x16, 0x10, 0x11, 0x13, 0x14, 0x15, 0x15, 0x15,
+    0x0C, 0x0F, 0x17, 0x18, 0x16, 0x14, 0x18, 0x12, 0x14, 0x15, 0x14, 0xFF,
+    0xC0, 0x00, 0x11, 0x08, 0x00, 0x01, 0x00, 0x01, 0x03, 0x01, 0x11, 0x00,
+    0x02, 0x11, 0x01, 0x03, 0x11, 0x01, 0xFF, 0xC4, 0x00, 0x14, 0x00, 0x01,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0xFF, 0xC4, 0x00, 0x14, 0x10, 0x01, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0xFF, 0xDA, 0x00, 0x0C, 0x03, 0x01, 0x00, 0x02, 0x11, 0x03,
+    0x11, 0x00, 0x3F, 0x00, 0xFF, 0xD9};
+
+// BT.601 studio-swing colour bars: white, yellow, cyan, green, magenta, red,
+// blue, black as {Y, U, V}.
+constexpr uint8_t kBars[8][3] = {{235, 128, 128}, {210, 16, 146},
+                                 {170, 166, 16},  {145, 54, 34},
+                                 {106, 202, 222}, {81, 90, 240},
+                                 {41, 240, 110},  {16, 128, 128}};
+
+// Bouncing block of frame `index`.
+struct Block {
+  int x = 0;
+  int y = 0;
+  int size = 0;
+
+  Block(int width, int height, uint64_t index) {
+    size = std::max(8, std::min(width, height) / 6) & ~1;
+    const int span_x = std::max(1, width - size);
+    const int span_y = std::max(1, height - size);
+    const auto tx = static_cast<int>((index * 8) % (2 * span_x));
+    const auto ty = static_cast<int>((index * 6) % (2 * span_y));
+    x = (tx < span_x ? tx : 2 * span_x - tx) & ~1;
+    y = (ty < span_y ? ty : 2 * span_y - ty) & ~1;
+  }
+  bool rows(int row) const { return row >= y && row < y + size; }
+};
+
+constexpr int kRampPeriod = 220;
+} // namespace
+
+bool is_test_device(const std::string &device_id) {
+  return device_id.rfind(kTestDevicePrefix, 0) == 0;
+}
+
+PixelFormat test_device_format(const std::string &device_id) {
+  for (const auto &device : kTestDevices)
+    if (device_id == device.id)
+      return device.format;
+  return PixelFormat::UNKNOWN;
+}
+
+std::vector<std::string> test_device_ids() {
+  std::vector<std::string> ids;
+  for (const auto &device : kTestDevices)
+    ids.emplace_back(device.id);
+  return ids;
+}
+
+size_t test_pattern_size(PixelFormat fmt, int stride, int height) {
+  const size_t plane = static_cast<size_t>(stride) * height;
+  return fmt == PixelFormat::YUYV ? plane : plane * 3 / 2;
+}
+
+// Rows are copied out of a scrolling ramp and per-frame chroma rows, with
+// the block stamped on top, so drawing costs about a memcpy per frame.
+void render_test_pattern(PixelFormat fmt, int width, int height, int stride,
+                         uint64_t index, uint8_t *out) {
+  const Block block(width, height, index);
+  std::vector<uint8_t> ramp(static_cast<size_t>(width) + kRampPeriod);
+  for (size_t i = 0; i < ramp.size(); ++i)
+    ramp[i] = static_cast<uint8_t>(16 + i % kRampPeriod);
+  // Subsampled chroma across one row: the bars, neutral inside the block.
+  std::vector<uint8_t> bar_u(width / 2);
+  std::vector<uint8_t> bar_v(width / 2);
+  for (int x = 0; x < width / 2; ++x) {
+    const auto &bar = kBars[std::min(7, 2 * x * 8 / std::max(1, width))];
+    bar_u[x] = bar[1];
+    bar_v[x] = bar[2];
+  }
+  auto luma_row = [&](int y) {
+    return ramp.data() + (y / 4 + index * 4) % kRampPeriod;
+  };
+
+  if (fmt == PixelFormat::YUYV) {
+    std::vector<uint8_t> packed(static_cast<size_t>(width) * 2);
+    for (int y = 0; y < height; ++y) {
+      const uint8_t *luma = luma_row(y);
+      const bool in_block = block.rows(y);
+      for (int x = 0; x < width / 2; ++x) {
+        const bool hit = in_block && 2 * x >= block.x &&
+                         2 * x < block.x + block.size;
+        packed[4 * x] = hit ? 235 : luma[2 * x];
+        packed[4 * x + 1] = hit ? 128 : bar_u[x];
+        packed[4 * x + 2] = hit ? 235 : luma[2 * x + 1];
+        packed[4 * x + 3] = hit ? 128 : bar_v[x];
+      }
+      std::memcpy(out + static_cast<size_t>(y) * stride, packed.data(),
+                  packed.size());
+    }
+    return;
+  }
+
+  for (int y = 0; y < height; ++y) {
+    uint8_t *row = out + static_cast<size_t>(y) * stride;
+    std::memcpy(row, luma_row(y), width);
+    if (block.rows(y))
+      std::memset(row + block.x, 235, block.size);
+  }
+  uint8_t *chroma = out + static_cast<size_t>(stride) * height;
+  const int cx = block.x / 2;
+  const int csize = block.size / 2;
+  if (fmt == PixelFormat::NV12) {
+    std::vector<uint8_t> interleaved(width / 2 * 2);
+    for (int x = 0; x < width / 2; ++x) {
+      interleaved[2 * x] = bar_u[x];
+      interleaved[2 * x + 1] = bar_v[x];
+    }
+    for (int y = 0; y < height / 2; ++y) {
+      uint8_t *row = chroma + static_cast<size_t>(y) * stride;
+      std::memcpy(row, interleaved.data(), interleaved.size());
+      if (block.rows(2 * y))
+        std::memset(row + 2 * cx, 128, 2 * csize);
+    }
+    return;
+  }
+  const int cstride = stride / 2;
+  uint8_t *u = chroma;
+  uint8_t *v = u + static_cast<size_t>(cstride) * (height / 2);
+  for (int y = 0; y < height / 2; ++y) {
+    uint8_t *urow = u + static_cast<size_t>(y) * cstride;
+    uint8_t *vrow = v + static_cast<size_t>(y) * cstride;
+    std::memcpy(urow, bar_u.data(), bar_u.size());
+    std::memcpy(vrow, bar_v.data(), bar_v.size());
+    if (block.rows(2 * y)) {
+      std::memset(urow + cx, 128, csize);
+      std::memset(vrow + cx, 128, csize);
+    }
+  }
+}
+
+const std::vector<uint8_t> &tiny_jpeg() {
+  static const std::vector<uint8_t> jpeg(std::begin(kTinyJpeg),
+                                         std::end(kTinyJpeg));
+  return jpeg;
+}
+
+std::vector<uint8_t> test_pattern_jpeg(size_t bytes) {
+  const auto &base = tiny_jpeg();
+  std::vector<uint8_t> out(base.begin(), base.begin() + 2); // SOI
+  // COM segments right after SOI; decoders skip them.
+  constexpr size_t kMaxSegment = 65533;
+  size_t pad = bytes > base.size() ? bytes - base.size() : 0;
+  while (pad > 4) {
+    const size_t payload = std::min(kMaxSegment, pad - 4);
+    const size_t length = payload + 2;
+    out.push_back(0xFF);
+    out.push_back(0xFE);
+    out.push_back(static_cast<uint8_t>(length >> 8));
+    out.push_back(static_cast<uint8_t>(length & 0xFF));
+    out.insert(out.end(), payload, 'x');
+    pad -= payload + 4;
+  }
+  out.insert(out.end(), base.begin() + 2, base.end());
+  return out;
+}
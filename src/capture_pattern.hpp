@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "types.hpp"
+
+// Synthetic capture for benchmarks and load tests on machines without a
+// camera. CaptureV4L2 serves these device ids itself when
+// CaptureOptions::test_devices is set:
+//   test:pattern       I420
+//   test:pattern-nv12  NV12
+//   test:pattern-yuyv  YUYV (exercises the conversion path)
+// A session opened for MJPEG gets a static JPEG instead.
+inline constexpr const char *kTestDevicePrefix = "test:";
+
+bool is_test_device(const std::string &device_id);
+// Raw layout a test device id stands for; UNKNOWN if it names none.
+PixelFormat test_device_format(const std::string &device_id);
+std::vector<std::string> test_device_ids();
+
+// Bytes of one frame in `fmt` (YUYV, NV12 or I420) with `stride` bytes per
+// row of the packed/luma plane.
+size_t test_pattern_size(PixelFormat fmt, int stride, int height);
+// Draws frame `index`: scrolling luma ramp, colour bars and a bouncing
+// block, so encoders see real motion and texture.
+void render_test_pattern(PixelFormat fmt, int width, int height, int stride,
+                         uint64_t index, uint8_t *out);
+
+// Minimal valid 1x1 JPEG.
+const std::vector<uint8_t> &tiny_jpeg();
+// tiny_jpeg() padded with comment segments to about `bytes`, so MJPEG load
+// tests move realistic frame sizes.
+std::vector<uint8_t> test_pattern_jpeg(size_t bytes);
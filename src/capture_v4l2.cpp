@@ -1,5 +1,7 @@
 #ifdef __linux__
 #include "capture_v4l2.hpp"
+#include "capture_pattern.hpp"
+#include "relay_upstream.hpp"
 
 #include <errno.h>
 #include <fcntl.h>
@@ -11,7 +13,10 @@
 
 #include <algorithm>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <iterator>
 
 using namespace std::chrono_literals;
 
@@ -32,11 +37,77 @@ PixelFormat v4l2_to_pixel_format(__u32 fmt) {
     return PixelFormat::YUYV;
   case V4L2_PIX_FMT_NV12:
     return PixelFormat::NV12;
+  case V4L2_PIX_FMT_YUV420:
+    return PixelFormat::I420;
+  case V4L2_PIX_FMT_H264:
+    return PixelFormat::H264;
   default:
     return PixelFormat::UNKNOWN;
   }
 }
 
+// Drivers flagged TIMESTAMP_MONOTONIC stamp buffers with CLOCK_MONOTONIC,
+// which is steady_clock's clock on Linux. Anything else is stamped on dequeue.
+std::chrono::steady_clock::time_point buffer_timestamp(const v4l2_buffer &buf) {
+  if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) ==
+          V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC &&
+      (buf.timestamp.tv_sec != 0 || buf.timestamp.tv_usec != 0)) {
+    const auto since_boot = std::chrono::seconds(buf.timestamp.tv_sec) +
+                            std::chrono::microseconds(buf.timestamp.tv_usec);
+    return std::chrono::steady_clock::time_point(
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            since_boot));
+  }
+  return std::chrono::steady_clock::now();
+}
+
+// Source format for the H.264 path, best first: the camera's own H.264
+// costs nothing to encode, planar 4:2:0 goes to the encoder untouched, NV12
+// only needs its chroma split, and YUYV (which every UVC camera offers)
+// needs a full conversion pass.
+__u32 pick_h264_source_format(int fd, bool allow_passthrough) {
+  static constexpr __u32 kPreference[] = {
+      V4L2_PIX_FMT_H264, V4L2_PIX_FMT_YUV420, V4L2_PIX_FMT_NV12,
+      V4L2_PIX_FMT_YUYV};
+  size_t best = std::size(kPreference);
+  v4l2_fmtdesc desc{};
+  desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  for (desc.index = 0; xioctl(fd, VIDIOC_ENUM_FMT, &desc); ++desc.index) {
+    for (size_t i = allow_passthrough ? 0 : 1; i < best; ++i) {
+      if (desc.pixelformat == kPreference[i]) {
+        best = i;
+        break;
+      }
+    }
+  }
+  return best < std::size(kPreference) ? kPreference[best]
+                                       : V4L2_PIX_FMT_YUYV;
+}
+
+// Driver queue depth. ultra keeps just two buffers so the encoder never
+// works on a stale frame; view buys headroom for bursty consumers at high
+// frame rates. An explicit --capture-buffers wins.
+unsigned buffer_count_for(const CaptureParams &params, unsigned requested) {
+  if (requested > 0)
+    return std::clamp(requested, 2u, 16u);
+  if (params.latency == "ultra")
+    return 2;
+  if (params.latency == "low")
+    return 3;
+  return params.fps > 30 ? 6 : 4;
+}
+
+const char *capture_io_label(CaptureIo io) {
+  switch (io) {
+  case CaptureIo::Userptr:
+    return "userptr";
+  case CaptureIo::Dmabuf:
+    return "dmabuf";
+  default:
+    return "mmap";
+  }
+}
+
 std::string fourcc_to_string(__u32 fmt) {
   char fourcc[5] = {static_cast<char>(fmt & 0xFF),
                     static_cast<char>((fmt >> 8) & 0xFF),
@@ -46,39 +117,95 @@ std::string fourcc_to_string(__u32 fmt) {
 }
 } // namespace
 
-CaptureV4L2::~CaptureV4L2() { stop(); }
+// Driver buffer ring. Frames lent out zero-copy hold a reference and
+// requeue their slot when released, so the ring and its mappings outlive
+// stop() until the last lent frame is dropped.
+struct CaptureV4L2::BufferRing {
+  struct Slot {
+    uint8_t *start = nullptr;
+    size_t length = 0;
+    int dmabuf_fd = -1;
+  };
+
+  int fd = -1; // device fd; only touched while !closed
+  __u32 memory = V4L2_MEMORY_MMAP;
+  std::vector<Slot> slots;
+
+  ~BufferRing() {
+    for (auto &slot : slots) {
+      if (slot.dmabuf_fd >= 0)
+        ::close(slot.dmabuf_fd);
+      if (!slot.start)
+        continue;
+      if (memory == V4L2_MEMORY_USERPTR)
+        std::free(slot.start);
+      else
+        munmap(slot.start, slot.length);
+    }
+  }
 
-void CaptureV4L2::cleanup_mmap_buffers() {
-  for (unsigned i = 0; i < num_buffers_; ++i) {
-    if (buffers_[i].start && buffers_[i].start != MAP_FAILED) {
-      munmap(buffers_[i].start, buffers_[i].length);
+  bool queue(unsigned index) {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (closed_)
+      return false;
+    v4l2_buffer buf{};
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = memory;
+    buf.index = index;
+    if (memory == V4L2_MEMORY_USERPTR) {
+      buf.m.userptr = reinterpret_cast<unsigned long>(slots[index].start);
+      buf.length = static_cast<__u32>(slots[index].length);
     }
+    if (!xioctl(fd, VIDIOC_QBUF, &buf)) {
+      std::cerr << "VIDIOC_QBUF failed; index=" << index << " errno=" << errno
+                << "\n";
+      return false;
+    }
+    ++queued_;
+    return true;
   }
-  for (unsigned i = 0; i < kNumBuffers; ++i) {
-    buffers_[i].start = nullptr;
-    buffers_[i].length = 0;
+
+  // Records a successful DQBUF; returns how many buffers the driver still
+  // holds to fill.
+  unsigned note_dequeued() {
+    std::lock_guard<std::mutex> lock(mu_);
+    return queued_ > 0 ? --queued_ : 0;
   }
-  num_buffers_ = 0;
-}
 
-void CaptureV4L2::cleanup_mmap_setup_failure(int fd) {
-  if (!use_mmap_) {
-    return;
+  // Stops streaming; late releases of lent frames no longer requeue.
+  void shutdown() {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (closed_)
+      return;
+    closed_ = true;
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    xioctl(fd, VIDIOC_STREAMOFF, &type);
+    queued_ = 0;
   }
-  // Best-effort cleanup for partial mmap setup so retries don't leak buffers.
-  v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  xioctl(fd, VIDIOC_STREAMOFF, &type);
-  cleanup_mmap_buffers();
 
+private:
+  std::mutex mu_;
+  unsigned queued_ = 0;
+  bool closed_ = false;
+};
+
+CaptureV4L2::~CaptureV4L2() { stop(); }
+
+void CaptureV4L2::cleanup_streaming_setup_failure(int fd, uint32_t memory) {
+  // Best-effort cleanup for partial setup so retries don't leak buffers.
+  if (ring_) {
+    ring_->shutdown();
+    ring_.reset();
+  }
   v4l2_requestbuffers req{};
   req.count = 0;
   req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  req.memory = V4L2_MEMORY_MMAP;
+  req.memory = memory;
   xioctl(fd, VIDIOC_REQBUFS, &req);
 }
 
 bool CaptureV4L2::configure_device(int fd, CaptureParams &params) {
-  cleanup_mmap_buffers();
+  ring_.reset();
 
   v4l2_capability cap{};
   if (!xioctl(fd, VIDIOC_QUERYCAP, &cap)) {
@@ -94,16 +221,19 @@ bool CaptureV4L2::configure_device(int fd, CaptureParams &params) {
     std::cerr << "No V4L2_CAP_VIDEO_CAPTURE\n";
     return false;
   }
-  use_mmap_ = (caps & V4L2_CAP_STREAMING) != 0;
-  if (!use_mmap_ && !(caps & V4L2_CAP_READWRITE)) {
+  use_streaming_ = (caps & V4L2_CAP_STREAMING) != 0;
+  if (!use_streaming_ && !(caps & V4L2_CAP_READWRITE)) {
     std::cerr << "Camera supports neither streaming nor read/write\n";
     return false;
   }
-  std::cerr << "Using " << (use_mmap_ ? "mmap streaming" : "read()") << "\n";
+  std::cerr << "Using " << (use_streaming_ ? "streaming I/O" : "read()")
+            << "\n";
 
   // Choose pixel format based on desired codec.
   __u32 pixfmt =
-      params.codec == "h264" ? V4L2_PIX_FMT_YUYV : V4L2_PIX_FMT_MJPEG;
+      params.codec == "h264"
+          ? pick_h264_source_format(fd, options_.h264_passthrough)
+          : V4L2_PIX_FMT_MJPEG;
   std::cerr << "Setting format: " << params.width << "x" << params.height
             << " codec=" << params.codec << " pixfmt=0x" << std::hex << pixfmt
             << std::dec << "\n";
@@ -131,8 +261,8 @@ bool CaptureV4L2::configure_device(int fd, CaptureParams &params) {
               << fourcc_to_string(fmt.fmt.pix.pixelformat) << "\n";
     return false;
   }
-  if (params.codec == "h264" && pixel_format_ != PixelFormat::YUYV &&
-      pixel_format_ != PixelFormat::NV12) {
+  if (params.codec == "h264" && !is_raw_yuv(pixel_format_) &&
+      pixel_format_ != PixelFormat::H264) {
     std::cerr << "Device did not provide raw frames for H264, got "
               << fourcc_to_string(fmt.fmt.pix.pixelformat) << "\n";
     return false;
@@ -175,9 +305,29 @@ bool CaptureV4L2::configure_device(int fd, CaptureParams &params) {
                 << "\n";
     }
   }
+  if (pixel_format_ == PixelFormat::H264) {
+    // Camera-side encoder: pass our rate and GOP on where the driver exposes
+    // them. Many UVC cameras ignore both, so failures are only logged.
+    v4l2_control ctrl{};
+    ctrl.id = V4L2_CID_MPEG_VIDEO_BITRATE;
+    ctrl.value = params.bitrate_kbps * 1000;
+    if (!xioctl(fd, VIDIOC_S_CTRL, &ctrl))
+      std::cerr << "Camera H.264 bitrate control unavailable\n";
+    if (params.gop > 0) {
+      ctrl.id = V4L2_CID_MPEG_VIDEO_H264_I_PERIOD;
+      ctrl.value = params.gop;
+      if (!xioctl(fd, VIDIOC_S_CTRL, &ctrl))
+        std::cerr << "Camera H.264 I-period control unavailable\n";
+    }
+    std::cerr << "Using camera H.264 passthrough\n";
+  }
   std::cerr << "Format set: " << params.width << "x" << params.height
             << " fourcc=" << fourcc_to_string(fmt.fmt.pix.pixelformat) << "\n";
   frame_size_ = fmt.fmt.pix.sizeimage;
+  // Some drivers leave bytesperline at 0 for packed formats.
+  const int min_stride =
+      pixel_format_ == PixelFormat::YUYV ? params.width * 2 : params.width;
+  stride_ = std::max(static_cast<int>(fmt.fmt.pix.bytesperline), min_stride);
 
   // Set FPS if possible.
   v4l2_streamparm sp{};
@@ -196,64 +346,112 @@ bool CaptureV4L2::configure_device(int fd, CaptureParams &params) {
     }
   }
 
-  if (use_mmap_) {
-    // Request buffers
-    v4l2_requestbuffers req{};
-    req.count = kNumBuffers;
+  if (use_streaming_ && !setup_streaming(fd, params))
+    return false;
+
+  return true;
+}
+
+bool CaptureV4L2::setup_streaming(int fd, const CaptureParams &params) {
+  const unsigned want = buffer_count_for(params, options_.buffers);
+  io_ = options_.io;
+  __u32 memory =
+      io_ == CaptureIo::Userptr ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP;
+
+  v4l2_requestbuffers req{};
+  req.count = want;
+  req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  req.memory = memory;
+  if (!xioctl(fd, VIDIOC_REQBUFS, &req) && memory == V4L2_MEMORY_USERPTR) {
+    std::cerr << "USERPTR capture unsupported (errno=" << errno
+              << "); falling back to mmap\n";
+    io_ = CaptureIo::Mmap;
+    memory = V4L2_MEMORY_MMAP;
+    req = {};
+    req.count = want;
     req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    req.memory = V4L2_MEMORY_MMAP;
-    if (!xioctl(fd, VIDIOC_REQBUFS, &req) || req.count < 2) {
-      std::cerr << "VIDIOC_REQBUFS failed; errno=" << errno << "\n";
-      cleanup_mmap_setup_failure(fd);
-      return false;
-    }
-    std::cerr << "Requested " << req.count << " buffers\n";
-
-    // mmap each buffer
-    for (unsigned i = 0; i < req.count && i < kNumBuffers; ++i) {
-      v4l2_buffer buf{};
-      buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-      buf.memory = V4L2_MEMORY_MMAP;
-      buf.index = i;
-      if (!xioctl(fd, VIDIOC_QUERYBUF, &buf)) {
-        std::cerr << "VIDIOC_QUERYBUF failed; errno=" << errno << "\n";
-        cleanup_mmap_setup_failure(fd);
-        return false;
-      }
-      buffers_[i].length = buf.length;
-      buffers_[i].start = mmap(nullptr, buf.length, PROT_READ | PROT_WRITE,
-                               MAP_SHARED, fd, buf.m.offset);
-      if (buffers_[i].start == MAP_FAILED) {
-        std::cerr << "mmap failed; errno=" << errno << "\n";
-        cleanup_mmap_setup_failure(fd);
+    req.memory = memory;
+    xioctl(fd, VIDIOC_REQBUFS, &req);
+  }
+  if (req.count < 2) {
+    std::cerr << "VIDIOC_REQBUFS failed; errno=" << errno << "\n";
+    cleanup_streaming_setup_failure(fd, memory);
+    return false;
+  }
+  std::cerr << "Requested " << want << " buffers, driver gave " << req.count
+            << " (" << capture_io_label(io_) << ")\n";
+
+  ring_ = std::make_shared<BufferRing>();
+  ring_->fd = fd;
+  ring_->memory = memory;
+  ring_->slots.resize(req.count);
+
+  const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  for (unsigned i = 0; i < req.count; ++i) {
+    auto &slot = ring_->slots[i];
+    if (memory == V4L2_MEMORY_USERPTR) {
+      // Page-aligned and page-rounded: the strictest thing drivers ask for.
+      const size_t bytes =
+          frame_size_ > 0 ? frame_size_
+                          : static_cast<size_t>(stride_) * params.height * 2;
+      slot.length = (bytes + page - 1) / page * page;
+      slot.start = static_cast<uint8_t *>(std::aligned_alloc(page, slot.length));
+      if (!slot.start) {
+        std::cerr << "USERPTR buffer allocation failed\n";
+        cleanup_streaming_setup_failure(fd, memory);
         return false;
       }
-      num_buffers_++;
+      continue;
     }
 
-    // Queue all buffers
-    for (unsigned i = 0; i < num_buffers_; ++i) {
-      v4l2_buffer buf{};
-      buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-      buf.memory = V4L2_MEMORY_MMAP;
-      buf.index = i;
-      if (!xioctl(fd, VIDIOC_QBUF, &buf)) {
-        std::cerr << "VIDIOC_QBUF failed; errno=" << errno << "\n";
-        cleanup_mmap_setup_failure(fd);
-        return false;
+    v4l2_buffer buf{};
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = i;
+    if (!xioctl(fd, VIDIOC_QUERYBUF, &buf)) {
+      std::cerr << "VIDIOC_QUERYBUF failed; errno=" << errno << "\n";
+      cleanup_streaming_setup_failure(fd, memory);
+      return false;
+    }
+    void *start = mmap(nullptr, buf.length, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, buf.m.offset);
+    if (start == MAP_FAILED) {
+      std::cerr << "mmap failed; errno=" << errno << "\n";
+      cleanup_streaming_setup_failure(fd, memory);
+      return false;
+    }
+    slot.start = static_cast<uint8_t *>(start);
+    slot.length = buf.length;
+
+    if (io_ == CaptureIo::Dmabuf) {
+      v4l2_exportbuffer exp{};
+      exp.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      exp.index = i;
+      exp.flags = O_CLOEXEC | O_RDONLY;
+      if (xioctl(fd, VIDIOC_EXPBUF, &exp)) {
+        slot.dmabuf_fd = exp.fd;
+      } else {
+        // Still lend the mapping zero-copy, just without an fd to hand on.
+        std::cerr << "VIDIOC_EXPBUF failed for buffer " << i
+                  << "; errno=" << errno << "\n";
       }
     }
+  }
 
-    // Start streaming
-    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    if (!xioctl(fd, VIDIOC_STREAMON, &type)) {
-      std::cerr << "VIDIOC_STREAMON failed; errno=" << errno << "\n";
-      cleanup_mmap_setup_failure(fd);
+  for (unsigned i = 0; i < req.count; ++i) {
+    if (!ring_->queue(i)) {
+      cleanup_streaming_setup_failure(fd, memory);
       return false;
     }
-    std::cerr << "Streaming started\n";
   }
 
+  v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  if (!xioctl(fd, VIDIOC_STREAMON, &type)) {
+    std::cerr << "VIDIOC_STREAMON failed; errno=" << errno << "\n";
+    cleanup_streaming_setup_failure(fd, memory);
+    return false;
+  }
+  std::cerr << "Streaming started\n";
   return true;
 }
 
@@ -263,6 +461,18 @@ bool CaptureV4L2::start(const std::string &device_id,
     return true;
   device_id_ = device_id;
   params_ = params;
+  pattern_ = false;
+  if (relay_upstream_)
+    return start_relay();
+  if (is_test_device(device_id_)) {
+    if (!options_.test_devices || !configure_pattern(params_))
+      return false;
+    pattern_ = true;
+    stop_flag_ = false;
+    running_ = true;
+    thread_ = std::thread([this] { loop(); });
+    return true;
+  }
 
   std::string dev_path =
       device_id_.rfind("/dev/", 0) == 0 ? device_id_ : "/dev/" + device_id_;
@@ -271,6 +481,7 @@ bool CaptureV4L2::start(const std::string &device_id,
     std::cerr << "Failed to open " << dev_path << " errno=" << errno << "\n";
     return false;
   }
+  numa_node_ = device_numa_node(dev_path);
   if (!configure_device(fd_, params_)) {
     ::close(fd_);
     fd_ = -1;
@@ -278,6 +489,7 @@ bool CaptureV4L2::start(const std::string &device_id,
   }
 
   stop_flag_ = false;
+  driver_seq_.reset();
   running_ = true;
   thread_ = std::thread([this] { loop(); });
   return true;
@@ -285,42 +497,98 @@ bool CaptureV4L2::start(const std::string &device_id,
 
 void CaptureV4L2::stop() {
   stop_flag_ = true;
+  {
+    std::lock_guard<std::mutex> lock(relay_mu_);
+    if (relay_)
+      relay_->cancel();
+  }
   if (thread_.joinable())
     thread_.join();
 
   if (fd_ >= 0) {
-    if (use_mmap_) {
-      // Stop streaming
-      v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-      xioctl(fd_, VIDIOC_STREAMOFF, &type);
-
-      // Unmap buffers
-      cleanup_mmap_buffers();
+    if (ring_) {
+      // Frames still lent out keep the ring (and its mappings) alive; they
+      // just stop requeueing once streaming is off.
+      ring_->shutdown();
+      ring_.reset();
     }
     ::close(fd_);
     fd_ = -1;
   }
   running_ = false;
+  publish(nullptr);
 }
 
-bool CaptureV4L2::latest_frame(std::string &out) {
-  std::lock_guard<std::mutex> lock(buf_mu_);
-  if (buffer_.empty())
-    return false;
-  out = buffer_;
-  return true;
+void CaptureV4L2::request_keyframe() {
+  if (relay_upstream_) {
+    std::lock_guard<std::mutex> lock(relay_mu_);
+    if (relay_)
+      relay_->request_idr();
+    return;
+  }
+  if (fd_ < 0 || pixel_format_ != PixelFormat::H264)
+    return;
+  v4l2_control ctrl{};
+  ctrl.id = V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME;
+  xioctl(fd_, VIDIOC_S_CTRL, &ctrl);
+}
+
+FrameRef CaptureV4L2::latest_frame() const {
+  std::lock_guard<std::mutex> lock(latest_mu_);
+  return latest_;
+}
+
+FrameRef CaptureV4L2::wait_frame(uint64_t after_seq,
+                                 std::chrono::milliseconds timeout) const {
+  std::unique_lock<std::mutex> lock(latest_mu_);
+  auto fresh = [&] { return latest_ && latest_->seq > after_seq; };
+  latest_cv_.wait_for(lock, timeout, fresh);
+  return fresh() ? latest_ : nullptr;
+}
+
+void CaptureV4L2::publish(FrameRef frame) {
+  // Swap the handle under the lock, drop the previous one outside it so a
+  // recycle never runs while readers are waiting on latest_mu_.
+  {
+    std::lock_guard<std::mutex> lock(latest_mu_);
+    latest_.swap(frame);
+  }
+  latest_cv_.notify_all();
+  listeners_.notify();
+}
+
+void CaptureV4L2::note_dequeued(CapturedFrame &frame, const v4l2_buffer &buf) {
+  frame.seq = ++frame_seq_;
+  frame.captured_at = buffer_timestamp(buf);
+  frame.dequeued_at = std::chrono::steady_clock::now();
+  metrics_.dequeue.record(frame.captured_at, frame.dequeued_at);
+  if (driver_seq_ && buf.sequence > *driver_seq_ + 1)
+    metrics_.dropped.fetch_add(buf.sequence - *driver_seq_ - 1,
+                               std::memory_order_relaxed);
+  if ((driver_seq_ && buf.sequence == *driver_seq_) ||
+      frame.captured_at == last_captured_at_)
+    metrics_.duplicate.fetch_add(1, std::memory_order_relaxed);
+  driver_seq_ = buf.sequence;
+  last_captured_at_ = frame.captured_at;
 }
 
 void CaptureV4L2::loop() {
-  if (use_mmap_) {
-    loop_mmap();
+  apply_thread_policy(options_.thread_policy, ThreadRole::Capture,
+                      params_.latency, numa_node_, "cap " + device_id_);
+  if (relay_upstream_) {
+    loop_relay();
+  } else if (pattern_) {
+    loop_pattern();
+  } else if (use_streaming_) {
+    loop_streaming();
   } else {
     loop_read();
   }
   running_ = false;
 }
 
-void CaptureV4L2::loop_mmap() {
+void CaptureV4L2::loop_streaming() {
+  const bool lend = io_ != CaptureIo::Mmap;
   while (!stop_flag_) {
     fd_set fds;
     FD_ZERO(&fds);
@@ -342,52 +610,230 @@ void CaptureV4L2::loop_mmap() {
     // Dequeue buffer
     v4l2_buffer buf{};
     buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf.memory = V4L2_MEMORY_MMAP;
+    buf.memory = ring_->memory;
     if (!xioctl(fd_, VIDIOC_DQBUF, &buf)) {
       if (errno == EAGAIN)
         continue;
       std::cerr << "VIDIOC_DQBUF failed; errno=" << errno << "\n";
       break;
     }
-
-    // Copy frame data
-    {
-      std::lock_guard<std::mutex> lock(buf_mu_);
-      buffer_.assign(static_cast<char *>(buffers_[buf.index].start),
-                     buf.bytesused);
+    const unsigned still_queued = ring_->note_dequeued();
+    const auto &slot = ring_->slots[buf.index];
+
+    if (lend && still_queued > 0) {
+      // Zero-copy: the frame points into the driver buffer, and the buffer
+      // goes back to the driver when the last reader drops the frame.
+      auto *lent = new CapturedFrame();
+      lent->external = slot.start;
+      lent->dmabuf_fd = slot.dmabuf_fd;
+      lent->size = buf.bytesused;
+      note_dequeued(*lent, buf);
+      std::shared_ptr<BufferRing> ring = ring_;
+      const unsigned index = buf.index;
+      publish(FrameRef(lent, [ring, index](const CapturedFrame *f) {
+        delete f;
+        ring->queue(index);
+      }));
+      continue;
     }
 
-    // Requeue buffer
-    if (!xioctl(fd_, VIDIOC_QBUF, &buf)) {
-      std::cerr << "VIDIOC_QBUF (requeue) failed; errno=" << errno << "\n";
+    // Copy mode, or readers are holding every other buffer: copy once into
+    // pooled storage and requeue at once so the driver never starves.
+    auto frame = pool_->acquire(buf.bytesused);
+    std::memcpy(frame->storage.data(), slot.start, buf.bytesused);
+    note_dequeued(*frame, buf);
+    if (!ring_->queue(buf.index))
       break;
-    }
+    publish(std::move(frame));
   }
 }
 
 void CaptureV4L2::loop_read() {
   constexpr size_t kMaxFrame = 8 * 1024 * 1024; // up to 1080p YUYV
-  std::string local;
-  local.resize(kMaxFrame);
 
   while (!stop_flag_) {
-    ssize_t n = ::read(fd_, local.data(), local.size());
+    // Block until the driver has a frame rather than spinning on EAGAIN.
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(fd_, &fds);
+    timeval tv{};
+    tv.tv_sec = 0;
+    tv.tv_usec = 100000; // 100ms timeout
+
+    int r = select(fd_ + 1, &fds, nullptr, nullptr, &tv);
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      std::cerr << "select error errno=" << errno << "\n";
+      break;
+    }
+    if (r == 0)
+      continue; // timeout
+
+    // read() lands directly in pooled storage; no staging copy.
+    auto frame = pool_->acquire(kMaxFrame);
+    ssize_t n = ::read(fd_, frame->storage.data(), kMaxFrame);
     if (n < 0) {
-      if (errno == EAGAIN || errno == EINTR) {
-        std::this_thread::sleep_for(5ms);
+      if (errno == EAGAIN || errno == EINTR)
         continue;
-      }
       std::cerr << "read error errno=" << errno << "\n";
       break;
     } else if (n == 0) {
-      std::this_thread::sleep_for(5ms);
       continue;
     }
+    frame->size = static_cast<size_t>(n);
+    frame->seq = ++frame_seq_;
+    frame->captured_at = std::chrono::steady_clock::now();
+    frame->dequeued_at = frame->captured_at;
+    publish(std::move(frame));
+  }
+}
+
+bool CaptureV4L2::configure_pattern(CaptureParams &params) {
+  const PixelFormat raw = test_device_format(device_id_);
+  if (raw == PixelFormat::UNKNOWN) {
+    std::cerr << "Unknown test device " << device_id_ << "\n";
+    return false;
+  }
+  pixel_format_ = params.codec == "h264" ? raw : PixelFormat::MJPEG;
+  params.width = std::clamp(params.width, 16, 3840) & ~1;
+  params.height = std::clamp(params.height, 16, 2160) & ~1;
+  params.fps = std::clamp(params.fps, 1, 120);
+  stride_ = pixel_format_ == PixelFormat::YUYV ? params.width * 2
+                                               : params.width;
+  std::cerr << "Test pattern " << device_id_ << ": " << params.width << "x"
+            << params.height << "@" << params.fps << " "
+            << (pixel_format_ == PixelFormat::MJPEG ? "MJPEG" : "raw")
+            << "\n";
+  return true;
+}
+
+// Paced by the steady clock instead of a driver. Frames are due on a fixed
+// grid and stamped with their slot, as a camera stamps its exposure, so
+// drawing time never shows as jitter; a loop that falls a frame behind
+// skips slots instead of bursting. MJPEG sessions get one static JPEG
+// padded to a typical compressed size (there is no JPEG encoder in the
+// tree); raw formats are drawn fresh for every frame.
+void CaptureV4L2::loop_pattern() {
+  const auto interval =
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::seconds(1)) /
+      std::max(1, params_.fps);
+  const bool jpeg = pixel_format_ == PixelFormat::MJPEG;
+  const std::vector<uint8_t> still =
+      jpeg ? test_pattern_jpeg(static_cast<size_t>(params_.width) *
+                               params_.height / 10)
+           : std::vector<uint8_t>();
+  const size_t size =
+      jpeg ? still.size()
+           : test_pattern_size(pixel_format_, stride_, params_.height);
+  auto next = std::chrono::steady_clock::now();
+  uint64_t index = 0;
+  while (!stop_flag_) {
+    std::this_thread::sleep_until(next);
+    const auto due = next;
+    next += interval;
+    const auto now = std::chrono::steady_clock::now();
+    if (now >= next)
+      next += (now - due) / interval * interval;
+    auto frame = pool_->acquire(size);
+    if (jpeg)
+      std::memcpy(frame->storage.data(), still.data(), size);
+    else
+      render_test_pattern(pixel_format_, params_.width, params_.height,
+                          stride_, index, frame->storage.data());
+    ++index;
+    frame->seq = ++frame_seq_;
+    frame->captured_at = due;
+    frame->dequeued_at = std::chrono::steady_clock::now();
+    publish(std::move(frame));
+  }
+}
+
+void CaptureV4L2::set_relay(const RelayUpstream &upstream) {
+  relay_upstream_ = std::make_shared<const RelayUpstream>(upstream);
+}
+
+// The pull runs on the capture thread. start() waits for the upstream's
+// first keyframe, so the session learns the real geometry before any
+// viewer is served.
+bool CaptureV4L2::start_relay() {
+  {
+    std::lock_guard<std::mutex> lock(relay_mu_);
+    relay_opened_ = false;
+    relay_ended_ = false;
+  }
+  pixel_format_ = PixelFormat::H264;
+  stride_ = 0;
+  stop_flag_ = false;
+  running_ = true;
+  thread_ = std::thread([this] { loop(); });
+  bool opened = false;
+  {
+    std::unique_lock<std::mutex> lock(relay_mu_);
+    relay_cv_.wait_for(lock, std::chrono::seconds(8),
+                       [this] { return relay_opened_ || relay_ended_; });
+    opened = relay_opened_;
+  }
+  if (!opened) {
+    std::cerr << "Relay " << device_id_ << ": cannot pull "
+              << relay_upstream_->url << "\n";
+    stop();
+  }
+  return opened;
+}
+
+// Once open, a lost upstream is retried every second with the session
+// (and its viewers) kept; they just see a pause and resume at the next IDR.
+void CaptureV4L2::loop_relay() {
+  while (!stop_flag_) {
+    auto puller = std::make_shared<RelayPuller>(*relay_upstream_);
+    {
+      std::lock_guard<std::mutex> lock(relay_mu_);
+      relay_ = puller;
+    }
+    if (stop_flag_) // stop() may have cancelled the previous puller only
+      break;
+    puller->run(
+        [this](const RelayStreamInfo &info) {
+          std::lock_guard<std::mutex> lock(relay_mu_);
+          if (relay_opened_)
+            return; // reconnected: keep the geometry viewers were told
+          params_.width = info.width;
+          params_.height = info.height;
+          params_.fps = info.fps;
+          relay_opened_ = true;
+          relay_cv_.notify_all();
+          std::cerr << "Relay " << device_id_ << ": " << info.width << "x"
+                    << info.height << "@" << info.fps << " from "
+                    << relay_upstream_->url << "\n";
+        },
+        [this](const std::string &au) {
+          auto frame = pool_->acquire(au.size());
+          std::memcpy(frame->storage.data(), au.data(), au.size());
+          frame->seq = ++frame_seq_;
+          // Arrival time: the upstream's clock is not ours.
+          frame->captured_at = std::chrono::steady_clock::now();
+          frame->dequeued_at = frame->captured_at;
+          publish(std::move(frame));
+        });
     {
-      std::lock_guard<std::mutex> lock(buf_mu_);
-      buffer_.assign(local.data(), n);
+      std::lock_guard<std::mutex> lock(relay_mu_);
+      relay_.reset();
+      if (!relay_opened_)
+        break; // start() reports the failure
     }
+    if (stop_flag_)
+      break;
+    std::cerr << "Relay " << device_id_ << ": upstream lost, reconnecting\n";
+    for (int i = 0; i < 10 && !stop_flag_; ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  {
+    std::lock_guard<std::mutex> lock(relay_mu_);
+    relay_ended_ = true;
   }
+  relay_cv_.notify_all();
 }
 
 #endif // __linux__
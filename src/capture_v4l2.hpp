@@ -1,96 +1,235 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <optional>
 #include <string>
 #include <thread>
+#include <utility>
+#include <vector>
 
+#include "frame_pool.hpp"
+#include "thread_policy.hpp"
 #include "types.hpp"
 
+// How streaming capture shares buffers with the driver (Linux only).
+enum class CaptureIo {
+  Mmap,    // driver-owned buffers, one copy into pooled frames (default)
+  Userptr, // driver fills buffers we allocate; frames lend them zero-copy
+  Dmabuf,  // mmap buffers also exported via VIDIOC_EXPBUF, lent zero-copy
+};
+
+struct CaptureOptions {
+  CaptureIo io = CaptureIo::Mmap;
+  unsigned buffers = 0; // driver queue depth; 0 = derive from latency tier
+  bool h264_passthrough = true; // use a camera's own H.264 when offered
+  bool test_devices = false;    // serve test:pattern* ids (capture_pattern.hpp)
+  ThreadOptions thread_policy;  // for the capture thread
+};
+
+// Callbacks run on the capture thread after every publish, so readiness-driven
+// consumers (the stream engine) learn about frames without a waiting thread.
+// They must not block. remove() returns only once the callback can no longer
+// be running.
+class FrameListeners {
+public:
+  uint64_t add(std::function<void()> fn) {
+    std::lock_guard<std::mutex> lock(mu_);
+    fns_.emplace_back(next_id_, std::move(fn));
+    return next_id_++;
+  }
+  void remove(uint64_t id) {
+    std::lock_guard<std::mutex> lock(mu_);
+    for (auto it = fns_.begin(); it != fns_.end(); ++it) {
+      if (it->first == id) {
+        fns_.erase(it);
+        return;
+      }
+    }
+  }
+  void notify() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    for (const auto &entry : fns_)
+      entry.second();
+  }
+
+private:
+  mutable std::mutex mu_;
+  std::vector<std::pair<uint64_t, std::function<void()>>> fns_;
+  uint64_t next_id_ = 1;
+};
+
+struct RelayUpstream;
+
 #ifdef __linux__
+struct v4l2_buffer;
+class RelayPuller;
+
 class CaptureV4L2 {
 public:
-  CaptureV4L2() = default;
+  explicit CaptureV4L2(const CaptureOptions &options = {})
+      : options_(options) {}
   ~CaptureV4L2();
 
   bool start(const std::string &device_id, const CaptureParams &params);
   void stop();
   bool running() const { return running_; }
-  bool latest_frame(std::string &out);
+  // Makes start() pull `upstream` instead of opening a device: a relay
+  // (relay_upstream.hpp) that publishes the upstream's H.264 access units
+  // as if a camera had encoded them.
+  void set_relay(const RelayUpstream &upstream);
+  // Handle to the most recent frame (nullptr before the first one). Holding
+  // it keeps the pixels alive; no copy is made.
+  FrameRef latest_frame() const;
+  // Blocks until a frame newer than `after_seq` is published; nullptr on
+  // timeout. Lets consumers follow the camera clock instead of polling.
+  FrameRef wait_frame(uint64_t after_seq,
+                      std::chrono::milliseconds timeout) const;
+  // Registers a callback for each new frame (and for stop()); see
+  // FrameListeners.
+  uint64_t add_frame_listener(std::function<void()> fn) {
+    return listeners_.add(std::move(fn));
+  }
+  void remove_frame_listener(uint64_t id) { listeners_.remove(id); }
   PixelFormat pixel_format() const { return pixel_format_; }
+  // Asks a camera producing H.264 itself for an IDR; best effort.
+  void request_keyframe();
   int width() const { return params_.width; }
   int height() const { return params_.height; }
   int fps() const { return params_.fps; }
+  // Bytes per row of the packed/luma plane as reported by the driver; rows
+  // may be padded past width * bytes-per-pixel.
+  int stride() const { return stride_; }
+  // NUMA node of the device's bus (-1 unknown), for placing its consumers.
+  int numa_node() const { return numa_node_; }
+  const CaptureMetrics &metrics() const { return metrics_; }
 
 private:
+  void publish(FrameRef frame);
+  // Stamps a dequeued frame and accounts for it in metrics_.
+  void note_dequeued(CapturedFrame &frame, const v4l2_buffer &buf);
+  struct BufferRing;
+
   void loop();
-  void loop_mmap();
+  void loop_streaming();
   void loop_read();
+  bool configure_pattern(CaptureParams &params);
+  void loop_pattern();
+  bool start_relay();
+  void loop_relay();
   bool configure_device(int fd, CaptureParams &params);
-  void cleanup_mmap_setup_failure(int fd);
-  void cleanup_mmap_buffers();
+  bool setup_streaming(int fd, const CaptureParams &params);
+  void cleanup_streaming_setup_failure(int fd, uint32_t memory);
 
+  const CaptureOptions options_;
   std::string device_id_;
   CaptureParams params_;
   PixelFormat pixel_format_ = PixelFormat::UNKNOWN;
+  int stride_ = 0;
   int fd_ = -1;
+  int numa_node_ = -1;
   std::atomic<bool> stop_flag_{false};
   std::atomic<bool> running_{false};
   std::thread thread_;
-  std::string buffer_; // latest frame
-  std::mutex buf_mu_;
-
-  // mmap streaming support
-  bool use_mmap_ = false;
-  static constexpr unsigned kNumBuffers = 4;
-  struct MmapBuffer {
-    void *start = nullptr;
-    size_t length = 0;
-  };
-  MmapBuffer buffers_[kNumBuffers];
-  unsigned num_buffers_ = 0;
+  std::shared_ptr<FramePool> pool_ = std::make_shared<FramePool>();
+  FrameRef latest_;
+  uint64_t frame_seq_ = 0;       // capture thread only
+  std::optional<uint32_t> driver_seq_; // last v4l2_buffer::sequence
+  std::chrono::steady_clock::time_point last_captured_at_{};
+  CaptureMetrics metrics_;
+  mutable std::mutex latest_mu_; // guards the pointer swap only
+  mutable std::condition_variable latest_cv_;
+  FrameListeners listeners_;
+
+  // Streaming I/O (VIDIOC_REQBUFS) support; otherwise read().
+  bool use_streaming_ = false;
+  bool pattern_ = false; // synthetic test device, no fd
+  // Relay: the upstream, the pull in progress and whether it has opened.
+  std::shared_ptr<const RelayUpstream> relay_upstream_;
+  std::shared_ptr<RelayPuller> relay_; // guarded by relay_mu_
+  bool relay_opened_ = false;          // guarded by relay_mu_
+  bool relay_ended_ = false;           // guarded by relay_mu_
+  std::mutex relay_mu_;
+  std::condition_variable relay_cv_;
+  CaptureIo io_ = CaptureIo::Mmap; // effective mode after fallbacks
+  std::shared_ptr<BufferRing> ring_;
   size_t frame_size_ = 0;
 };
 #elif defined(__APPLE__)
 class CaptureV4L2 {
 public:
-  CaptureV4L2();
+  explicit CaptureV4L2(const CaptureOptions &options = {});
   ~CaptureV4L2();
 
   bool start(const std::string &device_id, const CaptureParams &params);
   void stop();
   bool running() const { return running_; }
-  bool latest_frame(std::string &out);
+  void set_relay(const RelayUpstream &) {} // relays are Linux only
+  FrameRef latest_frame() const;
+  FrameRef wait_frame(uint64_t after_seq,
+                      std::chrono::milliseconds timeout) const;
+  uint64_t add_frame_listener(std::function<void()> fn) {
+    return listeners_.add(std::move(fn));
+  }
+  void remove_frame_listener(uint64_t id) { listeners_.remove(id); }
   PixelFormat pixel_format() const { return pixel_format_; }
+  void request_keyframe() {}
   int width() const { return params_.width; }
   int height() const { return params_.height; }
   int fps() const { return params_.fps; }
+  // handle_sample() repacks planes tightly, so rows are exactly width bytes.
+  int stride() const { return params_.width; }
+  int numa_node() const { return -1; }
+  const CaptureMetrics &metrics() const { return metrics_; }
   void handle_sample(void *sample_buffer);
 
 private:
   struct Impl;
+  void publish(FrameRef frame);
 
   std::unique_ptr<Impl> impl_;
   std::string device_id_;
   CaptureParams params_;
   PixelFormat pixel_format_ = PixelFormat::UNKNOWN;
   std::atomic<bool> running_{false};
-  std::string buffer_;
-  std::mutex buf_mu_;
+  std::shared_ptr<FramePool> pool_ = std::make_shared<FramePool>();
+  FrameRef latest_;
+  uint64_t frame_seq_ = 0;
+  mutable std::mutex latest_mu_;
+  mutable std::condition_variable latest_cv_;
+  FrameListeners listeners_;
+  CaptureMetrics metrics_;
 };
 #else
 // Non-Linux stub to keep buildable on macOS/Windows during development.
 class CaptureV4L2 {
 public:
+  explicit CaptureV4L2(const CaptureOptions & = {}) {}
   bool start(const std::string &, const CaptureParams &) { return false; }
   void stop() {}
   bool running() const { return false; }
-  bool latest_frame(std::string &) { return false; }
+  void set_relay(const RelayUpstream &) {}
+  FrameRef latest_frame() const { return nullptr; }
+  FrameRef wait_frame(uint64_t, std::chrono::milliseconds timeout) const {
+    std::this_thread::sleep_for(timeout);
+    return nullptr;
+  }
+  uint64_t add_frame_listener(std::function<void()>) { return 0; }
+  void remove_frame_listener(uint64_t) {}
   PixelFormat pixel_format() const { return PixelFormat::UNKNOWN; }
+  void request_keyframe() {}
   int width() const { return 0; }
   int height() const { return 0; }
   int fps() const { return 0; }
+  int stride() const { return 0; }
+  int numa_node() const { return -1; }
+  const CaptureMetrics &metrics() const { return metrics_; }
+
+private:
+  CaptureMetrics metrics_;
 };
 #endif
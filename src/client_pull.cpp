@@ -1,9 +1,14 @@
 #include "client_pull.hpp"
 
-#include <atomic>
+#include <algorithm>
 #include <chrono>
 #include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <thread>
@@ -15,52 +20,153 @@
 #include "wels/codec_api.h"
 #endif
 
-// Minimal Annex-B splitter
+// Streaming Annex-B splitter. Received bytes are appended once; start codes
+// are found with memchr and every byte is scanned once, however a NAL is
+// split across reads. Consumed bytes are only dropped once they outweigh
+// what is left, so a large IDR arriving in many reads is not moved each time.
 class AnnexBParser {
 public:
-  void feed(const char *data, size_t len) {
+  // One NAL unit starting with its start code (`prefix` bytes), as decoders
+  // take it. Points into the parser: valid until the next feed() or reset().
+  struct Nal {
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    size_t prefix = 0;
+    uint8_t type() const { return data[prefix] & 0x1f; }
+  };
+
+  void feed(const uint8_t *data, size_t len) {
+    // Nothing before the current NAL is needed (or, while none has been
+    // found, before the last two bytes, which may open a start code).
+    size_t keep = nal_ != kNone ? nal_ : (scan_ > 2 ? scan_ - 2 : 0);
+    if (keep > 0 && keep >= buffer_.size() - keep) {
+      buffer_.erase(buffer_.begin(), buffer_.begin() + keep);
+      scan_ -= keep;
+      if (nal_ != kNone)
+        nal_ -= keep;
+    }
     buffer_.insert(buffer_.end(), data, data + len);
   }
 
-  std::optional<std::vector<uint8_t>> next_nal() {
-    size_t start = find_start_code(0);
-    if (start == std::string::npos) {
-      // Keep a small tail to avoid splitting a start code
-      if (buffer_.size() > 3) {
-        buffer_.erase(buffer_.begin(), buffer_.end() - 3);
-      }
-      return std::nullopt;
-    }
-    size_t next = find_start_code(start + 3);
-    if (next == std::string::npos) {
-      if (start > 0)
-        buffer_.erase(buffer_.begin(), buffer_.begin() + start);
-      return std::nullopt;
+  // The next complete NAL unit; false until the start code after it has
+  // arrived.
+  bool next_nal(Nal &out) {
+    if (nal_ == kNone) {
+      const size_t at = find_start_code(0);
+      if (at == kNone)
+        return false;
+      nal_ = at;
     }
-    const size_t prefix_len =
-        (buffer_[start + 2] == 0x01) ? 3 : 4; // 00 00 01 or 00 00 00 01
-    size_t data_begin = start + prefix_len;
-    std::vector<uint8_t> nal(buffer_.begin() + data_begin,
-                             buffer_.begin() + next);
-    buffer_.erase(buffer_.begin(), buffer_.begin() + next);
-    return nal;
+    const size_t prefix = buffer_[nal_ + 2] == 0x01 ? 3 : 4;
+    const size_t next = find_start_code(nal_ + prefix);
+    if (next == kNone)
+      return false;
+    out.data = buffer_.data() + nal_;
+    out.size = next - nal_;
+    out.prefix = prefix;
+    nal_ = next;
+    return true;
+  }
+
+  void reset() {
+    buffer_.clear();
+    nal_ = kNone;
+    scan_ = 0;
   }
 
 private:
+  static constexpr size_t kNone = static_cast<size_t>(-1);
+
+  // Offset of the first start code that begins at or after `from` and ends
+  // past `scan_`, or kNone (then everything has been scanned).
   size_t find_start_code(size_t from) {
-    for (size_t k = from; k + 3 < buffer_.size(); ++k) {
-      if (buffer_[k] == 0x00 && buffer_[k + 1] == 0x00) {
-        if (buffer_[k + 2] == 0x01)
-          return k;
-        if (k + 4 <= buffer_.size() && buffer_[k + 2] == 0x00 &&
-            buffer_[k + 3] == 0x01)
-          return k;
+    const uint8_t *base = buffer_.data();
+    size_t k = std::max(scan_, from + 2);
+    while (k < buffer_.size()) {
+      const void *hit = std::memchr(base + k, 0x01, buffer_.size() - k);
+      if (!hit)
+        break;
+      k = static_cast<size_t>(static_cast<const uint8_t *>(hit) - base);
+      if (base[k - 1] == 0x00 && base[k - 2] == 0x00) {
+        scan_ = k + 1;
+        const size_t at = k - 2;
+        return at > from && base[at - 1] == 0x00 ? at - 1 : at;
       }
+      ++k;
     }
-    return std::string::npos;
+    scan_ = std::max(scan_, buffer_.size());
+    return kNone;
   }
 
   std::vector<uint8_t> buffer_;
+  size_t nal_ = kNone; // start code of the NAL being collected
+  size_t scan_ = 0;    // bytes before this hold no unseen 0x01
+};
+
+// Received chunks on their way to the decode thread. Bounded: when the
+// decoder falls `kMaxQueued` behind, new data is dropped rather than the
+// network read waiting, and the next chunk handed out is flagged as
+// following a gap. Chunk buffers are recycled.
+class ChunkQueue {
+public:
+  static constexpr size_t kMaxQueued = 8 << 20;
+
+  void push(const char *data, size_t len) {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (queued_bytes_ + len > kMaxQueued) {
+      gap_ = true;
+      return;
+    }
+    std::string chunk;
+    if (!spare_.empty()) {
+      chunk = std::move(spare_.back());
+      spare_.pop_back();
+    }
+    chunk.assign(data, len);
+    queued_bytes_ += len;
+    queue_.push_back({std::move(chunk), gap_});
+    gap_ = false;
+    cv_.notify_one();
+  }
+
+  // Blocks for the next chunk, swapped into `out` (whose old buffer is
+  // kept for reuse). False once closed and drained.
+  bool pop(std::string &out, bool &after_gap) {
+    std::unique_lock<std::mutex> lock(mu_);
+    cv_.wait(lock, [this] { return closed_ || !queue_.empty(); });
+    if (queue_.empty())
+      return false;
+    Entry &front = queue_.front();
+    queued_bytes_ -= front.data.size();
+    out.swap(front.data);
+    after_gap = front.after_gap;
+    if (spare_.size() < 16)
+      spare_.push_back(std::move(front.data));
+    queue_.pop_front();
+    return true;
+  }
+
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      closed_ = true;
+    }
+    cv_.notify_all();
+  }
+
+private:
+  struct Entry {
+    std::string data;
+    bool after_gap = false;
+  };
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<Entry> queue_;
+  std::vector<std::string> spare_;
+  size_t queued_bytes_ = 0;
+  bool gap_ = false;
+  bool closed_ = false;
 };
 
 struct DecodedFrame {
@@ -90,13 +196,13 @@ public:
 
   ~OpenH264Decoder() { WelsDestroyDecoder(decoder_); }
 
-  std::optional<DecodedFrame> decode(const std::vector<uint8_t> &nal) {
-    if (nal.empty())
+  std::optional<DecodedFrame> decode(const uint8_t *nal, size_t size) {
+    if (size == 0)
       return std::nullopt;
     SBufferInfo info{};
     uint8_t *dst[3] = {nullptr, nullptr, nullptr};
     DECODING_STATE st = decoder_->DecodeFrameNoDelay(
-        nal.data(), static_cast<int>(nal.size()), dst, &info);
+        nal, static_cast<int>(size), dst, &info);
     if (st != dsErrorFree && st != dsFramePending)
       return std::nullopt;
     if (info.iBufferStatus != 1)
@@ -116,6 +222,12 @@ private:
 #endif
 
 int run_client(const std::string &connect_to, const std::string &device_id) {
+#ifndef HAS_OPENH264
+  (void)connect_to;
+  (void)device_id;
+  std::cerr << "OpenH264 NOT enabled. Cannot decode stream." << std::endl;
+  return 1;
+#else
   std::string host = connect_to;
   int port = 8080;
   size_t colon = connect_to.find(':');
@@ -137,47 +249,59 @@ int run_client(const std::string &connect_to, const std::string &device_id) {
       "/stream/live/" + device_id + "?codec=h264&w=" + std::to_string(w) +
       "&h=" + std::to_string(h) + "&fps=" + std::to_string(fps);
 
-  AnnexBParser parser;
-#ifdef HAS_OPENH264
-  OpenH264Decoder decoder;
-#else
-  std::cerr << "OpenH264 NOT enabled. Cannot decode stream." << std::endl;
-  return 1;
-#endif
-
   std::cout << "[Client] Connecting to " << host << ":" << port << target
             << std::endl;
 
-  std::atomic<int> frames{0};
-  auto t0 = std::chrono::steady_clock::now();
+  // The receive callback only queues bytes; parsing and decoding run here,
+  // so a slow decode never holds up the socket.
+  ChunkQueue chunks;
+  std::thread decode_thread([&chunks] {
+    OpenH264Decoder decoder;
+    AnnexBParser parser;
+    std::string chunk;
+    bool after_gap = false;
+    bool wait_idr = false;
+    int frames = 0;
+    const auto t0 = std::chrono::steady_clock::now();
+    while (chunks.pop(chunk, after_gap)) {
+      if (after_gap) {
+        // Bytes were dropped: resume at the next IDR's parameter sets.
+        parser.reset();
+        wait_idr = true;
+      }
+      parser.feed(reinterpret_cast<const uint8_t *>(chunk.data()),
+                  chunk.size());
+      AnnexBParser::Nal nal;
+      while (parser.next_nal(nal)) {
+        if (wait_idr && nal.type() != 7 && nal.type() != 5)
+          continue;
+        wait_idr = false;
+        auto out = decoder.decode(nal.data, nal.size);
+        if (!out)
+          continue;
+        ++frames;
+        if (frames % 30 == 0) {
+          auto now = std::chrono::steady_clock::now();
+          double sec =
+              std::chrono::duration_cast<std::chrono::milliseconds>(now - t0)
+                  .count() /
+              1000.0;
+          double approx_fps = frames / std::max(0.001, sec);
+          std::cout << "\rDecoded " << frames << " frames (" << (out->width)
+                    << "x" << (out->height) << ") @ " << approx_fps
+                    << " fps   " << std::flush;
+        }
+      }
+    }
+  });
 
-  auto res =
-      cli.Get(target.c_str(), {{"Accept", "video/H264"}},
-              [&](const char *data, size_t len) {
-                parser.feed(data, len);
-                while (auto nal = parser.next_nal()) {
-#ifdef HAS_OPENH264
-                  auto out = decoder.decode(*nal);
-                  if (out) {
-                    ++frames;
-                    if (frames % 30 == 0) {
-                      auto now = std::chrono::steady_clock::now();
-                      double sec =
-                          std::chrono::duration_cast<std::chrono::milliseconds>(
-                              now - t0)
-                              .count() /
-                          1000.0;
-                      double approx_fps = frames / std::max(0.001, sec);
-                      std::cout << "\rDecoded " << frames << " frames ("
-                                << (out->width) << "x" << (out->height)
-                                << ") @ " << approx_fps << " fps   "
-                                << std::flush;
-                    }
-                  }
-#endif
-                }
-                return true; // keep streaming
-              });
+  auto res = cli.Get(target.c_str(), {{"Accept", "video/H264"}},
+                     [&](const char *data, size_t len) {
+                       chunks.push(data, len);
+                       return true; // keep streaming
+                     });
+  chunks.close();
+  decode_thread.join();
 
   if (!res) {
     std::cerr << "\n[Client] Connection failed or stream ended." << std::endl;
@@ -186,4 +310,5 @@ int run_client(const std::string &connect_to, const std::string &device_id) {
   std::cout << "\n[Client] Stream ended (status " << res->status << ")"
             << std::endl;
   return 0;
+#endif
 }
@@ -1,109 +1,74 @@
 #include "encoder_h264.hpp"
 
-#include <cstring>
+#include <iostream>
 
-#include "types.hpp"
+#include "encoder_openh264.hpp"
+#include "encoder_v4l2m2m.hpp"
 
-#ifdef HAS_OPENH264
-
-#include "wels/codec_api.h"
-
-H264Encoder::~H264Encoder() {
-  if (enc_) {
-    enc_->Uninitialize();
-    WelsDestroySVCEncoder(enc_);
-    enc_ = nullptr;
-  }
+namespace {
+#ifdef __linux__
+std::string m2m_device(const EncoderOptions &options) {
+  return options.m2m_device.empty() ? V4L2M2MEncoder::probe()
+                                    : options.m2m_device;
 }
+#endif
 
-bool H264Encoder::init(const CaptureParams &params) {
-  width_ = params.width;
-  height_ = params.height;
-  fps_ = params.fps;
-  bitrate_kbps_ = params.bitrate_kbps;
-
-  if (WelsCreateSVCEncoder(&enc_) != 0 || enc_ == nullptr) {
-    return false;
-  }
-
-  SEncParamBase p{};
-  p.iUsageType = CAMERA_VIDEO_REAL_TIME;
-  p.iPicWidth = width_;
-  p.iPicHeight = height_;
-  p.iTargetBitrate = bitrate_kbps_ * 1000;
-  p.iRCMode = RC_BITRATE_MODE;
-  p.fMaxFrameRate = static_cast<float>(fps_);
-
-  if (enc_->Initialize(&p) != 0) {
-    return false;
+std::unique_ptr<H264Encoder> try_init(std::unique_ptr<H264Encoder> encoder,
+                                      const CaptureParams &params,
+                                      const EncoderInput &input) {
+  if (encoder && encoder->init(params, input)) {
+    std::cerr << "H264 encoder backend: " << encoder->name() << "\n";
+    return encoder;
   }
-
-  // Note: ENCODER_OPTION_PROFILE removed - API changed in OpenH264 2.6.0, use
-  // default Set IDR interval (keyframe interval).
-  int gop = params.gop > 0 ? params.gop : 30;
-  enc_->SetOption(ENCODER_OPTION_IDR_INTERVAL, &gop);
-  // Disable frame skipping for consistent streaming.
-  bool frame_skip = false;
-  enc_->SetOption(ENCODER_OPTION_RC_FRAME_SKIP, &frame_skip);
-
-  return true;
+  if (encoder)
+    std::cerr << "H264 encoder backend " << encoder->name()
+              << " failed to initialise\n";
+  return nullptr;
 }
-
-bool H264Encoder::encode_i420(const uint8_t *y, const uint8_t *u,
-                              const uint8_t *v, std::string &out) {
-  if (!enc_)
-    return false;
-
-  const int y_size = width_ * height_;
-  const int uv_width = width_ / 2;
-  const int uv_height = height_ / 2;
-  const int uv_size = uv_width * uv_height;
-
-  SSourcePicture pic{};
-  pic.iPicWidth = width_;
-  pic.iPicHeight = height_;
-  pic.iColorFormat = videoFormatI420;
-  pic.iStride[0] = width_;
-  pic.iStride[1] = uv_width;
-  pic.iStride[2] = uv_width;
-  pic.pData[0] = const_cast<unsigned char *>(y);
-  pic.pData[1] = const_cast<unsigned char *>(u);
-  pic.pData[2] = const_cast<unsigned char *>(v);
-
-  SFrameBSInfo info{};
-  if (enc_->EncodeFrame(&pic, &info) != 0) {
-    return false;
-  }
-
-  out.clear();
-  for (int i = 0; i < info.iLayerNum; ++i) {
-    const SLayerBSInfo &layer = info.sLayerInfo[i];
-    for (int j = 0; j < layer.iNalCount; ++j) {
-      unsigned char *p = layer.pBsBuf + layer.pNalLengthInByte[j];
-      (void)p; // silence unused warning
-    }
-    int total = 0;
-    for (int j = 0; j < layer.iNalCount; ++j)
-      total += layer.pNalLengthInByte[j];
-    out.append(reinterpret_cast<char *>(layer.pBsBuf), total);
+} // namespace
+
+const char *encoder_backend_label(EncoderBackend backend) {
+  switch (backend) {
+  case EncoderBackend::OpenH264:
+    return "openh264";
+  case EncoderBackend::V4L2M2M:
+    return "v4l2m2m";
+  default:
+    return "auto";
   }
-  return !out.empty();
 }
 
-void H264Encoder::force_idr() {
-  if (!enc_)
-    return;
-  enc_->ForceIntraFrame(true);
+std::unique_ptr<H264Encoder> create_h264_encoder(const EncoderOptions &options,
+                                                 const CaptureParams &params,
+                                                 const EncoderInput &input) {
+  std::unique_ptr<H264Encoder> encoder;
+#ifdef __linux__
+  if (options.backend != EncoderBackend::OpenH264) {
+    const std::string device = m2m_device(options);
+    if (!device.empty())
+      encoder = try_init(std::make_unique<V4L2M2MEncoder>(device), params,
+                         input);
+    if (encoder || options.backend == EncoderBackend::V4L2M2M)
+      return encoder;
+  }
+#endif
+#ifdef HAS_OPENH264
+  if (options.backend != EncoderBackend::V4L2M2M)
+    encoder =
+        try_init(std::make_unique<OpenH264Encoder>(options), params, input);
+#endif
+  return encoder;
 }
 
-#else // HAS_OPENH264
-
-H264Encoder::~H264Encoder() = default;
-bool H264Encoder::init(const CaptureParams &) { return false; }
-bool H264Encoder::encode_i420(const uint8_t *, const uint8_t *, const uint8_t *,
-                              std::string &) {
+bool h264_encoder_available(const EncoderOptions &options) {
+#ifdef HAS_OPENH264
+  if (options.backend != EncoderBackend::V4L2M2M)
+    return true;
+#endif
+#ifdef __linux__
+  if (options.backend != EncoderBackend::OpenH264)
+    return !m2m_device(options).empty();
+#endif
+  (void)options;
   return false;
 }
-void H264Encoder::force_idr() {}
-
-#endif
@@ -2,31 +2,80 @@
 
 #include <cstdint>
 #include <memory>
-#include <optional>
 #include <string>
 
-struct CaptureParams;
+#include "thread_policy.hpp"
+#include "types.hpp"
 
-#ifdef HAS_OPENH264
-#include "wels/codec_api.h"
-#endif
+enum class EncoderBackend {
+  Auto,     // hardware if one is found, else OpenH264
+  OpenH264, // software
+  V4L2M2M,  // stateful V4L2 memory-to-memory encoder (Pi, many ARM SoCs)
+};
+
+struct EncoderOptions {
+  EncoderBackend backend = EncoderBackend::Auto;
+  std::string m2m_device; // empty = probe /dev/video* for an H.264 encoder
+
+  // OpenH264 tuning; 0 / empty picks a default from the latency tier.
+  int threads = 0;         // iMultipleThreadIdc
+  int slices = 0;          // fixed slice count per frame
+  int slice_max_bytes = 0; // > 0 switches to size-limited slices
+  std::string complexity;  // low | medium | high
+
+  // Seconds of access units a full-size encoder keeps for time-shifted
+  // viewers (?from=-30s); 0 = off.
+  int rewind_seconds = 0;
+
+  ThreadOptions thread_policy; // for encode threads
+};
+
+// What the encoder will be fed: the capture's native layout, so a backend
+// that can ingest it directly skips our I420 conversion.
+struct EncoderInput {
+  PixelFormat format = PixelFormat::I420;
+  int stride = 0; // bytes per row of the packed/luma plane
+};
 
+// One H.264 encoding backend. Output is an access unit in Annex-B with start
+// codes, SPS/PPS ahead of every IDR. Backends that get NAL lengths from
+// their encoder fill EncodedFrame::nals too; the rest leave it empty for
+// SessionEncoder to index.
 class H264Encoder {
 public:
-  H264Encoder() = default;
-  ~H264Encoder();
-
-  bool init(const CaptureParams &params);
-  // Encodes an I420 frame (Y plane first, then U, then V).
-  bool encode_i420(const uint8_t* y, const uint8_t* u, const uint8_t* v, std::string &out);
-  void force_idr();
-
-private:
-#ifdef HAS_OPENH264
-  ISVCEncoder *enc_{nullptr};
-  int width_{640};
-  int height_{480};
-  int fps_{15};
-  int bitrate_kbps_{256};
-#endif
+  virtual ~H264Encoder() = default;
+
+  virtual bool init(const CaptureParams &params, const EncoderInput &input) = 0;
+  // Encodes an I420 frame from separate plane pointers; the planes may live
+  // in a padded capture buffer (U and V share uv_stride).
+  virtual bool encode_i420(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                           int y_stride, int uv_stride, EncodedFrame &out) = 0;
+  // True when init() accepted EncoderInput's layout as-is; encode_native()
+  // then takes the captured bytes without conversion.
+  virtual bool native_input() const { return false; }
+  virtual bool encode_native(const uint8_t *, size_t, EncodedFrame &) {
+    return false;
+  }
+  virtual void force_idr() = 0;
+  // Retargets the rate control mid-stream; false if the backend cannot.
+  virtual bool set_bitrate(int kbps) {
+    (void)kbps;
+    return false;
+  }
+  // Tells the rate control frames now arrive at `fps`; the caller does the
+  // actual frame dropping. False if the backend cannot retune.
+  virtual bool set_frame_rate(int fps) {
+    (void)fps;
+    return false;
+  }
+  virtual const char *name() const = 0;
 };
+
+// Builds and initialises the configured backend. Auto tries hardware first
+// and falls back to OpenH264; nullptr if nothing could be initialised.
+std::unique_ptr<H264Encoder> create_h264_encoder(const EncoderOptions &options,
+                                                 const CaptureParams &params,
+                                                 const EncoderInput &input);
+// Whether create_h264_encoder() has any backend to try (cheap, cached probe).
+bool h264_encoder_available(const EncoderOptions &options);
+const char *encoder_backend_label(EncoderBackend backend);
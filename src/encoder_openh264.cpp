@@ -0,0 +1,197 @@
+#ifdef HAS_OPENH264
+#include "encoder_openh264.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+namespace {
+// OpenH264 caps its worker pool at four threads.
+constexpr int kMaxThreads = 4;
+
+ECOMPLEXITY_MODE parse_complexity(const std::string &name,
+                                  ECOMPLEXITY_MODE fallback) {
+  if (name == "low")
+    return LOW_COMPLEXITY;
+  if (name == "medium")
+    return MEDIUM_COMPLEXITY;
+  if (name == "high")
+    return HIGH_COMPLEXITY;
+  return fallback;
+}
+} // namespace
+
+OpenH264Encoder::~OpenH264Encoder() {
+  if (enc_) {
+    enc_->Uninitialize();
+    WelsDestroySVCEncoder(enc_);
+    enc_ = nullptr;
+  }
+}
+
+bool OpenH264Encoder::init(const CaptureParams &params,
+                           const EncoderInput &) {
+  width_ = params.width;
+  height_ = params.height;
+  fps_ = params.fps;
+  bitrate_kbps_ = params.bitrate_kbps;
+
+  if (WelsCreateSVCEncoder(&enc_) != 0 || enc_ == nullptr) {
+    return false;
+  }
+
+  SEncParamExt p{};
+  enc_->GetDefaultParams(&p);
+  p.iUsageType = CAMERA_VIDEO_REAL_TIME;
+  p.iPicWidth = width_;
+  p.iPicHeight = height_;
+  p.iTargetBitrate = bitrate_kbps_ * 1000;
+  p.iMaxBitrate = bitrate_kbps_ * 1000;
+  p.iRCMode = RC_BITRATE_MODE;
+  p.fMaxFrameRate = static_cast<float>(fps_);
+  p.uiIntraPeriod = static_cast<unsigned>(params.gop > 0 ? params.gop : 30);
+  p.bEnableFrameSkip = false;        // consistent streaming cadence
+  p.iEntropyCodingModeFlag = 0;      // CAVLC: Baseline profile
+  p.eSpsPpsIdStrategy = CONSTANT_ID; // late joiners reuse cached SPS/PPS
+  p.iTemporalLayerNum = 1;
+  p.iSpatialLayerNum = 1;
+
+  // Latency tiers: ultra trades compression for speed, view the reverse.
+  // Threads only pay off once there is enough picture to split.
+  const bool ultra = params.latency == "ultra";
+  const bool low = params.latency == "low";
+  const int hw =
+      static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+  const bool small = width_ * height_ < 640 * 480;
+  int threads = options_.threads > 0 ? options_.threads
+                                     : (small ? 1 : std::min(hw, kMaxThreads));
+  threads = std::clamp(threads, 1, kMaxThreads);
+  const int mb_rows = std::max(1, (height_ + 15) / 16);
+  const int slices =
+      std::clamp(options_.slices > 0 ? options_.slices : threads, 1, mb_rows);
+  p.iMultipleThreadIdc = static_cast<unsigned short>(threads);
+  p.iComplexityMode = parse_complexity(
+      options_.complexity,
+      ultra ? LOW_COMPLEXITY : (low ? MEDIUM_COMPLEXITY : HIGH_COMPLEXITY));
+  if (ultra) {
+    // Skip the optional per-frame analysis passes.
+    p.bEnableSceneChangeDetect = false;
+    p.bEnableBackgroundDetection = false;
+    p.bEnableDenoise = false;
+  }
+
+  SSpatialLayerConfig &layer = p.sSpatialLayers[0];
+  layer.iVideoWidth = width_;
+  layer.iVideoHeight = height_;
+  layer.fFrameRate = static_cast<float>(fps_);
+  layer.iSpatialBitrate = p.iTargetBitrate;
+  layer.iMaxSpatialBitrate = p.iMaxBitrate;
+  layer.uiProfileIdc = PRO_BASELINE;
+  if (options_.slice_max_bytes > 0) {
+    layer.sSliceArgument.uiSliceMode = SM_SIZELIMITED_SLICE;
+    layer.sSliceArgument.uiSliceSizeConstraint =
+        static_cast<unsigned>(options_.slice_max_bytes);
+    p.uiMaxNalSize = static_cast<unsigned>(options_.slice_max_bytes);
+  } else if (slices > 1) {
+    layer.sSliceArgument.uiSliceMode = SM_FIXEDSLCNUM_SLICE;
+    layer.sSliceArgument.uiSliceNum = static_cast<unsigned>(slices);
+  } else {
+    layer.sSliceArgument.uiSliceMode = SM_SINGLE_SLICE;
+  }
+
+  if (enc_->InitializeExt(&p) != 0) {
+    return false;
+  }
+  std::cerr << "OpenH264: threads=" << threads << " slices="
+            << (options_.slice_max_bytes > 0
+                    ? "<=" + std::to_string(options_.slice_max_bytes) + "B"
+                    : std::to_string(slices))
+            << " complexity=" << static_cast<int>(p.iComplexityMode) << "\n";
+  return true;
+}
+
+bool OpenH264Encoder::encode_i420(const uint8_t *y, const uint8_t *u,
+                                  const uint8_t *v, int y_stride,
+                                  int uv_stride, EncodedFrame &out) {
+  if (!enc_)
+    return false;
+
+  SSourcePicture pic{};
+  pic.iPicWidth = width_;
+  pic.iPicHeight = height_;
+  pic.iColorFormat = videoFormatI420;
+  pic.iStride[0] = y_stride;
+  pic.iStride[1] = uv_stride;
+  pic.iStride[2] = uv_stride;
+  pic.pData[0] = const_cast<unsigned char *>(y);
+  pic.pData[1] = const_cast<unsigned char *>(u);
+  pic.pData[2] = const_cast<unsigned char *>(v);
+
+  SFrameBSInfo info{};
+  if (enc_->EncodeFrame(&pic, &info) != 0) {
+    return false;
+  }
+
+  // The encoder reports every NAL's length (start code included), so the
+  // spans come for free and nobody downstream has to search for them.
+  out.data.clear();
+  out.nals.clear();
+  for (int i = 0; i < info.iLayerNum; ++i) {
+    const SLayerBSInfo &layer = info.sLayerInfo[i];
+    const auto *nal = reinterpret_cast<const char *>(layer.pBsBuf);
+    for (int j = 0; j < layer.iNalCount; ++j) {
+      const auto len = static_cast<uint32_t>(layer.pNalLengthInByte[j]);
+      const uint32_t start_code = (len > 3 && nal[2] == 1) ? 3 : 4;
+      if (len > start_code) {
+        NalSpan span;
+        span.offset = static_cast<uint32_t>(out.data.size()) + start_code;
+        span.size = len - start_code;
+        span.type = static_cast<uint8_t>(nal[start_code]) & 0x1F;
+        span.ref_idc = (static_cast<uint8_t>(nal[start_code]) >> 5) & 0x03;
+        out.nals.push_back(span);
+      }
+      out.data.append(nal, len);
+      nal += len;
+    }
+  }
+  return !out.data.empty();
+}
+
+void OpenH264Encoder::force_idr() {
+  if (!enc_)
+    return;
+  enc_->ForceIntraFrame(true);
+}
+
+bool OpenH264Encoder::set_bitrate(int kbps) {
+  if (!enc_ || kbps <= 0)
+    return false;
+  SBitrateInfo info{};
+  info.iLayer = SPATIAL_LAYER_ALL;
+  info.iBitrate = kbps * 1000;
+  // The target never goes above the cap: going up, raise the cap first;
+  // going down, lower the target first.
+  const bool up = kbps > bitrate_kbps_;
+  const ENCODER_OPTION first =
+      up ? ENCODER_OPTION_MAX_BITRATE : ENCODER_OPTION_BITRATE;
+  const ENCODER_OPTION second =
+      up ? ENCODER_OPTION_BITRATE : ENCODER_OPTION_MAX_BITRATE;
+  if (enc_->SetOption(first, &info) != 0 ||
+      enc_->SetOption(second, &info) != 0)
+    return false;
+  bitrate_kbps_ = kbps;
+  return true;
+}
+
+bool OpenH264Encoder::set_frame_rate(int fps) {
+  if (!enc_ || fps <= 0)
+    return false;
+  float rate = static_cast<float>(fps);
+  if (enc_->SetOption(ENCODER_OPTION_FRAME_RATE, &rate) != 0)
+    return false;
+  fps_ = fps;
+  return true;
+}
+
+#endif // HAS_OPENH264
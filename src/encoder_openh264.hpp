@@ -0,0 +1,31 @@
+#pragma once
+
+#ifdef HAS_OPENH264
+
+#include "encoder_h264.hpp"
+#include "wels/codec_api.h"
+
+// Software fallback; runs everywhere OpenH264 is installed.
+class OpenH264Encoder : public H264Encoder {
+public:
+  explicit OpenH264Encoder(const EncoderOptions &options) : options_(options) {}
+  ~OpenH264Encoder() override;
+
+  bool init(const CaptureParams &params, const EncoderInput &input) override;
+  bool encode_i420(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                   int y_stride, int uv_stride, EncodedFrame &out) override;
+  void force_idr() override;
+  bool set_bitrate(int kbps) override;
+  bool set_frame_rate(int fps) override;
+  const char *name() const override { return "openh264"; }
+
+private:
+  const EncoderOptions options_;
+  ISVCEncoder *enc_{nullptr};
+  int width_{640};
+  int height_{480};
+  int fps_{15};
+  int bitrate_kbps_{256};
+};
+
+#endif // HAS_OPENH264
@@ -0,0 +1,384 @@
+#ifdef __linux__
+#include "encoder_v4l2m2m.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/videodev2.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+namespace {
+bool xioctl(int fd, unsigned long request, void *arg) {
+  int r;
+  do {
+    r = ioctl(fd, request, arg);
+  } while (r == -1 && errno == EINTR);
+  return r != -1;
+}
+
+constexpr __u32 kInputType = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+constexpr __u32 kOutputType = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+constexpr unsigned kInputBuffers = 2;
+constexpr unsigned kOutputBuffers = 4;
+constexpr int kEncodeTimeoutMs = 1000;
+
+__u32 fourcc_for(PixelFormat fmt) {
+  switch (fmt) {
+  case PixelFormat::YUYV:
+    return V4L2_PIX_FMT_YUYV;
+  case PixelFormat::NV12:
+    return V4L2_PIX_FMT_NV12;
+  case PixelFormat::I420:
+    return V4L2_PIX_FMT_YUV420;
+  default:
+    return 0;
+  }
+}
+
+// An encoder is an M2M node whose CAPTURE (bitstream) side offers H.264;
+// decoders list H.264 on the OUTPUT side instead.
+bool is_h264_encoder(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDWR | O_NONBLOCK);
+  if (fd < 0)
+    return false;
+  bool found = false;
+  v4l2_capability cap{};
+  if (xioctl(fd, VIDIOC_QUERYCAP, &cap)) {
+    __u32 caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps
+                                                           : cap.capabilities;
+    if (caps & V4L2_CAP_VIDEO_M2M_MPLANE) {
+      v4l2_fmtdesc desc{};
+      desc.type = kOutputType;
+      for (desc.index = 0; !found && xioctl(fd, VIDIOC_ENUM_FMT, &desc);
+           ++desc.index) {
+        found = desc.pixelformat == V4L2_PIX_FMT_H264;
+      }
+    }
+  }
+  ::close(fd);
+  return found;
+}
+
+bool set_ctrl(int fd, __u32 id, int value, const char *what) {
+  v4l2_control ctrl{};
+  ctrl.id = id;
+  ctrl.value = value;
+  if (xioctl(fd, VIDIOC_S_CTRL, &ctrl))
+    return true;
+  std::cerr << "M2M encoder: " << what << " control unavailable\n";
+  return false;
+}
+} // namespace
+
+std::string V4L2M2MEncoder::probe() {
+  static const std::string found = [] {
+    std::vector<std::string> nodes;
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator("/dev", ec)) {
+      const auto name = entry.path().filename().string();
+      if (name.rfind("video", 0) == 0)
+        nodes.push_back(entry.path().string());
+    }
+    std::sort(nodes.begin(), nodes.end());
+    for (const auto &node : nodes) {
+      if (is_h264_encoder(node))
+        return node;
+    }
+    return std::string();
+  }();
+  return found;
+}
+
+V4L2M2MEncoder::~V4L2M2MEncoder() {
+  if (fd_ >= 0 && streaming_) {
+    v4l2_buf_type type = static_cast<v4l2_buf_type>(kInputType);
+    xioctl(fd_, VIDIOC_STREAMOFF, &type);
+    type = static_cast<v4l2_buf_type>(kOutputType);
+    xioctl(fd_, VIDIOC_STREAMOFF, &type);
+  }
+  for (auto *maps : {&in_maps_, &out_maps_}) {
+    for (auto &m : *maps) {
+      if (m.start)
+        munmap(m.start, m.length);
+    }
+  }
+  if (fd_ >= 0)
+    ::close(fd_);
+}
+
+bool V4L2M2MEncoder::set_output_format(uint32_t fourcc, int stride) {
+  v4l2_format fmt{};
+  fmt.type = kInputType;
+  fmt.fmt.pix_mp.width = width_;
+  fmt.fmt.pix_mp.height = height_;
+  fmt.fmt.pix_mp.pixelformat = fourcc;
+  fmt.fmt.pix_mp.field = V4L2_FIELD_NONE;
+  fmt.fmt.pix_mp.num_planes = 1;
+  fmt.fmt.pix_mp.plane_fmt[0].bytesperline = stride;
+  if (!xioctl(fd_, VIDIOC_S_FMT, &fmt) || fmt.fmt.pix_mp.pixelformat != fourcc ||
+      fmt.fmt.pix_mp.num_planes != 1)
+    return false;
+  in_stride_ = static_cast<int>(fmt.fmt.pix_mp.plane_fmt[0].bytesperline);
+  in_height_ = static_cast<int>(fmt.fmt.pix_mp.height);
+  in_size_ = fmt.fmt.pix_mp.plane_fmt[0].sizeimage;
+  return in_stride_ > 0 && in_size_ > 0;
+}
+
+bool V4L2M2MEncoder::map_queue(uint32_t type, unsigned count,
+                               std::vector<Mapping> &maps) {
+  v4l2_requestbuffers req{};
+  req.count = count;
+  req.type = type;
+  req.memory = V4L2_MEMORY_MMAP;
+  if (!xioctl(fd_, VIDIOC_REQBUFS, &req) || req.count == 0) {
+    std::cerr << "M2M encoder: VIDIOC_REQBUFS failed; errno=" << errno << "\n";
+    return false;
+  }
+  maps.resize(req.count);
+  for (unsigned i = 0; i < req.count; ++i) {
+    v4l2_plane planes[VIDEO_MAX_PLANES]{};
+    v4l2_buffer buf{};
+    buf.type = type;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = i;
+    buf.m.planes = planes;
+    buf.length = VIDEO_MAX_PLANES;
+    if (!xioctl(fd_, VIDIOC_QUERYBUF, &buf)) {
+      std::cerr << "M2M encoder: VIDIOC_QUERYBUF failed; errno=" << errno
+                << "\n";
+      return false;
+    }
+    void *start = mmap(nullptr, planes[0].length, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd_, planes[0].m.mem_offset);
+    if (start == MAP_FAILED) {
+      std::cerr << "M2M encoder: mmap failed; errno=" << errno << "\n";
+      return false;
+    }
+    maps[i].start = start;
+    maps[i].length = planes[0].length;
+  }
+  return true;
+}
+
+bool V4L2M2MEncoder::init(const CaptureParams &params,
+                          const EncoderInput &input) {
+  width_ = params.width;
+  height_ = params.height;
+  fd_ = ::open(device_.c_str(), O_RDWR | O_NONBLOCK);
+  if (fd_ < 0) {
+    std::cerr << "M2M encoder: failed to open " << device_ << " errno="
+              << errno << "\n";
+    return false;
+  }
+
+  v4l2_format fmt{};
+  fmt.type = kOutputType;
+  fmt.fmt.pix_mp.width = width_;
+  fmt.fmt.pix_mp.height = height_;
+  fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_H264;
+  fmt.fmt.pix_mp.field = V4L2_FIELD_NONE;
+  fmt.fmt.pix_mp.num_planes = 1;
+  fmt.fmt.pix_mp.plane_fmt[0].sizeimage =
+      std::max(512u * 1024u, static_cast<unsigned>(width_ * height_));
+  if (!xioctl(fd_, VIDIOC_S_FMT, &fmt)) {
+    std::cerr << "M2M encoder: H.264 output format rejected; errno=" << errno
+              << "\n";
+    return false;
+  }
+
+  // Feed the capture layout directly when the encoder takes it as-is
+  // (same fourcc, stride and plane height); otherwise we convert to I420.
+  const __u32 native = fourcc_for(input.format);
+  native_ = native != 0 && set_output_format(native, input.stride) &&
+            in_stride_ == input.stride && in_height_ == height_;
+  if (!native_ && !set_output_format(V4L2_PIX_FMT_YUV420, width_)) {
+    std::cerr << "M2M encoder: no usable raw input format\n";
+    return false;
+  }
+
+  v4l2_streamparm sp{};
+  sp.type = kInputType;
+  sp.parm.output.timeperframe.numerator = 1;
+  sp.parm.output.timeperframe.denominator = std::max(1, params.fps);
+  xioctl(fd_, VIDIOC_S_PARM, &sp); // best effort
+
+  set_ctrl(fd_, V4L2_CID_MPEG_VIDEO_BITRATE, params.bitrate_kbps * 1000,
+           "bitrate");
+  set_ctrl(fd_, V4L2_CID_MPEG_VIDEO_H264_I_PERIOD,
+           params.gop > 0 ? params.gop : 30, "I-period");
+  set_ctrl(fd_, V4L2_CID_MPEG_VIDEO_H264_PROFILE,
+           V4L2_MPEG_VIDEO_H264_PROFILE_CONSTRAINED_BASELINE, "profile");
+  // Late joiners and fMP4 need SPS/PPS in front of every IDR.
+  set_ctrl(fd_, V4L2_CID_MPEG_VIDEO_REPEAT_SEQ_HEADER, 1, "repeat-headers");
+  set_ctrl(fd_, V4L2_CID_MPEG_VIDEO_HEADER_MODE,
+           V4L2_MPEG_VIDEO_HEADER_MODE_JOINED_WITH_1ST_FRAME, "header-mode");
+
+  if (!map_queue(kInputType, kInputBuffers, in_maps_) ||
+      !map_queue(kOutputType, kOutputBuffers, out_maps_))
+    return false;
+  for (unsigned i = 0; i < in_maps_.size(); ++i)
+    free_inputs_.push_back(i);
+  for (unsigned i = 0; i < out_maps_.size(); ++i) {
+    v4l2_plane planes[VIDEO_MAX_PLANES]{};
+    v4l2_buffer buf{};
+    buf.type = kOutputType;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = i;
+    buf.m.planes = planes;
+    buf.length = 1;
+    if (!xioctl(fd_, VIDIOC_QBUF, &buf)) {
+      std::cerr << "M2M encoder: VIDIOC_QBUF failed; errno=" << errno << "\n";
+      return false;
+    }
+  }
+
+  v4l2_buf_type type = static_cast<v4l2_buf_type>(kOutputType);
+  if (!xioctl(fd_, VIDIOC_STREAMON, &type))
+    return false;
+  type = static_cast<v4l2_buf_type>(kInputType);
+  if (!xioctl(fd_, VIDIOC_STREAMON, &type))
+    return false;
+  streaming_ = true;
+  std::cerr << "M2M encoder " << device_ << ": " << width_ << "x" << height_
+            << (native_ ? " (native input)" : " (I420 input)") << "\n";
+  return true;
+}
+
+void V4L2M2MEncoder::reclaim_inputs() {
+  for (;;) {
+    v4l2_plane planes[VIDEO_MAX_PLANES]{};
+    v4l2_buffer buf{};
+    buf.type = kInputType;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.m.planes = planes;
+    buf.length = 1;
+    if (!xioctl(fd_, VIDIOC_DQBUF, &buf))
+      return;
+    free_inputs_.push_back(buf.index);
+  }
+}
+
+uint8_t *V4L2M2MEncoder::acquire_input(unsigned &index) {
+  reclaim_inputs();
+  if (free_inputs_.empty()) {
+    // Both raw buffers still in flight: wait for the encoder to consume one.
+    pollfd pfd{fd_, POLLOUT, 0};
+    if (poll(&pfd, 1, kEncodeTimeoutMs) <= 0)
+      return nullptr;
+    reclaim_inputs();
+    if (free_inputs_.empty())
+      return nullptr;
+  }
+  index = free_inputs_.back();
+  free_inputs_.pop_back();
+  return static_cast<uint8_t *>(in_maps_[index].start);
+}
+
+bool V4L2M2MEncoder::submit(unsigned index, size_t bytes, std::string &out) {
+  v4l2_plane in_planes[VIDEO_MAX_PLANES]{};
+  in_planes[0].bytesused = static_cast<__u32>(bytes);
+  in_planes[0].length = static_cast<__u32>(in_maps_[index].length);
+  v4l2_buffer in{};
+  in.type = kInputType;
+  in.memory = V4L2_MEMORY_MMAP;
+  in.index = index;
+  in.m.planes = in_planes;
+  in.length = 1;
+  if (!xioctl(fd_, VIDIOC_QBUF, &in)) {
+    std::cerr << "M2M encoder: input QBUF failed; errno=" << errno << "\n";
+    free_inputs_.push_back(index);
+    return false;
+  }
+
+  // Collect whatever bitstream is ready once the first buffer lands; a
+  // separate header buffer simply gets concatenated ahead of the frame.
+  out.clear();
+  pollfd pfd{fd_, POLLIN, 0};
+  if (poll(&pfd, 1, kEncodeTimeoutMs) <= 0)
+    return false;
+  for (;;) {
+    v4l2_plane planes[VIDEO_MAX_PLANES]{};
+    v4l2_buffer buf{};
+    buf.type = kOutputType;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.m.planes = planes;
+    buf.length = 1;
+    if (!xioctl(fd_, VIDIOC_DQBUF, &buf))
+      break;
+    const auto *base = static_cast<const char *>(out_maps_[buf.index].start);
+    const size_t offset = planes[0].data_offset;
+    if (planes[0].bytesused > offset)
+      out.append(base + offset, planes[0].bytesused - offset);
+    planes[0].bytesused = 0;
+    if (!xioctl(fd_, VIDIOC_QBUF, &buf)) {
+      std::cerr << "M2M encoder: output requeue failed; errno=" << errno
+                << "\n";
+      break;
+    }
+  }
+  return !out.empty();
+}
+
+bool V4L2M2MEncoder::encode_i420(const uint8_t *y, const uint8_t *u,
+                                 const uint8_t *v, int y_stride, int uv_stride,
+                                 EncodedFrame &out) {
+  if (!streaming_ || native_)
+    return false;
+  unsigned index = 0;
+  uint8_t *dst = acquire_input(index);
+  if (!dst)
+    return false;
+  const int dst_uv_stride = in_stride_ / 2;
+  uint8_t *dst_u = dst + static_cast<size_t>(in_stride_) * in_height_;
+  uint8_t *dst_v = dst_u + static_cast<size_t>(dst_uv_stride) * (in_height_ / 2);
+  for (int row = 0; row < height_; ++row)
+    std::memcpy(dst + row * in_stride_, y + row * y_stride, width_);
+  for (int row = 0; row < height_ / 2; ++row) {
+    std::memcpy(dst_u + row * dst_uv_stride, u + row * uv_stride, width_ / 2);
+    std::memcpy(dst_v + row * dst_uv_stride, v + row * uv_stride, width_ / 2);
+  }
+  return submit(index, in_size_, out.data);
+}
+
+bool V4L2M2MEncoder::encode_native(const uint8_t *data, size_t size,
+                                   EncodedFrame &out) {
+  if (!streaming_ || !native_)
+    return false;
+  unsigned index = 0;
+  uint8_t *dst = acquire_input(index);
+  if (!dst)
+    return false;
+  const size_t bytes = std::min(size, in_maps_[index].length);
+  std::memcpy(dst, data, bytes);
+  return submit(index, bytes, out.data);
+}
+
+void V4L2M2MEncoder::force_idr() {
+  if (fd_ >= 0)
+    set_ctrl(fd_, V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME, 0, "force-keyframe");
+}
+
+bool V4L2M2MEncoder::set_bitrate(int kbps) {
+  // Most stateful encoders accept the bitrate control while streaming.
+  return fd_ >= 0 && kbps > 0 &&
+         set_ctrl(fd_, V4L2_CID_MPEG_VIDEO_BITRATE, kbps * 1000, "bitrate");
+}
+
+bool V4L2M2MEncoder::set_frame_rate(int fps) {
+  if (fd_ < 0 || fps <= 0)
+    return false;
+  v4l2_streamparm sp{};
+  sp.type = kInputType;
+  sp.parm.output.timeperframe.numerator = 1;
+  sp.parm.output.timeperframe.denominator = fps;
+  return xioctl(fd_, VIDIOC_S_PARM, &sp);
+}
+
+#endif // __linux__
@@ -0,0 +1,58 @@
+#pragma once
+
+#ifdef __linux__
+
+#include <string>
+#include <vector>
+
+#include "encoder_h264.hpp"
+
+// Stateful V4L2 memory-to-memory encoder (multi-planar API), e.g. the
+// Raspberry Pi's bcm2835-codec at /dev/video11. Raw frames go in on the
+// OUTPUT queue, H.264 comes back on the CAPTURE queue.
+class V4L2M2MEncoder : public H264Encoder {
+public:
+  explicit V4L2M2MEncoder(std::string device) : device_(std::move(device)) {}
+  ~V4L2M2MEncoder() override;
+
+  bool init(const CaptureParams &params, const EncoderInput &input) override;
+  bool encode_i420(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                   int y_stride, int uv_stride, EncodedFrame &out) override;
+  bool native_input() const override { return native_; }
+  bool encode_native(const uint8_t *data, size_t size,
+                     EncodedFrame &out) override;
+  void force_idr() override;
+  bool set_bitrate(int kbps) override;
+  bool set_frame_rate(int fps) override;
+  const char *name() const override { return "v4l2m2m"; }
+
+  // First /dev/video* node that encodes to H.264, or empty. Cached.
+  static std::string probe();
+
+private:
+  struct Mapping {
+    void *start = nullptr;
+    size_t length = 0;
+  };
+
+  bool set_output_format(uint32_t fourcc, int stride);
+  bool map_queue(uint32_t type, unsigned count, std::vector<Mapping> &maps);
+  uint8_t *acquire_input(unsigned &index);
+  bool submit(unsigned index, size_t bytes, std::string &out);
+  void reclaim_inputs();
+
+  std::string device_;
+  int fd_ = -1;
+  int width_ = 0;
+  int height_ = 0;
+  int in_stride_ = 0;      // luma bytes per row of the OUTPUT buffers
+  int in_height_ = 0;      // rows per plane, possibly aligned by the driver
+  size_t in_size_ = 0;     // bytes per OUTPUT buffer
+  bool native_ = false;    // OUTPUT queue takes the capture layout as-is
+  bool streaming_ = false;
+  std::vector<Mapping> in_maps_;
+  std::vector<Mapping> out_maps_;
+  std::vector<unsigned> free_inputs_;
+};
+
+#endif // __linux__
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "types.hpp"
+
+// Recycles capture buffers. The capture thread fills a frame once and
+// publishes it as an immutable FrameRef; readers share that handle instead of
+// copying pixels, and the storage returns here when the last one lets go.
+class FramePool : public std::enable_shared_from_this<FramePool> {
+public:
+  explicit FramePool(size_t max_idle = 4) : max_idle_(max_idle) {}
+
+  // Returns a writable frame with room for `size` bytes. Recycled storage is
+  // reused as-is, so steady-state capture does not touch the allocator.
+  std::shared_ptr<CapturedFrame> acquire(size_t size) {
+    std::unique_ptr<CapturedFrame> frame;
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (!idle_.empty()) {
+        frame = std::move(idle_.back());
+        idle_.pop_back();
+      }
+    }
+    if (!frame)
+      frame = std::make_unique<CapturedFrame>();
+    if (frame->storage.size() < size)
+      frame->storage.resize(size);
+    frame->size = size;
+
+    std::weak_ptr<FramePool> weak = weak_from_this();
+    return std::shared_ptr<CapturedFrame>(
+        frame.release(), [weak](CapturedFrame *f) {
+          // The pool may be gone (capture torn down) while a slow reader
+          // still holds the last reference.
+          if (auto pool = weak.lock())
+            pool->recycle(std::unique_ptr<CapturedFrame>(f));
+          else
+            delete f;
+        });
+  }
+
+private:
+  void recycle(std::unique_ptr<CapturedFrame> frame) {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (idle_.size() < max_idle_)
+      idle_.push_back(std::move(frame));
+  }
+
+  std::mutex mu_;
+  std::vector<std::unique_ptr<CapturedFrame>> idle_;
+  const size_t max_idle_;
+};
+
+// The same for a SessionEncoder's access units. A frame comes back once
+// the last viewer, the GOP cache and the rewind ring have let go, with the
+// capacity of its payload, span list and AVCC copy intact, so steady-state
+// encoding refills buffers instead of growing new ones every frame.
+class EncodedFramePool
+    : public std::enable_shared_from_this<EncodedFramePool> {
+public:
+  // Room for a whole cached GOP: it is released all at once by the next
+  // IDR, and every frame of it is needed again before the one after.
+  explicit EncodedFramePool(size_t max_idle) : max_idle_(max_idle) {}
+
+  // An empty frame (default fields, no bytes), possibly recycled.
+  std::shared_ptr<EncodedFrame> acquire() {
+    std::unique_ptr<EncodedFrame> frame;
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (!idle_.empty()) {
+        frame = std::move(idle_.back());
+        idle_.pop_back();
+      }
+    }
+    if (!frame)
+      frame = std::make_unique<EncodedFrame>();
+
+    std::weak_ptr<EncodedFramePool> weak = weak_from_this();
+    return std::shared_ptr<EncodedFrame>(
+        frame.release(), [weak](EncodedFrame *f) {
+          if (auto pool = weak.lock())
+            pool->recycle(std::unique_ptr<EncodedFrame>(f));
+          else
+            delete f;
+        });
+  }
+
+private:
+  void recycle(std::unique_ptr<EncodedFrame> frame) {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (idle_.size() >= max_idle_)
+        return;
+    }
+    // avcc_once cannot be re-armed, so the frame is rebuilt around its
+    // buffers.
+    std::string data = std::move(frame->data);
+    std::string avcc = std::move(frame->avcc);
+    std::vector<NalSpan> nals = std::move(frame->nals);
+    data.clear();
+    avcc.clear();
+    nals.clear();
+    std::destroy_at(frame.get());
+    std::construct_at(frame.get());
+    frame->data = std::move(data);
+    frame->avcc = std::move(avcc);
+    frame->nals = std::move(nals);
+    std::lock_guard<std::mutex> lock(mu_);
+    if (idle_.size() < max_idle_)
+      idle_.push_back(std::move(frame));
+  }
+
+  std::mutex mu_;
+  std::vector<std::unique_ptr<EncodedFrame>> idle_;
+  const size_t max_idle_;
+};
@@ -0,0 +1,341 @@
+#include "hls.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "session_encoder.hpp"
+#include "stream_utils.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+constexpr uint32_t kTimescale = 90000;
+// Longest a segment may get while it waits for an IDR.
+constexpr uint64_t kMaxSegment = 30 * kTimescale;
+
+// `<prefix><middle><suffix>`: the middle part, or false.
+bool split_name(const std::string &name, const char *prefix,
+                const char *suffix, std::string &middle) {
+  const std::string p(prefix), s(suffix);
+  if (name.size() <= p.size() + s.size() || name.compare(0, p.size(), p) != 0 ||
+      name.compare(name.size() - s.size(), s.size(), s) != 0)
+    return false;
+  middle = name.substr(p.size(), name.size() - p.size() - s.size());
+  return true;
+}
+
+bool parse_u64(const std::string &text, uint64_t &out) {
+  if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos)
+    return false;
+  out = std::strtoull(text.c_str(), nullptr, 10);
+  return true;
+}
+
+double seconds(uint64_t ticks) {
+  return static_cast<double>(ticks) / kTimescale;
+}
+} // namespace
+
+HlsPackager::HlsPackager(std::shared_ptr<SessionEncoder> encoder,
+                         const CaptureParams &track,
+                         const std::vector<uint8_t> &sps,
+                         const std::vector<uint8_t> &pps,
+                         const HlsOptions &options,
+                         std::function<void()> on_end)
+    : encoder_(std::move(encoder)), options_(options),
+      on_end_(std::move(on_end)),
+      mux_(track.width, track.height, track.fps, sps, pps),
+      init_(mux_.build_init_segment()), clock_(track.fps),
+      sample_duration_(track.fps > 0 ? (kTimescale / track.fps) : 6000),
+      target_duration_(static_cast<int>(
+          std::ceil(std::clamp(options.segment_seconds, 1.0, 30.0)))),
+      part_target_(std::max<uint32_t>(
+          static_cast<uint32_t>(std::clamp(options.part_ms, 50, 1000)) * 90,
+          sample_duration_)),
+      // Segments last at least 3/4 s, so two numbers per second stay ahead
+      // of any earlier run of the same stream.
+      generation_(static_cast<uint64_t>(
+                      std::chrono::duration_cast<std::chrono::seconds>(
+                          std::chrono::system_clock::now().time_since_epoch())
+                          .count()) *
+                  2),
+      last_request_(std::chrono::steady_clock::now()),
+      thread_([this] { loop(); }) {}
+
+HlsPackager::~HlsPackager() {
+  stop_ = true;
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void HlsPackager::touch() {
+  std::lock_guard<std::mutex> lock(mu_);
+  last_request_ = std::chrono::steady_clock::now();
+}
+
+void HlsPackager::loop() {
+  auto sub = encoder_->subscribe();
+  while (!stop_) {
+    auto frame = sub->pop(100ms);
+    if (frame)
+      stream::frame_avcc(*frame); // converted outside the lock
+    bool published = false;
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (frame)
+        published = add_locked(*frame);
+      else if (sub->closed())
+        break;
+      if (std::chrono::steady_clock::now() - last_request_ > kIdle)
+        break;
+    }
+    if (published)
+      cv_.notify_all();
+  }
+  encoder_->unsubscribe(sub);
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    ended_ = true;
+  }
+  cv_.notify_all();
+  if (!stop_)
+    on_end_();
+}
+
+bool HlsPackager::add_locked(const EncodedFrame &frame) {
+  if (segments_.empty() && !frame.keyframe)
+    return false;
+  uint32_t duration = 0;
+  const uint64_t decode_time = clock_.stamp(frame.captured_at, duration);
+  const auto target = static_cast<uint64_t>(
+      std::clamp(options_.segment_seconds, 1.0, 30.0) * kTimescale);
+  bool cut = segments_.empty();
+  if (!cut) {
+    const Segment &live = segments_.back();
+    cut = frame.keyframe && live.ticks >= target * 3 / 4;
+    // Segments only start at an IDR. When the one asked for is late (a
+    // camera's own H.264 that ignores the request, or `still` stretching
+    // the GOP), the live segment runs on until it comes. Only one that
+    // never comes makes the stream pause at kMaxSegment, dropping frames.
+    if (!cut && live.ticks + duration > kMaxSegment) {
+      ++frames_dropped_;
+      const bool flushed = !pending_.empty();
+      close_part_locked();
+      return flushed;
+    }
+  }
+  if (cut) {
+    uint64_t msn = generation_;
+    if (!segments_.empty()) {
+      close_part_locked();
+      Segment &done = segments_.back();
+      done.complete = true;
+      msn = done.msn + 1;
+      // EXTINF, rounded, must not exceed the target duration: a long
+      // segment raises it, for the rest of the stream.
+      const int needed = static_cast<int>(std::lround(seconds(done.ticks)));
+      if (needed > target_duration_) {
+        ++long_segments_;
+        std::cerr << "HLS: a " << seconds(done.ticks)
+                  << " s segment waited for an IDR; target duration now "
+                  << needed << " s\n";
+        target_duration_ = needed;
+      }
+    }
+    segments_.push_back(Segment{msn, {}, 0, false});
+    const size_t keep = static_cast<size_t>(std::max(1, options_.window)) + 1;
+    while (segments_.size() > keep)
+      segments_.pop_front();
+    idr_asked_ = false;
+  }
+  Segment &live = segments_.back();
+  // Ask for the next segment's IDR on time, so segments track the target
+  // even with a long GOP.
+  if (!idr_asked_ && live.ticks + duration >= target) {
+    encoder_->request_idr();
+    idr_asked_ = true;
+  }
+
+  if (pending_.empty())
+    pending_independent_ = frame.keyframe;
+  pending_ += mux_.build_fragment(stream::frame_avcc(frame), seqno_++,
+                                  decode_time, duration, frame.keyframe);
+  pending_ticks_ += duration;
+  live.ticks += duration;
+  if (pending_ticks_ + sample_duration_ > part_target_) {
+    close_part_locked();
+    return true;
+  }
+  return cut;
+}
+
+void HlsPackager::close_part_locked() {
+  if (pending_.empty() || segments_.empty())
+    return;
+  Part part;
+  part.data = std::make_shared<const std::string>(std::move(pending_));
+  part.ticks = pending_ticks_;
+  part.independent = pending_independent_;
+  segments_.back().parts.push_back(std::move(part));
+  pending_.clear();
+  pending_ticks_ = 0;
+}
+
+const HlsPackager::Segment *HlsPackager::find_locked(uint64_t msn) const {
+  if (segments_.empty() || msn < segments_.front().msn ||
+      msn > segments_.back().msn)
+    return nullptr;
+  return &segments_[msn - segments_.front().msn];
+}
+
+bool HlsPackager::wait_locked(std::unique_lock<std::mutex> &lock,
+                              const std::function<bool()> &ready) {
+  const auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::seconds(3 * target_duration_);
+  cv_.wait_until(lock, deadline, [&] { return ended_ || ready(); });
+  return ready();
+}
+
+HlsPackager::Status HlsPackager::playlist(int64_t msn, int part,
+                                          const std::string &query,
+                                          std::string &out) {
+  std::unique_lock<std::mutex> lock(mu_);
+  last_request_ = std::chrono::steady_clock::now();
+  if (msn >= 0) {
+    const uint64_t last =
+        segments_.empty() ? generation_ : segments_.back().msn;
+    if (static_cast<uint64_t>(msn) > last + 2)
+      return Status::BadRequest;
+  }
+  auto ready = [&] {
+    if (segments_.empty() ||
+        (segments_.size() == 1 && segments_.back().parts.empty()))
+      return false;
+    if (msn < 0)
+      return true;
+    const Segment &live = segments_.back();
+    const auto edge = static_cast<int64_t>(live.msn);
+    if (part < 0)
+      return edge > msn; // segment msn complete
+    return edge > msn ||
+           (edge == msn && live.parts.size() > static_cast<size_t>(part));
+  };
+  if (!ready() && !wait_locked(lock, ready))
+    return Status::Timeout;
+
+  const double part_target = seconds(part_target_);
+  std::ostringstream m;
+  m << std::fixed << std::setprecision(3);
+  m << "#EXTM3U\n"
+    << "#EXT-X-VERSION:9\n"
+    << "#EXT-X-TARGETDURATION:" << target_duration_ << "\n"
+    << "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK="
+    << 3 * part_target << "\n"
+    << "#EXT-X-PART-INF:PART-TARGET=" << part_target << "\n"
+    << "#EXT-X-MEDIA-SEQUENCE:" << segments_.front().msn << "\n"
+    << "#EXT-X-MAP:URI=\"init" << generation_ << ".mp4" << query << "\"\n";
+  // Parts are only listed for the last three target durations.
+  size_t parts_from = segments_.size();
+  uint64_t recent = 0;
+  while (parts_from > 0 &&
+         recent < static_cast<uint64_t>(3 * target_duration_) * kTimescale) {
+    --parts_from;
+    recent += segments_[parts_from].ticks;
+  }
+  for (size_t i = 0; i < segments_.size(); ++i) {
+    const Segment &seg = segments_[i];
+    if (i >= parts_from) {
+      for (size_t j = 0; j < seg.parts.size(); ++j) {
+        m << "#EXT-X-PART:DURATION=" << seconds(seg.parts[j].ticks)
+          << ",URI=\"part" << seg.msn << "." << j << ".m4s" << query << "\""
+          << (seg.parts[j].independent ? ",INDEPENDENT=YES" : "") << "\n";
+      }
+    }
+    if (seg.complete)
+      m << "#EXTINF:" << seconds(seg.ticks) << ",\n"
+        << "seg" << seg.msn << ".m4s" << query << "\n";
+  }
+  const Segment &live = segments_.back();
+  m << "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"part" << live.msn << "."
+    << live.parts.size() << ".m4s" << query << "\"\n";
+  out = m.str();
+  return Status::Ok;
+}
+
+HlsPackager::Status HlsPackager::media(const std::string &name,
+                                       std::string &out) {
+  std::string middle;
+  uint64_t msn = 0;
+  std::unique_lock<std::mutex> lock(mu_);
+  last_request_ = std::chrono::steady_clock::now();
+
+  if (split_name(name, "init", ".mp4", middle)) {
+    if (!parse_u64(middle, msn) || msn != generation_)
+      return Status::NotFound;
+    out = init_;
+    return Status::Ok;
+  }
+
+  if (split_name(name, "seg", ".m4s", middle)) {
+    if (!parse_u64(middle, msn) || !find_locked(msn))
+      return Status::NotFound;
+    if (!find_locked(msn)->complete &&
+        !wait_locked(lock, [&] {
+          const Segment *seg = find_locked(msn);
+          return !seg || seg->complete;
+        }))
+      return Status::Timeout;
+    const Segment *seg = find_locked(msn);
+    if (!seg)
+      return Status::NotFound;
+    out.clear();
+    for (const auto &part : seg->parts)
+      out += *part.data;
+    return Status::Ok;
+  }
+
+  uint64_t index = 0;
+  if (!split_name(name, "part", ".m4s", middle))
+    return Status::NotFound;
+  const size_t split = middle.find('.');
+  if (split == std::string::npos || !parse_u64(middle.substr(0, split), msn) ||
+      !parse_u64(middle.substr(split + 1), index))
+    return Status::NotFound;
+  const Segment *seg = find_locked(msn);
+  if (!seg)
+    return Status::NotFound;
+  if (index >= seg->parts.size()) {
+    // Only the preload hint is worth waiting for.
+    const bool hinted = seg == &segments_.back() && !seg->complete &&
+                        index == seg->parts.size();
+    if (!hinted)
+      return Status::NotFound;
+    wait_locked(lock, [&] {
+      const Segment *s = find_locked(msn);
+      return !s || s->complete || s->parts.size() > index;
+    });
+    seg = find_locked(msn);
+    if (!seg || index >= seg->parts.size())
+      return ended_ || (seg && seg->complete) ? Status::NotFound
+                                              : Status::Timeout;
+  }
+  out = *seg->parts[index].data;
+  return Status::Ok;
+}
+
+std::shared_ptr<HlsPackager>
+find_hls(Session &session, const std::shared_ptr<SessionEncoder> &encoder) {
+  std::lock_guard<std::mutex> lock(session.hls_mu);
+  auto &list = session.hls;
+  list.erase(std::remove_if(list.begin(), list.end(),
+                            [](const auto &p) { return p->ended(); }),
+             list.end());
+  for (const auto &packager : list)
+    if (packager->encoder() == encoder)
+      return packager;
+  return nullptr;
+}
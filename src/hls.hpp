@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mp4_frag.hpp"
+#include "stream_utils.hpp"
+#include "types.hpp"
+
+class SessionEncoder;
+
+struct HlsOptions {
+  double segment_seconds = 2.0; // target segment length (>= 1)
+  int part_ms = 200;            // target partial segment length
+  int window = 6;               // complete segments kept after the live one
+};
+
+// Low-latency HLS packager for one H.264 encoder (the session's or a
+// rendition). One subscriber's access units are cut into CMAF fragments
+// once, grouped into partial segments of about `part_ms` and segments that
+// start at an IDR, and kept in a ring of `window` segments. A segment whose
+// IDR is late runs on until it arrives, and the target duration grows to
+// cover it. Every request for the stream is answered from that ring, so an
+// HTTP cache in front of the server turns any number of players into one
+// fetch per part.
+//
+// Playlist and part requests ahead of the live edge block (up to three
+// target durations) until it gets there, as LL-HLS blocking reload asks.
+// They wait on the calling pool thread; parts come every `part_ms`.
+//
+// URIs: init<gen>.mp4, seg<msn>.m4s and part<msn>.<i>.m4s. The first media
+// sequence number is derived from the wall clock, so a restarted stream
+// never reuses a URI a cache may still hold.
+class HlsPackager {
+public:
+  enum class Status { Ok, NotFound, BadRequest, Timeout };
+
+  // `on_end` runs on the packager thread when it stops by itself: idle for
+  // kIdle or its encoder closed. It does not run from the destructor.
+  HlsPackager(std::shared_ptr<SessionEncoder> encoder,
+              const CaptureParams &track, const std::vector<uint8_t> &sps,
+              const std::vector<uint8_t> &pps,
+              const HlsOptions &options, std::function<void()> on_end);
+  ~HlsPackager();
+
+  const std::shared_ptr<SessionEncoder> &encoder() const { return encoder_; }
+  int target_duration() const { return target_duration_; }
+  // Segments that outran the target duration waiting for an IDR, and
+  // frames dropped once one had reached the 30 s limit.
+  uint64_t long_segments() const { return long_segments_; }
+  uint64_t frames_dropped() const { return frames_dropped_; }
+  bool ended() const { return ended_; }
+  // Any request keeps the packager running for another kIdle.
+  void touch();
+
+  // Media playlist; `msn`/`part` are _HLS_msn/_HLS_part (-1 = absent).
+  // `query` is appended to every URI, so a cache keys them per rendition.
+  Status playlist(int64_t msn, int part, const std::string &query,
+                  std::string &out);
+  // `name` is a file name from the playlist.
+  Status media(const std::string &name, std::string &out);
+
+  static constexpr std::chrono::seconds kIdle{10};
+
+private:
+  struct Part {
+    std::shared_ptr<const std::string> data;
+    uint32_t ticks = 0; // 90 kHz
+    bool independent = false;
+  };
+  struct Segment {
+    uint64_t msn = 0;
+    std::vector<Part> parts;
+    uint64_t ticks = 0;
+    bool complete = false;
+  };
+
+  void loop();
+  // True when a part or segment was published.
+  bool add_locked(const EncodedFrame &frame);
+  void close_part_locked();
+  // Segment `msn` in the ring, or nullptr.
+  const Segment *find_locked(uint64_t msn) const;
+  // Blocks until `ready` or three target durations; false on timeout.
+  bool wait_locked(std::unique_lock<std::mutex> &lock,
+                   const std::function<bool()> &ready);
+
+  const std::shared_ptr<SessionEncoder> encoder_;
+  const HlsOptions options_;
+  const std::function<void()> on_end_;
+  Mp4Fragmenter mux_;
+  const std::string init_;
+  stream::MediaClock clock_; // decode times, from capture times
+  const uint32_t sample_duration_; // nominal
+  // EXT-X-TARGETDURATION, whole seconds; only grows. Written under mu_.
+  std::atomic<int> target_duration_;
+  const uint32_t part_target_; // ticks
+  const uint64_t generation_;  // first media sequence number
+
+  mutable std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<Segment> segments_;
+  std::string pending_; // fragments of the part being built
+  uint32_t pending_ticks_ = 0;
+  bool pending_independent_ = false;
+  bool idr_asked_ = false; // for the live segment
+  uint32_t seqno_ = 1;
+  std::chrono::steady_clock::time_point last_request_;
+
+  std::atomic<uint64_t> long_segments_{0};
+  std::atomic<uint64_t> frames_dropped_{0};
+  std::atomic<bool> stop_{false};
+  std::atomic<bool> ended_{false};
+  std::thread thread_;
+};
+
+// The running packager of `session` for `encoder`, if any; drops ended ones.
+std::shared_ptr<HlsPackager>
+find_hls(Session &session, const std::shared_ptr<SessionEncoder> &encoder);
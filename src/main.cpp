@@ -1,5 +1,10 @@
+#include <algorithm>
+#include <cctype>
 #include <chrono>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <vector>
@@ -7,30 +12,104 @@
 #include "api_router.hpp"
 #include "capture_v4l2.hpp"
 #include "client_pull.hpp"
-#include "encoder_h264.hpp"
+#include "hls.hpp"
 #include "httplib.h"
 #include "index_html.hpp"
 #include "mp4_frag.hpp"
+#include "recorder.hpp"
+#include "session_encoder.hpp"
 #include "session_manager.hpp"
+#include "stream_engine.hpp"
 #include "stream_utils.hpp"
+#include "thread_policy.hpp"
 #include "types.hpp"
-#include "yuv_convert.hpp"
+#include "udp_output.hpp"
 
 #ifdef __linux__
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <unistd.h>
 #endif
 
 using namespace std::chrono_literals;
 
+namespace {
+// The first requester's codec picks the capture format (compressed for
+// MJPEG, raw for H.264), which renditions cannot change.
+constexpr const char *kCodecLocked =
+    "codec locked by first requester; renditions may differ in size and "
+    "fps only";
+
+// `from` of a time-shifted request: -30s, -2m, -1500ms (a bare number is
+// seconds). False unless it names a point in the past.
+bool parse_rewind(const std::string &text, std::chrono::milliseconds &out) {
+  const size_t pos = text.rfind('-', 0) == 0 ? 1 : 0;
+  const size_t end = std::min(text.find_first_not_of("0123456789", pos),
+                              text.size());
+  const size_t digits = end - pos;
+  if (digits == 0 || digits > 9)
+    return false;
+  const long long value = std::stoll(text.substr(pos, digits));
+  const std::string unit = text.substr(pos + digits);
+  if (unit.empty() || unit == "s")
+    out = std::chrono::seconds(value);
+  else if (unit == "m")
+    out = std::chrono::minutes(value);
+  else if (unit == "ms")
+    out = std::chrono::milliseconds(value);
+  else
+    return false;
+  return out.count() > 0;
+}
+
+// The request's query minus LL-HLS directives, for URIs in a playlist.
+std::string hls_query(const httplib::Request &req) {
+  static const char kHex[] = "0123456789ABCDEF";
+  auto encode = [](const std::string &text) {
+    std::string out;
+    for (unsigned char c : text) {
+      if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+        out += static_cast<char>(c);
+      } else {
+        out += '%';
+        out += kHex[c >> 4];
+        out += kHex[c & 15];
+      }
+    }
+    return out;
+  };
+  std::string query;
+  for (const auto &param : req.params) {
+    if (param.first.rfind("_HLS_", 0) == 0)
+      continue;
+    query += query.empty() ? "?" : "&";
+    query += encode(param.first) + "=" + encode(param.second);
+  }
+  return query;
+}
+} // namespace
+
 int main(int argc, char *argv[]) {
   struct Config {
     std::string addr = "0.0.0.0";
     int port = 8080;
     int idle_timeout = 10;
+    int linger = 3;
+    // `device[?query]`, e.g. `video0?codec=h264&w=1280&h=720`.
+    std::vector<std::string> keep_warm;
+    // `name=url`, served as device `relay:<name>`.
+    std::vector<std::string> relays;
+    // `device[?query]`, recorded to disk from startup.
+    std::vector<std::string> record;
     std::string default_codec = "mjpeg";
     std::string connect_target = "";
+    unsigned io_threads = 2;
+    CaptureOptions capture;
+    EncoderOptions encoder;
+    ThreadOptions threads; // capture and encode thread placement
+    HlsOptions hls;
+    RecordOptions recording;
   } cfg;
 
   for (int i = 1; i < argc; ++i) {
@@ -41,20 +120,159 @@ int main(int argc, char *argv[]) {
       cfg.port = std::stoi(argv[++i]);
     } else if (arg == "--idle-timeout" && i + 1 < argc) {
       cfg.idle_timeout = std::stoi(argv[++i]);
+    } else if (arg == "--linger" && i + 1 < argc) {
+      cfg.linger = std::stoi(argv[++i]);
+    } else if (arg == "--keep-warm" && i + 1 < argc) {
+      cfg.keep_warm.push_back(argv[++i]);
+    } else if (arg == "--keep-warm-file" && i + 1 < argc) {
+      // One spec per line; blank lines and `#` comments are skipped.
+      std::ifstream file(argv[++i]);
+      if (!file) {
+        std::cerr << "Cannot read --keep-warm-file '" << argv[i] << "'\n";
+        return 1;
+      }
+      std::string line;
+      while (std::getline(file, line)) {
+        line.erase(0, line.find_first_not_of(" \t"));
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (!line.empty() && line[0] != '#')
+          cfg.keep_warm.push_back(line);
+      }
+    } else if (arg == "--relay" && i + 1 < argc) {
+      cfg.relays.push_back(argv[++i]);
+    } else if (arg == "--hls-segment" && i + 1 < argc) {
+      cfg.hls.segment_seconds = std::stod(argv[++i]);
+    } else if (arg == "--hls-part" && i + 1 < argc) {
+      cfg.hls.part_ms = std::stoi(argv[++i]);
+    } else if (arg == "--rewind" && i + 1 < argc) {
+      cfg.encoder.rewind_seconds = std::stoi(argv[++i]);
+    } else if (arg == "--record" && i + 1 < argc) {
+      cfg.record.push_back(argv[++i]);
+    } else if (arg == "--record-dir" && i + 1 < argc) {
+      cfg.recording.dir = argv[++i];
+    } else if (arg == "--record-file-seconds" && i + 1 < argc) {
+      cfg.recording.file_seconds = std::stoi(argv[++i]);
     } else if (arg == "--codec" && i + 1 < argc) {
       cfg.default_codec = std::string(argv[++i]);
     } else if (arg == "--connect" && i + 1 < argc) {
       cfg.connect_target = argv[++i];
+    } else if (arg == "--io-threads" && i + 1 < argc) {
+      cfg.io_threads = static_cast<unsigned>(std::max(1, std::stoi(argv[++i])));
+    } else if (arg == "--capture-io" && i + 1 < argc) {
+      std::string io = argv[++i];
+      if (io == "mmap") {
+        cfg.capture.io = CaptureIo::Mmap;
+      } else if (io == "userptr") {
+        cfg.capture.io = CaptureIo::Userptr;
+      } else if (io == "dmabuf") {
+        cfg.capture.io = CaptureIo::Dmabuf;
+      } else {
+        std::cerr << "Unknown --capture-io '" << io << "'\n";
+        return 1;
+      }
+    } else if (arg == "--encoder" && i + 1 < argc) {
+      std::string backend = argv[++i];
+      if (backend == "auto") {
+        cfg.encoder.backend = EncoderBackend::Auto;
+      } else if (backend == "openh264") {
+        cfg.encoder.backend = EncoderBackend::OpenH264;
+      } else if (backend == "v4l2m2m") {
+        cfg.encoder.backend = EncoderBackend::V4L2M2M;
+      } else {
+        std::cerr << "Unknown --encoder '" << backend << "'\n";
+        return 1;
+      }
+    } else if (arg == "--encoder-device" && i + 1 < argc) {
+      cfg.encoder.m2m_device = argv[++i];
+    } else if (arg == "--encoder-threads" && i + 1 < argc) {
+      cfg.encoder.threads = std::stoi(argv[++i]);
+    } else if (arg == "--encoder-slices" && i + 1 < argc) {
+      cfg.encoder.slices = std::stoi(argv[++i]);
+    } else if (arg == "--encoder-slice-bytes" && i + 1 < argc) {
+      cfg.encoder.slice_max_bytes = std::stoi(argv[++i]);
+    } else if (arg == "--encoder-complexity" && i + 1 < argc) {
+      cfg.encoder.complexity = argv[++i];
+    } else if (arg == "--no-h264-passthrough") {
+      cfg.capture.h264_passthrough = false;
+    } else if (arg == "--capture-buffers" && i + 1 < argc) {
+      cfg.capture.buffers = static_cast<unsigned>(std::stoi(argv[++i]));
+    } else if (arg == "--test-devices") {
+      cfg.capture.test_devices = true;
+    } else if (arg == "--realtime") {
+      cfg.threads.realtime = true;
+    } else if ((arg == "--capture-cpus" || arg == "--encode-cpus") &&
+               i + 1 < argc) {
+      auto &cpus = arg == "--capture-cpus" ? cfg.threads.capture_cpus
+                                           : cfg.threads.encode_cpus;
+      if (!parse_cpu_list(argv[++i], cpus)) {
+        std::cerr << "Bad CPU list '" << argv[i] << "' for " << arg << "\n";
+        return 1;
+      }
+    } else if (arg == "--no-numa") {
+      cfg.threads.numa = false;
     } else if (arg == "--help" || arg == "-h") {
       std::cout << "SilkCast\n"
                 << "  --addr <ip>          Bind address (default 0.0.0.0)\n"
                 << "  --port <port>        Bind port   (default 8080)\n"
                 << "  --idle-timeout <s>   Idle seconds before closing device "
                    "(default 10)\n"
+                << "  --linger <s>         Seconds a device stays open after "
+                   "its last viewer leaves (default 3)\n"
+                << "  --keep-warm <id[?params]>\n"
+                << "                       Keep a device open and encoding "
+                   "without viewers (repeatable)\n"
+                << "  --keep-warm-file <path> Keep-warm specs, one per line\n"
+                << "  --relay <name>=<http|udp://host:port/device[?params]>\n"
+                << "                       Re-serve another SilkCast stream as "
+                   "device relay:<name> (Linux, repeatable)\n"
+                << "  --hls-segment <s>    LL-HLS target segment length "
+                   "(default 2)\n"
+                << "  --hls-part <ms>      LL-HLS partial segment length "
+                   "(default 200)\n"
+                << "  --rewind <s>         Keep the last <s> seconds of each "
+                   "H.264 stream for ?from=-<s> (default 0)\n"
+                << "  --record <id[?params]>\n"
+                << "                       Record a device's H.264 stream to "
+                   "rolling fMP4 files (repeatable)\n"
+                << "  --record-dir <path>  Where recordings go (default "
+                   "recordings)\n"
+                << "  --record-file-seconds <s> Length of each recording file "
+                   "(default 300)\n"
                 << "  --codec <mjpeg|h264> Default codec if not specified "
                    "(default mjpeg)\n"
                 << "  --connect <ip:port>  Run as client (pull stream from "
-                   "server)\n";
+                   "server)\n"
+                << "  --io-threads <n>     Threads serving stream bodies "
+                   "(default 2)\n"
+                << "  --capture-io <mmap|userptr|dmabuf>\n"
+                << "                       V4L2 buffer mode; userptr/dmabuf "
+                   "pass frames on zero-copy (default mmap)\n"
+                << "  --capture-buffers <n> V4L2 queue depth (default: 2 for "
+                   "ultra, 3 for low, 4-6 for view)\n"
+                << "  --no-h264-passthrough Always encode H.264 ourselves, "
+                   "even if the camera offers it\n"
+                << "  --test-devices       Offer synthetic test:pattern "
+                   "devices (Linux; for benchmarks)\n"
+                << "  --realtime           SCHED_FIFO capture/encode threads "
+                   "for ultra and low sessions\n"
+                << "  --capture-cpus <list>, --encode-cpus <list>\n"
+                << "                       Pin those threads, e.g. 2,3 or 4-7 "
+                   "(default: the camera's NUMA node)\n"
+                << "  --no-numa            Do not follow the camera's NUMA "
+                   "node\n"
+                << "  --encoder <auto|openh264|v4l2m2m>\n"
+                << "                       H.264 encoder backend (default "
+                   "auto: hardware if found, else OpenH264)\n"
+                << "  --encoder-device <path> V4L2 M2M encoder node (default: "
+                   "probe /dev/video*)\n"
+                << "  --encoder-threads <n> OpenH264 threads (default: up to 4 "
+                   "from 640x480)\n"
+                << "  --encoder-slices <n> OpenH264 slices per frame (default: "
+                   "one per thread)\n"
+                << "  --encoder-slice-bytes <n> Size-limited slices (e.g. 1200 "
+                   "to fit UDP packets)\n"
+                << "  --encoder-complexity <low|medium|high> (default: ultra "
+                   "low, low medium, view high)\n";
       return 0;
     }
   }
@@ -62,9 +280,59 @@ int main(int argc, char *argv[]) {
   if (!cfg.connect_target.empty()) {
     return run_client(cfg.connect_target);
   }
+  cfg.capture.thread_policy = cfg.threads;
+  cfg.encoder.thread_policy = cfg.threads;
+
+  SessionManager sessions(cfg.idle_timeout, cfg.capture, cfg.encoder,
+                          cfg.linger);
+  // Before the keep-warm specs, which may name a relay.
+  for (const auto &spec : cfg.relays) {
+    const size_t eq = spec.find('=');
+    if (eq == std::string::npos ||
+        !sessions.add_relay(spec.substr(0, eq), spec.substr(eq + 1))) {
+      std::cerr << "--relay expects <name>=<url>, got '" << spec << "'\n";
+      return 1;
+    }
+  }
+  // Opened up front, so their first viewer skips the device open, format
+  // negotiation, exposure settling and the wait for SPS/PPS.
+  for (const auto &spec : cfg.keep_warm) {
+    const size_t q = spec.find('?');
+    const std::string query =
+        q == std::string::npos ? std::string() : spec.substr(q + 1);
+    auto params = stream::parse_params(query);
+    // parse_params always fills in a codec; --codec applies unless the
+    // spec names one.
+    if (("&" + query).find("&codec=") == std::string::npos)
+      params.codec = cfg.default_codec;
+    sessions.keep_warm(spec.substr(0, q), params);
+  }
+  for (const auto &spec : cfg.record) {
+    const size_t q = spec.find('?');
+    auto params = stream::parse_params(
+        q == std::string::npos ? std::string() : spec.substr(q + 1));
+    sessions.record(spec.substr(0, q), params, cfg.recording);
+  }
+  StreamServer svr(cfg.io_threads);
 
-  SessionManager sessions(cfg.idle_timeout);
-  httplib::Server svr;
+  // H.264 viewers join the rendition closest to what they asked for. What
+  // they leave out is taken from the running capture (one side of the size
+  // alone keeps its aspect), so plain requests share the full-size encoder.
+  auto pick_encoder = [&sessions](const httplib::Request &req,
+                                  Session &session,
+                                  const CaptureParams &params,
+                                  bool create = true) {
+    CaptureParams want = params;
+    const int cw = std::max(1, session.params.width);
+    const int ch = std::max(1, session.params.height);
+    if (!req.has_param("w"))
+      want.width = req.has_param("h") ? want.height * cw / ch : cw;
+    if (!req.has_param("h"))
+      want.height = req.has_param("w") ? want.width * ch / cw : ch;
+    if (!req.has_param("fps"))
+      want.fps = session.params.fps;
+    return sessions.encoder_for(session, want, create);
+  };
   ApiRouter api;
 
   // Streaming endpoints require chunked transfer encoding hacks and range
@@ -137,6 +405,19 @@ int main(int argc, char *argv[]) {
 #endif
        }});
 
+  // Prometheus scrape target: stage latency histograms and frame counters
+  // for every open session and its viewers.
+  api.add_route({"/metrics",
+                 "GET",
+                 "Prometheus metrics (latency histograms, frame counters)",
+                 {},
+                 [&sessions](const httplib::Request &, httplib::Response &res) {
+                   res.status = 200;
+                   res.set_content(
+                       stream::build_metrics_text(sessions.active()),
+                       "text/plain; version=0.0.4");
+                 }});
+
   // Stats route.
   api.add_route(
       {"/stream/{device}/stats",
@@ -168,6 +449,58 @@ int main(int argc, char *argv[]) {
          double fps = session->frames_sent.load() / uptime;
          double bitrate_kbps =
              (session->bytes_sent.load() * 8.0 / 1000.0) / uptime;
+         // Frames shed by congested viewers (MJPEG skips + H.264 queue drops).
+         uint64_t dropped = session->frames_dropped.load();
+         // Left out by the static-scene test: JPEGs per viewer, like
+         // frames_sent; raw frames per encoder, out of those it took.
+         uint64_t unchanged = session->frames_unchanged.load();
+         uint64_t considered = unchanged + session->frames_sent.load();
+         if (session->params.codec == "h264") {
+           unchanged = 0;
+           considered = 0;
+         }
+         std::string rendition_list;
+         for (const auto &encoder : SessionManager::encoders(*session)) {
+           dropped += encoder->dropped_frames();
+           if (session->params.codec == "h264") {
+             unchanged += encoder->unchanged_frames();
+             considered +=
+                 encoder->unchanged_frames() + encoder->encoded_frames();
+           }
+           if (!encoder->scaled())
+             continue;
+           const auto &r = encoder->requested();
+           const RateTarget t = encoder->rate_target();
+           if (!rendition_list.empty())
+             rendition_list += ",";
+           rendition_list +=
+               "{\"width\":" + std::to_string(r.width) +
+               ",\"height\":" + std::to_string(r.height) +
+               ",\"fps\":" + std::to_string(r.fps) +
+               ",\"subscribers\":" +
+               std::to_string(encoder->subscriber_count()) +
+               ",\"target_bitrate_kbps\":" + std::to_string(t.kbps) +
+               ",\"target_fps\":" + std::to_string(t.fps) +
+               ",\"frames_unchanged\":" +
+               std::to_string(encoder->unchanged_frames()) + "}";
+         }
+         const uint64_t sent = session->frames_sent.load();
+         const double drop_pct =
+             dropped + sent > 0 ? 100.0 * dropped / (dropped + sent) : 0.0;
+         const double unchanged_pct =
+             considered > 0 ? 100.0 * unchanged / considered : 0.0;
+         // Where receiver feedback has taken the encoder.
+         const RateTarget target = session->encoder->rate_target();
+         // LL-HLS segments stretched waiting for a late IDR.
+         uint64_t hls_long = 0;
+         uint64_t hls_dropped = 0;
+         {
+           std::lock_guard<std::mutex> lock(session->hls_mu);
+           for (const auto &hls : session->hls) {
+             hls_long += hls->long_segments();
+             hls_dropped += hls->frames_dropped();
+           }
+         }
 
          res.status = 200;
          res.set_content("{"
@@ -199,6 +532,17 @@ int main(int argc, char *argv[]) {
                              "\"active_clients\":" +
                              std::to_string(session->client_count.load()) +
                              ","
+                             "\"warm\":" +
+                             std::string(session->warm ? "true" : "false") +
+                             ","
+                             "\"upstream\":\"" +
+                             json_escape(session->upstream) +
+                             "\","
+                             "\"recording\":\"" +
+                             json_escape(session->recorder
+                                             ? session->recorder->current_file()
+                                             : std::string()) +
+                             "\","
                              "\"fps_out\":" +
                              std::to_string(fps) +
                              ","
@@ -209,7 +553,34 @@ int main(int argc, char *argv[]) {
                              std::to_string(session->frames_sent.load()) +
                              ","
                              "\"bytes_sent\":" +
-                             std::to_string(session->bytes_sent.load()) + "}",
+                             std::to_string(session->bytes_sent.load()) +
+                             ","
+                             "\"frames_dropped\":" +
+                             std::to_string(dropped) +
+                             ","
+                             "\"drop_pct\":" +
+                             std::to_string(drop_pct) +
+                             ","
+                             "\"frames_unchanged\":" +
+                             std::to_string(unchanged) +
+                             ","
+                             "\"unchanged_pct\":" +
+                             std::to_string(unchanged_pct) +
+                             ","
+                             "\"target_bitrate_kbps\":" +
+                             std::to_string(target.kbps) +
+                             ","
+                             "\"target_fps\":" +
+                             std::to_string(target.fps) +
+                             ","
+                             "\"hls_long_segments\":" +
+                             std::to_string(hls_long) +
+                             ","
+                             "\"hls_frames_dropped\":" +
+                             std::to_string(hls_dropped) +
+                             ","
+                             "\"renditions\":[" +
+                             rendition_list + "]}",
                          "application/json");
        }});
 
@@ -224,6 +595,8 @@ int main(int argc, char *argv[]) {
         {"fps", ParamType::Int, "30", "Framerate"},
         {"bitrate", ParamType::Int, "256", "Bitrate (kbps)"},
         {"quality", ParamType::Int, "80", "JPEG quality (1-100, MJPEG only)"},
+        {"still", ParamType::Int, "0",
+         "Skip unchanged frames: threshold (0 = off)"},
         {"gop", ParamType::Int, "30", "GOP Size"},
         {"codec", ParamType::Select, "mjpeg", "Video Codec", {"mjpeg", "h264"}},
         {"latency",
@@ -235,8 +608,11 @@ int main(int argc, char *argv[]) {
          ParamType::Select,
          "raw",
          "Container Format",
-         {"raw", "mp4"}}},
-       [&sessions](const httplib::Request &req, httplib::Response &res) {
+         {"raw", "mp4"}},
+        {"from", ParamType::String, "",
+         "Start in the past, e.g. -30s (H.264, needs --rewind)"}},
+       [&sessions, &svr, &pick_encoder](const httplib::Request &req,
+                                        httplib::Response &res) {
          if (req.matches.size() < 2) {
            res.status = 404;
            return;
@@ -247,6 +623,18 @@ int main(int argc, char *argv[]) {
            params.codec = "mjpeg";
          if (params.container.empty())
            params.container = "raw";
+         std::chrono::milliseconds rewind{};
+         if (req.has_param("from") &&
+             (!parse_rewind(req.get_param_value("from"), rewind) ||
+              params.codec != "h264")) {
+           res.status = 400;
+           res.set_content(stream::build_error_json(
+                               "bad_request",
+                               "from must be a past offset like -30s, with "
+                               "codec=h264"),
+                           "application/json");
+           return;
+         }
 
          auto session = sessions.get_or_create(device_id, params);
          session->client_count.fetch_add(1);
@@ -254,12 +642,13 @@ int main(int argc, char *argv[]) {
 
          EffectiveParams eff{params, session->params};
          eff.actual.container = params.container;
+         eff.passthrough = session->pixel_format == PixelFormat::H264;
          stream::add_effective_headers(res, eff);
 
          if (params.codec != session->params.codec) {
            res.status = 409;
            res.set_content(stream::build_error_json(
-                               "conflict", "params locked by first requester"),
+                               "conflict", kCodecLocked),
                            "application/json");
            session->client_count.fetch_sub(1);
            return;
@@ -288,8 +677,16 @@ int main(int argc, char *argv[]) {
            session->bytes_sent = 0;
          }
 
+         std::shared_ptr<SessionEncoder> encoder;
          EffectiveParams eff_actual{params, session->params};
+         if (params.codec == "h264") {
+           encoder = pick_encoder(req, *session, params);
+           if (encoder->scaled())
+             eff_actual.actual = encoder->requested();
+         }
          eff_actual.actual.container = params.container;
+         eff_actual.passthrough = session->pixel_format == PixelFormat::H264 &&
+                                  !(encoder && encoder->scaled());
          stream::add_effective_headers(res, eff_actual);
 
          if (params.container == "mp4" && params.codec != "h264") {
@@ -301,14 +698,27 @@ int main(int argc, char *argv[]) {
            sessions.release_if_idle(device_id);
            return;
          }
+         if (rewind.count() > 0 && !encoder->rewind_enabled()) {
+           res.status = 400;
+           res.set_content(
+               stream::build_error_json(
+                   "bad_request",
+                   encoder->scaled() ? "renditions have no rewind buffer"
+                                     : "rewind buffer off (see --rewind)"),
+               "application/json");
+           session->client_count.fetch_sub(1);
+           sessions.release_if_idle(device_id);
+           return;
+         }
 
          if (params.codec == "mjpeg") {
-           stream::serve_mjpeg_live(session->params, res, session, on_done);
+           stream::serve_mjpeg_live(svr, session->params, res, session,
+                                    on_done);
          } else if (params.codec == "h264") {
            if (params.container == "mp4") {
              std::string error;
              if (!stream::preflight_fmp4_bootstrap(session->params, session,
-                                                   error)) {
+                                                   encoder, error)) {
                res.status = 503;
                res.set_content(
                    stream::build_error_json("fmp4_unavailable", error),
@@ -317,9 +727,11 @@ int main(int argc, char *argv[]) {
                sessions.release_if_idle(device_id);
                return;
              }
-             stream::serve_fmp4_live(session->params, res, session, on_done);
+             stream::serve_fmp4_live(svr, session->params, res, session,
+                                     encoder, on_done, rewind);
            } else {
-             stream::serve_h264_live(session->params, res, session, on_done);
+             stream::serve_h264_live(svr, session->params, res, session,
+                                     encoder, on_done, rewind);
            }
          } else {
            res.status = 400;
@@ -331,6 +743,243 @@ int main(int argc, char *argv[]) {
          }
        }});
 
+  // Low-latency HLS: one packager per encoder cuts CMAF parts into a ring
+  // that any number of players (or a cache in front) fetch from. The
+  // playlist request starts it; the parts and segments it lists name files
+  // under the same path, with the same query.
+  api.add_route(
+      {"/stream/hls/{device}/{file}",
+       "GET",
+       "Low-latency HLS (CMAF): index.m3u8, then the files it lists",
+       {{"device", ParamType::Device, "video0", "Device ID"},
+        {"file", ParamType::String, "index.m3u8",
+         "Playlist, init, segment or part"},
+        {"w", ParamType::Int, "1280", "Width"},
+        {"h", ParamType::Int, "720", "Height"},
+        {"fps", ParamType::Int, "30", "Framerate"},
+        {"bitrate", ParamType::Int, "2000", "Bitrate (kbps)"},
+        {"gop", ParamType::Int, "30", "GOP Size"},
+        {"latency",
+         ParamType::Select,
+         "view",
+         "Latency Mode",
+         {"view", "low", "ultra"}}},
+       [&sessions, &pick_encoder, &cfg](const httplib::Request &req,
+                                        httplib::Response &res) {
+         if (req.matches.size() < 3) {
+           res.status = 404;
+           return;
+         }
+         const std::string device_id = req.matches[1].str();
+         const std::string file = req.matches[2].str();
+         const bool index = file == "index.m3u8";
+         auto params = stream::parse_params(req);
+         params.codec = "h264";
+         res.set_header("Access-Control-Allow-Origin", "*");
+
+         std::shared_ptr<HlsPackager> hls;
+         auto session_opt = sessions.find(device_id);
+         if (session_opt && (*session_opt)->capture->running() &&
+             (*session_opt)->params.codec == "h264")
+           hls = find_hls(**session_opt,
+                          pick_encoder(req, **session_opt, params, false));
+         if (!hls && !index) {
+           res.status = 404;
+           res.set_content(stream::build_error_json(
+                               "not_found", "no HLS stream; load index.m3u8"),
+                           "application/json");
+           return;
+         }
+         if (!hls) {
+           auto session = sessions.get_or_create(device_id, params);
+           session->client_count.fetch_add(1);
+           session->last_accessed = std::chrono::steady_clock::now();
+           auto fail = [&](int status, const std::string &error,
+                           const std::string &details) {
+             res.status = status;
+             res.set_content(stream::build_error_json(error, details),
+                             "application/json");
+             session->client_count.fetch_sub(1);
+             sessions.release_if_idle(device_id);
+           };
+           if (session->params.codec != "h264") {
+             fail(409, "conflict", kCodecLocked);
+             return;
+           }
+           if (!session->capture->running()) {
+             if (!session->capture->start(device_id, session->params)) {
+               fail(503, "device_unavailable", "failed to open camera");
+               return;
+             }
+             stream::sync_session_params(*session);
+             session->started = std::chrono::steady_clock::now();
+             session->frames_sent = 0;
+             session->bytes_sent = 0;
+           }
+           auto encoder = pick_encoder(req, *session, params);
+           std::string error;
+           if (!stream::preflight_fmp4_bootstrap(session->params, session,
+                                                 encoder, error)) {
+             fail(503, "fmp4_unavailable", error);
+             return;
+           }
+           // A concurrent first request may have started one meanwhile.
+           std::lock_guard<std::mutex> lock(session->hls_mu);
+           for (const auto &running : session->hls)
+             if (running->encoder() == encoder && !running->ended())
+               hls = running;
+           if (hls) {
+             session->client_count.fetch_sub(1);
+           } else {
+             std::vector<uint8_t> sps;
+             std::vector<uint8_t> pps;
+             encoder->parameter_sets(sps, pps);
+             const CaptureParams track =
+                 encoder->scaled() ? encoder->requested() : session->params;
+             // Holds the session's reference until nobody polls for a while.
+             hls = std::make_shared<HlsPackager>(
+                 encoder, track, sps, pps, cfg.hls, [device_id, &sessions] {
+                   auto session_opt = sessions.find(device_id);
+                   if (!session_opt)
+                     return;
+                   (*session_opt)->client_count.fetch_sub(1);
+                   sessions.release_if_idle(device_id);
+                 });
+             session->hls.push_back(hls);
+             std::cerr << "Session " << device_id << ": HLS " << track.width
+                       << "x" << track.height << "@" << track.fps << "\n";
+           }
+         }
+
+         std::string body;
+         std::string cache = "public, max-age=60";
+         HlsPackager::Status status;
+         if (index) {
+           const int64_t msn = req.has_param("_HLS_msn")
+                                   ? std::stoll(req.get_param_value("_HLS_msn"))
+                                   : -1;
+           const int part = req.has_param("_HLS_part")
+                                ? std::stoi(req.get_param_value("_HLS_part"))
+                                : -1;
+           status = hls->playlist(msn, part, hls_query(req), body);
+           // A blocking reload names a point in the stream, so caches may
+           // keep it; a plain reload must be revalidated.
+           cache = msn >= 0 ? "public, max-age=" +
+                                  std::to_string(3 * hls->target_duration())
+                            : "no-cache";
+         } else {
+           status = hls->media(file, body);
+         }
+         switch (status) {
+         case HlsPackager::Status::Ok:
+           res.status = 200;
+           res.set_header("Cache-Control", cache);
+           res.set_content(body, index ? "application/vnd.apple.mpegurl"
+                                       : "video/mp4");
+           return;
+         case HlsPackager::Status::BadRequest:
+           res.status = 400;
+           res.set_content(stream::build_error_json(
+                               "bad_request", "_HLS_msn too far ahead"),
+                           "application/json");
+           break;
+         case HlsPackager::Status::Timeout:
+           res.status = 503;
+           res.set_content(stream::build_error_json(
+                               "hls_unavailable", "stream did not advance"),
+                           "application/json");
+           break;
+         case HlsPackager::Status::NotFound:
+           res.status = 404;
+           res.set_content(
+               stream::build_error_json("not_found", "no such part or segment"),
+               "application/json");
+           break;
+         }
+         res.set_header("Cache-Control", "no-store");
+       }});
+
+  // WebSocket stream route.
+  api.add_route(
+      {"/stream/ws/{device}",
+       "GET",
+       "Start a WebSocket stream (Linux only)",
+       {{"device", ParamType::Device, "video0", "Device ID"},
+        {"w", ParamType::Int, "1280", "Width"},
+        {"h", ParamType::Int, "720", "Height"},
+        {"fps", ParamType::Int, "30", "Framerate"},
+        {"bitrate", ParamType::Int, "256", "Bitrate (kbps)"},
+        {"quality", ParamType::Int, "80", "JPEG quality (1-100, MJPEG only)"},
+        {"still", ParamType::Int, "0",
+         "Skip unchanged frames: threshold (0 = off)"},
+        {"gop", ParamType::Int, "30", "GOP Size"},
+        {"codec", ParamType::Select, "mjpeg", "Video Codec", {"mjpeg", "h264"}},
+        {"latency",
+         ParamType::Select,
+         "low",
+         "Latency Mode",
+         {"view", "low", "ultra"}}},
+       [&sessions, &svr, &pick_encoder](const httplib::Request &req,
+                                        httplib::Response &res) {
+         if (req.matches.size() < 2) {
+           res.status = 404;
+           return;
+         }
+         std::string device_id = req.matches[1].str();
+         auto params = stream::parse_params(req);
+         if (params.codec.empty())
+           params.codec = "mjpeg";
+         if (params.codec != "mjpeg" && params.codec != "h264") {
+           res.status = 400;
+           res.set_content(
+               stream::build_error_json("bad_request", "unsupported codec"),
+               "application/json");
+           return;
+         }
+
+         auto session = sessions.get_or_create(device_id, params);
+         session->client_count.fetch_add(1);
+         session->last_accessed = std::chrono::steady_clock::now();
+
+         if (params.codec != session->params.codec) {
+           res.status = 409;
+           res.set_content(stream::build_error_json(
+                               "conflict", kCodecLocked),
+                           "application/json");
+           session->client_count.fetch_sub(1);
+           return;
+         }
+
+         auto on_done = [device_id, &sessions](bool) {
+           auto session_opt = sessions.find(device_id);
+           if (session_opt) {
+             (*session_opt)->client_count.fetch_sub(1);
+             sessions.release_if_idle(device_id);
+           }
+         };
+
+         if (!session->capture->running()) {
+           if (!session->capture->start(device_id, session->params)) {
+             res.status = 503;
+             res.set_content(stream::build_error_json("device_unavailable",
+                                                      "failed to open camera"),
+                             "application/json");
+             session->client_count.fetch_sub(1);
+             return;
+           }
+           stream::sync_session_params(*session);
+           session->started = std::chrono::steady_clock::now();
+           session->frames_sent = 0;
+           session->bytes_sent = 0;
+         }
+
+         auto encoder = params.codec == "h264"
+                            ? pick_encoder(req, *session, params)
+                            : nullptr;
+         stream::serve_ws_live(svr, session->params, req, res, session,
+                               encoder, on_done);
+       }});
+
   // UDP stream route.
   api.add_route(
       {"/stream/udp/{device}",
@@ -340,14 +989,22 @@ int main(int argc, char *argv[]) {
         {"target", ParamType::String, "127.0.0.1", "Target IP"},
         {"port", ParamType::Int, "5000", "Target Port"},
         {"duration", ParamType::Int, "10", "Duration (seconds)"},
+        {"mtu", ParamType::Int, "1400", "Datagram size (576-9000)"},
+        {"pace", ParamType::Select, "0", "Pace over frame interval", {"0", "1"}},
+        {"fec", ParamType::Int, "0", "Fragments per XOR parity (0 = off)"},
+        {"ts", ParamType::Select, "0", "Capture time on every datagram",
+         {"0", "1"}},
         {"w", ParamType::Int, "1280", "Width"},
         {"h", ParamType::Int, "720", "Height"},
         {"fps", ParamType::Int, "30", "Framerate"},
         {"bitrate", ParamType::Int, "2000", "Bitrate (kbps)"},
         {"quality", ParamType::Int, "80", "JPEG quality (1-100, MJPEG only)"},
+        {"still", ParamType::Int, "0",
+         "Skip unchanged frames: threshold (0 = off)"},
         {"gop", ParamType::Int, "30", "GOP Size"},
         {"codec", ParamType::Select, "h264", "Video Codec", {"h264", "mjpeg"}}},
-       [&sessions](const httplib::Request &req, httplib::Response &res) {
+       [&sessions, &svr, &pick_encoder](const httplib::Request &req,
+                                        httplib::Response &res) {
 #ifdef __linux__
          if (req.matches.size() < 2) {
            res.status = 404;
@@ -363,9 +1020,17 @@ int main(int argc, char *argv[]) {
          }
          const std::string target = req.get_param_value("target");
          int port = std::stoi(req.get_param_value("port"));
-         int duration_sec = req.has_param("duration")
-                                ? std::stoi(req.get_param_value("duration"))
-                                : 10;
+         stream::UdpOptions udp;
+         if (req.has_param("duration"))
+           udp.duration =
+               std::chrono::seconds(std::stoi(req.get_param_value("duration")));
+         if (req.has_param("mtu"))
+           udp.mtu = static_cast<size_t>(
+               std::max(0, std::stoi(req.get_param_value("mtu"))));
+         udp.pace = req.get_param_value("pace") == "1";
+         udp.timestamps = req.get_param_value("ts") == "1";
+         if (req.has_param("fec"))
+           udp.fec = std::stoi(req.get_param_value("fec"));
          auto params = stream::parse_params(req);
          if (params.codec.empty())
            params.codec = "h264";
@@ -373,14 +1038,22 @@ int main(int argc, char *argv[]) {
          auto session = sessions.get_or_create(device_id, params);
          session->client_count.fetch_add(1);
          session->last_accessed = std::chrono::steady_clock::now();
+         auto fail = [&](int status, const std::string &error,
+                         const std::string &details) {
+           res.status = status;
+           res.set_content(stream::build_error_json(error, details),
+                           "application/json");
+           session->client_count.fetch_sub(1);
+           sessions.release_if_idle(device_id);
+         };
+         if (params.codec != session->params.codec) {
+           fail(409, "conflict", kCodecLocked);
+           return;
+         }
 
          if (!session->capture->running()) {
            if (!session->capture->start(device_id, session->params)) {
-             res.status = 503;
-             res.set_content(stream::build_error_json("device_unavailable",
-                                                      "failed to open camera"),
-                             "application/json");
-             session->client_count.fetch_sub(1);
+             fail(503, "device_unavailable", "failed to open camera");
              return;
            }
            stream::sync_session_params(*session);
@@ -389,172 +1062,229 @@ int main(int argc, char *argv[]) {
            session->bytes_sent = 0;
          }
 
-         std::thread([session, params, target, port, duration_sec,
-                      &sessions]() {
-           int sock = socket(AF_INET, SOCK_DGRAM, 0);
-           if (sock < 0) {
-             session->client_count.fetch_sub(1);
-             sessions.release_if_idle(session->device_id);
-             return;
-           }
-           sockaddr_in addr{};
-           addr.sin_family = AF_INET;
-           addr.sin_port = htons(port);
-           if (inet_pton(AF_INET, target.c_str(), &addr.sin_addr) != 1) {
+         const bool h264 = params.codec == "h264";
+         auto encoder = h264 ? pick_encoder(req, *session, params) : nullptr;
+         if (h264 && !encoder->available()) {
+           fail(503, "h264_unavailable",
+                "OpenH264 not enabled and camera has no H.264");
+           return;
+         }
+         if (!h264 && params.codec != "mjpeg") {
+           fail(400, "bad_request", "unsupported codec");
+           return;
+         }
+         sockaddr_in addr{};
+         addr.sin_family = AF_INET;
+         addr.sin_port = htons(port);
+         if (inet_pton(AF_INET, target.c_str(), &addr.sin_addr) != 1) {
+           fail(400, "bad_request", "target must be an IPv4 address");
+           return;
+         }
+         std::memcpy(&udp.peer, &addr, sizeof(addr));
+         // Connected, so the engine can use send() and learn of ICMP errors.
+         int sock = socket(AF_INET, SOCK_DGRAM, 0);
+         if (sock < 0 || connect(sock, reinterpret_cast<sockaddr *>(&addr),
+                                 sizeof(addr)) != 0) {
+           if (sock >= 0)
              close(sock);
-             session->client_count.fetch_sub(1);
-             sessions.release_if_idle(session->device_id);
-             return;
-           }
-
-           std::string frame;
-           std::string yuv;
-           const int y_size = params.width * params.height;
-           const int uv_size = (params.width / 2) * (params.height / 2);
-           yuv.resize(y_size + 2 * uv_size);
-           uint8_t *y = reinterpret_cast<uint8_t *>(yuv.data());
-           uint8_t *u = y + y_size;
-           uint8_t *v = u + uv_size;
-           bool first = true;
-#ifdef HAS_OPENH264
-           H264Encoder encoder;
-           bool encoder_ready = false;
-           if (params.codec == "h264") {
-             if (!encoder.init(session->params))
-               encoder_ready = false;
-             else {
-               encoder.force_idr();
-               encoder_ready = true;
-               first = false;
-             }
-           }
-#endif
+           fail(503, "udp_unavailable", "failed to open UDP socket");
+           return;
+         }
 
-           auto start = std::chrono::steady_clock::now();
-           uint32_t last_idr = session->idr_request_seq.load();
-           const int frame_interval_ms =
-               std::max(1, 1000 / std::max(1, params.fps));
-           const size_t mtu = 1400;
-           uint32_t frame_sequence = 0;
-
-           while (true) {
-             auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
-                                std::chrono::steady_clock::now() - start)
-                                .count();
-             if (elapsed >= duration_sec)
-               break;
-
-             // Check for IDR requests
-             uint32_t current_idr = session->idr_request_seq.load();
-             if (current_idr > last_idr) {
-#ifdef HAS_OPENH264
-               if (encoder_ready) {
-                 encoder.force_idr();
+         // H.264 receivers share the session encoder (which also paces
+         // them); MJPEG frames go out exactly as captured. The engine's I/O
+         // threads do the sending, so no thread is spawned per request.
+         svr.engine().adopt(
+             sock, StreamEngine::Framing::Datagram,
+             stream::make_udp_source(session, encoder, udp),
+             [device_id, &sessions](bool) {
+               auto session_opt = sessions.find(device_id);
+               if (session_opt) {
+                 (*session_opt)->client_count.fetch_sub(1);
+                 sessions.release_if_idle(device_id);
                }
-#endif
-               last_idr = current_idr;
-             }
+             });
 
-             if (!session->capture || !session->capture->running()) {
-               std::this_thread::sleep_for(10ms);
-               continue;
-             }
-             if (!session->capture->latest_frame(frame)) {
-               std::this_thread::sleep_for(5ms);
-               continue;
-             }
-
-             const uint8_t *p_data = nullptr;
-             size_t p_size = 0;
-             std::string h264_buf;
-
-             if (params.codec == "mjpeg") {
-               p_data = reinterpret_cast<const uint8_t *>(frame.data());
-               p_size = frame.size();
-             } else if (params.codec == "h264") {
-#ifdef HAS_OPENH264
-               if (!encoder_ready)
-                 break;
-               PixelFormat fmt = session->capture->pixel_format();
-               if (fmt != PixelFormat::YUYV && fmt != PixelFormat::NV12) {
-                 std::this_thread::sleep_for(5ms);
-                 continue;
-               }
-               if (fmt == PixelFormat::YUYV) {
-                 yuyv_to_i420(reinterpret_cast<const uint8_t *>(frame.data()),
-                              params.width, params.height, y, u, v);
-               } else {
-                 const uint8_t *src_y =
-                     reinterpret_cast<const uint8_t *>(frame.data());
-                 const uint8_t *src_uv = src_y + (params.width * params.height);
-                 nv12_to_i420(src_y, src_uv, params.width, params.height,
-                              params.width, params.width, y, u, v);
-               }
-               if (first) {
-                 encoder.force_idr();
-                 first = false;
-               }
-               std::string nal;
-               if (!encoder.encode_i420(y, u, v, nal)) {
-                 std::this_thread::sleep_for(5ms);
-                 continue;
-               }
-               if (!nal.empty()) {
-                 static const char start_code[] = {0x00, 0x00, 0x00, 0x01};
-                 h264_buf.reserve(sizeof(start_code) + nal.size());
-                 h264_buf.append(start_code, sizeof(start_code));
-                 h264_buf.append(nal);
-                 p_data = reinterpret_cast<const uint8_t *>(h264_buf.data());
-                 p_size = h264_buf.size();
-               }
+         res.status = 200;
+         res.set_content("{\"status\":\"udp_stream_started\"}",
+                         "application/json");
 #else
-               break;
+         (void)req;
+         (void)svr;
+         res.status = 503;
+         res.set_content(
+             stream::build_error_json("udp_unavailable",
+                                      "UDP sender supported on Linux only"),
+             "application/json");
 #endif
-             } else {
-               break;
-             }
+       }});
 
-             if (p_size > 0) {
-               size_t max_payload = mtu - sizeof(UdpFrameHeader);
-               size_t offset = 0;
-               uint16_t frag_id = 0;
-               uint16_t num_frags = (p_size + max_payload - 1) / max_payload;
-
-               while (offset < p_size) {
-                 size_t chunk = std::min(max_payload, p_size - offset);
-                 UdpFrameHeader header;
-                 header.frame_id = frame_sequence;
-                 header.frag_id = frag_id++;
-                 header.num_frags = num_frags;
-                 header.data_size = chunk;
-
-                 std::vector<uint8_t> packet(sizeof(header) + chunk);
-                 memcpy(packet.data(), &header, sizeof(header));
-                 memcpy(packet.data() + sizeof(header), p_data + offset, chunk);
-
-                 sendto(sock, packet.data(), packet.size(), 0,
-                        reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
-
-                 session->bytes_sent.fetch_add(packet.size());
-                 offset += chunk;
-               }
-               session->frames_sent.fetch_add(1);
-               frame_sequence++;
-             }
-             session->last_accessed = std::chrono::steady_clock::now();
-             std::this_thread::sleep_for(
-                 std::chrono::milliseconds(frame_interval_ms));
-           }
-           close(sock);
+  // Persistent UDP outputs: receivers (unicast or multicast, IPv4/IPv6)
+  // are added and removed at runtime and all share one encode.
+  api.add_route(
+      {"/stream/{device}/udp",
+       "POST",
+       "Add a receiver to the persistent UDP output (Linux only)",
+       {{"device", ParamType::Device, "video0", "Device ID"},
+        {"target", ParamType::String, "239.0.0.1", "Target or multicast IP"},
+        {"port", ParamType::Int, "5000", "Target Port"},
+        {"ttl", ParamType::Int, "1", "TTL / hop limit"},
+        {"iface", ParamType::String, "", "Multicast interface"},
+        {"mtu", ParamType::Int, "1400", "Datagram size (576-9000)"},
+        {"pace", ParamType::Select, "0", "Pace over frame interval", {"0", "1"}},
+        {"fec", ParamType::Int, "0", "Fragments per XOR parity (0 = off)"},
+        {"ts", ParamType::Select, "0", "Capture time on every datagram",
+         {"0", "1"}},
+        {"w", ParamType::Int, "1280", "Width"},
+        {"h", ParamType::Int, "720", "Height"},
+        {"fps", ParamType::Int, "30", "Framerate"},
+        {"bitrate", ParamType::Int, "2000", "Bitrate (kbps)"},
+        {"quality", ParamType::Int, "80", "JPEG quality (1-100, MJPEG only)"},
+        {"still", ParamType::Int, "0",
+         "Skip unchanged frames: threshold (0 = off)"},
+        {"gop", ParamType::Int, "30", "GOP Size"},
+        {"codec", ParamType::Select, "h264", "Video Codec", {"h264", "mjpeg"}}},
+       [&sessions, &svr, &pick_encoder](const httplib::Request &req,
+                                        httplib::Response &res) {
+#ifdef __linux__
+         if (req.matches.size() < 2) {
+           res.status = 404;
+           return;
+         }
+         std::string device_id = req.matches[1].str();
+         sockaddr_storage addr{};
+         if (!req.has_param("target") || !req.has_param("port") ||
+             !parse_udp_target(req.get_param_value("target"),
+                               std::stoi(req.get_param_value("port")), addr)) {
+           res.status = 400;
+           res.set_content(stream::build_error_json(
+                               "bad_request",
+                               "target (IPv4/IPv6) and port are required"),
+                           "application/json");
+           return;
+         }
+         auto params = stream::parse_params(req);
+         if (params.codec.empty())
+           params.codec = "h264";
+
+         auto session = sessions.get_or_create(device_id, params);
+         session->client_count.fetch_add(1);
+         session->last_accessed = std::chrono::steady_clock::now();
+         auto fail = [&](int status, const std::string &error,
+                         const std::string &details) {
+           res.status = status;
+           res.set_content(stream::build_error_json(error, details),
+                           "application/json");
            session->client_count.fetch_sub(1);
-           sessions.release_if_idle(session->device_id);
-         }).detach();
+           sessions.release_if_idle(device_id);
+         };
+         if (params.codec != session->params.codec) {
+           fail(409, "conflict", kCodecLocked);
+           return;
+         }
+         const bool h264 = params.codec == "h264";
+         if (!h264 && params.codec != "mjpeg") {
+           fail(400, "bad_request", "unsupported codec");
+           return;
+         }
+         if (!session->capture->running()) {
+           if (!session->capture->start(device_id, session->params)) {
+             fail(503, "device_unavailable", "failed to open camera");
+             return;
+           }
+           stream::sync_session_params(*session);
+           session->started = std::chrono::steady_clock::now();
+           session->frames_sent = 0;
+           session->bytes_sent = 0;
+         }
+         if (h264 && !session->encoder->available()) {
+           fail(503, "h264_unavailable",
+                "OpenH264 not enabled and camera has no H.264");
+           return;
+         }
 
+         // Join the running output for this family, or start one. Socket
+         // options (ttl, iface, mtu, pace) are fixed by whoever starts it.
+         const int slot = addr.ss_family == AF_INET6 ? 1 : 0;
+         std::shared_ptr<UdpTargets> targets;
+         bool joined = false;
+         bool duplicate = false;
+         {
+           std::lock_guard<std::mutex> lock(session->udp_mu);
+           auto &output = session->udp_outputs[slot];
+           // add() also refuses once the last receiver has gone: that
+           // output is winding down, so start a new one.
+           if (output && output->add(addr)) {
+             targets = output;
+             joined = true;
+           } else if (output && !output->ended()) {
+             duplicate = true;
+           } else {
+             targets = std::make_shared<UdpTargets>();
+             targets->add(addr);
+             output = targets;
+           }
+         }
+         if (duplicate) {
+           fail(409, "udp_target_exists",
+                "target already receives this output");
+           return;
+         }
+         if (joined) {
+           // The running output already holds the session.
+           session->client_count.fetch_sub(1);
+         } else {
+           std::string error;
+           const int ttl = req.has_param("ttl")
+                               ? std::stoi(req.get_param_value("ttl"))
+                               : 1;
+           int sock = open_udp_output(addr.ss_family, ttl,
+                                      req.get_param_value("iface"), error);
+           if (sock < 0) {
+             {
+               std::lock_guard<std::mutex> lock(session->udp_mu);
+               if (session->udp_outputs[slot] == targets)
+                 session->udp_outputs[slot].reset();
+             }
+             fail(400, "udp_unavailable", error);
+             return;
+           }
+           stream::UdpOptions udp;
+           if (req.has_param("mtu"))
+             udp.mtu = static_cast<size_t>(
+                 std::max(0, std::stoi(req.get_param_value("mtu"))));
+           udp.pace = req.get_param_value("pace") == "1";
+           udp.timestamps = req.get_param_value("ts") == "1";
+           if (req.has_param("fec"))
+             udp.fec = std::stoi(req.get_param_value("fec"));
+           udp.targets = targets;
+           // Joiners get this output's rendition; only its starter picks.
+           auto encoder =
+               h264 ? pick_encoder(req, *session, params) : nullptr;
+           svr.engine().adopt(
+               sock, StreamEngine::Framing::Datagram,
+               stream::make_udp_source(session, encoder, udp),
+               [device_id, &sessions, targets, slot](bool) {
+                 auto session_opt = sessions.find(device_id);
+                 if (!session_opt)
+                   return;
+                 {
+                   std::lock_guard<std::mutex> lock((*session_opt)->udp_mu);
+                   if ((*session_opt)->udp_outputs[slot] == targets)
+                     (*session_opt)->udp_outputs[slot].reset();
+                 }
+                 (*session_opt)->client_count.fetch_sub(1);
+                 sessions.release_if_idle(device_id);
+               });
+         }
          res.status = 200;
-         res.set_content("{\"status\":\"udp_stream_started\"}",
+         res.set_content("{\"status\":\"udp_target_added\",\"targets\":" +
+                             targets->to_json() + "}",
                          "application/json");
 #else
          (void)req;
+         (void)sessions;
+         (void)svr;
          res.status = 503;
          res.set_content(
              stream::build_error_json("udp_unavailable",
@@ -563,14 +1293,103 @@ int main(int argc, char *argv[]) {
 #endif
        }});
 
-  // Feedback route (IDR Request)
+  api.add_route(
+      {"/stream/{device}/udp",
+       "DELETE",
+       "Remove a receiver from the persistent UDP output",
+       {{"device", ParamType::Device, "video0", "Device ID"},
+        {"target", ParamType::String, "239.0.0.1", "Target or multicast IP"},
+        {"port", ParamType::Int, "5000", "Target Port"}},
+       [&sessions](const httplib::Request &req, httplib::Response &res) {
+         if (req.matches.size() < 2) {
+           res.status = 404;
+           return;
+         }
+         sockaddr_storage addr{};
+         if (!req.has_param("target") || !req.has_param("port") ||
+             !parse_udp_target(req.get_param_value("target"),
+                               std::stoi(req.get_param_value("port")), addr)) {
+           res.status = 400;
+           res.set_content(stream::build_error_json(
+                               "bad_request",
+                               "target (IPv4/IPv6) and port are required"),
+                           "application/json");
+           return;
+         }
+         auto session_opt = sessions.find(req.matches[1].str());
+         std::shared_ptr<UdpTargets> targets;
+         if (session_opt) {
+           auto &session = *session_opt;
+           std::lock_guard<std::mutex> lock(session->udp_mu);
+           targets = session->udp_outputs[addr.ss_family == AF_INET6 ? 1 : 0];
+         }
+         if (!targets || !targets->remove(addr)) {
+           res.status = 404;
+           res.set_content(
+               stream::build_error_json("not_found", "no such UDP target"),
+               "application/json");
+           return;
+         }
+         // Removing the last receiver ends the output; the engine notices on
+         // its next pull and releases the session.
+         res.status = 200;
+         res.set_content("{\"status\":\"udp_target_removed\",\"targets\":" +
+                             targets->to_json() + "}",
+                         "application/json");
+       }});
+
+  api.add_route(
+      {"/stream/{device}/udp",
+       "GET",
+       "List persistent UDP receivers",
+       {{"device", ParamType::Device, "video0", "Device ID"}},
+       [&sessions](const httplib::Request &req, httplib::Response &res) {
+         if (req.matches.size() < 2) {
+           res.status = 404;
+           return;
+         }
+         std::vector<std::string> lists;
+         auto session_opt = sessions.find(req.matches[1].str());
+         if (session_opt) {
+           auto &session = *session_opt;
+           std::lock_guard<std::mutex> lock(session->udp_mu);
+           for (const auto &output : session->udp_outputs) {
+             if (output && !output->ended())
+               lists.push_back(output->to_json());
+           }
+         }
+         std::string targets = "[";
+         for (const auto &list : lists) {
+           if (list.size() > 2)
+             targets += (targets.size() > 1 ? "," : "") +
+                        list.substr(1, list.size() - 2);
+         }
+         targets += "]";
+         res.status = 200;
+         res.set_content("{\"targets\":" + targets + "}", "application/json");
+       }});
+
+  // Feedback route (IDR request, UDP NACK)
   api.add_route(
       {"/stream/{device}/feedback",
        "POST",
        "Send feedback (e.g. request IDR)",
        {{"device", ParamType::Device, "video0", "Device ID"},
-        {"type", ParamType::Select, "idr", "Feedback Type", {"idr"}}},
-       [&sessions](const httplib::Request &req, httplib::Response &res) {
+        {"type", ParamType::Select, "idr", "Feedback Type",
+         {"idr", "nack", "report"}},
+        {"frame", ParamType::Int, "0", "NACK: UDP frame_id"},
+        {"frags", ParamType::String, "", "NACK: missing frag_ids (1,4,5)"},
+        {"target", ParamType::String, "", "NACK: receiver IP (if persistent)"},
+        {"port", ParamType::Int, "5000", "NACK: receiver port"},
+        {"loss", ParamType::String, "0", "Report: loss fraction (0-1)"},
+        {"jitter", ParamType::String, "0", "Report: jitter (ms)"},
+        {"rate", ParamType::Int, "0", "Report: receive rate (kbps)"},
+        {"id", ParamType::String, "", "Report: receiver ID"},
+        {"w", ParamType::Int, "", "Report: rendition width"},
+        {"h", ParamType::Int, "", "Report: rendition height"},
+        {"fps", ParamType::Int, "", "Report: rendition framerate"}},
+       [&sessions, &pick_encoder](const httplib::Request &req,
+                                  httplib::Response &res) {
          if (req.matches.size() < 2) {
            res.status = 404;
            return;
@@ -587,10 +1406,104 @@ int main(int argc, char *argv[]) {
          auto session = *session_opt;
          std::string type = req.get_param_value("type");
          if (type == "idr") {
-           session->idr_request_seq.fetch_add(1);
+           for (const auto &encoder : SessionManager::encoders(*session))
+             encoder->request_idr();
            res.status = 200;
            res.set_content("{\"status\":\"idr_requested\"}",
                            "application/json");
+         } else if (type == "report") {
+           // One congestion-control input per receiver; the encoder
+           // follows the weakest of them.
+           ReceiverReport report;
+           try {
+             if (req.has_param("loss"))
+               report.loss = std::stod(req.get_param_value("loss"));
+             if (req.has_param("jitter"))
+               report.jitter_ms = std::stod(req.get_param_value("jitter"));
+             if (req.has_param("rate"))
+               report.receive_kbps = std::stoi(req.get_param_value("rate"));
+           } catch (const std::exception &) {
+             res.status = 400;
+             res.set_content(stream::build_error_json(
+                                 "bad_request", "loss, jitter and rate must "
+                                                "be numbers"),
+                             "application/json");
+             return;
+           }
+           std::string receiver = req.get_param_value("id");
+           if (receiver.empty())
+             receiver = req.remote_addr;
+           // Receivers of a rendition name it with w/h/fps.
+           auto encoder = session->encoder;
+           if (req.has_param("w") || req.has_param("h") ||
+               req.has_param("fps"))
+             encoder = pick_encoder(req, *session, stream::parse_params(req),
+                                    false);
+           encoder->report(receiver, report);
+           const RateTarget target = encoder->rate_target();
+           res.status = 200;
+           res.set_content("{\"status\":\"report_accepted\","
+                           "\"target_bitrate_kbps\":" +
+                               std::to_string(target.kbps) +
+                               ",\"target_fps\":" +
+                               std::to_string(target.fps) + "}",
+                           "application/json");
+         } else if (type == "nack") {
+           UdpNacks::Request nack;
+           try {
+             nack.frame_id =
+                 static_cast<uint32_t>(std::stoul(req.get_param_value("frame")));
+             std::stringstream list(req.get_param_value("frags"));
+             std::string item;
+             while (std::getline(list, item, ','))
+               if (!item.empty())
+                 nack.frags.push_back(static_cast<uint16_t>(std::stoi(item)));
+           } catch (const std::exception &) {
+             nack.frags.clear();
+           }
+           if (nack.frags.empty()) {
+             res.status = 400;
+             res.set_content(stream::build_error_json(
+                                 "bad_request", "frame and frags are required"),
+                             "application/json");
+             return;
+           }
+           if (!req.get_param_value("target").empty()) {
+             nack.has_target = parse_udp_target(
+                 req.get_param_value("target"),
+                 req.has_param("port") ? std::stoi(req.get_param_value("port"))
+                                       : 0,
+                 nack.target);
+             if (!nack.has_target) {
+               res.status = 400;
+               res.set_content(stream::build_error_json(
+                                   "bad_request", "target must be an IP address"),
+                               "application/json");
+               return;
+             }
+           }
+           // Every H.264 UDP sender of the session gets it; only the one
+           // that reaches this receiver (and still has the frame) answers.
+           std::vector<std::shared_ptr<UdpNacks>> inboxes;
+           {
+             std::lock_guard<std::mutex> lock(session->udp_mu);
+             for (const auto &weak : session->udp_nacks)
+               if (auto inbox = weak.lock())
+                 inboxes.push_back(std::move(inbox));
+           }
+           if (inboxes.empty()) {
+             res.status = 404;
+             res.set_content(stream::build_error_json(
+                                 "not_found", "no H.264 UDP sender active"),
+                             "application/json");
+             return;
+           }
+           for (auto &inbox : inboxes)
+             inbox->push(nack);
+           res.status = 200;
+           res.set_content("{\"status\":\"nack_queued\",\"senders\":" +
+                               std::to_string(inboxes.size()) + "}",
+                           "application/json");
          } else {
            res.status = 400;
            res.set_content(
@@ -0,0 +1,122 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+
+namespace {
+// Exported bucket bounds: every power of two from 64 µs to ~67 s. They sit
+// on bucket edges, so the cumulative counts are exact.
+constexpr int kFirstExportedOctave = 6;
+constexpr int kLastExportedOctave = 26;
+
+std::string seconds(uint64_t us) {
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%.6f", static_cast<double>(us) / 1e6);
+  return buf;
+}
+} // namespace
+
+int LatencyHistogram::bucket_for(uint64_t us) {
+  if (us < kSubBuckets)
+    return static_cast<int>(us);
+  // [2^k, 2^(k+1)) splits into kSubBuckets equal parts for k >= 2.
+  const int k = std::bit_width(us) - 1;
+  const int index =
+      kSubBuckets * (k - 1) + static_cast<int>((us >> (k - 2)) & 3);
+  return std::min(index, kBuckets - 1);
+}
+
+uint64_t LatencyHistogram::bucket_floor(int index) {
+  if (index < kSubBuckets)
+    return static_cast<uint64_t>(index);
+  const int k = index / kSubBuckets + 1;
+  return static_cast<uint64_t>(kSubBuckets + index % kSubBuckets) << (k - 2);
+}
+
+void LatencyHistogram::record(std::chrono::steady_clock::duration d) {
+  const auto us =
+      std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+  const uint64_t value = us > 0 ? static_cast<uint64_t>(us) : 0;
+  buckets_[bucket_for(value)].fetch_add(1, std::memory_order_relaxed);
+  sum_us_.fetch_add(value, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::record(std::chrono::steady_clock::time_point from,
+                              std::chrono::steady_clock::time_point to) {
+  if (from == std::chrono::steady_clock::time_point{} || to < from)
+    return;
+  record(to - from);
+}
+
+uint64_t LatencyHistogram::count() const {
+  uint64_t total = 0;
+  for (const auto &bucket : buckets_)
+    total += bucket.load(std::memory_order_relaxed);
+  return total;
+}
+
+void LatencyHistogram::write_prometheus(std::string &out,
+                                        const std::string &name,
+                                        const std::string &labels) const {
+  const std::string sep = labels.empty() ? "" : ",";
+  uint64_t cumulative = 0;
+  int index = 0;
+  for (int octave = kFirstExportedOctave; octave <= kLastExportedOctave;
+       ++octave) {
+    const uint64_t bound = uint64_t{1} << octave;
+    for (; index < kBuckets && bucket_floor(index) < bound; ++index)
+      cumulative += buckets_[index].load(std::memory_order_relaxed);
+    out += name + "_bucket{" + labels + sep + "le=\"" + seconds(bound) +
+           "\"} " + std::to_string(cumulative) + "\n";
+  }
+  for (; index < kBuckets; ++index)
+    cumulative += buckets_[index].load(std::memory_order_relaxed);
+  out += name + "_bucket{" + labels + sep + "le=\"+Inf\"} " +
+         std::to_string(cumulative) + "\n";
+  out += name + "_sum{" + labels + "} " +
+         seconds(sum_us_.load(std::memory_order_relaxed)) + "\n";
+  out += name + "_count{" + labels + "} " + std::to_string(cumulative) + "\n";
+}
+
+std::shared_ptr<ViewerMetrics>
+SessionMetrics::add_viewer(const std::string &kind) {
+  auto viewer = std::make_shared<ViewerMetrics>();
+  viewer->kind = kind;
+  std::lock_guard<std::mutex> lock(mu_);
+  viewer->id = next_id_++;
+  viewers_.erase(std::remove_if(viewers_.begin(), viewers_.end(),
+                                [](const auto &w) { return w.expired(); }),
+                 viewers_.end());
+  viewers_.push_back(viewer);
+  return viewer;
+}
+
+std::vector<std::shared_ptr<ViewerMetrics>> SessionMetrics::viewers() {
+  std::vector<std::shared_ptr<ViewerMetrics>> out;
+  std::lock_guard<std::mutex> lock(mu_);
+  for (const auto &weak : viewers_)
+    if (auto viewer = weak.lock())
+      out.push_back(std::move(viewer));
+  return out;
+}
+
+void write_prometheus_family(std::string &out, const std::string &name,
+                             const char *type, const char *help) {
+  out += "# HELP " + name + " " + help + "\n";
+  out += "# TYPE " + name + " " + type + "\n";
+}
+
+std::string prometheus_label(const std::string &value) {
+  std::string out = "\"";
+  for (char c : value) {
+    if (c == '\\' || c == '"')
+      out += '\\';
+    if (c == '\n') {
+      out += "\\n";
+      continue;
+    }
+    out += c;
+  }
+  return out + "\"";
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Latency histogram with HDR-style log-linear buckets: four per power of two
+// from 1 µs to about two minutes, so every sample is kept to within 25% for
+// one relaxed atomic add. Recording never blocks, neither other recorders
+// nor the /metrics exporter.
+class LatencyHistogram {
+public:
+  static constexpr int kSubBuckets = 4;
+  static constexpr int kBuckets = kSubBuckets * 26; // up to 2^27 µs
+
+  void record(std::chrono::steady_clock::duration d);
+  // Span from `from` to `to`; skipped when `from` is unset or later.
+  void record(std::chrono::steady_clock::time_point from,
+              std::chrono::steady_clock::time_point to);
+  uint64_t count() const;
+
+  // Appends the histogram in Prometheus text format (seconds), with
+  // `labels` (`key="value",...`, possibly empty) on every sample. The
+  // family's HELP/TYPE lines are the caller's.
+  void write_prometheus(std::string &out, const std::string &name,
+                        const std::string &labels) const;
+
+  static int bucket_for(uint64_t us);
+  // Smallest value (µs) that lands in bucket `index`.
+  static uint64_t bucket_floor(int index);
+
+private:
+  std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+  std::atomic<uint64_t> sum_us_{0};
+};
+
+// Capture thread: driver timestamp to dequeue, and frames the driver lost
+// (sequence gaps) or delivered twice (repeated timestamps).
+struct CaptureMetrics {
+  LatencyHistogram dequeue;
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<uint64_t> duplicate{0};
+};
+
+// One encoder thread (a session's or a rendition's).
+struct EncodeMetrics {
+  LatencyHistogram convert; // pixel format conversion and scaling
+  LatencyHistogram encode;
+};
+
+// What happens to frames past the encoder (or the capture, for MJPEG), for
+// one viewer or summed over all of a session's viewers.
+struct DeliveryMetrics {
+  LatencyHistogram queue; // published until the viewer takes it
+  LatencyHistogram mux;   // taken until its unit is built (framing, fMP4)
+  LatencyHistogram write; // built until the last byte reaches the kernel
+  LatencyHistogram total; // capture timestamp to the last byte written
+  std::atomic<uint64_t> frames{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> dropped{0};
+};
+
+struct ViewerMetrics {
+  uint64_t id = 0;
+  std::string kind; // mjpeg | h264 | fmp4 | ws | udp
+  DeliveryMetrics delivery;
+};
+
+// Per-session delivery totals plus the live viewers' own figures, which
+// disappear with the viewer.
+class SessionMetrics {
+public:
+  DeliveryMetrics delivery;
+
+  std::shared_ptr<ViewerMetrics> add_viewer(const std::string &kind);
+  std::vector<std::shared_ptr<ViewerMetrics>> viewers();
+
+private:
+  std::mutex mu_;
+  std::vector<std::weak_ptr<ViewerMetrics>> viewers_;
+  uint64_t next_id_ = 1;
+};
+
+// HELP/TYPE header of a metric family.
+void write_prometheus_family(std::string &out, const std::string &name,
+                             const char *type, const char *help);
+// `value` quoted and escaped for a Prometheus label.
+std::string prometheus_label(const std::string &value);
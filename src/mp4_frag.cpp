@@ -44,10 +44,75 @@ void append_version_flags(std::string& out, uint8_t version, uint32_t flags) {
   out.push_back(static_cast<char>(flags & 0xFF));
 }
 
+void put_be32(char* dst, uint32_t v) {
+  dst[0] = static_cast<char>((v >> 24) & 0xFF);
+  dst[1] = static_cast<char>((v >> 16) & 0xFF);
+  dst[2] = static_cast<char>((v >> 8) & 0xFF);
+  dst[3] = static_cast<char>(v & 0xFF);
+}
+
+// Byte offsets of the patched fields in the fragment template:
+// moof(8) { mfhd(16) traf(8) { tfhd(16) tfdt(16) trun(32) } } mdat(8).
+constexpr size_t kMfhdSequence = 20;
+constexpr size_t kTfdtDecodeTime = 60;
+constexpr size_t kTrunDuration = 84;
+constexpr size_t kTrunSize = 88;
+constexpr size_t kTrunFlags = 92;
+constexpr size_t kMdatSize = 96;
+
+// One-sample moof + mdat header with the per-fragment fields zeroed.
+std::string build_fragment_template() {
+  std::string mfhd;
+  {
+    std::string p;
+    append_version_flags(p, 0, 0);
+    append_be32(p, 0); // sequence number
+    append_box(mfhd, p, "mfhd");
+  }
+
+  std::string tfhd;
+  {
+    std::string p;
+    append_version_flags(p, 0, 0x020000); // default-base-is-moof
+    append_be32(p, 1); // track id
+    append_box(tfhd, p, "tfhd");
+  }
+
+  std::string tfdt;
+  {
+    std::string p;
+    append_version_flags(p, 0, 0);
+    append_be32(p, 0); // base decode time
+    append_box(tfdt, p, "tfdt");
+  }
+
+  std::string trun;
+  {
+    std::string p;
+    append_version_flags(p, 0, 0x000701);
+    append_be32(p, 1); // sample count
+    append_be32(p, static_cast<uint32_t>(
+                       Mp4Fragmenter::kFragmentHeaderSize)); // data offset
+    append_be32(p, 0); // duration
+    append_be32(p, 0); // size
+    append_be32(p, 0); // flags
+    append_box(trun, p, "trun");
+  }
+
+  std::string traf;
+  append_box(traf, tfhd + tfdt + trun, "traf");
+  std::string out;
+  append_box(out, mfhd + traf, "moof");
+  append_be32(out, 8); // mdat size
+  append_tag(out, "mdat");
+  return out;
+}
+
 } // namespace
 
 Mp4Fragmenter::Mp4Fragmenter(int width, int height, int fps, const std::vector<uint8_t>& sps, const std::vector<uint8_t>& pps)
-    : width_(width), height_(height), fps_(fps), timescale_(90000), sps_(sps), pps_(pps) {}
+    : width_(width), height_(height), fps_(fps), timescale_(90000), sps_(sps), pps_(pps),
+      fragment_template_(build_fragment_template()) {}
 
 std::string Mp4Fragmenter::build_init_segment() const {
   std::string out;
@@ -252,75 +317,26 @@ std::string Mp4Fragmenter::build_init_segment() const {
   return out;
 }
 
-std::string Mp4Fragmenter::build_fragment(const std::vector<uint8_t>& avcc_sample, uint32_t seq,
+std::string Mp4Fragmenter::build_fragment(const std::string& avcc_sample, uint32_t seq,
                                           uint64_t base_decode_time, uint32_t sample_duration,
                                           bool keyframe) const {
-  // Build sub-boxes
-  std::string mfhd;
-  {
-    std::string p;
-    append_version_flags(p, 0, 0);
-    append_be32(p, seq);
-    append_box(mfhd, p, "mfhd");
-  }
-
-  std::string tfhd;
-  {
-    std::string p;
-    append_version_flags(p, 0, 0x020000); // default-base-is-moof
-    append_be32(p, 1); // track id
-    append_box(tfhd, p, "tfhd");
-  }
-
-  std::string tfdt;
-  {
-    std::string p;
-    append_version_flags(p, 0, 0);
-    append_be32(p, static_cast<uint32_t>(base_decode_time));
-    append_box(tfdt, p, "tfdt");
-  }
-
-  // Precompute sizes to set trun data-offset (traf/moof include headers).
-  uint32_t trun_payload =
-      4 /*ver/flags*/ + 4 /*count*/ + 4 /*offset*/ + 4 /*duration*/ +
-      4 /*size*/ + 4 /*flags*/;
-  uint32_t trun_size = trun_payload + 8;
-  uint32_t traf_size =
-      static_cast<uint32_t>(tfhd.size() + tfdt.size() + trun_size + 8);
-  uint32_t moof_size =
-      static_cast<uint32_t>(mfhd.size() + traf_size + 8);
-  uint32_t data_offset = moof_size + 8; // mdat header
-
-  std::string trun;
-  {
-    std::string p;
-    append_version_flags(p, 0, 0x000701);
-    append_be32(p, 1);
-    append_be32(p, data_offset);
-    append_be32(p, sample_duration);
-    append_be32(p, static_cast<uint32_t>(avcc_sample.size()));
-    uint32_t flags = keyframe ? 0x02000000 : 0x01010000;
-    append_be32(p, flags);
-    append_box(trun, p, "trun");
-  }
-
-  std::string traf_payload;
-  traf_payload.append(tfhd);
-  traf_payload.append(tfdt);
-  traf_payload.append(trun);
-  std::string traf;
-  append_box(traf, traf_payload, "traf");
-
-  std::string moof_payload;
-  moof_payload.append(mfhd);
-  moof_payload.append(traf);
-  std::string moof;
-  append_box(moof, moof_payload, "moof");
-
   std::string out;
-  out.append(moof);
-  append_be32(out, static_cast<uint32_t>(8 + avcc_sample.size()));
-  append_tag(out, "mdat");
-  out.append(reinterpret_cast<const char*>(avcc_sample.data()), avcc_sample.size());
+  out.reserve(kFragmentHeaderSize + avcc_sample.size());
+  write_fragment_header(out, seq, base_decode_time, sample_duration,
+                        static_cast<uint32_t>(avcc_sample.size()), keyframe);
+  out.append(avcc_sample);
   return out;
 }
+
+void Mp4Fragmenter::write_fragment_header(std::string& out, uint32_t seq,
+                                          uint64_t base_decode_time, uint32_t sample_duration,
+                                          uint32_t sample_size, bool keyframe) const {
+  out.assign(fragment_template_);
+  char* p = out.data();
+  put_be32(p + kMfhdSequence, seq);
+  put_be32(p + kTfdtDecodeTime, static_cast<uint32_t>(base_decode_time));
+  put_be32(p + kTrunDuration, sample_duration);
+  put_be32(p + kTrunSize, sample_size);
+  put_be32(p + kTrunFlags, keyframe ? 0x02000000 : 0x01010000);
+  put_be32(p + kMdatSize, 8 + sample_size);
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include <cstddef>
 #include <cstdint>
 #include <string>
 #include <vector>
@@ -13,10 +14,19 @@ public:
 
   // Build one fragment (moof+mdat) for a single sample.
   // pts and duration are in timescale units (default timescale 90000).
-  std::string build_fragment(const std::vector<uint8_t>& avcc_sample, uint32_t sequence_number,
+  std::string build_fragment(const std::string& avcc_sample, uint32_t sequence_number,
                              uint64_t base_decode_time, uint32_t sample_duration,
                              bool keyframe) const;
 
+  // moof + mdat header for one sample of `sample_size` bytes, which the
+  // caller sends right after it. The boxes are a fixed-size template built
+  // once; only the per-fragment fields are patched, so this never allocates
+  // once `out` has capacity.
+  static constexpr size_t kFragmentHeaderSize = 104;
+  void write_fragment_header(std::string& out, uint32_t sequence_number,
+                             uint64_t base_decode_time, uint32_t sample_duration,
+                             uint32_t sample_size, bool keyframe) const;
+
   uint32_t timescale() const { return timescale_; }
 
 private:
@@ -26,5 +36,6 @@ private:
   uint32_t timescale_;
   std::vector<uint8_t> sps_;
   std::vector<uint8_t> pps_;
+  std::string fragment_template_;
 };
 
@@ -0,0 +1,119 @@
+#include "rate_control.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std::chrono_literals;
+
+namespace {
+// Loss above this is congestion; below the lower bound the link is clean.
+constexpr double kLossHigh = 0.10;
+constexpr double kLossLow = 0.02;
+// Probe up by 8% (plus a little, so low rates recover) at most once a
+// second; back off to 85% of what actually got through.
+constexpr double kIncrease = 1.08;
+constexpr int kIncreaseStepKbps = 16;
+constexpr double kDecrease = 0.85;
+constexpr auto kIncreaseInterval = 1s;
+constexpr auto kReceiverTimeout = 5s;
+// Bits per pixel per frame below which fewer, better frames win. Around
+// 0.02 a Baseline picture degrades visibly.
+constexpr double kMinBitsPerPixel = 0.02;
+
+// Estimates never back off below this; never above the cap itself.
+int floor_for(int max_kbps) {
+  return std::min(max_kbps, std::max(64, max_kbps / 10));
+}
+} // namespace
+
+RateController::RateController(int max_kbps, int max_fps, int width,
+                               int height)
+    : max_kbps_(std::max(1, max_kbps)), min_kbps_(floor_for(max_kbps_)),
+      max_fps_(std::max(1, max_fps)), min_fps_(std::max(1, max_fps_ / 4)),
+      pixels_(std::max(1.0, static_cast<double>(width) * height)),
+      target_{max_kbps_, max_fps_} {}
+
+bool RateController::on_report(const std::string &receiver,
+                               const ReceiverReport &report,
+                               std::chrono::steady_clock::time_point now) {
+  auto [it, added] = receivers_.try_emplace(receiver);
+  Receiver &r = it->second;
+  if (added) {
+    r.estimate_kbps = target_.kbps;
+    r.last_increase = now;
+  }
+  r.last_report = now;
+
+  const double loss = std::clamp(report.loss, 0.0, 1.0);
+  // Delay-based overuse: jitter well above its own average means queues
+  // are building somewhere on the path, usually before loss shows up.
+  const bool overuse = r.jitter_avg_ms >= 0.0 &&
+                       report.jitter_ms > 2.0 * r.jitter_avg_ms + 5.0;
+  r.jitter_avg_ms = r.jitter_avg_ms < 0.0
+                        ? report.jitter_ms
+                        : 0.9 * r.jitter_avg_ms + 0.1 * report.jitter_ms;
+
+  if (loss > kLossHigh || overuse) {
+    double next = r.estimate_kbps;
+    if (loss > kLossHigh)
+      next *= 1.0 - 0.5 * loss;
+    if (report.receive_kbps > 0)
+      next = std::min(next, report.receive_kbps * kDecrease);
+    else if (overuse)
+      next *= kDecrease;
+    r.estimate_kbps = static_cast<int>(next);
+    r.last_increase = now; // hold off probing right after a back-off
+  } else if (loss < kLossLow && now - r.last_increase >= kIncreaseInterval) {
+    double next = r.estimate_kbps * kIncrease + kIncreaseStepKbps;
+    // Do not run far ahead of what the receiver actually sees.
+    if (report.receive_kbps > 0)
+      next = std::min(next, report.receive_kbps * 1.5 + kIncreaseStepKbps);
+    r.estimate_kbps = std::max(r.estimate_kbps, static_cast<int>(next));
+    r.last_increase = now;
+  }
+  r.estimate_kbps = std::clamp(r.estimate_kbps, min_kbps_, max_kbps_);
+  return retarget();
+}
+
+bool RateController::expire(std::chrono::steady_clock::time_point now) {
+  bool removed = false;
+  for (auto it = receivers_.begin(); it != receivers_.end();) {
+    if (now - it->second.last_report > kReceiverTimeout) {
+      it = receivers_.erase(it);
+      removed = true;
+    } else {
+      ++it;
+    }
+  }
+  return removed && retarget();
+}
+
+void RateController::set_max_kbps(int kbps) {
+  if (kbps <= 0)
+    return;
+  max_kbps_ = kbps;
+  min_kbps_ = floor_for(max_kbps_);
+  for (auto &entry : receivers_)
+    entry.second.estimate_kbps =
+        std::clamp(entry.second.estimate_kbps, min_kbps_, max_kbps_);
+  retarget();
+}
+
+bool RateController::retarget() {
+  int kbps = max_kbps_;
+  for (const auto &entry : receivers_)
+    kbps = std::min(kbps, entry.second.estimate_kbps);
+
+  int fps = max_fps_;
+  const double affordable = kbps * 1000.0 / (pixels_ * kMinBitsPerPixel);
+  if (affordable < max_fps_) {
+    fps = std::clamp(static_cast<int>(affordable), min_fps_, max_fps_);
+    // Hysteresis: small wobbles in the estimate keep the current rate.
+    if (std::abs(fps - target_.fps) < 2 && target_.fps < max_fps_)
+      fps = target_.fps;
+  }
+
+  const bool changed = kbps != target_.kbps || fps != target_.fps;
+  target_ = {kbps, fps};
+  return changed;
+}
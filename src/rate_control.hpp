@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <string>
+
+// What a receiver measured over its last report interval.
+struct ReceiverReport {
+  double loss = 0.0;     // fraction of packets/frames lost (0..1)
+  double jitter_ms = 0.0; // interarrival jitter
+  int receive_kbps = 0;  // goodput; 0 = not measured
+};
+
+struct RateTarget {
+  int kbps = 0;
+  int fps = 0;
+};
+
+// Receiver-driven congestion control for one encoder. Each receiver gets a
+// loss/delay-based estimate (back off on loss or rising jitter, probe up
+// slowly while clean) and the encoder follows the weakest active receiver.
+// Once the bitrate no longer buys an acceptable picture at full rate, the
+// frame rate is lowered instead, down to a quarter of the nominal fps.
+// Not thread-safe; the owner serialises calls.
+class RateController {
+public:
+  RateController(int max_kbps, int max_fps, int width, int height);
+
+  // Folds in one report; true if the target changed.
+  bool on_report(const std::string &receiver, const ReceiverReport &report,
+                 std::chrono::steady_clock::time_point now);
+  // Drops receivers that stopped reporting; true if the target changed.
+  bool expire(std::chrono::steady_clock::time_point now);
+  // New ceiling (an explicit bitrate request); estimates are clamped to it.
+  void set_max_kbps(int kbps);
+  RateTarget target() const { return target_; }
+  bool active() const { return !receivers_.empty(); }
+
+private:
+  struct Receiver {
+    int estimate_kbps = 0;
+    double jitter_avg_ms = -1.0; // < 0 until the first report
+    std::chrono::steady_clock::time_point last_report;
+    std::chrono::steady_clock::time_point last_increase;
+  };
+
+  bool retarget();
+
+  int max_kbps_;
+  int min_kbps_;
+  const int max_fps_;
+  const int min_fps_;
+  const double pixels_;
+  std::map<std::string, Receiver> receivers_;
+  RateTarget target_;
+};
@@ -0,0 +1,271 @@
+#include "recorder.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <iostream>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "capture_v4l2.hpp"
+#include "mp4_frag.hpp"
+#include "session_encoder.hpp"
+#include "stream_utils.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+bool write_all(int fd, const std::string &data) {
+  size_t off = 0;
+  while (off < data.size()) {
+    const ssize_t n = ::write(fd, data.data() + off, data.size() - off);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    off += static_cast<size_t>(n);
+  }
+  return true;
+}
+
+// Creates a new recording and reserves `reserve` bytes for it, so extending
+// the file never waits on block allocation. Never replaces a file: names
+// only go down to the second, and a file cut short by a full queue is
+// followed by the next one at once, so a taken name gets a -1, -2, ...
+// suffix and `path` is updated to the one used.
+int open_recording(std::string &path, uint64_t reserve) {
+  const std::string stem = path.substr(0, path.size() - 4); // minus ".mp4"
+  int fd = -1;
+  for (int n = 1; n <= 100; ++n) {
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd >= 0 || errno != EEXIST)
+      break;
+    path = stem + "-" + std::to_string(n) + ".mp4";
+  }
+  if (fd < 0) {
+    std::cerr << "Recorder: cannot create " << path << ": "
+              << std::strerror(errno) << "\n";
+    return -1;
+  }
+#ifdef __linux__
+  // Beyond EOF: the file's size still tracks what was written.
+  (void)::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0,
+                    static_cast<off_t>(reserve));
+#else
+  (void)reserve;
+#endif
+  return fd;
+}
+
+void close_recording(int fd, uint64_t written) {
+  if (fd < 0)
+    return;
+  // Returns the unused part of the reservation.
+  (void)::ftruncate(fd, static_cast<off_t>(written));
+  ::close(fd);
+}
+} // namespace
+
+Recorder::Recorder(std::string device_id, std::shared_ptr<CaptureV4L2> capture,
+                   std::shared_ptr<SessionEncoder> encoder,
+                   const CaptureParams &params, const RecordOptions &options)
+    : device_id_(std::move(device_id)), capture_(std::move(capture)),
+      encoder_(std::move(encoder)), params_(params), options_(options) {
+  std::error_code ec;
+  std::filesystem::create_directories(options_.dir, ec);
+  if (ec)
+    std::cerr << "Recorder " << device_id_ << ": cannot create "
+              << options_.dir << ": " << ec.message() << "\n";
+  writer_ = std::thread([this] { write_loop(); });
+  mux_ = std::thread([this] { mux_loop(); });
+}
+
+Recorder::~Recorder() {
+  stop_mux_ = true;
+  if (mux_.joinable())
+    mux_.join();
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  if (writer_.joinable())
+    writer_.join();
+}
+
+std::string Recorder::current_file() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return current_;
+}
+
+std::string Recorder::next_path() const {
+  std::string name = device_id_;
+  for (char &c : name)
+    if (!std::isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_')
+      c = '_';
+  const std::time_t now = std::time(nullptr);
+  std::tm utc{};
+  gmtime_r(&now, &utc);
+  char stamp[32];
+  std::strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &utc);
+  return options_.dir + "/" + name + "-" + stamp + ".mp4";
+}
+
+bool Recorder::flush_batch() {
+  const size_t size = batch_.data.size();
+  bool queued = false;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (queued_bytes_ + size <= kMaxQueued) {
+      queued_bytes_ += size;
+      queue_.push_back(std::move(batch_));
+      queued = true;
+    }
+  }
+  batch_ = Batch{};
+  if (queued) {
+    cv_.notify_one();
+    return true;
+  }
+  dropped_bytes_ += size;
+  std::cerr << "Recorder " << device_id_ << ": disk behind, dropped " << size
+            << " bytes; resuming at the next IDR\n";
+  return false;
+}
+
+void Recorder::mux_loop() {
+  auto sub = encoder_->subscribe();
+  std::unique_ptr<Mp4Fragmenter> mux; // null: waiting for an IDR
+  std::unique_ptr<stream::MediaClock> clock; // per file, from zero
+  std::string header;
+  uint32_t seqno = 1;
+  const auto file_length =
+      std::chrono::seconds(std::max(10, options_.file_seconds));
+  auto file_started = std::chrono::steady_clock::now();
+  auto flushed = file_started;
+  while (!stop_mux_) {
+    auto frame = sub->pop(100ms);
+    const auto now = std::chrono::steady_clock::now();
+    if (!frame) {
+      if (sub->closed())
+        break;
+      if (!batch_.data.empty() && now - flushed >= 1s) {
+        if (!flush_batch())
+          mux.reset();
+        flushed = now;
+      }
+      continue;
+    }
+    if (frame->keyframe && (!mux || now - file_started >= file_length)) {
+      std::vector<uint8_t> sps;
+      std::vector<uint8_t> pps;
+      if (!encoder_->parameter_sets(sps, pps))
+        continue;
+      int width = params_.width;
+      int height = params_.height;
+      stream::sps_dimensions(sps, width, height);
+      const int fps =
+          capture_ && capture_->fps() > 0 ? capture_->fps() : params_.fps;
+      if (mux && !batch_.data.empty() && !flush_batch()) {
+        mux.reset();
+        continue;
+      }
+      mux = std::make_unique<Mp4Fragmenter>(width, height, fps, sps, pps);
+      clock = std::make_unique<stream::MediaClock>(fps);
+      seqno = 1;
+      file_started = now;
+      batch_.path = next_path();
+      batch_.data = mux->build_init_segment();
+      batch_.data.reserve(kBatch + (64 << 10));
+    }
+    if (!mux)
+      continue;
+    const std::string &avcc = stream::frame_avcc(*frame);
+    uint32_t duration = 0;
+    const uint64_t decode_time = clock->stamp(frame->captured_at, duration);
+    mux->write_fragment_header(header, seqno++, decode_time, duration,
+                               static_cast<uint32_t>(avcc.size()),
+                               frame->keyframe);
+    batch_.data += header;
+    batch_.data += avcc;
+    if (batch_.data.size() >= kBatch || now - flushed >= 1s) {
+      if (!flush_batch())
+        mux.reset();
+      flushed = now;
+    }
+  }
+  encoder_->unsubscribe(sub);
+  if (!batch_.data.empty())
+    flush_batch();
+}
+
+void Recorder::write_loop() {
+  int fd = -1;
+  uint64_t written = 0;
+  uint64_t synced = 0;
+  uint64_t advised = 0; // dropped from the page cache up to here
+  // Room for a whole file at the requested bitrate, plus a quarter.
+  const uint64_t reserve = std::clamp<uint64_t>(
+      static_cast<uint64_t>(std::max(1, params_.bitrate_kbps)) * 125 *
+          static_cast<uint64_t>(std::max(10, options_.file_seconds)) * 5 / 4,
+      16ull << 20, 4ull << 30);
+  for (;;) {
+    Batch batch;
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+      if (queue_.empty())
+        break;
+      batch = std::move(queue_.front());
+      queue_.pop_front();
+      queued_bytes_ -= batch.data.size();
+    }
+    if (!batch.path.empty()) {
+      close_recording(fd, written);
+      fd = open_recording(batch.path, reserve);
+      written = 0;
+      synced = 0;
+      advised = 0;
+      std::lock_guard<std::mutex> lock(mu_);
+      current_ = fd >= 0 ? batch.path : std::string();
+      if (fd >= 0)
+        std::cerr << "Recorder " << device_id_ << ": " << batch.path << "\n";
+    }
+    if (fd < 0)
+      continue; // until the next file
+    if (!write_all(fd, batch.data)) {
+      std::cerr << "Recorder " << device_id_ << ": write failed: "
+                << std::strerror(errno) << "\n";
+      close_recording(fd, written);
+      fd = -1;
+      std::lock_guard<std::mutex> lock(mu_);
+      current_.clear();
+      continue;
+    }
+    written += batch.data.size();
+#ifdef __linux__
+    // Start writeback now rather than at the kernel's dirty limit, and drop
+    // the pages the previous batch sent on their way: a recording is never
+    // read back here.
+    (void)::sync_file_range(fd, static_cast<off_t>(synced),
+                            static_cast<off_t>(written - synced),
+                            SYNC_FILE_RANGE_WRITE);
+    if (synced > advised)
+      (void)::posix_fadvise(fd, static_cast<off_t>(advised),
+                            static_cast<off_t>(synced - advised),
+                            POSIX_FADV_DONTNEED);
+    advised = synced;
+    synced = written;
+#endif
+  }
+  close_recording(fd, written);
+  std::lock_guard<std::mutex> lock(mu_);
+  current_.clear();
+}
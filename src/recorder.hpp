@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "types.hpp"
+
+class CaptureV4L2;
+class SessionEncoder;
+
+struct RecordOptions {
+  std::string dir = "recordings";
+  int file_seconds = 300; // a new file starts at the first IDR after this
+};
+
+// Continuous recording of a session's encoded stream: the access units its
+// viewers get, muxed (never re-encoded) into rolling fMP4 files named
+// <dir>/<device>-<UTC start>.mp4, each an init segment plus one fragment
+// per frame.
+//
+// Two threads keep disk I/O off the live path. The mux thread is one more
+// subscriber of the encoder and packs fragments into ~1 MiB batches (at
+// least once a second). The writer thread writes them into space
+// preallocated for the whole file and starts writeback as it goes, so
+// dirty pages never pile up into a stall. If the disk still falls behind
+// by kMaxQueued, batches are dropped and the next file starts at the next
+// IDR; the encoder never waits.
+class Recorder {
+public:
+  Recorder(std::string device_id, std::shared_ptr<CaptureV4L2> capture,
+           std::shared_ptr<SessionEncoder> encoder, const CaptureParams &params,
+           const RecordOptions &options);
+  // Flushes what was muxed and closes the file.
+  ~Recorder();
+
+  // File being written, empty between files.
+  std::string current_file() const;
+  uint64_t dropped_bytes() const { return dropped_bytes_; }
+
+  static constexpr size_t kBatch = 1 << 20;
+  static constexpr size_t kMaxQueued = 64 << 20;
+
+private:
+  struct Batch {
+    std::string path; // set: close the current file and open this one
+    std::string data;
+  };
+
+  void mux_loop();
+  void write_loop();
+  // Hands `batch_` to the writer; false (and dropped) when it is behind.
+  bool flush_batch();
+  std::string next_path() const;
+
+  const std::string device_id_;
+  const std::shared_ptr<CaptureV4L2> capture_;
+  const std::shared_ptr<SessionEncoder> encoder_;
+  const CaptureParams params_;
+  const RecordOptions options_;
+
+  Batch batch_; // mux thread only
+
+  mutable std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<Batch> queue_;
+  size_t queued_bytes_ = 0;
+  std::string current_;
+  bool stop_ = false;      // writer: drain and exit
+  std::atomic<bool> stop_mux_{false};
+  std::atomic<uint64_t> dropped_bytes_{0};
+  std::thread writer_;
+  std::thread mux_;
+};
@@ -0,0 +1,538 @@
+#include "relay_upstream.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <vector>
+
+#include "httplib.h"
+#include "stream_utils.hpp"
+#include "types.hpp"
+
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+using namespace std::chrono_literals;
+
+namespace {
+constexpr char kStartCode[] = {0, 0, 0, 1};
+// How long the upstream may take to accept and send its first keyframe,
+// and how long it may then go quiet before the pull counts as failed.
+constexpr auto kOpenTimeout = 5s;
+constexpr auto kStallTimeout = 5s;
+
+// `key`'s value in `a=1&b=2` (or `a=1;b=2` with sep ';'), or "".
+std::string field(const std::string &list, const std::string &key,
+                  char sep = '&') {
+  size_t pos = 0;
+  while (pos < list.size()) {
+    size_t end = list.find(sep, pos);
+    if (end == std::string::npos)
+      end = list.size();
+    if (list.compare(pos, key.size() + 1, key + "=") == 0)
+      return list.substr(pos + key.size() + 1, end - pos - key.size() - 1);
+    pos = end + 1;
+  }
+  return {};
+}
+
+int to_int(const std::string &s, int fallback) {
+  char *end = nullptr;
+  const long v = std::strtol(s.c_str(), &end, 10);
+  return end != s.c_str() && v > 0 && v < 100000 ? static_cast<int>(v)
+                                                 : fallback;
+}
+
+uint32_t be32(const uint8_t *p) {
+  return (uint32_t{p[0]} << 24) | (uint32_t{p[1]} << 16) |
+         (uint32_t{p[2]} << 8) | p[3];
+}
+
+bool has_nal(const std::string &au, uint8_t type) {
+  for (const auto &nal : stream::annexb_nals(au))
+    if (nal.type == type)
+      return true;
+  return false;
+}
+
+// Splits chunked fMP4, as served by Fmp4Source, back into access units:
+// SPS/PPS from the init segment's avcC, then one sample per mdat.
+class Fmp4Demuxer {
+public:
+  using AuFn = std::function<void(std::string &&au)>;
+
+  // False on a malformed stream.
+  bool feed(const char *data, size_t len, const AuFn &on_au) {
+    buffer_.append(data, len);
+    size_t pos = 0;
+    while (buffer_.size() - pos >= 8) {
+      const auto *p = reinterpret_cast<const uint8_t *>(buffer_.data() + pos);
+      uint64_t size = be32(p);
+      size_t header = 8;
+      if (size == 1) {
+        if (buffer_.size() - pos < 16)
+          break;
+        size = (uint64_t{be32(p + 8)} << 32) | be32(p + 12);
+        header = 16;
+      }
+      if (size < header || size > kMaxBox)
+        return false;
+      if (buffer_.size() - pos < size)
+        break;
+      const std::string type(buffer_.data() + pos + 4, 4);
+      if (!box(type, p + header, static_cast<size_t>(size) - header, on_au))
+        return false;
+      pos += static_cast<size_t>(size);
+    }
+    buffer_.erase(0, pos);
+    return true;
+  }
+
+  const std::vector<uint8_t> &sps() const { return sps_; }
+
+private:
+  static constexpr uint64_t kMaxBox = 32 << 20;
+
+  bool box(const std::string &type, const uint8_t *p, size_t n,
+           const AuFn &on_au) {
+    if (type == "moov")
+      return parse_avcc(p, n);
+    if (type != "mdat")
+      return true; // ftyp, moof: nothing a relay needs
+    std::string au;
+    au.reserve(n + 64);
+    for (size_t i = 0; i + length_size_ <= n;) {
+      size_t nal = 0;
+      for (int b = 0; b < length_size_; ++b)
+        nal = (nal << 8) | p[i + b];
+      i += length_size_;
+      if (nal == 0 || nal > n - i)
+        return false;
+      au.append(kStartCode, 4);
+      au.append(reinterpret_cast<const char *>(p + i), nal);
+      i += nal;
+    }
+    // Keyframes must stand alone for joiners here too.
+    if (has_nal(au, 5) && !has_nal(au, 7) && !sps_.empty())
+      au = parameter_sets_ + au;
+    on_au(std::move(au));
+    return true;
+  }
+
+  // avcC sits deep inside moov (trak/mdia/minf/stbl/stsd/avc1); finding its
+  // fourcc is enough for the one track SilkCast writes.
+  bool parse_avcc(const uint8_t *p, size_t n) {
+    const uint8_t *end = p + n;
+    const uint8_t tag[] = {'a', 'v', 'c', 'C'};
+    const uint8_t *it = std::search(p, end, tag, tag + 4);
+    if (it == end || it - p < 4)
+      return false;
+    const size_t box = be32(it - 4);
+    if (box < 8 + 7 || static_cast<size_t>(end - (it - 4)) < box)
+      return false;
+    const uint8_t *c = it + 4;
+    const uint8_t *c_end = it - 4 + box;
+    length_size_ = (c[4] & 3) + 1;
+    std::vector<uint8_t> *targets[] = {&sps_, &pps_};
+    c += 5;
+    for (auto *target : targets) {
+      if (c >= c_end)
+        return false;
+      const int count = *c++ & (target == &sps_ ? 0x1f : 0xff);
+      for (int i = 0; i < count; ++i) {
+        if (c_end - c < 2)
+          return false;
+        const size_t len = (size_t{c[0]} << 8) | c[1];
+        c += 2;
+        if (static_cast<size_t>(c_end - c) < len)
+          return false;
+        if (i == 0)
+          target->assign(c, c + len);
+        c += len;
+      }
+    }
+    parameter_sets_.clear();
+    for (const auto *set : {&sps_, &pps_}) {
+      parameter_sets_.append(kStartCode, 4);
+      parameter_sets_.append(set->begin(), set->end());
+    }
+    return !sps_.empty() && !pps_.empty();
+  }
+
+  std::string buffer_;
+  std::vector<uint8_t> sps_;
+  std::vector<uint8_t> pps_;
+  std::string parameter_sets_; // Annex-B SPS + PPS
+  int length_size_ = 4;
+};
+
+#ifdef __linux__
+// A frame being reassembled from UdpFrameHeader fragments.
+struct PendingFrame {
+  uint16_t num_frags = 0;
+  std::vector<std::string> frags;
+  std::vector<bool> have;
+  size_t count = 0;
+  std::map<uint16_t, std::pair<UdpFrameHeader, std::string>> parity;
+  bool nacked = false;
+
+  bool complete() const { return count == num_frags; }
+
+  void put(uint16_t frag, std::string payload) {
+    if (frag >= num_frags || have[frag])
+      return;
+    frags[frag] = std::move(payload);
+    have[frag] = true;
+    ++count;
+  }
+
+  // Rebuilds the single missing fragment of each parity group.
+  void recover() {
+    for (const auto &[first, entry] : parity) {
+      const auto &[header, payload] = entry;
+      const size_t end =
+          std::min<size_t>(first + header.fec_span, num_frags);
+      size_t missing = end;
+      int holes = 0;
+      for (size_t f = first; f < end; ++f)
+        if (!have[f]) {
+          missing = f;
+          ++holes;
+        }
+      if (holes != 1)
+        continue;
+      std::string rebuilt = payload;
+      size_t size = header.data_size;
+      for (size_t f = first; f < end; ++f) {
+        if (f == missing)
+          continue;
+        size ^= frags[f].size();
+        for (size_t i = 0; i < frags[f].size() && i < rebuilt.size(); ++i)
+          rebuilt[i] ^= frags[f][i];
+      }
+      if (size <= rebuilt.size()) {
+        rebuilt.resize(size);
+        put(static_cast<uint16_t>(missing), std::move(rebuilt));
+      }
+    }
+  }
+
+  std::string missing_list() const {
+    std::string out;
+    for (size_t f = 0; f < num_frags; ++f)
+      if (!have[f])
+        out += (out.empty() ? "" : ",") + std::to_string(f);
+    return out;
+  }
+};
+
+// Source address of packets towards `host`: where the upstream reaches us.
+std::string local_address_towards(const std::string &host, int port) {
+  addrinfo hints{};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  addrinfo *info = nullptr;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints,
+                  &info) != 0 ||
+      !info)
+    return "127.0.0.1";
+  std::string out = "127.0.0.1";
+  int s = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in local{};
+  socklen_t len = sizeof(local);
+  char buf[INET_ADDRSTRLEN];
+  if (s >= 0 && connect(s, info->ai_addr, info->ai_addrlen) == 0 &&
+      getsockname(s, reinterpret_cast<sockaddr *>(&local), &len) == 0 &&
+      inet_ntop(AF_INET, &local.sin_addr, buf, sizeof(buf)))
+    out = buf;
+  if (s >= 0)
+    close(s);
+  freeaddrinfo(info);
+  return out;
+}
+#endif
+} // namespace
+
+bool parse_relay_upstream(const std::string &url, RelayUpstream &out) {
+  RelayUpstream u;
+  u.url = url;
+  std::string rest;
+  if (url.rfind("http://", 0) == 0) {
+    rest = url.substr(7);
+  } else if (url.rfind("udp://", 0) == 0) {
+    u.transport = RelayUpstream::Transport::Udp;
+    rest = url.substr(6);
+  } else {
+    return false;
+  }
+  const size_t slash = rest.find('/');
+  if (slash == std::string::npos)
+    return false;
+  const std::string authority = rest.substr(0, slash);
+  std::string path = rest.substr(slash + 1);
+  const size_t q = path.find('?');
+  if (q != std::string::npos) {
+    u.query = path.substr(q + 1);
+    path.resize(q);
+  }
+  // The upstream's own stream URL works as well as its bare device id.
+  if (path.rfind("stream/live/", 0) == 0)
+    path = path.substr(12);
+  if (path.empty() || path.find('/') != std::string::npos)
+    return false;
+  u.device = path;
+  const size_t colon = authority.rfind(':');
+  const size_t bracket = authority.rfind(']');
+  if (colon != std::string::npos &&
+      (bracket == std::string::npos || colon > bracket)) {
+    u.host = authority.substr(0, colon);
+    u.port = to_int(authority.substr(colon + 1), 0);
+    if (u.port <= 0 || u.port > 65535)
+      return false;
+  } else {
+    u.host = authority;
+  }
+  if (u.host.size() > 2 && u.host.front() == '[' && u.host.back() == ']')
+    u.host = u.host.substr(1, u.host.size() - 2);
+  if (u.host.empty())
+    return false;
+  out = std::move(u);
+  return true;
+}
+
+bool RelayPuller::run(const OpenFn &on_open, const Sink &sink) {
+  return upstream_.transport == RelayUpstream::Transport::Udp
+             ? run_udp(on_open, sink)
+             : run_http(on_open, sink);
+}
+
+void RelayPuller::feedback(const std::string &query) {
+  httplib::Client cli(upstream_.host, upstream_.port);
+  cli.set_connection_timeout(1, 0);
+  cli.set_read_timeout(1, 0);
+  cli.Post("/stream/" + upstream_.device + "/feedback?" + query, "",
+           "text/plain");
+}
+
+void RelayPuller::flush_idr() {
+  const auto now = std::chrono::steady_clock::now();
+  if (!idr_wanted_ || now - last_idr_ < 1s)
+    return;
+  idr_wanted_ = false;
+  last_idr_ = now;
+  feedback("type=idr");
+}
+
+bool RelayPuller::run_http(const OpenFn &on_open, const Sink &sink) {
+  httplib::Client cli(upstream_.host, upstream_.port);
+  cli.set_connection_timeout(3, 0);
+  // Bounds how long cancel() takes when the upstream goes quiet.
+  cli.set_read_timeout(2, 0);
+  const std::string path =
+      "/stream/live/" + upstream_.device + "?codec=h264&container=mp4" +
+      (upstream_.query.empty() ? "" : "&" + upstream_.query);
+
+  Fmp4Demuxer demux;
+  RelayStreamInfo info;
+  info.fps = to_int(field(upstream_.query, "fps"), 30);
+  bool opened = false;
+  cli.Get(
+      path,
+      [&](const httplib::Response &res) {
+        if (res.status != 200) {
+          std::cerr << "Relay " << upstream_.url << ": upstream answered "
+                    << res.status << "\n";
+          return false;
+        }
+        info.fps = to_int(field(res.get_header_value("Effective-Params"),
+                                "fps", ';'),
+                          info.fps);
+        return true;
+      },
+      [&](const char *data, size_t len) {
+        if (cancelled_)
+          return false;
+        flush_idr();
+        return demux.feed(data, len, [&](std::string &&au) {
+          if (!opened) {
+            if (!stream::sps_dimensions(demux.sps(), info.width,
+                                        info.height))
+              return;
+            on_open(info);
+            opened = true;
+          }
+          sink(au);
+        });
+      });
+  return opened;
+}
+
+#ifdef __linux__
+bool RelayPuller::run_udp(const OpenFn &on_open, const Sink &sink) {
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in bind_addr{};
+  bind_addr.sin_family = AF_INET;
+  socklen_t len = sizeof(bind_addr);
+  if (sock < 0 ||
+      bind(sock, reinterpret_cast<sockaddr *>(&bind_addr), len) != 0 ||
+      getsockname(sock, reinterpret_cast<sockaddr *>(&bind_addr), &len) !=
+          0) {
+    std::cerr << "Relay " << upstream_.url << ": cannot open UDP socket\n";
+    if (sock >= 0)
+      close(sock);
+    return false;
+  }
+  // Room for a few large keyframes while a NACK or IDR request is out.
+  const int rcvbuf = 4 << 20;
+  setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  const std::string receiver =
+      "target=" + local_address_towards(upstream_.host, upstream_.port) +
+      "&port=" + std::to_string(ntohs(bind_addr.sin_port));
+
+  httplib::Client cli(upstream_.host, upstream_.port);
+  cli.set_connection_timeout(3, 0);
+  cli.set_read_timeout(3, 0);
+  const std::string output = "/stream/" + upstream_.device + "/udp?";
+  auto res = cli.Post(output + receiver + "&codec=h264" +
+                          (upstream_.query.empty() ? ""
+                                                   : "&" + upstream_.query),
+                      "", "text/plain");
+  if (!res || res->status != 200) {
+    std::cerr << "Relay " << upstream_.url << ": upstream refused UDP output"
+              << (res ? " (" + std::to_string(res->status) + ")" : "")
+              << "\n";
+    close(sock);
+    return false;
+  }
+
+  // Frames kept open for late fragments (retransmits, parity) before they
+  // count as lost, as in client/silkcast_client.py.
+  constexpr size_t kReorderWindow = 3;
+  RelayStreamInfo info;
+  info.fps = to_int(field(upstream_.query, "fps"), 30);
+  std::map<uint32_t, PendingFrame> pending;
+  std::vector<char> packet(65536);
+  std::optional<uint32_t> last_delivered;
+  bool need_key = true;
+  bool opened = false;
+  const auto started = std::chrono::steady_clock::now();
+  auto last_packet = started;
+
+  auto deliver = [&] {
+    while (!pending.empty()) {
+      auto it = pending.begin();
+      if (!it->second.complete()) {
+        if (pending.size() <= kReorderWindow)
+          return;
+        pending.erase(it);
+        need_key = true;
+        request_idr();
+        continue;
+      }
+      const uint32_t id = it->first;
+      if (last_delivered && id != *last_delivered + 1) {
+        need_key = true; // frames we never saw a fragment of
+        request_idr();
+      }
+      last_delivered = id;
+      std::string au;
+      for (auto &frag : it->second.frags)
+        au += frag;
+      pending.erase(it);
+      if (need_key && !has_nal(au, 5))
+        continue;
+      need_key = false;
+      if (!opened) {
+        std::vector<uint8_t> sps;
+        std::vector<uint8_t> pps;
+        stream::extract_sps_pps(au, sps, pps);
+        if (!stream::sps_dimensions(sps, info.width, info.height)) {
+          need_key = true;
+          request_idr();
+          continue;
+        }
+        on_open(info);
+        opened = true;
+      }
+      sink(au);
+    }
+  };
+
+  while (!cancelled_) {
+    const auto now = std::chrono::steady_clock::now();
+    if (!opened && now - started > kOpenTimeout) {
+      std::cerr << "Relay " << upstream_.url << ": no keyframe from upstream\n";
+      break;
+    }
+    if (opened && now - last_packet > kStallTimeout)
+      break;
+    flush_idr();
+    pollfd pfd{sock, POLLIN, 0};
+    if (poll(&pfd, 1, 100) <= 0)
+      continue;
+    const ssize_t n = recv(sock, packet.data(), packet.size(), 0);
+    if (n < static_cast<ssize_t>(sizeof(UdpFrameHeader)))
+      continue;
+    last_packet = std::chrono::steady_clock::now();
+    UdpFrameHeader header;
+    std::memcpy(&header, packet.data(), sizeof(header));
+    // Frames are timestamped on arrival, so a capture time is skipped.
+    const size_t skip = sizeof(header) + ((header.flags & kUdpTimestamp)
+                                              ? sizeof(uint32_t)
+                                              : 0);
+    if (static_cast<size_t>(n) < skip)
+      continue;
+    std::string payload(packet.data() + skip, static_cast<size_t>(n) - skip);
+    const bool parity = header.flags & kUdpParity;
+    if ((!parity && payload.size() != header.data_size) ||
+        header.num_frags == 0 ||
+        (last_delivered && header.frame_id <= *last_delivered))
+      continue;
+    auto it = pending.find(header.frame_id);
+    if (it == pending.end()) {
+      if (header.flags & kUdpRetransmit)
+        continue; // answer for a frame already given up on
+      // Older frames still open now: ask for their missing fragments
+      // while the upstream keeps them.
+      for (auto &[id, old] : pending) {
+        if (old.nacked || old.complete())
+          continue;
+        old.nacked = true;
+        old.recover();
+        if (!old.complete())
+          feedback("type=nack&frame=" + std::to_string(id) +
+                   "&frags=" + old.missing_list() + "&" + receiver);
+      }
+      it = pending.emplace(header.frame_id, PendingFrame{}).first;
+      it->second.num_frags = header.num_frags;
+      it->second.frags.resize(header.num_frags);
+      it->second.have.assign(header.num_frags, false);
+    }
+    auto &frame = it->second;
+    if (parity)
+      frame.parity[header.frag_id] = {header, std::move(payload)};
+    else
+      frame.put(header.frag_id, std::move(payload));
+    if (!frame.complete())
+      frame.recover();
+    deliver();
+  }
+
+  cli.Delete(output + receiver);
+  close(sock);
+  return opened;
+}
+#else
+bool RelayPuller::run_udp(const OpenFn &, const Sink &) {
+  std::cerr << "Relay " << upstream_.url << ": UDP upstreams are Linux only\n";
+  return false;
+}
+#endif
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+
+// Another SilkCast node's H.264 stream, pulled once by a relay device and
+// re-served to local viewers as if it came from a camera that encodes
+// H.264 itself: no decode and no re-encode, whatever the viewer count.
+struct RelayUpstream {
+  enum class Transport { Http, Udp };
+  Transport transport = Transport::Http;
+  std::string host;
+  int port = 8080;
+  std::string device; // device id on the upstream node
+  std::string query;  // stream params passed through (w, h, fps, bitrate...)
+  std::string url;    // as configured, for logs and /stats
+};
+
+// `http://host[:port]/device[?query]` pulls chunked fMP4, whose boxes frame
+// each access unit exactly. `udp://host[:port]/device[?query]` registers a
+// persistent UDP output at the upstream and reassembles its fragments,
+// using the XOR parity and NACKs of the UDP protocol. False on anything
+// else.
+bool parse_relay_upstream(const std::string &url, RelayUpstream &out);
+
+struct RelayStreamInfo {
+  int width = 0; // from the upstream's SPS
+  int height = 0;
+  int fps = 0;
+};
+
+// One pull from an upstream, run on the caller's thread.
+class RelayPuller {
+public:
+  // One Annex-B access unit, start codes included. Keyframes carry their
+  // SPS/PPS.
+  using Sink = std::function<void(const std::string &au)>;
+  using OpenFn = std::function<void(const RelayStreamInfo &)>;
+
+  explicit RelayPuller(RelayUpstream upstream)
+      : upstream_(std::move(upstream)) {}
+
+  // Pulls until cancel() or the upstream fails. `on_open` runs once, before
+  // the first access unit. False if the upstream never got that far.
+  bool run(const OpenFn &on_open, const Sink &sink);
+  // Makes run() return within a read timeout; callable from any thread.
+  void cancel() { cancelled_ = true; }
+  // Asks the upstream for an IDR, from run()'s thread and at most once a
+  // second.
+  void request_idr() { idr_wanted_ = true; }
+
+private:
+  bool run_http(const OpenFn &on_open, const Sink &sink);
+  bool run_udp(const OpenFn &on_open, const Sink &sink);
+  // Sends a pending IDR request if one is due.
+  void flush_idr();
+  void feedback(const std::string &query);
+
+  const RelayUpstream upstream_;
+  std::atomic<bool> cancelled_{false};
+  std::atomic<bool> idr_wanted_{false};
+  std::chrono::steady_clock::time_point last_idr_{};
+};
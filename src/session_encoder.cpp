@@ -0,0 +1,573 @@
+#include "session_encoder.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "capture_v4l2.hpp"
+#include "encoder_h264.hpp"
+#include "stream_utils.hpp"
+#include "yuv_convert.hpp"
+
+using namespace std::chrono_literals;
+
+namespace {
+// Upper bound on the GOP cache; cameras with very long GOPs just fall back
+// to forced IDRs.
+constexpr size_t kMaxGopFrames = 300;
+
+// How old the cached IDR may be before a newcomer gets a fresh one instead:
+// joining from the cache means starting that far behind live.
+std::chrono::milliseconds gop_max_age(const std::string &latency) {
+  if (latency == "ultra")
+    return 100ms;
+  if (latency == "low")
+    return 500ms;
+  return 3000ms;
+}
+} // namespace
+
+SessionEncoder::SessionEncoder(std::shared_ptr<CaptureV4L2> capture,
+                               const CaptureParams &params,
+                               const EncoderOptions &options, bool scaled)
+    : capture_(std::move(capture)), params_(params), requested_(params),
+      options_(options), scaled_(scaled),
+      gop_max_age_(gop_max_age(params.latency)),
+      frames_(std::make_shared<EncodedFramePool>(
+          std::clamp<size_t>(static_cast<size_t>(std::max(0, params.gop)), 1,
+                             kMaxGopFrames) +
+          8)),
+      rewind_(scaled ? 0 : std::max(0, options.rewind_seconds)),
+      idle_since_(std::chrono::steady_clock::now()),
+      rate_(params.bitrate_kbps, params.fps, params.width, params.height) {}
+
+SessionEncoder::~SessionEncoder() { stop(); }
+
+std::shared_ptr<FrameSubscriber> SessionEncoder::subscribe() {
+  auto sub = std::make_shared<FrameSubscriber>();
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (stop_) {
+      sub->close();
+      return sub;
+    }
+    // Primed under the lock so no frame published after the snapshot can
+    // overtake the cached ones.
+    const bool cached = gop_fresh_locked();
+    if (cached)
+      sub->prime(gop_);
+    subscribers_.push_back(sub);
+    if (!thread_.joinable())
+      thread_ = std::thread([this] { loop(); });
+    if (!cached)
+      idr_pending_ = true;
+  }
+  cv_.notify_all();
+  return sub;
+}
+
+void SessionEncoder::hold_warm() {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (stop_ || warm_)
+      return;
+    warm_ = true;
+    if (!thread_.joinable())
+      thread_ = std::thread([this] { loop(); });
+    idr_pending_ = true;
+  }
+  cv_.notify_all();
+}
+
+void SessionEncoder::unsubscribe(const std::shared_ptr<FrameSubscriber> &sub) {
+  if (!sub)
+    return;
+  sub->close();
+  std::lock_guard<std::mutex> lock(mu_);
+  auto it = std::find(subscribers_.begin(), subscribers_.end(), sub);
+  if (it == subscribers_.end())
+    return;
+  retired_drops_ += sub->dropped();
+  subscribers_.erase(it);
+  if (subscribers_.empty())
+    idle_since_ = std::chrono::steady_clock::now();
+}
+
+bool SessionEncoder::idle_for(std::chrono::steady_clock::duration idle) const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return subscribers_.empty() &&
+         std::chrono::steady_clock::now() - idle_since_ >= idle;
+}
+
+void SessionEncoder::keep_alive() {
+  std::lock_guard<std::mutex> lock(mu_);
+  idle_since_ = std::chrono::steady_clock::now();
+}
+
+void SessionEncoder::stop() {
+  std::vector<std::shared_ptr<FrameSubscriber>> subs;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stop_ = true;
+    subs.swap(subscribers_);
+  }
+  cv_.notify_all();
+  for (auto &sub : subs)
+    sub->close();
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void SessionEncoder::request_bitrate(int kbps) {
+  if (kbps <= 0)
+    return;
+  std::lock_guard<std::mutex> lock(mu_);
+  rate_.set_max_kbps(kbps);
+  bitrate_pending_ = rate_.target().kbps;
+  fps_pending_ = rate_.target().fps;
+}
+
+void SessionEncoder::report(const std::string &receiver,
+                            const ReceiverReport &report) {
+  std::lock_guard<std::mutex> lock(mu_);
+  const auto now = std::chrono::steady_clock::now();
+  const bool expired = rate_.expire(now);
+  if (rate_.on_report(receiver, report, now) || expired) {
+    bitrate_pending_ = rate_.target().kbps;
+    fps_pending_ = rate_.target().fps;
+  }
+}
+
+RateTarget SessionEncoder::rate_target() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return rate_.target();
+}
+
+bool SessionEncoder::parameter_sets(std::vector<uint8_t> &sps,
+                                    std::vector<uint8_t> &pps) const {
+  std::lock_guard<std::mutex> lock(mu_);
+  if (sps_.empty() || pps_.empty())
+    return false;
+  sps = sps_;
+  pps = pps_;
+  return true;
+}
+
+bool SessionEncoder::available() const {
+  // A rendition re-encodes; camera H.264 cannot be scaled.
+  return h264_encoder_available(options_) ||
+         (!scaled_ && capture_ &&
+          capture_->pixel_format() == PixelFormat::H264);
+}
+
+size_t SessionEncoder::subscriber_count() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return subscribers_.size();
+}
+
+uint64_t SessionEncoder::dropped_frames() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  uint64_t total = retired_drops_;
+  for (const auto &sub : subscribers_)
+    total += sub->dropped();
+  return total;
+}
+
+bool SessionEncoder::gop_fresh_locked() const {
+  if (gop_.empty())
+    return false;
+  return std::chrono::steady_clock::now() - gop_.front()->captured_at <=
+         gop_max_age_;
+}
+
+void SessionEncoder::cache_locked(const EncodedFramePtr &frame) {
+  if (rewind_.count() > 0) {
+    // Frames are shared with the viewers, so the ring costs pointers and
+    // keeps about bitrate x seconds alive.
+    ring_.push_back(frame);
+    const auto oldest = frame->captured_at - rewind_;
+    while (ring_.front()->captured_at < oldest)
+      ring_.pop_front();
+  }
+  if (frame->keyframe) {
+    gop_.clear();
+  } else if (gop_.empty()) {
+    return; // no IDR to anchor on yet
+  } else if (gop_.size() >= kMaxGopFrames) {
+    gop_.clear();
+    return;
+  }
+  gop_.push_back(frame);
+}
+
+EncodedFramePtr
+SessionEncoder::rewind_from(std::chrono::milliseconds ago) const {
+  std::lock_guard<std::mutex> lock(mu_);
+  const auto target = std::chrono::steady_clock::now() - ago;
+  EncodedFramePtr start;
+  for (const auto &frame : ring_) {
+    if (!frame->keyframe)
+      continue;
+    if (start && frame->captured_at > target)
+      break;
+    start = frame;
+  }
+  return start;
+}
+
+EncodedFramePtr SessionEncoder::rewind_next(uint64_t seq, bool &ended) const {
+  std::lock_guard<std::mutex> lock(mu_);
+  ended = stop_;
+  if (ring_.empty())
+    return nullptr;
+  if (ring_.front()->seq > seq + 1) {
+    for (const auto &frame : ring_)
+      if (frame->keyframe)
+        return frame;
+    return nullptr;
+  }
+  auto it = std::upper_bound(
+      ring_.begin(), ring_.end(), seq,
+      [](uint64_t s, const EncodedFramePtr &frame) { return s < frame->seq; });
+  return it == ring_.end() ? nullptr : *it;
+}
+
+void SessionEncoder::publish(const EncodedFramePtr &frame) {
+  // Snapshot under the lock, push outside it: subscriber queues have their
+  // own locks and pushing never blocks. Caching in the same critical section
+  // keeps subscribe()'s priming and live frames in order.
+  std::vector<std::shared_ptr<FrameSubscriber>> subs;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    cache_locked(frame);
+    subs = subscribers_;
+  }
+  for (auto &sub : subs)
+    sub->push(frame);
+}
+
+void SessionEncoder::loop() {
+  std::unique_ptr<H264Encoder> encoder;
+  int width = 0; // capture geometry
+  int height = 0;
+  int out_width = 0; // encoded geometry; differs for renditions
+  int out_height = 0;
+  int capture_fps = 0;
+  std::string yuv;
+  std::string scaled;
+  std::vector<uint8_t> scale_scratch;
+  // Static-scene test: the compared bytes of the last frame encoded.
+  std::vector<uint8_t> reference;
+  std::vector<uint32_t> block_sums;
+  std::chrono::steady_clock::time_point reference_at{};
+  uint64_t seq = 0;
+  uint64_t last_capture_seq = 0;
+  // Frame-rate adaptation: below the capture rate, frames captured before
+  // `next_due` are skipped ahead of any conversion.
+  int encode_fps = 0;
+  std::chrono::steady_clock::duration encode_interval{};
+  std::chrono::steady_clock::time_point next_due{};
+
+  apply_thread_policy(
+      options_.thread_policy, ThreadRole::Encode, params_.latency,
+      capture_ ? capture_->numa_node() : -1,
+      scaled_ ? "enc " + std::to_string(requested_.width) + "x" +
+                    std::to_string(requested_.height)
+              : std::string("enc"));
+  for (;;) {
+    {
+      // Idle without viewers: no point converting or encoding, unless the
+      // session is kept warm.
+      std::unique_lock<std::mutex> lock(mu_);
+      cv_.wait(lock,
+               [this] { return stop_ || warm_ || !subscribers_.empty(); });
+      if (stop_)
+        break;
+      // Receivers that went quiet no longer hold the rate down.
+      const auto now = std::chrono::steady_clock::now();
+      if (rate_.active() && now - rate_checked_ >= 1s) {
+        rate_checked_ = now;
+        if (rate_.expire(now)) {
+          bitrate_pending_ = rate_.target().kbps;
+          fps_pending_ = rate_.target().fps;
+        }
+      }
+    }
+    if (!capture_)
+      break;
+    // Paced by the camera: wake as soon as a new frame lands. The timeout
+    // only bounds how long a stop()/unsubscribe takes to be noticed.
+    FrameRef frame = capture_->wait_frame(last_capture_seq, 100ms);
+    if (!frame)
+      continue;
+    // Only the newest frame is kept, so a burst can overtake this thread.
+    const bool skipped =
+        last_capture_seq != 0 && frame->seq > last_capture_seq + 1;
+    last_capture_seq = frame->seq;
+    PixelFormat fmt = capture_->pixel_format();
+    if (fmt == PixelFormat::H264 && !scaled_) {
+      // Camera-encoded Annex-B: forward each access unit untouched. One
+      // that went by unseen breaks the references; the source's next IDR
+      // repairs them.
+      if (skipped)
+        idr_pending_ = true;
+      if (idr_pending_.exchange(false))
+        capture_->request_keyframe();
+      auto out = frames_->acquire();
+      out->data.assign(reinterpret_cast<const char *>(frame->data()),
+                       frame->size);
+      out->seq = ++seq;
+      out->captured_at = frame->captured_at;
+      publish_access_unit(std::move(out), true);
+      continue;
+    }
+    if (!is_raw_yuv(fmt))
+      continue;
+    if (encode_interval.count() > 0) {
+      // Half a capture interval of slack absorbs capture jitter.
+      const auto slack =
+          std::chrono::microseconds(500000 / std::max(1, capture_fps));
+      if (frame->captured_at + slack < next_due)
+        continue;
+      next_due = std::max(next_due, frame->captured_at - encode_interval) +
+                 encode_interval;
+    }
+
+    if (!encoder) {
+      // Capture negotiates the real geometry; encode at what we actually get
+      // (a rendition: at its own size, never above the capture's).
+      CaptureParams p = params_;
+      width = capture_->width();
+      height = capture_->height();
+      capture_fps = capture_->fps() > 0 ? capture_->fps() : p.fps;
+      EncoderInput input{fmt, capture_->stride()};
+      if (scaled_) {
+        p.width = std::min(p.width, width) & ~1;
+        p.height = std::min(p.height, height) & ~1;
+        p.fps = std::clamp(p.fps, 1, capture_fps);
+        input = {PixelFormat::I420, p.width};
+      } else {
+        p.width = width;
+        p.height = height;
+        p.fps = capture_fps;
+      }
+      encoder = create_h264_encoder(options_, p, input);
+      if (!encoder) {
+        std::cerr << "H264 encoder init failed for " << p.width << "x"
+                  << p.height << "\n";
+        std::vector<std::shared_ptr<FrameSubscriber>> subs;
+        {
+          std::lock_guard<std::mutex> lock(mu_);
+          stop_ = true;
+          subs.swap(subscribers_);
+        }
+        for (auto &sub : subs)
+          sub->close();
+        break;
+      }
+      out_width = p.width;
+      out_height = p.height;
+      params_ = p;
+      if (p.fps < capture_fps)
+        fps_pending_ = p.fps; // decimate from the first frame on
+      if ((fmt != PixelFormat::I420 && !encoder->native_input()) || scaled_)
+        std::cerr << "YUV conversion kernels: " << yuv_convert_backend()
+                  << "\n";
+    }
+
+    if (params_.still > 0) {
+      // Unchanged since the last frame encoded: leave it out before any
+      // conversion. The stream's timestamps carry the gap, and a frame a
+      // second still goes out so the picture (and its noise) catches up.
+      // Luma decides; YUYV rows are compared packed, chroma and all.
+      const int stride = capture_->stride();
+      const int bytes = fmt == PixelFormat::YUYV ? width * 2 : width;
+      if (frame->size < static_cast<size_t>(stride) * height)
+        continue;
+      const bool compared = reference.size() == static_cast<size_t>(bytes) *
+                                                    height;
+      if (compared && !idr_pending_ &&
+          frame->captured_at - reference_at < 1s &&
+          !blocks_differ(frame->data(), stride, reference.data(), bytes, bytes,
+                         height, params_.still, block_sums)) {
+        frames_unchanged_.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+      reference.resize(static_cast<size_t>(bytes) * height);
+      for (int row = 0; row < height; ++row)
+        std::memcpy(reference.data() + static_cast<size_t>(row) * bytes,
+                    frame->data() + static_cast<size_t>(row) * stride, bytes);
+      reference_at = frame->captured_at;
+    }
+
+    if (idr_pending_.exchange(false))
+      encoder->force_idr();
+    if (const int kbps = bitrate_pending_.exchange(0); kbps > 0) {
+      if (encoder->set_bitrate(kbps))
+        params_.bitrate_kbps = kbps;
+      else
+        std::cerr << encoder->name() << ": bitrate change not supported\n";
+    }
+    if (const int fps = fps_pending_.exchange(0); fps > 0 && fps != encode_fps) {
+      // Frames are dropped here either way; the encoder is told so its
+      // rate control budgets per frame correctly.
+      encoder->set_frame_rate(fps);
+      encode_fps = fps;
+      encode_interval = fps < capture_fps
+                            ? std::chrono::steady_clock::duration(
+                                  std::chrono::seconds(1)) /
+                                  fps
+                            : std::chrono::steady_clock::duration::zero();
+    }
+
+    auto out = frames_->acquire();
+    if (encoder->native_input() && !scaled_) {
+      // The backend ingests the capture layout itself (e.g. an M2M encoder
+      // taking YUYV): no conversion pass at all.
+      const auto encode_start = std::chrono::steady_clock::now();
+      if (!encoder->encode_native(frame->data(), frame->size, *out))
+        continue;
+      metrics_.encode.record(encode_start, std::chrono::steady_clock::now());
+      frames_encoded_.fetch_add(1, std::memory_order_relaxed);
+      out->seq = ++seq;
+      out->captured_at = frame->captured_at;
+      publish_access_unit(std::move(out), false);
+      continue;
+    }
+
+    // Read straight out of the (possibly padded) capture buffer. Native
+    // I420 is handed to the encoder as-is; other layouts are converted into
+    // a scratch buffer that is only allocated if it is ever needed.
+    const auto convert_start = std::chrono::steady_clock::now();
+    const int stride = capture_->stride();
+    const size_t luma = static_cast<size_t>(stride) * height;
+    const uint8_t *y = nullptr;
+    const uint8_t *u = nullptr;
+    const uint8_t *v = nullptr;
+    int y_stride = width;
+    int uv_stride = width / 2;
+    if (fmt == PixelFormat::I420) {
+      if (frame->size < luma * 3 / 2)
+        continue;
+      y = frame->data();
+      u = y + luma;
+      v = u + luma / 4;
+      y_stride = stride;
+      uv_stride = stride / 2;
+    } else {
+      yuv.resize(static_cast<size_t>(width) * height * 3 / 2);
+      uint8_t *dy = reinterpret_cast<uint8_t *>(yuv.data());
+      uint8_t *du = dy + width * height;
+      uint8_t *dv = du + (width / 2) * (height / 2);
+      if (fmt == PixelFormat::YUYV) {
+        if (frame->size < luma)
+          continue;
+        yuyv_to_i420(frame->data(), stride, width, height, dy, width, du,
+                     width / 2, dv, width / 2);
+      } else {
+        if (frame->size < luma * 3 / 2)
+          continue;
+        const uint8_t *src_y = frame->data();
+        nv12_to_i420(src_y, stride, src_y + luma, stride, width, height, dy,
+                     width, du, width / 2, dv, width / 2);
+      }
+      y = dy;
+      u = du;
+      v = dv;
+    }
+    if (scaled_ && (out_width != width || out_height != height)) {
+      scaled.resize(static_cast<size_t>(out_width) * out_height * 3 / 2);
+      uint8_t *sy = reinterpret_cast<uint8_t *>(scaled.data());
+      uint8_t *su = sy + out_width * out_height;
+      uint8_t *sv = su + (out_width / 2) * (out_height / 2);
+      scale_plane(y, y_stride, width, height, sy, out_width, out_width,
+                  out_height, scale_scratch);
+      scale_plane(u, uv_stride, width / 2, height / 2, su, out_width / 2,
+                  out_width / 2, out_height / 2, scale_scratch);
+      scale_plane(v, uv_stride, width / 2, height / 2, sv, out_width / 2,
+                  out_width / 2, out_height / 2, scale_scratch);
+      y = sy;
+      u = su;
+      v = sv;
+      y_stride = out_width;
+      uv_stride = out_width / 2;
+    }
+
+    const auto encode_start = std::chrono::steady_clock::now();
+    if (fmt != PixelFormat::I420 || scaled_)
+      metrics_.convert.record(convert_start, encode_start);
+    if (!encoder->encode_i420(y, u, v, y_stride, uv_stride, *out))
+      continue;
+    metrics_.encode.record(encode_start, std::chrono::steady_clock::now());
+    frames_encoded_.fetch_add(1, std::memory_order_relaxed);
+    out->seq = ++seq;
+    out->captured_at = frame->captured_at;
+    publish_access_unit(std::move(out), false);
+  }
+}
+
+void SessionEncoder::publish_access_unit(std::shared_ptr<EncodedFrame> out,
+                                         bool repeat_parameter_sets) {
+  if (out->nals.empty())
+    stream::annexb_nals(out->data, out->nals);
+  // Everything below works off the spans; the payload is not read again.
+  bool saw_slice = false;
+  bool referenced = false;
+  const NalSpan *sps_nal = nullptr;
+  const NalSpan *pps_nal = nullptr;
+  for (const auto &nal : out->nals) {
+    if (nal.type >= 1 && nal.type <= 5) {
+      saw_slice = true;
+      referenced |= nal.ref_idc != 0;
+      out->keyframe |= nal.type == 5;
+    } else if (nal.type == 7 && !sps_nal) {
+      sps_nal = &nal;
+    } else if (nal.type == 8 && !pps_nal) {
+      pps_nal = &nal;
+    }
+  }
+  // No slice to judge by: keep it.
+  out->reference = out->keyframe || referenced || !saw_slice;
+  // Camera streams may carry parameter sets outside IDR access units.
+  if (out->keyframe || repeat_parameter_sets) {
+    std::vector<uint8_t> sps;
+    std::vector<uint8_t> pps;
+    const auto *bytes = reinterpret_cast<const uint8_t *>(out->data.data());
+    if (sps_nal)
+      sps.assign(bytes + sps_nal->offset,
+                 bytes + sps_nal->offset + sps_nal->size);
+    if (pps_nal)
+      pps.assign(bytes + pps_nal->offset,
+                 bytes + pps_nal->offset + pps_nal->size);
+    std::lock_guard<std::mutex> lock(mu_);
+    if (!sps.empty() && !pps.empty()) {
+      sps_ = std::move(sps);
+      pps_ = std::move(pps);
+    } else if (out->keyframe && repeat_parameter_sets && !sps_.empty() &&
+               !pps_.empty()) {
+      // Some cameras send SPS/PPS only once at stream start; repeat them
+      // ahead of every IDR so late joiners can decode.
+      static const char kStartCode[] = {0, 0, 0, 1};
+      std::string prefix;
+      prefix.append(kStartCode, 4);
+      prefix.append(reinterpret_cast<const char *>(sps_.data()), sps_.size());
+      prefix.append(kStartCode, 4);
+      prefix.append(reinterpret_cast<const char *>(pps_.data()), pps_.size());
+      out->data.insert(0, prefix);
+      for (auto &nal : out->nals)
+        nal.offset += static_cast<uint32_t>(prefix.size());
+      auto span = [](uint32_t offset, const std::vector<uint8_t> &nal) {
+        return NalSpan{offset, static_cast<uint32_t>(nal.size()),
+                       static_cast<uint8_t>(nal[0] & 0x1F),
+                       static_cast<uint8_t>((nal[0] >> 5) & 0x03)};
+      };
+      out->nals.insert(out->nals.begin(),
+                       {span(4, sps_),
+                        span(static_cast<uint32_t>(8 + sps_.size()), pps_)});
+    }
+  }
+  out->published_at = std::chrono::steady_clock::now();
+  publish(out);
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder_h264.hpp"
+#include "frame_pool.hpp"
+#include "rate_control.hpp"
+#include "subscriber.hpp"
+#include "types.hpp"
+
+class CaptureV4L2;
+
+// One H.264 encoder per session. A dedicated thread converts and encodes each
+// captured frame exactly once and publishes the access unit to every
+// subscriber, so adding a viewer only costs its socket writes. When the
+// camera already emits H.264 the thread just forwards its access units.
+//
+// A rendition (`scaled`) encodes at params' size and fps instead of the
+// capture's: raw frames are decimated, converted and downscaled first, so
+// several renditions can share one capture.
+class SessionEncoder {
+public:
+  SessionEncoder(std::shared_ptr<CaptureV4L2> capture,
+                 const CaptureParams &params,
+                 const EncoderOptions &options = {}, bool scaled = false);
+  ~SessionEncoder();
+
+  // Registers a viewer. The encode thread starts on the first subscriber.
+  // The newcomer is primed with the cached GOP when it is recent enough for
+  // the latency tier; otherwise an IDR is requested.
+  std::shared_ptr<FrameSubscriber> subscribe();
+  void unsubscribe(const std::shared_ptr<FrameSubscriber> &sub);
+
+  // Keeps encoding with no subscribers (keep-warm sessions), so SPS/PPS and
+  // a recent GOP are ready before the first viewer arrives.
+  void hold_warm();
+
+  void request_idr() { idr_pending_ = true; }
+  // Asks the encoder to retarget its bitrate (applied on the encode thread).
+  // Ignored for passthrough and by backends without runtime rate control.
+  // Also the new ceiling for receiver-driven adaptation.
+  void request_bitrate(int kbps);
+  // Receiver feedback for the congestion controller; `receiver` names the
+  // reporting viewer. Bitrate and frame rate follow the weakest receiver
+  // that reported within the last few seconds.
+  void report(const std::string &receiver, const ReceiverReport &report);
+  // Current adapted bitrate/frame rate (the session params until a
+  // receiver reports).
+  RateTarget rate_target() const;
+  // True when the session can produce H.264 at all: an encoder backend
+  // exists, or the camera delivers H.264 itself (passthrough).
+  bool available() const;
+  // Stops the encode thread and closes every subscriber.
+  void stop();
+
+  // Rewind ring (EncoderOptions::rewind_seconds; never on a rendition).
+  // The last IDR captured at least `ago` back, or the oldest one held;
+  // nullptr when the ring has none.
+  EncodedFramePtr rewind_from(std::chrono::milliseconds ago) const;
+  // The frame after `seq`, nullptr until it is encoded. One that already
+  // left the ring resumes at the oldest IDR held. Sets `ended` once the
+  // encoder has stopped.
+  EncodedFramePtr rewind_next(uint64_t seq, bool &ended) const;
+  bool rewind_enabled() const { return rewind_.count() > 0; }
+
+  // Copies the cached SPS/PPS; false until the first IDR has been encoded.
+  bool parameter_sets(std::vector<uint8_t> &sps,
+                      std::vector<uint8_t> &pps) const;
+  size_t subscriber_count() const;
+  bool scaled() const { return scaled_; }
+  // What this encoder was created for; a rendition's output geometry.
+  const CaptureParams &requested() const { return requested_; }
+  // True once it has been without subscribers for at least `idle`.
+  bool idle_for(std::chrono::steady_clock::duration idle) const;
+  // Restarts the idle clock, so a viewer about to subscribe is not beaten
+  // to it by the reaper.
+  void keep_alive();
+  // Access units shed by congested subscribers, current and departed.
+  uint64_t dropped_frames() const;
+  // Raw frames encoded, and those left out as unchanged (params' `still`).
+  uint64_t encoded_frames() const { return frames_encoded_; }
+  uint64_t unchanged_frames() const { return frames_unchanged_; }
+  // Conversion and encode latency of the encode thread.
+  const EncodeMetrics &metrics() const { return metrics_; }
+
+private:
+  void loop();
+  void publish_access_unit(std::shared_ptr<EncodedFrame> out,
+                           bool repeat_parameter_sets);
+  void publish(const EncodedFramePtr &frame);
+  void cache_locked(const EncodedFramePtr &frame);
+  bool gop_fresh_locked() const;
+
+  std::shared_ptr<CaptureV4L2> capture_;
+  CaptureParams params_;
+  const CaptureParams requested_;
+  const EncoderOptions options_;
+  const bool scaled_;
+  const std::chrono::milliseconds gop_max_age_;
+  const std::shared_ptr<EncodedFramePool> frames_;
+
+  mutable std::mutex mu_;
+  std::condition_variable cv_;
+  std::vector<std::shared_ptr<FrameSubscriber>> subscribers_;
+  std::vector<uint8_t> sps_;
+  std::vector<uint8_t> pps_;
+  // Most recent IDR and everything after it, for late joiners.
+  std::vector<EncodedFramePtr> gop_;
+  // Everything captured within `rewind_`, oldest first.
+  const std::chrono::seconds rewind_;
+  std::deque<EncodedFramePtr> ring_;
+  uint64_t retired_drops_ = 0; // from unsubscribed viewers
+  std::chrono::steady_clock::time_point idle_since_;
+  std::thread thread_;
+  bool stop_ = false;
+  bool warm_ = false;
+  RateController rate_; // guarded by mu_
+  std::chrono::steady_clock::time_point rate_checked_{};
+  std::atomic<bool> idr_pending_{false};
+  std::atomic<int> bitrate_pending_{0};
+  std::atomic<int> fps_pending_{0};
+  std::atomic<uint64_t> frames_encoded_{0};
+  std::atomic<uint64_t> frames_unchanged_{0};
+  EncodeMetrics metrics_;
+};
@@ -1,9 +1,15 @@
 #include "session_manager.hpp"
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <filesystem>
 #include <iostream>
 
+#include "capture_pattern.hpp"
+#include "session_encoder.hpp"
+#include "stream_utils.hpp"
+
 #ifdef __APPLE__
 std::vector<std::string> list_avfoundation_devices();
 #endif
@@ -16,12 +22,21 @@ std::vector<std::string> list_avfoundation_devices();
 
 using namespace std::chrono_literals;
 
-SessionManager::SessionManager(int idle_timeout_seconds)
+SessionManager::SessionManager(int idle_timeout_seconds,
+                               const CaptureOptions &capture_options,
+                               const EncoderOptions &encoder_options,
+                               int linger_seconds)
     : idle_timeout_seconds_(idle_timeout_seconds),
+      linger_seconds_(std::clamp(linger_seconds, 0, idle_timeout_seconds)),
+      capture_options_(capture_options), encoder_options_(encoder_options),
       reaper_thread_([this] { reap_loop(); }) {}
 
 SessionManager::~SessionManager() {
-  stop_reaper_ = true;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stop_reaper_ = true;
+  }
+  reaper_cv_.notify_all();
   if (reaper_thread_.joinable())
     reaper_thread_.join();
 }
@@ -32,16 +47,99 @@ SessionManager::get_or_create(const std::string &device_id,
   std::lock_guard<std::mutex> lock(mu_);
   auto it = sessions_.find(device_id);
   if (it != sessions_.end()) {
+    // A rejoin within the linger cancels the pending close; the caller's
+    // client_count reference follows before the idle timeout could hit.
+    it->second->release_at = {};
+    it->second->last_accessed = std::chrono::steady_clock::now();
     return it->second;
   }
   auto session = std::make_shared<Session>();
   session->device_id = device_id;
   session->params = params;
-  session->capture = std::make_shared<CaptureV4L2>();
+  session->capture = std::make_shared<CaptureV4L2>(capture_options_);
+  auto relay = relays_.find(device_id);
+  if (relay != relays_.end()) {
+    // Relayed streams are forwarded as they arrive, never transcoded.
+    session->params.codec = "h264";
+    session->upstream = relay->second.url;
+    session->capture->set_relay(relay->second);
+  }
+  session->encoder = std::make_shared<SessionEncoder>(
+      session->capture, session->params, encoder_options_);
   sessions_[device_id] = session;
+  reaper_cv_.notify_all();
   return session;
 }
 
+bool SessionManager::keep_warm(const std::string &device_id,
+                               const CaptureParams &params) {
+  auto session = get_or_create(device_id, params);
+  session->warm = true;
+  if (!warm_up(*session)) {
+    std::cerr << "Keep-warm " << device_id << ": cannot open yet, retrying\n";
+    return false;
+  }
+  std::cerr << "Keep-warm " << device_id << ": " << session->params.codec
+            << " " << session->params.width << "x" << session->params.height
+            << "@" << session->params.fps << "\n";
+  return true;
+}
+
+bool SessionManager::record(const std::string &device_id,
+                            CaptureParams params,
+                            const RecordOptions &options) {
+  params.codec = "h264";
+  const bool opened = keep_warm(device_id, params);
+  auto session = get_or_create(device_id, params);
+  if (session->params.codec != "h264" || !session->encoder->available()) {
+    std::cerr << "Record " << device_id << ": no H.264 encoder\n";
+    return false;
+  }
+  session->recorder = std::make_shared<Recorder>(
+      session->device_id, session->capture, session->encoder, session->params,
+      options);
+  std::cerr << "Record " << device_id << ": into " << options.dir << "/\n";
+  return opened;
+}
+
+bool SessionManager::add_relay(const std::string &name,
+                               const std::string &url) {
+  RelayUpstream upstream;
+  if (name.empty() || name.find('/') != std::string::npos ||
+      !parse_relay_upstream(url, upstream)) {
+    std::cerr << "Bad relay '" << name << "=" << url << "'\n";
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mu_);
+  relays_["relay:" + name] = upstream;
+  return true;
+}
+
+bool SessionManager::warm_up(Session &session) {
+  if (!session.capture->running()) {
+    if (!session.capture->start(session.device_id, session.params))
+      return false;
+    stream::sync_session_params(session);
+    session.started = std::chrono::steady_clock::now();
+    session.frames_sent = 0;
+    session.bytes_sent = 0;
+  }
+  // Encoding from the start leaves SPS/PPS and a GOP cached for the first
+  // viewer, and lets the encoder and the camera's exposure settle.
+  if (session.params.codec == "h264" && session.encoder->available())
+    session.encoder->hold_warm();
+  return true;
+}
+
+std::vector<std::shared_ptr<Session>> SessionManager::active() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  std::vector<std::shared_ptr<Session>> out;
+  out.reserve(sessions_.size());
+  for (const auto &entry : sessions_)
+    out.push_back(entry.second);
+  return out;
+}
+
 void SessionManager::touch(const std::string &device_id) {
   std::lock_guard<std::mutex> lock(mu_);
   auto it = sessions_.find(device_id);
@@ -51,15 +149,90 @@ void SessionManager::touch(const std::string &device_id) {
 }
 
 void SessionManager::release_if_idle(const std::string &device_id) {
-  std::lock_guard<std::mutex> lock(mu_);
-  auto it = sessions_.find(device_id);
-  if (it != sessions_.end()) {
-    if (it->second->client_count.load() == 0) {
-      if (it->second->capture)
-        it->second->capture->stop();
-      sessions_.erase(it);
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    auto it = sessions_.find(device_id);
+    if (it == sessions_.end() || it->second->client_count.load() != 0 ||
+        it->second->warm)
+      return;
+    it->second->release_at = std::chrono::steady_clock::now() +
+                             std::chrono::seconds(linger_seconds_);
+  }
+  reaper_cv_.notify_all();
+}
+
+void SessionManager::stop_session(Session &session) {
+  for (auto &encoder : encoders(session))
+    encoder->stop();
+  if (session.capture)
+    session.capture->stop();
+}
+
+std::vector<std::shared_ptr<SessionEncoder>>
+SessionManager::encoders(Session &session) {
+  std::vector<std::shared_ptr<SessionEncoder>> out;
+  if (session.encoder)
+    out.push_back(session.encoder);
+  std::lock_guard<std::mutex> lock(session.renditions_mu);
+  out.insert(out.end(), session.renditions.begin(), session.renditions.end());
+  return out;
+}
+
+std::shared_ptr<SessionEncoder>
+SessionManager::encoder_for(Session &session, const CaptureParams &requested,
+                            bool create) {
+  auto &capture = session.capture;
+  if (!capture || !capture->running() ||
+      !is_raw_yuv(capture->pixel_format()) || capture->width() <= 0 ||
+      capture->height() <= 0)
+    return session.encoder;
+  const int width = capture->width();
+  const int height = capture->height();
+  const int fps = capture->fps() > 0 ? capture->fps() : session.params.fps;
+
+  // Never above the capture: renditions only scale down.
+  CaptureParams want = requested;
+  want.codec = "h264";
+  want.width = std::clamp(requested.width, 16, width) & ~1;
+  want.height = std::clamp(requested.height, 16, height) & ~1;
+  want.fps = std::clamp(requested.fps, 1, fps);
+  if (want.width >= (width & ~1) && want.height >= (height & ~1) &&
+      want.fps >= fps)
+    return session.encoder;
+
+  // Distance in log-area plus relative frame rate, so a thumbnail request
+  // never lands on the full-size feed while a smaller rendition exists.
+  auto distance = [&](int w, int h, int f) {
+    return std::abs(std::log(static_cast<double>(w) * h /
+                             (static_cast<double>(want.width) * want.height))) +
+           std::abs(f - want.fps) / static_cast<double>(std::max(f, want.fps));
+  };
+  std::lock_guard<std::mutex> lock(session.renditions_mu);
+  std::shared_ptr<SessionEncoder> best = session.encoder;
+  double best_distance = distance(width, height, fps);
+  for (const auto &rendition : session.renditions) {
+    const auto &r = rendition->requested();
+    if (r.width == want.width && r.height == want.height && r.fps == want.fps) {
+      rendition->keep_alive();
+      return rendition;
+    }
+    const double d = distance(r.width, r.height, r.fps);
+    if (d < best_distance) {
+      best = rendition;
+      best_distance = d;
     }
   }
+  if (!create || session.renditions.size() >= kMaxRenditions) {
+    best->keep_alive();
+    return best;
+  }
+  auto rendition = std::make_shared<SessionEncoder>(capture, want,
+                                                    encoder_options_, true);
+  session.renditions.push_back(rendition);
+  std::cerr << "Session " << session.device_id << ": rendition "
+            << want.width << "x" << want.height << "@" << want.fps << " ("
+            << session.renditions.size() << " extra)\n";
+  return rendition;
 }
 
 std::vector<std::string> SessionManager::list_devices() const {
@@ -89,6 +262,17 @@ std::vector<std::string> SessionManager::list_devices() const {
 #endif
     }
   }
+#endif
+#ifdef __linux__
+  if (capture_options_.test_devices) {
+    const auto ids = test_device_ids();
+    devices.insert(devices.end(), ids.begin(), ids.end());
+  }
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    for (const auto &entry : relays_)
+      devices.push_back(entry.first);
+  }
 #endif
   if (devices.empty()) {
     devices.push_back("video0"); // fallback hint
@@ -107,25 +291,71 @@ SessionManager::find(const std::string &device_id) {
 }
 
 void SessionManager::reap_loop() {
+  const auto idle_timeout = std::chrono::seconds(idle_timeout_seconds_);
+  std::chrono::steady_clock::time_point warm_retry{};
+  std::unique_lock<std::mutex> lock(mu_);
   while (!stop_reaper_) {
-    {
-      std::lock_guard<std::mutex> lock(mu_);
-      const auto now = std::chrono::steady_clock::now();
-      for (auto it = sessions_.begin(); it != sessions_.end();) {
-        auto &sess = it->second;
-        auto idle_for = std::chrono::duration_cast<std::chrono::seconds>(
-                            now - sess->last_accessed)
-                            .count();
-        if (sess->client_count.load() == 0 &&
-            idle_for > idle_timeout_seconds_) {
-          if (sess->capture)
-            sess->capture->stop();
+    const auto now = std::chrono::steady_clock::now();
+    // Sleeps until the earliest close, rendition check or keep-warm retry;
+    // with none pending, until a session is added or released.
+    auto next = std::chrono::steady_clock::time_point::max();
+    std::vector<std::shared_ptr<Session>> cold; // keep-warm, not running
+    std::vector<std::shared_ptr<SessionEncoder>> idle;
+    for (auto it = sessions_.begin(); it != sessions_.end();) {
+      auto &sess = it->second;
+      if (sess->warm && !sess->capture->running()) {
+        if (now >= warm_retry)
+          cold.push_back(sess);
+        else
+          next = std::min(next, warm_retry);
+      }
+      if (!sess->warm && sess->client_count.load() == 0) {
+        auto due = sess->last_accessed + idle_timeout;
+        if (sess->release_at != std::chrono::steady_clock::time_point{})
+          due = std::min(due, sess->release_at);
+        if (now >= due) {
+          stop_session(*sess);
           it = sessions_.erase(it);
-        } else {
-          ++it;
+          continue;
         }
+        next = std::min(next, due);
       }
+      // Renditions nobody watched for the idle timeout are dropped; the
+      // next request for that size recreates it.
+      {
+        std::lock_guard<std::mutex> rlock(sess->renditions_mu);
+        auto &list = sess->renditions;
+        for (auto r = list.begin(); r != list.end();) {
+          if ((*r)->idle_for(idle_timeout)) {
+            idle.push_back(*r);
+            r = list.erase(r);
+          } else {
+            ++r;
+          }
+        }
+        if (!list.empty())
+          next = std::min(next, now + std::max<std::chrono::seconds>(
+                                          idle_timeout, 1s));
+      }
+      ++it;
+    }
+    if (!cold.empty() || !idle.empty()) {
+      // Opening a camera or joining an encode thread can take a while; do
+      // it without blocking requests.
+      if (!cold.empty())
+        warm_retry = now + kWarmRetry;
+      lock.unlock();
+      for (auto &rendition : idle)
+        rendition->stop();
+      for (auto &sess : cold)
+        if (warm_up(*sess))
+          std::cerr << "Keep-warm " << sess->device_id << ": opened\n";
+      lock.lock();
+      continue;
     }
-    std::this_thread::sleep_for(10s);
+    if (next == std::chrono::steady_clock::time_point::max())
+      reaper_cv_.wait(lock);
+    else
+      reaper_cv_.wait_until(lock, next);
   }
 }
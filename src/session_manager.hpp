@@ -1,5 +1,7 @@
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
 #include <optional>
 #include <string>
@@ -8,26 +10,79 @@
 #include <vector>
 
 #include "capture_v4l2.hpp"
+#include "encoder_h264.hpp"
+#include "recorder.hpp"
+#include "relay_upstream.hpp"
 #include "types.hpp"
 
+class SessionEncoder;
+
 class SessionManager {
 public:
-  explicit SessionManager(int idle_timeout_seconds);
+  // A session nobody uses is closed after `idle_timeout_seconds`, or
+  // `linger_seconds` after its last viewer left, so quick reconnects find
+  // the camera still open.
+  explicit SessionManager(int idle_timeout_seconds,
+                          const CaptureOptions &capture_options = {},
+                          const EncoderOptions &encoder_options = {},
+                          int linger_seconds = 3);
   ~SessionManager();
 
   std::shared_ptr<Session> get_or_create(const std::string &device_id,
                                          const CaptureParams &params);
   void touch(const std::string &device_id);
+  // Called when a viewer leaves: schedules the close once the session has
+  // had no viewers for the linger time.
   void release_if_idle(const std::string &device_id);
+  // Opens `device_id` with `params` now and keeps its capture (and, for
+  // H.264, its encoder) running without viewers, so the first one gets a
+  // frame, SPS/PPS and a GOP at once. False if the device cannot be opened
+  // yet; the reaper retries.
+  bool keep_warm(const std::string &device_id, const CaptureParams &params);
+  // keep_warm() as H.264, plus a Recorder writing the session's encoded
+  // stream to disk for as long as the server runs.
+  bool record(const std::string &device_id, CaptureParams params,
+              const RecordOptions &options);
+  // Registers `relay:<name>`, a device fed by pulling `url` (see
+  // parse_relay_upstream) instead of a camera. Its viewers share the one
+  // upstream pull, whatever their transport. False on a malformed URL.
+  bool add_relay(const std::string &name, const std::string &url);
   std::vector<std::string> list_devices() const;
   std::optional<std::shared_ptr<Session>> find(const std::string &device_id);
+  // Every open session (for /metrics).
+  std::vector<std::shared_ptr<Session>> active() const;
+
+  // The H.264 encoder a viewer asking for `requested` (size, fps, bitrate)
+  // should join, once the capture runs: the session's own encoder when it
+  // matches or the capture cannot be scaled (MJPEG, camera H.264), else
+  // the rendition with that size and fps. Missing ones are created while
+  // there is room (with `create`); otherwise the closest one is used.
+  std::shared_ptr<SessionEncoder> encoder_for(Session &session,
+                                              const CaptureParams &requested,
+                                              bool create = true);
+  // The session's encoder followed by its renditions.
+  static std::vector<std::shared_ptr<SessionEncoder>>
+  encoders(Session &session);
 
 private:
+  // Renditions per session besides the full-size encoder.
+  static constexpr size_t kMaxRenditions = 4;
+
+  // Retry interval for keep-warm devices that failed to open.
+  static constexpr std::chrono::seconds kWarmRetry{5};
+
   void reap_loop();
+  static bool warm_up(Session &session);
+  static void stop_session(Session &session);
 
   mutable std::mutex mu_;
+  std::condition_variable reaper_cv_; // session released, added or shutdown
   std::unordered_map<std::string, std::shared_ptr<Session>> sessions_;
-  std::thread reaper_thread_;
-  std::atomic<bool> stop_reaper_{false};
+  std::unordered_map<std::string, RelayUpstream> relays_; // by device id
+  bool stop_reaper_ = false; // guarded by mu_
   const int idle_timeout_seconds_;
+  const int linger_seconds_;
+  const CaptureOptions capture_options_;
+  const EncoderOptions encoder_options_;
+  std::thread reaper_thread_; // last: starts once the rest is built
 };
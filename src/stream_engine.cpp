@@ -0,0 +1,672 @@
+#include "stream_engine.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+#include <utility>
+
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103 // Linux 4.18+; older headers lack it
+#endif
+#endif
+
+using namespace std::chrono_literals;
+
+#ifdef __linux__
+namespace {
+// Socket whose request the current pool thread is processing, and whether
+// deliver() took it over. Set by StreamServer::process_and_close_socket().
+thread_local int t_socket = -1;
+thread_local bool t_claimed = false;
+
+// Units pulled per connection before yielding to the others on the thread.
+constexpr int kMaxUnitsPerPump = 32;
+// A peer that has not accepted a byte for this long is considered gone.
+constexpr auto kStallTimeout = 10s;
+// Datagrams per GSO send / sendmmsg call (the kernel's UDP_MAX_SEGMENTS),
+// and the most bytes one GSO send may carry.
+constexpr size_t kMaxSegments = 64;
+constexpr size_t kMaxGsoBytes = 65000;
+
+std::string chunk_header(size_t size) {
+  char buf[24];
+  std::snprintf(buf, sizeof(buf), "%zx\r\n", size);
+  return buf;
+}
+} // namespace
+
+struct StreamEngine::Connection {
+  int fd = -1;
+  Framing framing = Framing::Chunked;
+  std::unique_ptr<StreamSource> source;
+  std::function<void(bool)> on_done;
+  std::shared_ptr<std::atomic<bool>> ready =
+      std::make_shared<std::atomic<bool>>(true);
+  // Unit being sent: out, then *tail, then the chunk's CRLF if `trailer`.
+  std::string out;
+  std::shared_ptr<const std::string> tail;
+  bool trailer = false;
+  size_t sent = 0;
+  bool want_write = false; // EPOLLOUT armed
+  std::chrono::steady_clock::time_point blocked_since{};
+  std::chrono::steady_clock::time_point resume_at =
+      std::chrono::steady_clock::time_point::max();
+  // Datagram only: bytes per datagram within a unit, whether UDP_SEGMENT is
+  // still worth trying, and the receivers of an unconnected socket with the
+  // next one due for the current chunk.
+  size_t segment = 0;
+  bool gso = true;
+  std::vector<sockaddr_storage> dests;
+  size_t next_dest = 0;
+
+  size_t pending_size() const {
+    return out.size() + (tail ? tail->size() : 0) + (trailer ? 2 : 0);
+  }
+  bool idle() const { return sent >= pending_size(); }
+  // The not-yet-sent part of the unit as up to three iovecs.
+  int unsent(iovec (&iov)[3]) const {
+    static const char kCrlf[] = "\r\n";
+    const std::pair<const char *, size_t> parts[3] = {
+        {out.data(), out.size()},
+        {tail ? tail->data() : nullptr, tail ? tail->size() : 0},
+        {kCrlf, trailer ? 2 : 0}};
+    size_t skip = sent;
+    int n = 0;
+    for (const auto &[data, size] : parts) {
+      if (skip >= size) {
+        skip -= size;
+        continue;
+      }
+      iov[n].iov_base = const_cast<char *>(data + skip);
+      iov[n].iov_len = size - skip;
+      skip = 0;
+      ++n;
+    }
+    return n;
+  }
+};
+
+struct StreamEngine::Worker {
+  int epfd = -1;
+  int wakefd = -1;
+  std::thread thread;
+  std::mutex mu; // guards incoming
+  std::vector<std::unique_ptr<Connection>> incoming;
+  std::unordered_map<int, std::unique_ptr<Connection>> conns; // I/O thread
+  std::atomic<size_t> count{0};
+
+  void wake() {
+    uint64_t one = 1;
+    ssize_t r = ::write(wakefd, &one, sizeof(one));
+    (void)r; // EAGAIN: a wake is already pending
+  }
+};
+
+StreamEngine::StreamEngine(unsigned threads) {
+  threads = std::max(1u, threads);
+  for (unsigned i = 0; i < threads; ++i) {
+    auto worker = std::make_unique<Worker>();
+    worker->epfd = epoll_create1(EPOLL_CLOEXEC);
+    worker->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (worker->epfd < 0 || worker->wakefd < 0) {
+      std::cerr << "StreamEngine: epoll/eventfd setup failed\n";
+      if (worker->epfd >= 0)
+        ::close(worker->epfd);
+      if (worker->wakefd >= 0)
+        ::close(worker->wakefd);
+      continue;
+    }
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = worker->wakefd;
+    epoll_ctl(worker->epfd, EPOLL_CTL_ADD, worker->wakefd, &ev);
+    workers_.push_back(std::move(worker));
+  }
+  for (auto &worker : workers_) {
+    Worker *w = worker.get();
+    w->thread = std::thread([this, w] { run(*w); });
+  }
+}
+
+StreamEngine::~StreamEngine() {
+  stop_ = true;
+  for (auto &worker : workers_) {
+    worker->wake();
+    if (worker->thread.joinable())
+      worker->thread.join();
+    ::close(worker->wakefd);
+    ::close(worker->epfd);
+  }
+}
+
+void StreamEngine::adopt(int fd, Framing framing,
+                         std::unique_ptr<StreamSource> source,
+                         std::function<void(bool)> on_done) {
+  if (workers_.empty() || stop_) {
+    source.reset();
+    ::close(fd);
+    if (on_done)
+      on_done(false);
+    return;
+  }
+  int flags = fcntl(fd, F_GETFL, 0);
+  fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+  auto conn = std::make_unique<Connection>();
+  conn->fd = fd;
+  conn->framing = framing;
+  conn->source = std::move(source);
+  conn->on_done = std::move(on_done);
+  conn->segment = conn->source->datagram_size();
+
+  Worker &worker = *workers_[next_worker_++ % workers_.size()];
+  // Only the first wake after a pump costs a syscall.
+  auto ready = conn->ready;
+  Worker *w = &worker;
+  conn->source->set_wake([ready, w] {
+    if (!ready->exchange(true))
+      w->wake();
+  });
+  {
+    std::lock_guard<std::mutex> lock(worker.mu);
+    worker.incoming.push_back(std::move(conn));
+  }
+  worker.count++;
+  worker.wake();
+}
+
+size_t StreamEngine::connection_count() const {
+  size_t total = 0;
+  for (const auto &worker : workers_)
+    total += worker->count.load();
+  return total;
+}
+
+void StreamEngine::run(Worker &worker) {
+  auto update_events = [&](Connection &c, bool want_write) {
+    if (c.want_write == want_write)
+      return;
+    c.want_write = want_write;
+    epoll_event ev{};
+    // Stream peers never send anything we need; EPOLLIN/RDHUP reveal a close.
+    ev.events = (c.framing != Framing::Datagram ? EPOLLIN | EPOLLRDHUP : 0u) |
+                (want_write ? EPOLLOUT : 0u);
+    ev.data.fd = c.fd;
+    epoll_ctl(worker.epfd, EPOLL_CTL_MOD, c.fd, &ev);
+  };
+
+  auto blocked = [](Connection &c) {
+    if (c.blocked_since == std::chrono::steady_clock::time_point{})
+      c.blocked_since = std::chrono::steady_clock::now();
+  };
+
+  // Sends the datagrams packed in c.out to the connected peer, or to each of
+  // c.dests. A message is either a GSO send of up to gso_count datagrams
+  // (UDP_SEGMENT) or, where the kernel or route refuses GSO, one datagram;
+  // up to kMaxSegments messages go out per sendmmsg, so one syscall covers
+  // a burst for every receiver.
+  auto flush_datagrams = [&](Connection &c) {
+    const size_t seg = c.segment > 0 ? c.segment : c.out.size();
+    const size_t gso_count =
+        std::max<size_t>(1, std::min(kMaxSegments, kMaxGsoBytes / seg));
+    const size_t targets = std::max<size_t>(1, c.dests.size());
+    const auto gso_size = static_cast<uint16_t>(seg);
+    while (c.sent < c.out.size()) {
+      const bool gso = c.gso && c.out.size() - c.sent > seg;
+      const size_t chunk = gso ? gso_count * seg : seg;
+      mmsghdr msgs[kMaxSegments] = {};
+      iovec iovs[kMaxSegments];
+      char control[kMaxSegments][CMSG_SPACE(sizeof(uint16_t))] = {};
+      unsigned count = 0;
+      for (size_t offset = c.sent, dest = c.next_dest;
+           offset < c.out.size() && count < kMaxSegments;) {
+        const size_t bytes = std::min(chunk, c.out.size() - offset);
+        iovs[count].iov_base = c.out.data() + offset;
+        iovs[count].iov_len = bytes;
+        msghdr &msg = msgs[count].msg_hdr;
+        msg.msg_iov = &iovs[count];
+        msg.msg_iovlen = 1;
+        if (!c.dests.empty()) {
+          msg.msg_name = &c.dests[dest];
+          msg.msg_namelen = c.dests[dest].ss_family == AF_INET6
+                                ? sizeof(sockaddr_in6)
+                                : sizeof(sockaddr_in);
+        }
+        if (bytes > seg) {
+          msg.msg_control = control[count];
+          msg.msg_controllen = sizeof(control[count]);
+          cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+          cm->cmsg_level = SOL_UDP;
+          cm->cmsg_type = UDP_SEGMENT;
+          cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+          std::memcpy(CMSG_DATA(cm), &gso_size, sizeof(gso_size));
+        }
+        ++count;
+        if (++dest == targets) {
+          dest = 0;
+          offset += bytes;
+        }
+      }
+      const int r = ::sendmmsg(c.fd, msgs, count, MSG_NOSIGNAL);
+      size_t advanced = static_cast<size_t>(r);
+      if (r < 0) {
+        if (errno == EINTR)
+          continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          blocked(c);
+          return true;
+        }
+        if (gso && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT ||
+                    errno == EOPNOTSUPP)) {
+          // Old kernel or no checksum offload on this route.
+          c.gso = false;
+          continue;
+        }
+        // ICMP-reported error (receiver not up yet) or an unreachable
+        // target: drop that message and carry on.
+        advanced = 1;
+      }
+      for (size_t i = 0; i < advanced; ++i) {
+        if (++c.next_dest == targets) {
+          c.next_dest = 0;
+          c.sent += std::min(chunk, c.out.size() - c.sent);
+        }
+      }
+      c.blocked_since = {};
+    }
+    return true;
+  };
+
+  // Writes as much of the unit as the socket takes, gathering its parts
+  // in one call. False on a fatal error.
+  auto flush = [&](Connection &c) {
+    if (c.framing == Framing::Datagram)
+      return flush_datagrams(c);
+    while (!c.idle()) {
+      iovec iov[3];
+      msghdr msg{};
+      msg.msg_iov = iov;
+      msg.msg_iovlen = static_cast<size_t>(c.unsent(iov));
+      ssize_t n = ::sendmsg(c.fd, &msg, MSG_NOSIGNAL);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          blocked(c);
+          return true;
+        }
+        return false;
+      }
+      c.sent += static_cast<size_t>(n);
+      c.blocked_since = {};
+    }
+    return true;
+  };
+
+  // Moves data from the source to the socket until either runs dry.
+  // Returns false once the connection should be closed; `ended` tells
+  // whether the source finished (as opposed to the peer failing).
+  std::string unit;
+  auto pump = [&](Connection &c, bool &ended) {
+    c.resume_at = std::chrono::steady_clock::time_point::max();
+    for (int i = 0; i < kMaxUnitsPerPump; ++i) {
+      if (!flush(c))
+        return false;
+      if (!c.idle()) {
+        update_events(c, true);
+        return true;
+      }
+      if (c.pending_size() > 0)
+        c.source->on_sent();
+      c.out.clear();
+      c.tail.reset();
+      c.trailer = false;
+      c.sent = 0;
+      unit.clear();
+      c.ready->store(false);
+      if (!c.source->pull(unit, c.tail)) {
+        ended = true;
+        if (c.framing == Framing::Chunked) {
+          static const char kLastChunk[] = "0\r\n\r\n";
+          ssize_t r = ::send(c.fd, kLastChunk, sizeof(kLastChunk) - 1,
+                             MSG_NOSIGNAL);
+          (void)r; // best effort; we are closing anyway
+        }
+        return false;
+      }
+      const size_t size = unit.size() + (c.tail ? c.tail->size() : 0);
+      if (size == 0) {
+        c.tail.reset();
+        c.resume_at = c.source->resume_at();
+        update_events(c, false);
+        return true;
+      }
+      if (c.framing == Framing::Chunked) {
+        // Appended, not assigned: c.out keeps the capacity it grew to.
+        c.out += chunk_header(size);
+        c.out += unit;
+        c.trailer = true;
+      } else { // Raw and Datagram go out as pulled
+        c.out.swap(unit);
+        if (c.framing == Framing::Datagram) {
+          if (c.tail) {
+            c.out += *c.tail; // datagram batches are sent from one buffer
+            c.tail.reset();
+          }
+          c.source->destinations(c.dests);
+          c.next_dest = 0;
+        }
+      }
+    }
+    // Still busy: let the other connections have a turn, then come back.
+    if (!c.ready->exchange(true))
+      worker.wake();
+    return true;
+  };
+
+  auto close_conn = [&](int fd, bool ended) {
+    auto it = worker.conns.find(fd);
+    if (it == worker.conns.end())
+      return;
+    std::unique_ptr<Connection> c = std::move(it->second);
+    worker.conns.erase(it);
+    epoll_ctl(worker.epfd, EPOLL_CTL_DEL, fd, nullptr);
+    ::shutdown(fd, SHUT_RDWR);
+    ::close(fd);
+    c->source.reset();
+    worker.count--;
+    if (c->on_done)
+      c->on_done(ended);
+  };
+
+  auto last_sweep = std::chrono::steady_clock::now();
+  std::vector<int> to_close;
+  std::vector<int> ended_fds;
+  epoll_event events[64];
+  int timeout_ms = 1000;
+  while (!stop_) {
+    const int n = epoll_wait(worker.epfd, events, 64, timeout_ms);
+    if (n < 0 && errno != EINTR)
+      break;
+    to_close.clear();
+    ended_fds.clear();
+
+    for (int i = 0; i < n; ++i) {
+      const int fd = events[i].data.fd;
+      if (fd == worker.wakefd) {
+        uint64_t value;
+        while (::read(worker.wakefd, &value, sizeof(value)) > 0) {
+        }
+        std::vector<std::unique_ptr<Connection>> incoming;
+        {
+          std::lock_guard<std::mutex> lock(worker.mu);
+          incoming.swap(worker.incoming);
+        }
+        for (auto &c : incoming) {
+          epoll_event ev{};
+          ev.events = c->framing != Framing::Datagram ? EPOLLIN | EPOLLRDHUP
+                                                      : 0u;
+          ev.data.fd = c->fd;
+          if (epoll_ctl(worker.epfd, EPOLL_CTL_ADD, c->fd, &ev) != 0) {
+            ::close(c->fd);
+            c->source.reset();
+            worker.count--;
+            if (c->on_done)
+              c->on_done(false);
+            continue;
+          }
+          worker.conns[c->fd] = std::move(c);
+        }
+        continue;
+      }
+      auto it = worker.conns.find(fd);
+      if (it == worker.conns.end())
+        continue;
+      Connection &c = *it->second;
+      const uint32_t ev = events[i].events;
+      if (c.framing == Framing::Datagram) {
+        if (ev & EPOLLERR) {
+          // Clear the pending ICMP error; UDP stays best-effort.
+          int err = 0;
+          socklen_t len = sizeof(err);
+          getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        }
+      } else if (ev & (EPOLLERR | EPOLLHUP)) {
+        to_close.push_back(fd);
+        continue;
+      } else if (ev & (EPOLLIN | EPOLLRDHUP)) {
+        // Chunked peers have nothing more to say, so their input is dropped;
+        // Raw peers (WebSocket) talk back. EOF means the viewer left.
+        char buf[4096];
+        ssize_t r = ::recv(fd, buf, sizeof(buf), 0);
+        if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR)) {
+          to_close.push_back(fd);
+          continue;
+        }
+        if (r > 0 && c.framing == Framing::Raw) {
+          if (!c.source->on_input(buf, static_cast<size_t>(r))) {
+            to_close.push_back(fd);
+            continue;
+          }
+          c.ready->store(true);
+        }
+      }
+      if (ev & EPOLLOUT)
+        c.ready->store(true);
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    const bool sweep = now - last_sweep >= 1s;
+    if (sweep)
+      last_sweep = now;
+    for (auto &[fd, conn] : worker.conns) {
+      Connection &c = *conn;
+      if (sweep && c.blocked_since != std::chrono::steady_clock::time_point{} &&
+          now - c.blocked_since > kStallTimeout) {
+        to_close.push_back(fd);
+        continue;
+      }
+      // The sweep also pulls idle sources so time-based ends (UDP duration)
+      // and closed subscribers are noticed without a wake; pacing sources
+      // are pulled again once their resume time has come.
+      if (!c.ready->load() && !(sweep && c.idle()) && c.resume_at > now)
+        continue;
+      bool ended = false;
+      if (!pump(c, ended)) {
+        if (ended)
+          ended_fds.push_back(fd);
+        else
+          to_close.push_back(fd);
+      }
+    }
+    auto next_resume = std::chrono::steady_clock::time_point::max();
+    for (auto &entry : worker.conns)
+      next_resume = std::min(next_resume, entry.second->resume_at);
+    timeout_ms = 1000;
+    if (next_resume != std::chrono::steady_clock::time_point::max()) {
+      const auto wait = std::chrono::ceil<std::chrono::milliseconds>(
+          next_resume - std::chrono::steady_clock::now());
+      timeout_ms = static_cast<int>(
+          std::clamp<std::chrono::milliseconds::rep>(wait.count(), 0, 1000));
+    }
+    for (int fd : ended_fds)
+      close_conn(fd, true);
+    for (int fd : to_close)
+      close_conn(fd, false);
+  }
+
+  std::vector<int> remaining;
+  for (auto &entry : worker.conns)
+    remaining.push_back(entry.first);
+  for (int fd : remaining)
+    close_conn(fd, false);
+  std::vector<std::unique_ptr<Connection>> incoming;
+  {
+    std::lock_guard<std::mutex> lock(worker.mu);
+    incoming.swap(worker.incoming);
+  }
+  for (auto &c : incoming) {
+    ::close(c->fd);
+    c->source.reset();
+    worker.count--;
+    if (c->on_done)
+      c->on_done(false);
+  }
+}
+
+StreamServer::StreamServer(unsigned io_threads) : engine_(io_threads) {
+  // A 101 answered through upgrade() has no body: drop the chunked framing
+  // httplib adds for the content provider and keep Connection: Upgrade.
+  set_header_writer([](httplib::Stream &strm,
+                       httplib::Headers &headers) -> ssize_t {
+    const bool upgrading = headers.find("Upgrade") != headers.end();
+    ssize_t total = 0;
+    for (const auto &[key, value] : headers) {
+      if (upgrading &&
+          (key == "Transfer-Encoding" || key == "Content-Type" ||
+           key == "Keep-Alive" || (key == "Connection" && value != "Upgrade")))
+        continue;
+      const std::string line = key + ": " + value + "\r\n";
+      if (strm.write(line.data(), line.size()) < 0)
+        return -1;
+      total += static_cast<ssize_t>(line.size());
+    }
+    if (strm.write("\r\n", 2) < 0)
+      return -1;
+    return total + 2;
+  });
+}
+
+bool StreamServer::process_and_close_socket(socket_t sock) {
+  t_socket = sock;
+  t_claimed = false;
+  auto ret = httplib::detail::process_server_socket(
+      svr_sock_, sock, keep_alive_max_count_, keep_alive_timeout_sec_,
+      read_timeout_sec_, read_timeout_usec_, write_timeout_sec_,
+      write_timeout_usec_,
+      [this](httplib::Stream &strm, bool close_connection,
+             bool &connection_closed) {
+        return process_request(strm, close_connection, connection_closed,
+                               nullptr);
+      });
+  t_socket = -1;
+  if (t_claimed)
+    return ret; // the engine owns the socket now
+  httplib::detail::shutdown_socket(sock);
+  httplib::detail::close_socket(sock);
+  return ret;
+}
+bool StreamServer::upgrade(httplib::Response &res,
+                           std::unique_ptr<StreamSource> source,
+                           std::function<void(bool)> on_done) {
+  auto holder = std::make_shared<std::unique_ptr<StreamSource>>(
+      std::move(source));
+  auto handed_off = std::make_shared<bool>(false);
+  res.status = 101;
+  res.set_chunked_content_provider(
+      "application/octet-stream",
+      [this, holder, handed_off, on_done](size_t, httplib::DataSink &) {
+        if (t_socket >= 0 && !t_claimed) {
+          t_claimed = true;
+          *handed_off = true;
+          engine_.adopt(t_socket, StreamEngine::Framing::Raw,
+                        std::move(*holder), on_done);
+        }
+        return false;
+      },
+      [handed_off, on_done](bool success) {
+        if (!*handed_off && on_done)
+          on_done(success);
+      });
+  return true;
+}
+#else
+StreamServer::StreamServer(unsigned io_threads) { (void)io_threads; }
+
+bool StreamServer::upgrade(httplib::Response &, std::unique_ptr<StreamSource>,
+                           std::function<void(bool)>) {
+  return false;
+}
+#endif
+
+void StreamServer::deliver(httplib::Response &res,
+                           const std::string &content_type,
+                           std::unique_ptr<StreamSource> source,
+                           std::function<void(bool)> on_done) {
+  auto holder = std::make_shared<std::unique_ptr<StreamSource>>(
+      std::move(source));
+  auto handed_off = std::make_shared<bool>(false);
+  res.set_chunked_content_provider(
+      content_type,
+      [this, holder, handed_off, on_done](size_t, httplib::DataSink &sink) {
+        (void)this; // engine_ only exists on Linux
+#ifdef __linux__
+        // First call: httplib has just flushed the headers. Take the socket
+        // and let httplib unwind; returning false stops it writing more.
+        if (t_socket >= 0 && !t_claimed) {
+          t_claimed = true;
+          *handed_off = true;
+          engine_.adopt(t_socket, StreamEngine::Framing::Chunked,
+                        std::move(*holder), on_done);
+          return false;
+        }
+#endif
+        // Fallback: drive the source from this pool thread.
+        StreamSource &src = **holder;
+        struct Waiter {
+          std::mutex mu;
+          std::condition_variable cv;
+          bool ready = false;
+        };
+        auto waiter = std::make_shared<Waiter>();
+        src.set_wake([waiter] {
+          {
+            std::lock_guard<std::mutex> lock(waiter->mu);
+            waiter->ready = true;
+          }
+          waiter->cv.notify_one();
+        });
+        std::string unit;
+        std::shared_ptr<const std::string> tail;
+        for (;;) {
+          unit.clear();
+          {
+            std::lock_guard<std::mutex> lock(waiter->mu);
+            waiter->ready = false;
+          }
+          if (!src.pull(unit, tail)) {
+            sink.done();
+            return true;
+          }
+          if (unit.empty() && !tail) {
+            std::unique_lock<std::mutex> lock(waiter->mu);
+            waiter->cv.wait_for(lock, 1s, [&] { return waiter->ready; });
+            continue;
+          }
+          if (tail)
+            unit += *tail; // one chunk per unit, as on the engine path
+          if (!sink.write(unit.data(), unit.size()))
+            return false;
+          src.on_sent();
+        }
+      },
+      [handed_off, on_done](bool success) {
+        if (!*handed_off && on_done)
+          on_done(success);
+      });
+}
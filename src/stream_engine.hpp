@@ -0,0 +1,130 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+
+#include "httplib.h"
+
+// Body of one long-lived response (or UDP stream). Whoever delivers it pulls
+// from it when the peer can take more, so a source never blocks and never
+// owns a thread.
+class StreamSource {
+public:
+  virtual ~StreamSource() = default;
+
+  // Installs the callback producers invoke (from their own threads) when
+  // pull() may have something new. Called once, before the first pull();
+  // the destructor must guarantee it is no longer running.
+  virtual void set_wake(std::function<void()> wake) = 0;
+  // Writes the next unit (a multipart frame, an access unit, a fragment, a
+  // datagram) into `out`, which is left empty when nothing is ready.
+  // Returns false once the stream has ended.
+  virtual bool pull(std::string &out) = 0;
+  // Scatter-gather form: the unit is `out` followed by `*tail` (if set), a
+  // buffer shared with other viewers that is written in place, never
+  // copied. Sources with such a payload override this one too.
+  virtual bool pull(std::string &out, std::shared_ptr<const std::string> &tail) {
+    tail.reset();
+    return pull(out);
+  }
+  // The unit last pulled has been handed to the kernel in full (for
+  // write-latency accounting).
+  virtual void on_sent() {}
+  // Datagram framing: a unit may pack several datagrams back to back, each
+  // this many bytes except the last, and is sent as one batch. 0 = one
+  // datagram per unit.
+  virtual size_t datagram_size() const { return 0; }
+  // Datagram framing on an unconnected socket: the receivers of the unit
+  // just pulled, each of which gets every datagram. Left empty for a
+  // connected socket.
+  virtual void destinations(std::vector<sockaddr_storage> &out) const {
+    out.clear();
+  }
+  // After a pull() that returned nothing because the source is pacing
+  // itself: when to pull again even without a wake.
+  virtual std::chrono::steady_clock::time_point resume_at() const {
+    return std::chrono::steady_clock::time_point::max();
+  }
+  // Bytes the peer sent on a Raw connection (e.g. WebSocket frames), called
+  // on the I/O thread; pull() is retried afterwards. False drops the peer.
+  virtual bool on_input(const char *data, size_t size) {
+    (void)data;
+    (void)size;
+    return true;
+  }
+};
+
+#ifdef __linux__
+// Readiness-driven delivery: a fixed set of I/O threads, each with its own
+// epoll set, serves every adopted connection. New data is announced through
+// StreamSource wakes, so viewers cost memory and bandwidth, not threads.
+class StreamEngine {
+public:
+  enum class Framing {
+    Chunked,  // HTTP/1.1 chunked body; headers already sent by httplib
+    Raw,      // upgraded connection: units go out as-is, input is forwarded
+    Datagram, // connected UDP socket; see StreamSource::datagram_size()
+  };
+
+  explicit StreamEngine(unsigned threads = 2);
+  ~StreamEngine();
+
+  // Takes ownership of `fd` and serves `source` on it until the source ends
+  // (on_done(true)) or the peer goes away (on_done(false)). on_done runs on
+  // an I/O thread after the source has been destroyed.
+  void adopt(int fd, Framing framing, std::unique_ptr<StreamSource> source,
+             std::function<void(bool)> on_done);
+  size_t connection_count() const;
+
+private:
+  struct Connection;
+  struct Worker;
+
+  void run(Worker &worker);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<size_t> next_worker_{0};
+  std::atomic<bool> stop_{false};
+};
+#endif
+
+// httplib server whose pool threads only parse requests and write response
+// headers. deliver() hands the rest of a streaming response to the engine,
+// freeing the pool thread for /stats, /device/list and the next viewer.
+class StreamServer : public httplib::Server {
+public:
+  explicit StreamServer(unsigned io_threads = 2);
+
+  // Serves `source` as the chunked body of `res`. Falls back to driving the
+  // source from the pool thread where handoff is unavailable (non-Linux).
+  void deliver(httplib::Response &res, const std::string &content_type,
+               std::unique_ptr<StreamSource> source,
+               std::function<void(bool)> on_done);
+
+  // Completes a protocol switch: the caller has set the 101 headers; once
+  // httplib has written them the socket carries `source`'s units verbatim
+  // and peer input reaches StreamSource::on_input(). Linux only; elsewhere
+  // returns false and leaves `res` untouched.
+  bool upgrade(httplib::Response &res, std::unique_ptr<StreamSource> source,
+               std::function<void(bool)> on_done);
+
+#ifdef __linux__
+  StreamEngine &engine() { return engine_; }
+
+private:
+  // Same as httplib's, except that a socket claimed by deliver() is left
+  // open for the engine.
+  bool process_and_close_socket(socket_t sock) override;
+
+  StreamEngine engine_;
+#endif
+};
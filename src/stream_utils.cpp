@@ -1,40 +1,41 @@
 #include "stream_utils.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
 #include <iostream>
 #include <optional>
 #include <sstream>
 #include <thread>
 
 #include "api_router.hpp"
+#include "capture_pattern.hpp"
 #include "capture_v4l2.hpp"
-#include "encoder_h264.hpp"
 #include "mp4_frag.hpp"
+#include "session_encoder.hpp"
+#include "session_manager.hpp"
+#include "stream_engine.hpp"
+#include "udp_output.hpp"
+#include "websocket.hpp"
 #include "types.hpp"
-#include "yuv_convert.hpp"
+
+#include <sys/resource.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/videodev2.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
 
 using namespace std::chrono_literals;
 
 namespace stream {
-namespace {
-// Minimal 1x1 white JPEG (valid) for placeholder MJPEG stream.
-static const unsigned char kTinyJpeg[] = {
-    0xFF, 0xD8, 0xFF, 0xDB, 0x00, 0x43, 0x00, 0x03, 0x02, 0x02, 0x03, 0x02,
-    0x02, 0x03, 0x03, 0x03, 0x03, 0x04, 0x03, 0x03, 0x04, 0x05, 0x08, 0x05,
-    0x05, 0x04, 0x04, 0x05, 0x0A, 0x07, 0x07, 0x06, 0x08, 0x0C, 0x0A, 0x0C,
-    0x0C, 0x0B, 0x0A, 0x0B, 0x0B, 0x0D, 0x0E, 0x12, 0x10, 0x0D, 0x0E, 0x11,
-    0x0E, 0x0B, 0x0B, 0x10, 0x16, 0x10, 0x11, 0x13, 0x14, 0x15, 0x15, 0x15,
-    0x0C, 0x0F, 0x17, 0x18, 0x16, 0x14, 0x18, 0x12, 0x14, 0x15, 0x14, 0xFF,
-    0xC0, 0x00, 0x11, 0x08, 0x00, 0x01, 0x00, 0x01, 0x03, 0x01, 0x11, 0x00,
-    0x02, 0x11, 0x01, 0x03, 0x11, 0x01, 0xFF, 0xC4, 0x00, 0x14, 0x00, 0x01,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0xFF, 0xC4, 0x00, 0x14, 0x10, 0x01, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0xFF, 0xDA, 0x00, 0x0C, 0x03, 0x01, 0x00, 0x02, 0x11, 0x03,
-    0x11, 0x00, 0x3F, 0x00, 0xFF, 0xD9};
-} // namespace
 
 std::string json_array(const std::vector<std::string> &items) {
   std::string out = "[";
@@ -56,6 +57,117 @@ std::string build_error_json(const std::string &msg,
   return out;
 }
 
+std::string build_metrics_text(
+    const std::vector<std::shared_ptr<Session>> &sessions) {
+  struct Sample {
+    std::string labels;
+    const LatencyHistogram *histogram;
+  };
+  std::vector<Sample> stages;
+  std::vector<Sample> viewer_stages;
+  std::map<std::string, std::string> counters; // family -> samples
+  std::vector<std::shared_ptr<ViewerMetrics>> viewers; // keeps them alive
+  auto counter = [&counters](const char *name, const std::string &labels,
+                             uint64_t value) {
+    counters[name] += std::string(name) + "{" + labels + "} " +
+                      std::to_string(value) + "\n";
+  };
+
+  for (const auto &session : sessions) {
+    const std::string device = "device=" + prometheus_label(session->device_id);
+    uint64_t viewer_drops = session->frames_dropped.load();
+    if (session->capture) {
+      const CaptureMetrics &capture = session->capture->metrics();
+      stages.push_back({device + ",stage=\"capture\"", &capture.dequeue});
+      counter("silkcast_frames_dropped_total",
+              device + ",where=\"capture\"", capture.dropped.load());
+      counter("silkcast_frames_duplicate_total", device,
+              capture.duplicate.load());
+    }
+    for (const auto &encoder : SessionManager::encoders(*session)) {
+      viewer_drops += encoder->dropped_frames();
+      const auto &r = encoder->requested();
+      const std::string labels =
+          device + ",rendition=" +
+          prometheus_label(encoder->scaled()
+                               ? std::to_string(r.width) + "x" +
+                                     std::to_string(r.height) + "@" +
+                                     std::to_string(r.fps)
+                               : "full");
+      stages.push_back({labels + ",stage=\"convert\"",
+                        &encoder->metrics().convert});
+      stages.push_back(
+          {labels + ",stage=\"encode\"", &encoder->metrics().encode});
+    }
+    const DeliveryMetrics &delivery = session->metrics.delivery;
+    stages.push_back({device + ",stage=\"queue\"", &delivery.queue});
+    stages.push_back({device + ",stage=\"mux\"", &delivery.mux});
+    stages.push_back({device + ",stage=\"write\"", &delivery.write});
+    stages.push_back({device + ",stage=\"total\"", &delivery.total});
+    counter("silkcast_frames_dropped_total",
+            device + ",where=\"viewer\"", viewer_drops);
+    counter("silkcast_frames_sent_total", device,
+            session->frames_sent.load());
+    counter("silkcast_bytes_sent_total", device,
+            session->bytes_sent.load());
+
+    for (auto &viewer : session->metrics.viewers()) {
+      const std::string labels = device + ",viewer=\"" +
+                                 std::to_string(viewer->id) + "\",kind=" +
+                                 prometheus_label(viewer->kind);
+      const DeliveryMetrics &d = viewer->delivery;
+      viewer_stages.push_back({labels + ",stage=\"queue\"", &d.queue});
+      viewer_stages.push_back({labels + ",stage=\"mux\"", &d.mux});
+      viewer_stages.push_back({labels + ",stage=\"write\"", &d.write});
+      viewer_stages.push_back({labels + ",stage=\"total\"", &d.total});
+      counter("silkcast_viewer_frames_sent_total", labels,
+              d.frames.load());
+      counter("silkcast_viewer_bytes_sent_total", labels,
+              d.bytes.load());
+      counter("silkcast_viewer_frames_dropped_total", labels,
+              d.dropped.load());
+      viewers.push_back(std::move(viewer));
+    }
+  }
+
+  std::string out;
+  write_prometheus_family(
+      out, "silkcast_stage_seconds", "histogram",
+      "Per-stage frame latency: capture (driver timestamp to dequeue), "
+      "convert, encode, queue, mux, write, and total (capture to socket).");
+  for (const auto &s : stages)
+    s.histogram->write_prometheus(out, "silkcast_stage_seconds", s.labels);
+  write_prometheus_family(out, "silkcast_viewer_stage_seconds", "histogram",
+                          "Per-viewer delivery latency by stage.");
+  for (const auto &s : viewer_stages)
+    s.histogram->write_prometheus(out, "silkcast_viewer_stage_seconds",
+                                  s.labels);
+  const std::pair<const char *, const char *> families[] = {
+      {"silkcast_frames_sent_total", "Frames delivered to viewers."},
+      {"silkcast_bytes_sent_total", "Bytes delivered to viewers."},
+      {"silkcast_frames_dropped_total",
+       "Frames lost by the driver (capture) or shed for slow viewers."},
+      {"silkcast_frames_duplicate_total",
+       "Frames the driver delivered with a repeated timestamp or sequence."},
+      {"silkcast_viewer_frames_sent_total", "Frames delivered to a viewer."},
+      {"silkcast_viewer_bytes_sent_total", "Bytes delivered to a viewer."},
+      {"silkcast_viewer_frames_dropped_total", "Frames a viewer skipped."}};
+  for (const auto &[name, help] : families) {
+    write_prometheus_family(out, name, "counter", help);
+    out += counters[name];
+  }
+  // Lets load tests put a CPU cost on each viewer.
+  rusage usage{};
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    const double cpu = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+                       (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    write_prometheus_family(out, "process_cpu_seconds_total", "counter",
+                            "User and system CPU time spent, in seconds.");
+    out += "process_cpu_seconds_total " + std::to_string(cpu) + "\n";
+  }
+  return out;
+}
+
 const char *pixel_format_label(PixelFormat fmt) {
   switch (fmt) {
   case PixelFormat::MJPEG:
@@ -64,6 +176,10 @@ const char *pixel_format_label(PixelFormat fmt) {
     return "yuyv";
   case PixelFormat::NV12:
     return "nv12";
+  case PixelFormat::I420:
+    return "i420";
+  case PixelFormat::H264:
+    return "h264";
   default:
     return "unknown";
   }
@@ -224,76 +340,241 @@ std::string build_device_caps_json(const std::string &device_id,
 }
 #endif // __linux__
 
-std::vector<uint8_t> annexb_to_avcc(const std::string &annexb) {
-  std::vector<uint8_t> out;
-  size_t i = 0;
-  auto len = annexb.size();
-  auto is_start_code = [&annexb, len](size_t pos) {
-    return pos + 2 < len && annexb[pos] == 0 && annexb[pos + 1] == 0 &&
-           (annexb[pos + 2] == 1 ||
-            (annexb[pos + 2] == 0 && pos + 3 < len && annexb[pos + 3] == 1));
+std::vector<NalSpan> annexb_nals(const std::string &annexb) {
+  std::vector<NalSpan> nals;
+  annexb_nals(annexb, nals);
+  return nals;
+}
+
+void annexb_nals(const std::string &annexb, std::vector<NalSpan> &nals) {
+  nals.clear();
+  const auto *p = reinterpret_cast<const uint8_t *>(annexb.data());
+  const size_t len = annexb.size();
+  size_t start = 0;
+  bool in_nal = false;
+  auto close_nal = [&](size_t end) {
+    if (!in_nal || end <= start)
+      return;
+    NalSpan span;
+    span.offset = static_cast<uint32_t>(start);
+    span.size = static_cast<uint32_t>(end - start);
+    span.type = p[start] & 0x1F;
+    span.ref_idc = (p[start] >> 5) & 0x03;
+    nals.push_back(span);
   };
-  while (i + 3 < len) {
-    if (!is_start_code(i)) {
-      ++i;
+  size_t i = 0;
+  while (i + 2 < len) {
+    if (p[i] == 0 && p[i + 1] == 0 && p[i + 2] == 1) {
+      // A zero ahead of 00 00 01 belongs to a 4-byte start code.
+      close_nal(i > 0 && p[i - 1] == 0 ? i - 1 : i);
+      start = i + 3;
+      in_nal = true;
+      i += 3;
       continue;
     }
-    size_t sc_size = (annexb[i + 2] == 1) ? 3 : 4;
-    size_t start = i + sc_size;
-    size_t next = start;
-    while (next + 3 < len && !is_start_code(next)) {
-      ++next;
-    }
-    size_t end = (next + 3 < len) ? next : len;
-    size_t nalsize = end - start;
-    uint32_t n = static_cast<uint32_t>(nalsize);
-    out.push_back((n >> 24) & 0xFF);
-    out.push_back((n >> 16) & 0xFF);
-    out.push_back((n >> 8) & 0xFF);
-    out.push_back(n & 0xFF);
-    out.insert(out.end(), annexb.begin() + start,
-               annexb.begin() + start + nalsize);
-    i = next;
+    ++i;
   }
+  close_nal(len);
+}
+
+std::string nals_to_avcc(const std::string &data,
+                         const std::vector<NalSpan> &nals) {
+  std::string out;
+  nals_to_avcc(data, nals, out);
   return out;
 }
 
+void nals_to_avcc(const std::string &data, const std::vector<NalSpan> &nals,
+                  std::string &out) {
+  size_t total = 0;
+  for (const auto &nal : nals)
+    total += 4 + nal.size;
+  out.clear();
+  out.reserve(total);
+  for (const auto &nal : nals) {
+    const uint32_t n = nal.size;
+    out.push_back(static_cast<char>((n >> 24) & 0xFF));
+    out.push_back(static_cast<char>((n >> 16) & 0xFF));
+    out.push_back(static_cast<char>((n >> 8) & 0xFF));
+    out.push_back(static_cast<char>(n & 0xFF));
+    out.append(data, nal.offset, nal.size);
+  }
+}
+
+std::string annexb_to_avcc(const std::string &annexb) {
+  return nals_to_avcc(annexb, annexb_nals(annexb));
+}
+
+const std::string &frame_avcc(const EncodedFrame &frame) {
+  std::call_once(frame.avcc_once, [&frame] {
+    if (frame.nals.empty())
+      frame.avcc = annexb_to_avcc(frame.data);
+    else
+      nals_to_avcc(frame.data, frame.nals, frame.avcc);
+  });
+  return frame.avcc;
+}
+
 void extract_sps_pps(const std::string &annexb, std::vector<uint8_t> &sps,
                      std::vector<uint8_t> &pps) {
-  size_t i = 0;
-  auto len = annexb.size();
-  auto is_start_code = [&annexb, len](size_t pos) {
-    return pos + 2 < len && annexb[pos] == 0 && annexb[pos + 1] == 0 &&
-           (annexb[pos + 2] == 1 ||
-            (annexb[pos + 2] == 0 && pos + 3 < len && annexb[pos + 3] == 1));
-  };
-  while (i + 3 < len) {
-    if (!is_start_code(i)) {
-      ++i;
-      continue;
-    }
-    size_t sc_size = (annexb[i + 2] == 1) ? 3 : 4;
-    size_t start = i + sc_size;
-    size_t next = start;
-    while (next + 3 < len && !is_start_code(next)) {
-      ++next;
+  for (const auto &nal : annexb_nals(annexb)) {
+    const auto *begin =
+        reinterpret_cast<const uint8_t *>(annexb.data()) + nal.offset;
+    if (nal.type == 7 && sps.empty())
+      sps.assign(begin, begin + nal.size);
+    else if (nal.type == 8 && pps.empty())
+      pps.assign(begin, begin + nal.size);
+    if (!sps.empty() && !pps.empty())
+      break;
+  }
+}
+
+namespace {
+// Exp-Golomb reader over an RBSP (emulation prevention bytes removed).
+class BitReader {
+public:
+  explicit BitReader(std::vector<uint8_t> rbsp) : data_(std::move(rbsp)) {}
+  bool ok() const { return ok_; }
+  uint32_t bits(int n) {
+    uint32_t v = 0;
+    for (int i = 0; i < n; ++i) {
+      if (pos_ >= data_.size() * 8) {
+        ok_ = false;
+        return 0;
+      }
+      v = (v << 1) | ((data_[pos_ / 8] >> (7 - pos_ % 8)) & 1);
+      ++pos_;
     }
-    size_t end = (next + 3 < len) ? next : len;
-    size_t nalsize = end - start;
-    if (nalsize == 0) {
-      i = next;
+    return v;
+  }
+  uint32_t ue() {
+    int zeros = 0;
+    while (ok_ && bits(1) == 0)
+      if (++zeros > 31)
+        ok_ = false;
+    return ok_ ? (1u << zeros) - 1 + bits(zeros) : 0;
+  }
+  int32_t se() {
+    const uint32_t v = ue();
+    return (v & 1) ? static_cast<int32_t>((v + 1) / 2)
+                   : -static_cast<int32_t>(v / 2);
+  }
+
+private:
+  std::vector<uint8_t> data_;
+  size_t pos_ = 0;
+  bool ok_ = true;
+};
+} // namespace
+
+bool sps_dimensions(const std::vector<uint8_t> &sps, int &width,
+                    int &height) {
+  std::vector<uint8_t> rbsp;
+  rbsp.reserve(sps.size());
+  int zeros = 0;
+  for (size_t i = 1; i < sps.size(); ++i) { // past the NAL header
+    if (zeros >= 2 && sps[i] == 3) {
+      zeros = 0; // emulation prevention byte
       continue;
     }
-    uint8_t nal_type = static_cast<uint8_t>(annexb[start]) & 0x1F;
-    if (nal_type == 7 && sps.empty()) {
-      sps.assign(annexb.begin() + start, annexb.begin() + start + nalsize);
-    } else if (nal_type == 8 && pps.empty()) {
-      pps.assign(annexb.begin() + start, annexb.begin() + start + nalsize);
+    zeros = sps[i] == 0 ? zeros + 1 : 0;
+    rbsp.push_back(sps[i]);
+  }
+  BitReader r(std::move(rbsp));
+  const uint32_t profile = r.bits(8);
+  r.bits(16); // constraint flags, level_idc
+  r.ue();     // seq_parameter_set_id
+  uint32_t chroma_format = 1;
+  switch (profile) {
+  case 100: case 110: case 122: case 244: case 44: case 83: case 86:
+  case 118: case 128: case 138: case 139: case 134: case 135:
+    chroma_format = r.ue();
+    if (chroma_format == 3)
+      r.bits(1); // separate_colour_plane_flag
+    r.ue();      // bit_depth_luma_minus8
+    r.ue();      // bit_depth_chroma_minus8
+    r.bits(1);   // qpprime_y_zero_transform_bypass_flag
+    if (r.bits(1)) { // seq_scaling_matrix_present_flag
+      for (int i = 0; i < (chroma_format != 3 ? 8 : 12); ++i) {
+        if (!r.bits(1))
+          continue;
+        int last = 8;
+        int next = 8;
+        for (int j = 0; j < (i < 6 ? 16 : 64) && next != 0 && r.ok(); ++j) {
+          next = (last + r.se() + 256) % 256;
+          last = next == 0 ? last : next;
+        }
+      }
     }
-    if (!sps.empty() && !pps.empty())
-      break;
-    i = next;
+    break;
+  default:
+    break;
   }
+  r.ue(); // log2_max_frame_num_minus4
+  const uint32_t poc_type = r.ue();
+  if (poc_type == 0) {
+    r.ue(); // log2_max_pic_order_cnt_lsb_minus4
+  } else if (poc_type == 1) {
+    r.bits(1); // delta_pic_order_always_zero_flag
+    r.se();    // offset_for_non_ref_pic
+    r.se();    // offset_for_top_to_bottom_field
+    const uint32_t cycle = r.ue();
+    for (uint32_t i = 0; i < cycle && r.ok(); ++i)
+      r.se();
+  }
+  r.ue();    // max_num_ref_frames
+  r.bits(1); // gaps_in_frame_num_value_allowed_flag
+  const uint32_t width_mbs = r.ue() + 1;
+  const uint32_t height_units = r.ue() + 1;
+  const uint32_t frame_mbs_only = r.bits(1);
+  if (!frame_mbs_only)
+    r.bits(1); // mb_adaptive_frame_field_flag
+  r.bits(1);   // direct_8x8_inference_flag
+  uint32_t crop[4] = {0, 0, 0, 0}; // left, right, top, bottom
+  if (r.bits(1))
+    for (auto &c : crop)
+      c = r.ue();
+  if (!r.ok() || width_mbs > 1024 || height_units > 1024)
+    return false;
+  // Crop offsets count chroma samples (luma for 4:4:4 and monochrome).
+  const uint32_t unit_x = chroma_format == 1 || chroma_format == 2 ? 2 : 1;
+  const uint32_t unit_y =
+      (chroma_format == 1 ? 2 : 1) * (2 - frame_mbs_only);
+  const int64_t w =
+      static_cast<int64_t>(width_mbs) * 16 - unit_x * (crop[0] + crop[1]);
+  const int64_t h = static_cast<int64_t>(height_units) * 16 *
+                        (2 - frame_mbs_only) -
+                    unit_y * (crop[2] + crop[3]);
+  if (w <= 0 || h <= 0)
+    return false;
+  width = static_cast<int>(w);
+  height = static_cast<int>(h);
+  return true;
+}
+
+MediaClock::MediaClock(int fps)
+    : nominal_(fps > 0 ? MediaClock::kTimescale / static_cast<uint32_t>(fps)
+                       : 6000) {}
+
+uint64_t MediaClock::stamp(std::chrono::steady_clock::time_point captured_at,
+                           uint32_t &duration) {
+  if (!started_) {
+    started_ = true;
+    origin_ = captured_at;
+    duration = nominal_;
+    return 0;
+  }
+  const auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                      captured_at - origin_)
+                      .count();
+  const uint64_t ticks =
+      us > 0 ? static_cast<uint64_t>(us) * 9 / 100 : 0; // us -> 90 kHz
+  // A repeated or backwards capture time moves on by one nominal frame.
+  const uint64_t stamp = ticks > last_ ? ticks : last_ + nominal_;
+  duration = static_cast<uint32_t>(
+      std::min<uint64_t>(stamp - last_, MediaClock::kTimescale));
+  last_ = stamp;
+  return stamp;
 }
 
 CaptureParams parse_params(const httplib::Request &req) {
@@ -305,7 +586,8 @@ CaptureParams parse_params(const httplib::Request &req) {
   if (req.has_param("fps"))
     p.fps = std::stoi(req.get_param_value("fps"));
   if (req.has_param("bitrate"))
-    p.bitrate_kbps = std::stoi(req.get_param_value("bitrate"));
+    p.bitrate_kbps = std::clamp(std::stoi(req.get_param_value("bitrate")),
+                                kMinBitrateKbps, kMaxBitrateKbps);
   if (req.has_param("quality"))
     p.quality = std::stoi(req.get_param_value("quality"));
   if (req.has_param("gop"))
@@ -316,10 +598,29 @@ CaptureParams parse_params(const httplib::Request &req) {
     p.latency = req.get_param_value("latency");
   if (req.has_param("container"))
     p.container = req.get_param_value("container");
+  if (req.has_param("still"))
+    p.still = std::clamp(std::stoi(req.get_param_value("still")), 0, 255);
   apply_latency_preset(p);
   return p;
 }
 
+CaptureParams parse_params(const std::string &query) {
+  httplib::Request req;
+  size_t pos = 0;
+  while (pos <= query.size()) {
+    size_t end = query.find('&', pos);
+    if (end == std::string::npos)
+      end = query.size();
+    const std::string pair = query.substr(pos, end - pos);
+    const size_t eq = pair.find('=');
+    if (!pair.empty())
+      req.params.emplace(pair.substr(0, eq),
+                         eq == std::string::npos ? "" : pair.substr(eq + 1));
+    pos = end + 1;
+  }
+  return parse_params(req);
+}
+
 void apply_latency_preset(CaptureParams &p) {
   if (p.latency == "zerolatency") {
     if (p.codec.empty() || p.codec == "mjpeg")
@@ -357,7 +658,9 @@ void add_effective_headers(httplib::Response &res, const EffectiveParams &eff) {
                      ";bitrate=" + std::to_string(a.bitrate_kbps) +
                      ";quality=" + std::to_string(a.quality) +
                      ";gop=" + std::to_string(a.gop) + ";latency=" + a.latency +
-                     ";container=" + a.container);
+                     ";container=" + a.container +
+                     ";still=" + std::to_string(a.still) +
+                     (eff.passthrough ? ";passthrough=1" : ""));
 }
 
 void serve_mjpeg_placeholder(const CaptureParams &p, httplib::Response &res,
@@ -368,348 +671,911 @@ void serve_mjpeg_placeholder(const CaptureParams &p, httplib::Response &res,
   res.set_chunked_content_provider(
       "multipart/x-mixed-replace; boundary=" + std::string(boundary),
       [p, boundary, session](size_t, httplib::DataSink &sink) mutable {
-        const int frame_interval_ms = std::max(1, 1000 / std::max(1, p.fps));
+        const auto interval = std::chrono::milliseconds(
+            std::max(1, 1000 / std::max(1, p.fps)));
+        const std::vector<uint8_t> &jpeg = tiny_jpeg();
         std::string prefix =
             "--" + std::string(boundary) +
             "\r\nContent-Type: image/jpeg\r\nContent-Length: " +
-            std::to_string(sizeof(kTinyJpeg)) + "\r\n\r\n";
+            std::to_string(jpeg.size()) + "\r\n\r\n";
+        // Deadlines, so the time spent writing does not slow the rate.
+        auto next = std::chrono::steady_clock::now();
         for (;;) {
           if (!sink.write(prefix.data(), prefix.size()))
             return false;
-          if (!sink.write(reinterpret_cast<const char *>(kTinyJpeg),
-                          sizeof(kTinyJpeg)))
+          if (!sink.write(reinterpret_cast<const char *>(jpeg.data()),
+                          jpeg.size()))
             return false;
           if (!sink.write("\r\n", 2))
             return false;
           session->frames_sent.fetch_add(1);
-          session->bytes_sent.fetch_add(prefix.size() + sizeof(kTinyJpeg) + 2);
-          session->last_accessed = std::chrono::steady_clock::now();
-          std::this_thread::sleep_for(
-              std::chrono::milliseconds(frame_interval_ms));
+          session->bytes_sent.fetch_add(prefix.size() + jpeg.size() + 2);
+          const auto now = std::chrono::steady_clock::now();
+          session->last_accessed = now;
+          next = std::max(next + interval, now);
+          std::this_thread::sleep_until(next);
         }
         return true;
       },
       on_done);
 }
 
-void serve_mjpeg_live(const CaptureParams &p, httplib::Response &res,
-                      std::shared_ptr<Session> session,
+namespace {
+// Frames come either from a session encoder's fan-out (H.264: the full-size
+// one or a rendition) or straight from the capture (MJPEG, no encoder).
+// Both announce new data through the wake, so a source never needs a
+// thread of its own. Each source is one viewer in the session's metrics:
+// queue time ends when a frame is taken, mux time when its unit is built
+// (count()), and write time once the engine reports the unit sent.
+//
+// A time-shifted viewer (`rewind` > 0) reads the encoder's rewind ring
+// instead of subscribing. Each frame goes out as long after its capture as
+// the starting IDR was behind live, paced through resume_at().
+class FeedSource : public StreamSource {
+public:
+  FeedSource(std::shared_ptr<Session> session,
+             std::shared_ptr<SessionEncoder> encoder, const char *kind,
+             std::chrono::milliseconds rewind = {})
+      : session_(std::move(session)), encoder_(std::move(encoder)),
+        viewer_(session_->metrics.add_viewer(kind)) {
+    if (encoder_ && rewind.count() > 0)
+      replay_next_ = encoder_->rewind_from(rewind);
+    if (replay_next_)
+      replay_delay_ =
+          std::chrono::steady_clock::now() - replay_next_->captured_at;
+    else if (encoder_)
+      sub_ = encoder_->subscribe();
+  }
+  ~FeedSource() override {
+    if (sub_) {
+      sub_->set_listener(nullptr);
+      encoder_->unsubscribe(sub_);
+    } else if (listener_ != 0 && session_->capture) {
+      session_->capture->remove_frame_listener(listener_);
+    }
+  }
+
+  void set_wake(std::function<void()> wake) override {
+    if (sub_)
+      sub_->set_listener(std::move(wake));
+    else if (session_->capture && !encoder_)
+      listener_ = session_->capture->add_frame_listener(std::move(wake));
+  }
+
+  std::chrono::steady_clock::time_point resume_at() const override {
+    return replay_resume_;
+  }
+
+protected:
+  // Next encoded access unit, if one is queued. Sets `ended` once the
+  // encoder has closed this subscriber.
+  EncodedFramePtr next_encoded(bool &ended) {
+    if (!sub_)
+      return next_replayed(ended);
+    auto frame = sub_->pop(0ms);
+    ended = !frame && sub_->closed();
+    if (frame) {
+      taken(frame->published_at, frame->captured_at);
+      viewer_->delivery.dropped.store(sub_->dropped(),
+                                      std::memory_order_relaxed);
+    }
+    return frame;
+  }
+  // Latest capture not yet seen; a reader that falls behind skips ahead
+  // (counted in Session::frames_dropped). A JPEG judged unchanged
+  // (CaptureParams::still) is passed over like one already sent.
+  FrameRef next_capture() {
+    if (!session_->capture)
+      return nullptr;
+    FrameRef frame = session_->capture->latest_frame();
+    if (!frame || frame->seq <= last_seq_)
+      return nullptr;
+    // Newest frame wins: anything published since the last pull is gone.
+    if (last_seq_ != 0) {
+      session_->frames_dropped.fetch_add(frame->seq - last_seq_ - 1);
+      viewer_->delivery.dropped.fetch_add(frame->seq - last_seq_ - 1,
+                                          std::memory_order_relaxed);
+    }
+    last_seq_ = frame->seq;
+    if (unchanged_jpeg(*frame)) {
+      session_->frames_unchanged.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    taken(frame->dequeued_at, frame->captured_at);
+    return frame;
+  }
+  // A unit is ready; `frame` when it completes a frame.
+  void count(size_t bytes, bool frame) {
+    const auto now = std::chrono::steady_clock::now();
+    if (taken_at_ != std::chrono::steady_clock::time_point{}) {
+      record(&DeliveryMetrics::mux, taken_at_, now);
+      taken_at_ = {};
+    }
+    if (frame) {
+      session_->frames_sent.fetch_add(1);
+      viewer_->delivery.frames.fetch_add(1, std::memory_order_relaxed);
+      built_at_ = now;
+      built_captured_at_ = captured_at_;
+    }
+    session_->bytes_sent.fetch_add(bytes);
+    viewer_->delivery.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    session_->last_accessed = now;
+  }
+
+  void on_sent() override {
+    if (built_at_ == std::chrono::steady_clock::time_point{})
+      return;
+    const auto now = std::chrono::steady_clock::now();
+    record(&DeliveryMetrics::write, built_at_, now);
+    record(&DeliveryMetrics::total, built_captured_at_, now);
+    built_at_ = {};
+  }
+
+  std::shared_ptr<Session> session_;
+  const std::shared_ptr<SessionEncoder> encoder_;
+  std::shared_ptr<FrameSubscriber> sub_;
+
+private:
+  EncodedFramePtr next_replayed(bool &ended) {
+    const auto now = std::chrono::steady_clock::now();
+    ended = false;
+    if (!replay_next_)
+      replay_next_ = encoder_->rewind_next(replay_seq_, ended);
+    if (!replay_next_) {
+      // Only if the encoder stalled: poll, there is no wake.
+      replay_resume_ = now + 20ms;
+      return nullptr;
+    }
+    const auto due = replay_next_->captured_at + replay_delay_;
+    if (now < due) {
+      replay_resume_ = due;
+      return nullptr;
+    }
+    replay_resume_ = std::chrono::steady_clock::time_point::max();
+    auto frame = std::move(replay_next_);
+    replay_seq_ = frame->seq;
+    // Latency counts from when the frame was due, not from its capture.
+    taken(due, due);
+    return frame;
+  }
+  // There are no pixels to compare without decoding, but a static scene
+  // compresses to nearly the same size every time and motion moves it.
+  // One part a second still goes, so a viewer can tell the feed is alive.
+  bool unchanged_jpeg(const CapturedFrame &frame) {
+    const int still = session_->params.still;
+    if (still <= 0 || session_->capture->pixel_format() != PixelFormat::MJPEG)
+      return false;
+    const size_t last = last_jpeg_size_;
+    if (last > 0 &&
+        frame.captured_at - last_jpeg_at_ < std::chrono::seconds(1)) {
+      const size_t diff =
+          frame.size > last ? frame.size - last : last - frame.size;
+      if (diff * 1000 <= last * static_cast<size_t>(still))
+        return true;
+    }
+    last_jpeg_size_ = frame.size;
+    last_jpeg_at_ = frame.captured_at;
+    return false;
+  }
+  void taken(std::chrono::steady_clock::time_point published,
+             std::chrono::steady_clock::time_point captured) {
+    taken_at_ = std::chrono::steady_clock::now();
+    captured_at_ = captured;
+    record(&DeliveryMetrics::queue, published, taken_at_);
+  }
+  // Into this viewer's figures and the session's totals.
+  void record(LatencyHistogram DeliveryMetrics::*stage,
+              std::chrono::steady_clock::time_point from,
+              std::chrono::steady_clock::time_point to) {
+    (viewer_->delivery.*stage).record(from, to);
+    (session_->metrics.delivery.*stage).record(from, to);
+  }
+
+  const std::shared_ptr<ViewerMetrics> viewer_;
+  EncodedFramePtr replay_next_;
+  uint64_t replay_seq_ = 0;
+  std::chrono::steady_clock::duration replay_delay_{};
+  std::chrono::steady_clock::time_point replay_resume_ =
+      std::chrono::steady_clock::time_point::max();
+  uint64_t listener_ = 0;
+  uint64_t last_seq_ = 0;
+  size_t last_jpeg_size_ = 0; // last JPEG not held back as unchanged
+  std::chrono::steady_clock::time_point last_jpeg_at_{};
+  std::chrono::steady_clock::time_point taken_at_{};
+  std::chrono::steady_clock::time_point captured_at_{};
+  std::chrono::steady_clock::time_point built_at_{};
+  std::chrono::steady_clock::time_point built_captured_at_{};
+};
+
+class MjpegSource : public FeedSource {
+public:
+  explicit MjpegSource(std::shared_ptr<Session> session)
+      : FeedSource(std::move(session), nullptr, "mjpeg") {}
+
+  bool pull(std::string &out) override {
+    if (!session_->capture)
+      return false;
+    FrameRef frame = next_capture();
+    if (!frame || session_->capture->pixel_format() != PixelFormat::MJPEG)
+      return true;
+    // Built in place: `out` comes back with its last capacity.
+    out.assign("--frame\r\nContent-Type: image/jpeg\r\nContent-Length: ");
+    out += std::to_string(frame->size);
+    out += "\r\n\r\n";
+    out.append(reinterpret_cast<const char *>(frame->data()), frame->size);
+    out.append("\r\n");
+    count(out.size(), true);
+    return true;
+  }
+};
+
+class H264Source : public FeedSource {
+public:
+  H264Source(std::shared_ptr<Session> session,
+             std::shared_ptr<SessionEncoder> encoder,
+             std::chrono::milliseconds rewind)
+      : FeedSource(std::move(session), std::move(encoder), "h264", rewind) {}
+
+  bool pull(std::string &out) override {
+    std::shared_ptr<const std::string> unit;
+    const bool more = pull(out, unit);
+    if (unit)
+      out += *unit;
+    return more;
+  }
+
+  // Access units (ours or the camera's) carry Annex-B start codes and go
+  // out as they are: every viewer writes the frame's own buffer.
+  bool pull(std::string &out,
+            std::shared_ptr<const std::string> &tail) override {
+    out.clear();
+    tail.reset();
+    bool ended = false;
+    auto frame = next_encoded(ended);
+    if (!frame)
+      return !ended;
+    tail = std::shared_ptr<const std::string>(frame, &frame->data);
+    count(frame->data.size(), true);
+    return true;
+  }
+};
+
+class Fmp4Source : public FeedSource {
+public:
+  Fmp4Source(std::shared_ptr<Session> session,
+             std::shared_ptr<SessionEncoder> encoder, const CaptureParams &p,
+             const std::vector<uint8_t> &sps, const std::vector<uint8_t> &pps,
+             std::chrono::milliseconds rewind)
+      : FeedSource(std::move(session), std::move(encoder), "fmp4", rewind),
+        mux_(p.width, p.height, p.fps, sps, pps), clock_(p.fps) {}
+
+  bool pull(std::string &out) override {
+    std::shared_ptr<const std::string> sample;
+    const bool more = pull(out, sample);
+    if (sample)
+      out += *sample;
+    return more;
+  }
+
+  // The fragment header is patched from the muxer's template; the mdat
+  // payload is the frame's shared AVCC buffer, converted once for all
+  // fMP4 viewers and handed to the writer as is.
+  bool pull(std::string &out,
+            std::shared_ptr<const std::string> &tail) override {
+    tail.reset();
+    if (!sent_init_) {
+      sent_init_ = true;
+      out = mux_.build_init_segment();
+      return true;
+    }
+    bool ended = false;
+    auto frame = next_encoded(ended);
+    if (!frame)
+      return !ended;
+    const std::string &avcc = frame_avcc(*frame);
+    uint32_t duration = 0;
+    const uint64_t decode_time = clock_.stamp(frame->captured_at, duration);
+    mux_.write_fragment_header(out, seqno_++, decode_time, duration,
+                               static_cast<uint32_t>(avcc.size()),
+                               frame->keyframe);
+    tail = std::shared_ptr<const std::string>(frame, &avcc);
+    count(out.size() + avcc.size(), true);
+    return true;
+  }
+
+private:
+  Mp4Fragmenter mux_;
+  MediaClock clock_;
+  bool sent_init_ = false;
+  uint32_t seqno_ = 1;
+};
+
+// Splits each frame into `mtu`-sized datagrams behind a UdpFrameHeader,
+// packed back to back so the engine sends a whole burst with one GSO send
+// (or sendmmsg). With pacing, fragment k of N is held back until k/N of
+// 80% of the frame interval has passed, so an IDR does not hit the switch
+// as one line-rate burst. A persistent output sends every burst to all of
+// its targets and runs until they are gone.
+//
+// Loss repair: with `fec`, every group of that many fragments is followed by
+// an XOR parity datagram, so a receiver can rebuild one missing fragment
+// per group on its own. H.264 senders also keep their last kRingFrames
+// access units and resend NACKed fragments (see UdpNacks) ahead of new
+// data, so a lost packet costs a packet instead of an IDR.
+class UdpSource : public FeedSource {
+public:
+  UdpSource(std::shared_ptr<Session> session,
+            std::shared_ptr<SessionEncoder> encoder, const UdpOptions &options)
+      : FeedSource(std::move(session), std::move(encoder), "udp"),
+        mtu_(std::clamp<size_t>(options.mtu, kMinMtu, kMaxMtu)),
+        max_payload_(mtu_ - sizeof(UdpFrameHeader) -
+                     (options.timestamps ? sizeof(uint32_t) : 0)),
+        fec_(std::clamp(options.fec, 0, kMaxFecSpan)),
+        timestamps_(options.timestamps),
+        spread_(options.pace ? pacing_spread(session_->params.fps)
+                             : std::chrono::steady_clock::duration::zero()),
+        deadline_(options.targets
+                      ? std::chrono::steady_clock::time_point::max()
+                      : std::chrono::steady_clock::now() + options.duration),
+        targets_(options.targets), peer_(options.peer) {
+    if (sub_) {
+      // Captured (MJPEG) frames pin capture buffers, so only encoded
+      // frames are kept for retransmission.
+      nacks_ = std::make_shared<UdpNacks>();
+      std::lock_guard<std::mutex> lock(session_->udp_mu);
+      auto &inboxes = session_->udp_nacks;
+      inboxes.erase(std::remove_if(inboxes.begin(), inboxes.end(),
+                                   [](const auto &w) { return w.expired(); }),
+                    inboxes.end());
+      inboxes.push_back(nacks_);
+    }
+  }
+  ~UdpSource() override {
+    // A feedback request may still hold the inbox.
+    if (nacks_)
+      nacks_->set_wake(nullptr);
+  }
+
+  void set_wake(std::function<void()> wake) override {
+    if (nacks_)
+      nacks_->set_wake(wake);
+    FeedSource::set_wake(std::move(wake));
+  }
+  size_t datagram_size() const override { return mtu_; }
+  void destinations(std::vector<sockaddr_storage> &out) const override {
+    if (retransmit_to_) {
+      out.assign(1, *retransmit_to_);
+    } else if (targets_) {
+      targets_->snapshot(out);
+    } else {
+      out.clear();
+    }
+  }
+  std::chrono::steady_clock::time_point resume_at() const override {
+    return resume_at_;
+  }
+
+  bool pull(std::string &out) override {
+    resume_at_ = std::chrono::steady_clock::time_point::max();
+    retransmit_to_.reset();
+    const auto now = std::chrono::steady_clock::now();
+    if (now >= deadline_ || (targets_ && targets_->ended()))
+      return false;
+    // One reused buffer per burst; the only copy is the payload itself.
+    out.clear();
+    if (nacks_ && retransmit(out))
+      return true;
+    if (frag_id_ >= num_frags_ && !next_frame(now))
+      return !ended_;
+
+    size_t burst = num_frags_ - frag_id_;
+    if (spread_.count() > 0) {
+      const auto elapsed = now - frame_start_;
+      const size_t due =
+          elapsed >= spread_
+              ? num_frags_
+              : std::min<size_t>(num_frags_, 1 + elapsed * num_frags_ / spread_);
+      if (due <= frag_id_) {
+        resume_at_ = frame_start_ + spread_ * frag_id_ / num_frags_;
+        return true;
+      }
+      burst = due - frag_id_;
+    }
+
+    out.reserve((burst + (fec_ > 0 ? burst / fec_ + 2 : 0)) * mtu_);
+    for (size_t i = 0; i < burst; ++i) {
+      const uint16_t frag = frag_id_++;
+      const bool final = frag + 1 == num_frags_;
+      // Parity follows its group, except for the frame's last group: there
+      // it goes ahead of the (short) final fragment, which keeps that one
+      // last in the burst as GSO requires.
+      if (fec_ > 0 && final)
+        append_parity(out, frag - frag % fec_);
+      append_fragment(out, frame_id_, data_, size_, frag, num_frags_, 0,
+                      captured_at_);
+      if (fec_ > 0 && !final && (frag + 1) % fec_ == 0)
+        append_parity(out, frag + 1 - fec_);
+    }
+
+    const bool last = frag_id_ >= num_frags_;
+    count(out.size(), last);
+    return true;
+  }
+
+private:
+  static constexpr size_t kMinMtu = 576;
+  static constexpr size_t kMaxMtu = 9000;
+  static constexpr int kMaxFecSpan = 32;
+  // Retransmit window: about a second of video at 30 fps.
+  static constexpr size_t kRingFrames = 32;
+
+  static std::chrono::steady_clock::duration pacing_spread(int fps) {
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::microseconds(800000 / std::max(1, fps)));
+  }
+
+  size_t fragment_size(size_t frame_size, size_t frag) const {
+    return std::min(max_payload_, frame_size - frag * max_payload_);
+  }
+
+  // The header, plus the capture time when the receiver asked for it.
+  void append_header(std::string &out, UdpFrameHeader header,
+                     std::chrono::steady_clock::time_point captured_at) {
+    if (!timestamps_) {
+      out.append(reinterpret_cast<const char *>(&header), sizeof(header));
+      return;
+    }
+    if (ts_origin_ == std::chrono::steady_clock::time_point{})
+      ts_origin_ = captured_at;
+    const auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                        captured_at - ts_origin_)
+                        .count();
+    const auto pts = static_cast<uint32_t>(static_cast<uint64_t>(us) * 9 / 100);
+    header.flags |= kUdpTimestamp;
+    out.append(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.append(reinterpret_cast<const char *>(&pts), sizeof(pts));
+  }
+
+  void append_fragment(std::string &out, uint32_t frame_id,
+                       const uint8_t *data, size_t size, size_t frag,
+                       uint16_t num_frags, uint8_t flags,
+                       std::chrono::steady_clock::time_point captured_at) {
+    const size_t chunk = fragment_size(size, frag);
+    UdpFrameHeader header{};
+    header.frame_id = frame_id;
+    header.frag_id = static_cast<uint16_t>(frag);
+    header.num_frags = num_frags;
+    header.data_size = static_cast<uint16_t>(chunk);
+    header.flags = flags;
+    append_header(out, header, captured_at);
+    out.append(reinterpret_cast<const char *>(data + frag * max_payload_),
+               chunk);
+  }
+
+  // XOR of the current frame's fragments [first, first + fec_), zero-padded
+  // to a full payload. data_size carries the XOR of their sizes, so the
+  // size of a rebuilt fragment is known too.
+  void append_parity(std::string &out, size_t first) {
+    const size_t end = std::min<size_t>(first + fec_, num_frags_);
+    UdpFrameHeader header{};
+    header.frame_id = frame_id_;
+    header.frag_id = static_cast<uint16_t>(first);
+    header.num_frags = num_frags_;
+    header.flags = kUdpParity;
+    header.fec_span = static_cast<uint8_t>(end - first);
+    for (size_t f = first; f < end; ++f)
+      header.data_size ^= static_cast<uint16_t>(fragment_size(size_, f));
+    append_header(out, header, captured_at_);
+    const size_t pos = out.size();
+    out.append(max_payload_, '\0');
+    auto *parity = reinterpret_cast<uint8_t *>(out.data() + pos);
+    for (size_t f = first; f < end; ++f) {
+      const uint8_t *src = data_ + f * max_payload_;
+      const size_t n = fragment_size(size_, f);
+      for (size_t i = 0; i < n; ++i)
+        parity[i] ^= src[i];
+    }
+  }
+
+  // Answers the oldest NACK this sender can serve; false if none.
+  bool retransmit(std::string &out) {
+    UdpNacks::Request request;
+    while (nacks_->pop(request)) {
+      if (request.has_target &&
+          (targets_ ? !targets_->contains(request.target)
+                    : !same_udp_address(request.target, peer_)))
+        continue; // another output's receiver
+      auto it = std::find_if(ring_.begin(), ring_.end(), [&](const auto &f) {
+        return static_cast<uint32_t>(f->seq) == request.frame_id;
+      });
+      if (it == ring_.end())
+        continue; // too old, or not one of ours
+      const auto *data = reinterpret_cast<const uint8_t *>((*it)->data.data());
+      const size_t size = (*it)->data.size();
+      const auto num_frags =
+          static_cast<uint16_t>((size + max_payload_ - 1) / max_payload_);
+      std::sort(request.frags.begin(), request.frags.end());
+      request.frags.erase(
+          std::unique(request.frags.begin(), request.frags.end()),
+          request.frags.end());
+      for (uint16_t frag : request.frags) {
+        if (frag < num_frags)
+          append_fragment(out, request.frame_id, data, size, frag, num_frags,
+                          kUdpRetransmit, (*it)->captured_at);
+      }
+      if (out.empty())
+        continue;
+      if (targets_ && request.has_target)
+        retransmit_to_ = request.target;
+      count(out.size(), false);
+      return true;
+    }
+    return false;
+  }
+
+  bool next_frame(std::chrono::steady_clock::time_point now) {
+    size_ = 0;
+    if (sub_) {
+      encoded_ = next_encoded(ended_);
+      if (!encoded_)
+        return false;
+      data_ = reinterpret_cast<const uint8_t *>(encoded_->data.data());
+      size_ = encoded_->data.size();
+      frame_id_ = static_cast<uint32_t>(encoded_->seq);
+      captured_at_ = encoded_->captured_at;
+      ring_.push_back(encoded_);
+      if (ring_.size() > kRingFrames)
+        ring_.pop_front();
+    } else {
+      if (!session_->capture) {
+        ended_ = true;
+        return false;
+      }
+      captured_ = next_capture();
+      if (!captured_)
+        return false;
+      data_ = captured_->data();
+      size_ = captured_->size;
+      frame_id_ = static_cast<uint32_t>(captured_->seq);
+      captured_at_ = captured_->captured_at;
+    }
+    frag_id_ = 0;
+    num_frags_ =
+        static_cast<uint16_t>((size_ + max_payload_ - 1) / max_payload_);
+    frame_start_ = now;
+    return size_ > 0;
+  }
+
+  const size_t mtu_;
+  const size_t max_payload_;
+  const int fec_; // data fragments per parity datagram; 0 = off
+  const bool timestamps_;
+  const std::chrono::steady_clock::duration spread_; // zero = no pacing
+  const std::chrono::steady_clock::time_point deadline_;
+  const std::shared_ptr<UdpTargets> targets_;
+  const sockaddr_storage peer_;
+  std::shared_ptr<UdpNacks> nacks_;
+  std::deque<EncodedFramePtr> ring_; // recently sent, for retransmission
+  std::optional<sockaddr_storage> retransmit_to_;
+  std::chrono::steady_clock::time_point frame_start_{};
+  std::chrono::steady_clock::time_point captured_at_{}; // current frame
+  std::chrono::steady_clock::time_point ts_origin_{};   // 90 kHz zero
+  std::chrono::steady_clock::time_point resume_at_ =
+      std::chrono::steady_clock::time_point::max();
+  EncodedFramePtr encoded_; // keeps the current frame alive
+  FrameRef captured_;
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+  uint32_t frame_id_ = 0;
+  uint16_t frag_id_ = 0;
+  uint16_t num_frags_ = 0;
+  bool ended_ = false;
+};
+
+// One binary message per access unit or JPEG, prefixed with a 13-byte
+// big-endian header: [u8 flags][u32 seq][u64 capture time, us since epoch].
+// flags bit 0 = keyframe, bit 1 = JPEG (else H.264 Annex-B). Text messages
+// from the client carry feedback: "idr", "bitrate <kbps>" or a receiver
+// report "report loss=<0..1> jitter=<ms> rate=<kbps>" for the congestion
+// controller.
+class WsSource : public FeedSource {
+public:
+  WsSource(std::shared_ptr<Session> session,
+           std::shared_ptr<SessionEncoder> encoder)
+      : FeedSource(std::move(session), std::move(encoder), "ws"),
+        h264_(encoder_ != nullptr),
+        receiver_id_("ws:" + std::to_string(next_receiver_id_.fetch_add(1))),
+        wall_offset_(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch() -
+            std::chrono::steady_clock::now().time_since_epoch())) {}
+
+  bool pull(std::string &out) override {
+    if (!control_.empty()) {
+      out.swap(control_);
+      control_.clear();
+      return true;
+    }
+    if (closing_)
+      return false;
+    uint8_t flags = 0;
+    uint64_t seq = 0;
+    std::chrono::steady_clock::time_point captured_at;
+    const char *data = nullptr;
+    size_t size = 0;
+    EncodedFramePtr encoded;
+    FrameRef captured;
+    if (h264_) {
+      bool ended = false;
+      encoded = next_encoded(ended);
+      if (!encoded)
+        return !ended;
+      flags = encoded->keyframe ? 0x01 : 0x00;
+      seq = encoded->seq;
+      captured_at = encoded->captured_at;
+      data = encoded->data.data();
+      size = encoded->data.size();
+    } else {
+      if (!session_->capture)
+        return false;
+      captured = next_capture();
+      if (!captured ||
+          session_->capture->pixel_format() != PixelFormat::MJPEG)
+        return true;
+      flags = 0x03; // every JPEG stands alone
+      seq = captured->seq;
+      captured_at = captured->captured_at;
+      data = reinterpret_cast<const char *>(captured->data());
+      size = captured->size;
+    }
+
+    // Steady-clock capture time mapped onto the wall clock, so the browser
+    // can compare it with Date.now() for glass-to-glass latency.
+    const uint64_t wall_us = static_cast<uint64_t>(
+        (std::chrono::duration_cast<std::chrono::microseconds>(
+             captured_at.time_since_epoch()) +
+         wall_offset_)
+            .count());
+    char header[13];
+    header[0] = static_cast<char>(flags);
+    for (int i = 0; i < 4; ++i)
+      header[1 + i] = static_cast<char>((seq >> (24 - 8 * i)) & 0xFF);
+    for (int i = 0; i < 8; ++i)
+      header[5 + i] = static_cast<char>((wall_us >> (56 - 8 * i)) & 0xFF);
+    ws::append_frame(out, ws::kBinary, header, sizeof(header), data, size);
+    count(out.size(), true);
+    return true;
+  }
+
+  bool on_input(const char *data, size_t size) override {
+    if (!reader_.feed(data, size))
+      return false;
+    ws::Opcode opcode;
+    std::string payload;
+    while (reader_.next(opcode, payload)) {
+      switch (opcode) {
+      case ws::kText:
+        handle_command(payload);
+        break;
+      case ws::kPing:
+        ws::append_frame(control_, ws::kPong, nullptr, 0, payload.data(),
+                         payload.size());
+        break;
+      case ws::kClose:
+        // Echo the close and end once it is out.
+        ws::append_frame(control_, ws::kClose, nullptr, 0, payload.data(),
+                         std::min<size_t>(payload.size(), 125));
+        closing_ = true;
+        return true;
+      default:
+        break; // binary/continuation/pong: nothing we act on
+      }
+    }
+    return true;
+  }
+
+private:
+  void handle_command(const std::string &text) {
+    if (text == "idr" && h264_) {
+      encoder_->request_idr();
+    } else if (text.rfind("bitrate ", 0) == 0 && h264_) {
+      const int kbps = std::atoi(text.c_str() + 8);
+      if (kbps > 0)
+        encoder_->request_bitrate(
+            std::clamp(kbps, kMinBitrateKbps, kMaxBitrateKbps));
+    } else if (text.rfind("report ", 0) == 0 && h264_) {
+      ReceiverReport report;
+      std::istringstream fields(text.substr(7));
+      std::string field;
+      while (fields >> field) {
+        const auto eq = field.find('=');
+        if (eq == std::string::npos)
+          continue;
+        const std::string key = field.substr(0, eq);
+        const char *value = field.c_str() + eq + 1;
+        if (key == "loss")
+          report.loss = std::atof(value);
+        else if (key == "jitter")
+          report.jitter_ms = std::atof(value);
+        else if (key == "rate")
+          report.receive_kbps = std::atoi(value);
+      }
+      encoder_->report(receiver_id_, report);
+    }
+  }
+
+  static inline std::atomic<uint64_t> next_receiver_id_{1};
+  const bool h264_;
+  const std::string receiver_id_;
+  // Steady to wall clock, fixed when the viewer joins: capture_us steps by
+  // exactly the capture interval, without the jitter of reading both clocks
+  // per frame or an NTP slew.
+  const std::chrono::microseconds wall_offset_;
+  ws::FrameReader reader_;
+  std::string control_; // pong/close frames, sent ahead of media
+  bool closing_ = false;
+};
+} // namespace
+
+void serve_mjpeg_live(StreamServer &server, const CaptureParams &p,
+                      httplib::Response &res, std::shared_ptr<Session> session,
                       std::function<void(bool)> on_done) {
-  const auto boundary = "frame";
+  (void)p; // paced by the capture, which already runs at the session's fps
   res.set_header("Connection", "close");
-  res.set_chunked_content_provider(
-      "multipart/x-mixed-replace; boundary=" + std::string(boundary),
-      [p, boundary, session](size_t, httplib::DataSink &sink) mutable {
-        const int frame_interval_ms = std::max(1, 1000 / std::max(1, p.fps));
-        std::string prefix;
-        std::string frame;
-        for (;;) {
-          if (!session->capture || !session->capture->running()) {
-            std::this_thread::sleep_for(20ms);
-            continue;
-          }
-          if (session->capture->pixel_format() != PixelFormat::MJPEG ||
-              !session->capture->latest_frame(frame)) {
-            std::this_thread::sleep_for(10ms);
-            continue;
-          }
-          prefix = "--" + std::string(boundary) +
-                   "\r\nContent-Type: image/jpeg\r\nContent-Length: " +
-                   std::to_string(frame.size()) + "\r\n\r\n";
-          if (!sink.write(prefix.data(), prefix.size()))
-            return false;
-          if (!sink.write(frame.data(), frame.size()))
-            return false;
-          if (!sink.write("\r\n", 2))
-            return false;
-          session->frames_sent.fetch_add(1);
-          session->bytes_sent.fetch_add(prefix.size() + frame.size() + 2);
-          session->last_accessed = std::chrono::steady_clock::now();
-          std::this_thread::sleep_for(
-              std::chrono::milliseconds(frame_interval_ms));
-        }
-        return true;
-      },
-      on_done);
+  server.deliver(res, "multipart/x-mixed-replace; boundary=frame",
+                 std::make_unique<MjpegSource>(std::move(session)),
+                 std::move(on_done));
 }
 
-void serve_h264_live(const CaptureParams &p, httplib::Response &res,
-                     std::shared_ptr<Session> session,
-                     std::function<void(bool)> on_done) {
-#ifdef HAS_OPENH264
+void serve_h264_live(StreamServer &server, const CaptureParams &p,
+                     httplib::Response &res, std::shared_ptr<Session> session,
+                     std::shared_ptr<SessionEncoder> encoder,
+                     std::function<void(bool)> on_done,
+                     std::chrono::milliseconds rewind) {
+  if (!encoder->available()) {
+    res.status = 503;
+    res.set_content(
+        build_error_json("h264_unavailable",
+                         "OpenH264 not enabled and camera has no H.264"),
+        "application/json");
+    on_done(false);
+    return;
+  }
+  (void)p;
   res.set_header("Connection", "close");
   res.set_header("Content-Type", "video/H264");
-  res.set_chunked_content_provider(
-      "video/H264",
-      [p, session](size_t, httplib::DataSink &sink) mutable {
-        H264Encoder encoder;
-        bool encoder_ready = false;
-        if (!encoder_ready) {
-          if (!encoder.init(session->params)) {
-            return false;
-          }
-          encoder.force_idr();
-          encoder_ready = true;
-        }
-        const int y_size = p.width * p.height;
-        const int uv_size = (p.width / 2) * (p.height / 2);
-        std::string frame;
-        std::string yuv;
-        yuv.resize(y_size + 2 * uv_size);
-        uint8_t *y = reinterpret_cast<uint8_t *>(yuv.data());
-        uint8_t *u = y + y_size;
-        uint8_t *v = u + uv_size;
-
-        const int frame_interval_ms = std::max(1, 1000 / std::max(1, p.fps));
-        bool first = true;
-        uint32_t last_idr = session->idr_request_seq.load();
-        for (;;) {
-          if (!session->capture || !session->capture->running()) {
-            std::this_thread::sleep_for(20ms);
-            continue;
-          }
-          PixelFormat fmt = session->capture->pixel_format();
-          if ((fmt != PixelFormat::YUYV && fmt != PixelFormat::NV12) ||
-              !session->capture->latest_frame(frame)) {
-            std::this_thread::sleep_for(10ms);
-            continue;
-          }
-          if (fmt == PixelFormat::YUYV) {
-            yuyv_to_i420(reinterpret_cast<const uint8_t *>(frame.data()),
-                         p.width, p.height, y, u, v);
-          } else {
-            const uint8_t *src_y =
-                reinterpret_cast<const uint8_t *>(frame.data());
-            const uint8_t *src_uv = src_y + (p.width * p.height);
-            nv12_to_i420(src_y, src_uv, p.width, p.height, p.width, p.width, y,
-                         u, v);
-          }
-          if (first) {
-            encoder.force_idr();
-            first = false;
-          }
-          uint32_t current_idr = session->idr_request_seq.load();
-          if (current_idr > last_idr) {
-            encoder.force_idr();
-            last_idr = current_idr;
-          }
-          std::string nal;
-          if (!encoder.encode_i420(y, u, v, nal)) {
-            std::this_thread::sleep_for(5ms);
-            continue;
-          }
-          if (!nal.empty()) {
-            static const char start_code[] = {0, 0, 0, 1};
-            if (!sink.write(start_code, 4))
-              return false;
-            if (!sink.write(nal.data(), nal.size()))
-              return false;
-            session->frames_sent.fetch_add(1);
-            session->bytes_sent.fetch_add(4 + nal.size());
-            session->last_accessed = std::chrono::steady_clock::now();
-          }
-          std::this_thread::sleep_for(
-              std::chrono::milliseconds(frame_interval_ms));
-        }
-        return true;
-      },
-      on_done);
-#else
-  (void)p;
-  res.status = 503;
-  res.set_content(build_error_json("h264_unavailable", "OpenH264 not enabled"),
-                  "application/json");
-  on_done(false);
-#endif
+  // Encoded once per session; this viewer only pays for its socket writes.
+  server.deliver(res, "video/H264",
+                 std::make_unique<H264Source>(std::move(session),
+                                              std::move(encoder), rewind),
+                 std::move(on_done));
 }
 
-void serve_fmp4_live(const CaptureParams &p, httplib::Response &res,
-                     std::shared_ptr<Session> session,
-                     std::function<void(bool)> on_done) {
-#ifdef HAS_OPENH264
+void serve_fmp4_live(StreamServer &server, const CaptureParams &p,
+                     httplib::Response &res, std::shared_ptr<Session> session,
+                     std::shared_ptr<SessionEncoder> encoder,
+                     std::function<void(bool)> on_done,
+                     std::chrono::milliseconds rewind) {
+  if (!encoder->available()) {
+    res.status = 503;
+    res.set_content(
+        build_error_json("h264_unavailable",
+                         "OpenH264 not enabled and camera has no H.264"),
+        "application/json");
+    on_done(false);
+    return;
+  }
   res.set_header("Connection", "close");
   res.set_header("Content-Type", "video/mp4");
   res.set_header("Cache-Control", "no-store");
   res.set_header("Access-Control-Allow-Origin", "*");
-  const uint32_t sample_duration = p.fps > 0 ? (90000 / p.fps) : 6000;
 
-  res.set_chunked_content_provider(
-      "video/mp4",
-      [p, session, sample_duration](size_t, httplib::DataSink &sink) mutable {
-        H264Encoder encoder;
-        if (!encoder.init(session->params))
-          return false;
-        encoder.force_idr();
-        std::vector<uint8_t> sps = session->sps;
-        std::vector<uint8_t> pps = session->pps;
-        uint32_t seqno = 1;
-        const int y_size = p.width * p.height;
-        const int uv_size = (p.width / 2) * (p.height / 2);
-        std::string frame;
-        std::string yuv;
-        yuv.resize(y_size + 2 * uv_size);
-        uint8_t *y = reinterpret_cast<uint8_t *>(yuv.data());
-        uint8_t *u = y + y_size;
-        uint8_t *v = u + uv_size;
-        bool sent_init = false;
-        std::unique_ptr<Mp4Fragmenter> mux_guard;
-        Mp4Fragmenter *mux = nullptr;
-        uint64_t decode_time = 0;
-        if (!sps.empty() && !pps.empty()) {
-          mux_guard = std::make_unique<Mp4Fragmenter>(p.width, p.height, p.fps,
-                                                      sps, pps);
-          mux = mux_guard.get();
-        }
-        uint32_t last_idr = session->idr_request_seq.load();
-        while (true) {
-          if (session->idr_request_seq.load() > last_idr) {
-            encoder.force_idr();
-            last_idr = session->idr_request_seq.load();
-          }
-          if (!session->capture || !session->capture->running()) {
-            std::this_thread::sleep_for(10ms);
-            continue;
-          }
-          if (!session->capture->latest_frame(frame)) {
-            std::this_thread::sleep_for(5ms);
-            continue;
-          }
-          PixelFormat fmt = session->capture->pixel_format();
-          if (fmt != PixelFormat::YUYV && fmt != PixelFormat::NV12) {
-            std::this_thread::sleep_for(5ms);
-            continue;
-          }
-          if (fmt == PixelFormat::YUYV) {
-            yuyv_to_i420(reinterpret_cast<const uint8_t *>(frame.data()),
-                         p.width, p.height, y, u, v);
-          } else {
-            const uint8_t *src_y =
-                reinterpret_cast<const uint8_t *>(frame.data());
-            const uint8_t *src_uv = src_y + (p.width * p.height);
-            nv12_to_i420(src_y, src_uv, p.width, p.height, p.width, p.width, y,
-                         u, v);
-          }
-          std::string nal_annexb;
-          if (!encoder.encode_i420(y, u, v, nal_annexb)) {
-            std::this_thread::sleep_for(5ms);
-            continue;
-          }
-          if (sps.empty() || pps.empty()) {
-            extract_sps_pps(nal_annexb, sps, pps);
-            if (!sps.empty() && !pps.empty()) {
-              session->sps = sps;
-              session->pps = pps;
-              mux_guard = std::make_unique<Mp4Fragmenter>(p.width, p.height,
-                                                          p.fps, sps, pps);
-              mux = mux_guard.get();
-            }
-          }
-          if (!mux) {
-            continue;
-          }
-          if (!sent_init) {
-            auto init_seg = mux->build_init_segment();
-            if (!sink.write(init_seg.data(), init_seg.size()))
-              return false;
-            sent_init = true;
-          }
-          auto avcc = annexb_to_avcc(nal_annexb);
-          bool keyframe = !nal_annexb.empty() && ((nal_annexb[4] & 0x1F) == 5);
-          auto frag = mux->build_fragment(avcc, seqno++, decode_time,
-                                          sample_duration, keyframe);
-          decode_time += sample_duration;
-          if (!sink.write(frag.data(), frag.size()))
-            return false;
+  // preflight_fmp4_bootstrap() guarantees the parameter sets are cached.
+  std::vector<uint8_t> sps;
+  std::vector<uint8_t> pps;
+  encoder->parameter_sets(sps, pps);
+  // A rendition's track has its own geometry.
+  const CaptureParams track = encoder->scaled() ? encoder->requested() : p;
+  server.deliver(res, "video/mp4",
+                 std::make_unique<Fmp4Source>(std::move(session),
+                                              std::move(encoder), track, sps,
+                                              pps, rewind),
+                 std::move(on_done));
+}
 
-          session->frames_sent.fetch_add(1);
-          session->bytes_sent.fetch_add(frag.size());
-          session->last_accessed = std::chrono::steady_clock::now();
-          std::this_thread::sleep_for(
-              std::chrono::milliseconds(1000 / std::max(1, p.fps)));
-        }
-        return true;
-      },
-      on_done);
-#else
+void serve_ws_live(StreamServer &server, const CaptureParams &p,
+                   const httplib::Request &req, httplib::Response &res,
+                   std::shared_ptr<Session> session,
+                   std::shared_ptr<SessionEncoder> encoder,
+                   std::function<void(bool)> on_done) {
   (void)p;
-  res.status = 503;
-  res.set_content(build_error_json("h264_unavailable", "OpenH264 not enabled"),
-                  "application/json");
-  on_done(false);
-#endif
+  const std::string key = req.get_header_value("Sec-WebSocket-Key");
+  std::string upgrade = req.get_header_value("Upgrade");
+  std::transform(upgrade.begin(), upgrade.end(), upgrade.begin(), ::tolower);
+  if (upgrade != "websocket" || key.empty()) {
+    res.status = 400;
+    res.set_content(build_error_json("bad_request", "expected WebSocket upgrade"),
+                    "application/json");
+    on_done(false);
+    return;
+  }
+  if (encoder && !encoder->available()) {
+    res.status = 503;
+    res.set_content(
+        build_error_json("h264_unavailable",
+                         "OpenH264 not enabled and camera has no H.264"),
+        "application/json");
+    on_done(false);
+    return;
+  }
+  res.set_header("Upgrade", "websocket");
+  res.set_header("Connection", "Upgrade");
+  res.set_header("Sec-WebSocket-Accept", ws::accept_key(key));
+  auto source =
+      std::make_unique<WsSource>(std::move(session), std::move(encoder));
+  if (!server.upgrade(res, std::move(source), on_done)) {
+    res.status = 503;
+    res.headers.clear();
+    res.set_content(build_error_json("ws_unavailable",
+                                     "WebSocket streaming is Linux only"),
+                    "application/json");
+    on_done(false);
+  }
+}
+
+std::unique_ptr<StreamSource>
+make_udp_source(std::shared_ptr<Session> session,
+                std::shared_ptr<SessionEncoder> encoder,
+                const UdpOptions &options) {
+  return std::make_unique<UdpSource>(std::move(session), std::move(encoder),
+                                     options);
 }
 
 bool preflight_fmp4_bootstrap(const CaptureParams &p,
                               std::shared_ptr<Session> session,
+                              const std::shared_ptr<SessionEncoder> &encoder,
                               std::string &error) {
-#ifdef HAS_OPENH264
+  (void)p;
   if (!session->capture || !session->capture->running()) {
     error = "capture not running";
     return false;
   }
-  if (!session->sps.empty() && !session->pps.empty()) {
+  if (!encoder->available()) {
+    error = "OpenH264 not enabled";
+    return false;
+  }
+  std::vector<uint8_t> sps;
+  std::vector<uint8_t> pps;
+  if (encoder->parameter_sets(sps, pps)) {
     return true;
   }
-
-  H264Encoder encoder;
-  if (!encoder.init(p)) {
-    error = "h264 encoder init failed";
+  PixelFormat fmt = session->capture->pixel_format();
+  if (!is_raw_yuv(fmt) && fmt != PixelFormat::H264) {
+    error = std::string("unsupported pixel format: ") + pixel_format_label(fmt);
     return false;
   }
-  encoder.force_idr();
-
-  const int y_size = p.width * p.height;
-  const int uv_size = (p.width / 2) * (p.height / 2);
-  std::string frame;
-  std::string yuv;
-  yuv.resize(y_size + 2 * uv_size);
-  uint8_t *y = reinterpret_cast<uint8_t *>(yuv.data());
-  uint8_t *u = y + y_size;
-  uint8_t *v = u + uv_size;
-
-  constexpr int kTries = 200;
-  for (int i = 0; i < kTries; ++i) {
-    if (!session->capture->latest_frame(frame)) {
-      std::this_thread::sleep_for(10ms);
-      continue;
-    }
-    PixelFormat fmt = session->capture->pixel_format();
-    if (fmt != PixelFormat::YUYV && fmt != PixelFormat::NV12) {
-      error =
-          std::string("unsupported pixel format: ") + pixel_format_label(fmt);
-      return false;
-    }
-    if (fmt == PixelFormat::YUYV) {
-      yuyv_to_i420(reinterpret_cast<const uint8_t *>(frame.data()), p.width,
-                   p.height, y, u, v);
-    } else {
-      const uint8_t *src_y = reinterpret_cast<const uint8_t *>(frame.data());
-      const uint8_t *src_uv = src_y + (p.width * p.height);
-      nv12_to_i420(src_y, src_uv, p.width, p.height, p.width, p.width, y, u, v);
-    }
-    std::string nal_annexb;
-    if (!encoder.encode_i420(y, u, v, nal_annexb)) {
-      std::this_thread::sleep_for(10ms);
-      continue;
+
+  // Attach briefly so the shared encoder emits an IDR carrying SPS/PPS (or,
+  // for passthrough, until the camera's next one goes by).
+  auto sub = encoder->subscribe();
+  const auto deadline = std::chrono::steady_clock::now() + 2s;
+  bool ok = false;
+  while (std::chrono::steady_clock::now() < deadline) {
+    sub->pop(50ms);
+    if (encoder->parameter_sets(sps, pps)) {
+      ok = true;
+      break;
     }
-    std::vector<uint8_t> sps;
-    std::vector<uint8_t> pps;
-    extract_sps_pps(nal_annexb, sps, pps);
-    if (!sps.empty() && !pps.empty()) {
-      session->sps = std::move(sps);
-      session->pps = std::move(pps);
-      return true;
+    if (sub->closed()) {
+      break;
     }
   }
-
-  error = "timed out waiting for SPS/PPS";
-  return false;
-#else
-  (void)p;
-  (void)session;
-  error = "OpenH264 not enabled";
-  return false;
-#endif
+  const bool encoder_failed = sub->closed();
+  encoder->unsubscribe(sub);
+  if (!ok) {
+    error = encoder_failed ? "h264 encoder init failed"
+                           : "timed out waiting for SPS/PPS";
+  }
+  return ok;
 }
 
 } // namespace stream
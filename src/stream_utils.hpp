@@ -1,13 +1,22 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include <sys/socket.h>
+
 #include "httplib.h"
 #include "types.hpp"
 
 class Session;
+class SessionEncoder;
+class StreamServer;
+class StreamSource;
+class UdpTargets;
 
 namespace stream {
 
@@ -22,32 +31,115 @@ std::string build_device_caps_json(const std::string &device_id,
                                    std::string &error);
 #endif
 
+// Prometheus text exposition of the sessions' stage histograms and frame
+// counters (see metrics.hpp).
+std::string build_metrics_text(
+    const std::vector<std::shared_ptr<Session>> &sessions);
+
 // Parameter parsing / syncing
 CaptureParams parse_params(const httplib::Request &req);
+// The same from a bare query string (`codec=h264&w=1280`), as used by
+// keep-warm specs. Values are taken verbatim (no percent-decoding).
+CaptureParams parse_params(const std::string &query);
 void apply_latency_preset(CaptureParams &p);
 void sync_session_params(Session &session);
 void add_effective_headers(httplib::Response &res, const EffectiveParams &eff);
 
 // Bitstream helpers
-std::vector<uint8_t> annexb_to_avcc(const std::string &annexb);
+// Locates the NALs of an Annex-B buffer in a single pass; only needed when
+// the producer did not report them (cameras, hardware encoders).
+std::vector<NalSpan> annexb_nals(const std::string &annexb);
+// The same into `nals`, reusing its capacity.
+void annexb_nals(const std::string &annexb, std::vector<NalSpan> &nals);
+// Length-prefixed (AVCC) form of `data`, whose NALs are `nals`.
+std::string nals_to_avcc(const std::string &data,
+                         const std::vector<NalSpan> &nals);
+// The same into `out`, replacing its contents but keeping its capacity.
+void nals_to_avcc(const std::string &data, const std::vector<NalSpan> &nals,
+                  std::string &out);
+std::string annexb_to_avcc(const std::string &annexb);
+// frame.avcc, converting on the first call only.
+const std::string &frame_avcc(const EncodedFrame &frame);
 void extract_sps_pps(const std::string &annexb, std::vector<uint8_t> &sps,
                      std::vector<uint8_t> &pps);
+// Picture size coded in an SPS NAL (header byte included), cropping
+// applied. False if it is truncated or malformed.
+bool sps_dimensions(const std::vector<uint8_t> &sps, int &width, int &height);
+
+// Timing
+// 90 kHz decode times for muxed output, taken from capture timestamps (the
+// V4L2 buffer time, AVFoundation's sample time) instead of counted at the
+// nominal rate, so a player's timeline follows the camera clock and a late
+// or skipped frame shows as the gap it is. The first frame is at zero;
+// stamps never repeat or go back.
+class MediaClock {
+public:
+  static constexpr uint32_t kTimescale = 90000;
+
+  explicit MediaClock(int fps);
+  // Decode time of the frame captured at `captured_at`. `duration` is the
+  // sample duration to write: the interval since the previous frame (the
+  // next capture time is not known yet), nominal for the first.
+  uint64_t stamp(std::chrono::steady_clock::time_point captured_at,
+                 uint32_t &duration);
+
+private:
+  const uint32_t nominal_;
+  std::chrono::steady_clock::time_point origin_{};
+  uint64_t last_ = 0;
+  bool started_ = false;
+};
 
 // Streaming responders
 void serve_mjpeg_placeholder(const CaptureParams &p, httplib::Response &res,
                              std::shared_ptr<Session> session,
                              std::function<void(bool)> on_done);
-void serve_mjpeg_live(const CaptureParams &p, httplib::Response &res,
-                      std::shared_ptr<Session> session,
+// Live responders hand the body to `server`, which streams it from its I/O
+// threads once the headers are out. H.264 ones take the encoder to join
+// (SessionManager::encoder_for: the session's own or a rendition), and
+// with `rewind` start that far in the past from its rewind ring (live when
+// the ring is off or empty).
+void serve_mjpeg_live(StreamServer &server, const CaptureParams &p,
+                      httplib::Response &res, std::shared_ptr<Session> session,
                       std::function<void(bool)> on_done);
-void serve_h264_live(const CaptureParams &p, httplib::Response &res,
-                     std::shared_ptr<Session> session,
-                     std::function<void(bool)> on_done);
-void serve_fmp4_live(const CaptureParams &p, httplib::Response &res,
-                     std::shared_ptr<Session> session,
-                     std::function<void(bool)> on_done);
+void serve_h264_live(StreamServer &server, const CaptureParams &p,
+                     httplib::Response &res, std::shared_ptr<Session> session,
+                     std::shared_ptr<SessionEncoder> encoder,
+                     std::function<void(bool)> on_done,
+                     std::chrono::milliseconds rewind = {});
+void serve_fmp4_live(StreamServer &server, const CaptureParams &p,
+                     httplib::Response &res, std::shared_ptr<Session> session,
+                     std::shared_ptr<SessionEncoder> encoder,
+                     std::function<void(bool)> on_done,
+                     std::chrono::milliseconds rewind = {});
+// WebSocket upgrade: one binary message per access unit/JPEG behind a small
+// header, with IDR/bitrate feedback coming back as text messages. A null
+// `encoder` streams MJPEG from the capture.
+void serve_ws_live(StreamServer &server, const CaptureParams &p,
+                   const httplib::Request &req, httplib::Response &res,
+                   std::shared_ptr<Session> session,
+                   std::shared_ptr<SessionEncoder> encoder,
+                   std::function<void(bool)> on_done);
+struct UdpOptions {
+  size_t mtu = 1400; // datagram size including UdpFrameHeader (576..9000)
+  bool pace = false; // spread each frame over the frame interval
+  int fec = 0;       // one XOR parity datagram per this many; 0 = off
+  bool timestamps = false; // kUdpTimestamp on every datagram
+  sockaddr_storage peer{}; // connected receiver, to match NACK targets
+  std::chrono::seconds duration{10};
+  // Persistent output: send to these (unconnected socket) until the list
+  // ends; `duration` is then ignored.
+  std::shared_ptr<UdpTargets> targets;
+};
+// UDP sender for StreamEngine::Framing::Datagram: H.264 from `encoder` or,
+// when it is null, MJPEG from the capture, fragmented behind UdpFrameHeader.
+std::unique_ptr<StreamSource>
+make_udp_source(std::shared_ptr<Session> session,
+                std::shared_ptr<SessionEncoder> encoder,
+                const UdpOptions &options);
 bool preflight_fmp4_bootstrap(const CaptureParams &p,
                               std::shared_ptr<Session> session,
+                              const std::shared_ptr<SessionEncoder> &encoder,
                               std::string &error);
 
 } // namespace stream
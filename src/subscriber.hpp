@@ -0,0 +1,148 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "types.hpp"
+
+// Per-viewer queue fed by a session's encoder thread. The producer never
+// blocks, so one slow reader cannot stall the encoder or the other viewers.
+// When the queue is full the subscriber sheds in GOP-aware steps:
+//   1. non-reference frames (queued or incoming) go first, since nothing
+//      predicts from them;
+//   2. failing that, the whole backlog is dropped and the subscriber skips
+//      ahead to the next IDR, so a lagging viewer is back at live within
+//      one GOP instead of trailing it frame by frame.
+class FrameSubscriber {
+public:
+  explicit FrameSubscriber(size_t capacity = 8) : capacity_(capacity) {}
+
+  void push(const EncodedFramePtr &frame) {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (closed_)
+        return;
+      // A new (or recovering) subscriber can only start decoding at an IDR.
+      if (waiting_for_key_) {
+        if (!frame->keyframe) {
+          dropped_ += recovering_ ? 1 : 0;
+          return;
+        }
+        waiting_for_key_ = false;
+        recovering_ = false;
+      }
+      if (queue_.size() >= capacity_ + backlog_ && !make_room(*frame))
+        return;
+      queue_.push_back(frame);
+      if (listener_)
+        listener_();
+    }
+    cv_.notify_one();
+  }
+
+  // Seeds a new subscriber with a cached GOP (IDR first). The backlog may
+  // exceed the queue capacity; the extra room shrinks as it is drained.
+  void prime(const std::vector<EncodedFramePtr> &gop) {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (closed_ || gop.empty() || !gop.front()->keyframe)
+        return;
+      queue_.assign(gop.begin(), gop.end());
+      backlog_ = gop.size();
+      waiting_for_key_ = false;
+      if (listener_)
+        listener_();
+    }
+    cv_.notify_one();
+  }
+
+  // Called under the queue lock whenever a frame is queued or the subscriber
+  // closes; must be cheap and must not call back into this subscriber.
+  // Clearing it guarantees the old callback is no longer running.
+  void set_listener(std::function<void()> fn) {
+    std::lock_guard<std::mutex> lock(mu_);
+    listener_ = std::move(fn);
+  }
+
+  // Returns the next frame, or nullptr on timeout or once closed.
+  EncodedFramePtr pop(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mu_);
+    cv_.wait_for(lock, timeout, [this] { return closed_ || !queue_.empty(); });
+    if (queue_.empty())
+      return nullptr;
+    auto frame = std::move(queue_.front());
+    queue_.pop_front();
+    if (backlog_ > 0)
+      --backlog_;
+    return frame;
+  }
+
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      closed_ = true;
+      queue_.clear();
+      if (listener_)
+        listener_();
+    }
+    cv_.notify_all();
+  }
+
+  bool closed() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return closed_;
+  }
+
+  // Frames this subscriber has shed because it could not keep up.
+  uint64_t dropped() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return dropped_;
+  }
+
+private:
+  // Full queue: returns true if `incoming` may now be queued.
+  bool make_room(const EncodedFrame &incoming) {
+    if (!incoming.reference && !incoming.keyframe) {
+      ++dropped_;
+      return false;
+    }
+    const size_t before = queue_.size();
+    for (auto it = queue_.begin(); it != queue_.end();) {
+      if (!(*it)->reference && !(*it)->keyframe)
+        it = queue_.erase(it);
+      else
+        ++it;
+    }
+    dropped_ += before - queue_.size();
+    backlog_ = std::min(backlog_, queue_.size());
+    if (queue_.size() < capacity_ + backlog_)
+      return true;
+    // Everything left is referenced: restart at the next IDR.
+    dropped_ += queue_.size();
+    queue_.clear();
+    backlog_ = 0;
+    if (incoming.keyframe)
+      return true;
+    ++dropped_;
+    waiting_for_key_ = true;
+    recovering_ = true;
+    return false;
+  }
+
+  mutable std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<EncodedFramePtr> queue_;
+  const size_t capacity_;
+  size_t backlog_ = 0; // primed frames allowed beyond capacity_
+  bool waiting_for_key_ = true;
+  bool recovering_ = false; // waiting after an overflow, not a fresh join
+  uint64_t dropped_ = 0;
+  bool closed_ = false;
+  std::function<void()> listener_;
+};
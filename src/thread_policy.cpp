@@ -0,0 +1,175 @@
+#include "thread_policy.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+#ifdef __linux__
+struct Tier {
+  int fifo = 0; // SCHED_FIFO priority with --realtime; 0 = stay SCHED_OTHER
+  int nice = 0;
+};
+
+// Capture ranks above encode: a late dequeue loses the frame outright,
+// a late encode only delays it.
+Tier tier_for(ThreadRole role, const std::string &latency) {
+  const bool capture = role == ThreadRole::Capture;
+  if (latency == "ultra")
+    return {capture ? 50 : 40, capture ? -10 : -8};
+  if (latency == "low")
+    return {capture ? 30 : 20, capture ? -5 : -4};
+  return {};
+}
+
+// One line per kind of refusal, not one per session.
+void warn_once(std::atomic<bool> &warned, const std::string &what) {
+  if (!warned.exchange(true))
+    std::cerr << "Thread policy: " << what << ": " << std::strerror(errno)
+              << " (continuing without)\n";
+}
+
+std::string read_line(const std::filesystem::path &path) {
+  std::ifstream file(path);
+  std::string line;
+  std::getline(file, line);
+  return line;
+}
+
+// CPUs of `node`, or nothing where placement would not change anything.
+std::vector<int> node_cpus(int node) {
+  std::vector<int> nodes;
+  if (node < 0 ||
+      !parse_cpu_list(read_line("/sys/devices/system/node/online"), nodes) ||
+      nodes.size() < 2)
+    return {};
+  std::vector<int> cpus;
+  parse_cpu_list(read_line("/sys/devices/system/node/node" +
+                           std::to_string(node) + "/cpulist"),
+                 cpus);
+  return cpus;
+}
+#endif
+} // namespace
+
+void apply_thread_policy(const ThreadOptions &options, ThreadRole role,
+                         const std::string &latency, int numa_node,
+                         const std::string &name) {
+#ifdef __linux__
+  static std::atomic<bool> affinity_warned{false};
+  static std::atomic<bool> fifo_warned{false};
+  static std::atomic<bool> nice_warned{false};
+
+  (void)pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+
+  std::vector<int> cpus =
+      role == ThreadRole::Capture ? options.capture_cpus : options.encode_cpus;
+  if (cpus.empty() && options.numa)
+    cpus = node_cpus(numa_node);
+  if (!cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+      if (cpu >= 0 && cpu < CPU_SETSIZE)
+        CPU_SET(cpu, &set);
+    const int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0) {
+      errno = err;
+      warn_once(affinity_warned, "CPU affinity");
+    }
+  }
+
+  const Tier tier = tier_for(role, latency);
+  if (options.realtime && tier.fifo > 0) {
+    sched_param param{};
+    param.sched_priority = tier.fifo;
+    const int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err == 0)
+      return;
+    errno = err;
+    warn_once(fifo_warned, "SCHED_FIFO");
+  }
+  // Without SCHED_FIFO, nice applies per thread on Linux.
+  if (tier.nice != 0 &&
+      ::setpriority(PRIO_PROCESS, static_cast<id_t>(::syscall(SYS_gettid)),
+                    tier.nice) != 0)
+    warn_once(nice_warned, "nice " + std::to_string(tier.nice));
+#else
+  (void)options;
+  (void)role;
+  (void)latency;
+  (void)numa_node;
+  (void)name;
+#endif
+}
+
+int device_numa_node(const std::string &device_path) {
+#ifdef __linux__
+  // A USB camera has no node of its own: walk up to its host controller.
+  std::error_code ec;
+  auto dev = std::filesystem::canonical(device_path.rfind("/dev/", 0) == 0
+                                            ? device_path
+                                            : "/dev/" + device_path,
+                                        ec);
+  if (ec)
+    return -1;
+  auto dir = std::filesystem::canonical(
+      "/sys/class/video4linux" / dev.filename() / "device", ec);
+  if (ec)
+    return -1;
+  for (; dir != "/sys/devices" && dir.has_relative_path();
+       dir = dir.parent_path()) {
+    std::ifstream file(dir / "numa_node");
+    int node = -1;
+    if (file >> node)
+      return node;
+  }
+#else
+  (void)device_path;
+#endif
+  return -1;
+}
+
+bool parse_cpu_list(const std::string &text, std::vector<int> &cpus) {
+  cpus.clear();
+  size_t pos = 0;
+  while (pos < text.size()) {
+    size_t end = text.find(',', pos);
+    if (end == std::string::npos)
+      end = text.size();
+    const std::string item = text.substr(pos, end - pos);
+    const size_t dash = item.find('-');
+    try {
+      size_t used = 0;
+      const int first = std::stoi(item, &used);
+      int last = first;
+      if (dash != std::string::npos) {
+        if (used != dash)
+          return false;
+        size_t rest = 0;
+        last = std::stoi(item.substr(dash + 1), &rest);
+        used = dash + 1 + rest;
+      }
+      if (used != item.size() || first < 0 || last < first)
+        return false;
+      for (int cpu = first; cpu <= last; ++cpu)
+        cpus.push_back(cpu);
+    } catch (const std::exception &) {
+      return false;
+    }
+    pos = end + 1;
+  }
+  return !cpus.empty();
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Where and how a session's hot threads run. Capture must dequeue before
+// the driver runs out of buffers and encode sits on every frame's path,
+// so on a busy host both are worth protecting from the HTTP pool, the
+// engine threads and everything else on the machine.
+struct ThreadOptions {
+  // SCHED_FIFO for `ultra` and `low` sessions (needs CAP_SYS_NICE or an
+  // RLIMIT_RTPRIO). Otherwise those tiers only get a raised nice value.
+  bool realtime = false;
+  // CPUs to pin to; empty: the CPUs of the camera's NUMA node, on hosts
+  // with more than one node, else wherever the kernel likes.
+  std::vector<int> capture_cpus;
+  std::vector<int> encode_cpus;
+  bool numa = true; // false: never follow the device's node
+};
+
+enum class ThreadRole { Capture, Encode };
+
+// Names the calling thread (`name`, cut to 15 characters) and applies the
+// CPU placement and scheduling of `role` in the `latency` tier: `view`
+// keeps the default scheduling. `numa_node` is the device's node, -1 when
+// unknown. Best effort: what the kernel refuses is logged once, and the
+// thread runs on as it is. Threads it starts inherit all of it, such as
+// OpenH264's workers. Linux only; a no-op elsewhere.
+void apply_thread_policy(const ThreadOptions &options, ThreadRole role,
+                         const std::string &latency, int numa_node,
+                         const std::string &name);
+
+// NUMA node of the bus a V4L2 device hangs off (`/dev/video0`, `video0` or
+// a /dev/v4l/by-id link), -1 when unknown.
+int device_numa_node(const std::string &device_path);
+
+// Parses a kernel-style CPU list such as `2,3,8-11`; false on anything
+// else.
+bool parse_cpu_list(const std::string &text, std::vector<int> &cpus);
@@ -2,8 +2,13 @@
 
 #include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
+
+#include "metrics.hpp"
 
 struct CaptureParams {
   int width = 640;
@@ -15,22 +20,90 @@ struct CaptureParams {
   std::string codec = "mjpeg";   // "h264" or "mjpeg"
   std::string latency = "view";  // view | low | ultra
   std::string container = "raw"; // raw | mp4 (fMP4)
+  // Static-scene threshold, 0 = off: raw frames whose 16x16 blocks all
+  // stay within this many luma levels (mean) of the last encoded frame are
+  // not encoded; MJPEG parts within this many per mille in size of the
+  // last one sent are not sent. Either way one frame a second still goes.
+  int still = 0;
 };
 
-enum class PixelFormat { MJPEG, YUYV, NV12, UNKNOWN };
+// Accepted H.264 bitrates, from a query or a WebSocket `bitrate` command.
+constexpr int kMinBitrateKbps = 16;
+constexpr int kMaxBitrateKbps = 100000;
+
+enum class PixelFormat { MJPEG, YUYV, NV12, I420, H264, UNKNOWN };
+
+// Uncompressed layouts the H.264 path can encode from.
+inline bool is_raw_yuv(PixelFormat fmt) {
+  return fmt == PixelFormat::YUYV || fmt == PixelFormat::NV12 ||
+         fmt == PixelFormat::I420;
+}
 
 struct EffectiveParams {
   CaptureParams requested;
   CaptureParams actual;
+  bool passthrough = false; // H.264 comes from the camera, not our encoder
+};
+
+// One captured frame in the device's native pixel format. Published once by
+// the capture thread and shared read-only by every consumer.
+struct CapturedFrame {
+  std::vector<uint8_t> storage; // pooled storage; may be larger than `size`
+  // Set instead of `storage` when the frame lends a driver buffer zero-copy.
+  const uint8_t *external = nullptr;
+  int dmabuf_fd = -1; // exported handle of that driver buffer, if any
+  size_t size = 0;
+  uint64_t seq = 0; // monotonically increasing per capture, starts at 1
+  // Driver timestamp (CLOCK_MONOTONIC == steady_clock on Linux) when
+  // available, else the dequeue time.
+  std::chrono::steady_clock::time_point captured_at{};
+  std::chrono::steady_clock::time_point dequeued_at{}; // published at
+
+  const uint8_t *data() const {
+    return external ? external : storage.data();
+  }
 };
+using FrameRef = std::shared_ptr<const CapturedFrame>;
+
+// One NAL unit inside EncodedFrame::data: where its header byte starts
+// (past the start code), its size without start code, and its type.
+struct NalSpan {
+  uint32_t offset = 0;
+  uint32_t size = 0;
+  uint8_t type = 0;    // nal_unit_type
+  uint8_t ref_idc = 0; // nal_ref_idc
+};
+
+// One encoded access unit (Annex-B H.264, start codes included). Produced once
+// per session and shared read-only by every subscriber.
+struct EncodedFrame {
+  std::string data;
+  // NAL boundaries within `data`, in order. Filled by encoders that know
+  // them; otherwise SessionEncoder scans `data` once before publishing.
+  std::vector<NalSpan> nals;
+  bool keyframe = false;
+  // False when no VCL NAL has nal_ref_idc set: nothing predicts from this
+  // frame, so a congested subscriber may skip it without breaking decode.
+  bool reference = true;
+  uint64_t seq = 0;
+  std::chrono::steady_clock::time_point captured_at{}; // of the source frame
+  std::chrono::steady_clock::time_point published_at{}; // to subscribers
+  // Length-prefixed copy of `data` for MP4 muxing, built on first use by
+  // stream::frame_avcc() and then shared by every fMP4 viewer of the frame.
+  mutable std::once_flag avcc_once;
+  mutable std::string avcc;
+};
+using EncodedFramePtr = std::shared_ptr<const EncodedFrame>;
 
 struct Session {
   std::string device_id;
   CaptureParams params;
   std::shared_ptr<class CaptureV4L2> capture;
-  std::shared_ptr<class H264Encoder> encoder;
-  std::vector<uint8_t> sps;
-  std::vector<uint8_t> pps;
+  std::shared_ptr<class SessionEncoder> encoder; // shared H.264 encode + fan-out
+  // Scaled/decimated H.264 renditions of the same capture, created on
+  // demand by SessionManager::encoder_for(); `encoder` is the full-size one.
+  std::mutex renditions_mu;
+  std::vector<std::shared_ptr<class SessionEncoder>> renditions;
   uint32_t seqno = 1;
   PixelFormat pixel_format = PixelFormat::UNKNOWN;
   std::atomic<int> client_count{0};
@@ -39,16 +112,55 @@ struct Session {
       std::chrono::steady_clock::now();
   std::chrono::steady_clock::time_point started =
       std::chrono::steady_clock::now();
+  // Relay sessions: the upstream stream URL pulled instead of a device.
+  std::string upstream;
+  // Kept open without viewers (--keep-warm); the reaper never closes it.
+  std::atomic<bool> warm{false};
+  // When the last viewer left, plus the linger: the reaper closes the
+  // session then unless someone rejoined (guarded by SessionManager).
+  std::chrono::steady_clock::time_point release_at{};
   std::atomic<uint64_t> frames_sent{0};
   std::atomic<uint64_t> bytes_sent{0};
-  std::atomic<uint32_t> idr_request_seq{0};
+  // Frames skipped by MJPEG readers that fell behind the capture; H.264
+  // subscriber drops are counted by SessionEncoder.
+  std::atomic<uint64_t> frames_dropped{0};
+  // MJPEG parts readers held back as unchanged (CaptureParams::still);
+  // encoders count their own.
+  std::atomic<uint64_t> frames_unchanged{0};
+  // Per-stage latency and counters of its viewers, for /metrics.
+  SessionMetrics metrics;
+  // Persistent UDP outputs (/stream/{id}/udp), one per address family:
+  // [0] IPv4, [1] IPv6. Each holds a client_count reference while it runs.
+  std::mutex udp_mu;
+  std::shared_ptr<class UdpTargets> udp_outputs[2];
+  // NACK inboxes of the session's H.264 UDP senders (guarded by udp_mu).
+  std::vector<std::weak_ptr<class UdpNacks>> udp_nacks;
+  // LL-HLS packagers, one per encoder served as HLS. Each holds a
+  // client_count reference until it goes idle.
+  std::mutex hls_mu;
+  std::vector<std::shared_ptr<class HlsPackager>> hls;
+  // Continuous recording (--record); set once at startup. Declared after
+  // `encoder` so it is flushed before the session's encoder goes away.
+  std::shared_ptr<class Recorder> recorder;
 };
 
+// UdpFrameHeader::flags. A plain fragment has none set, which keeps it
+// byte-identical to the original [frame_id:4][frag_id:2][num_frags:2]
+// [data_size:4] layout.
+constexpr uint8_t kUdpRetransmit = 0x01; // resent in answer to a NACK
+constexpr uint8_t kUdpParity = 0x02;     // XOR of fec_span fragments
+// The header is followed by the frame's capture time: u32, 90 kHz, in the
+// header's byte order, counted from the sender's first frame (and wrapping).
+// Only sent when the receiver asks for it (ts=1).
+constexpr uint8_t kUdpTimestamp = 0x04;
+
 #pragma pack(push, 1)
 struct UdpFrameHeader {
-  uint32_t frame_id;
-  uint16_t frag_id;
-  uint16_t num_frags;
-  uint32_t data_size; // Payload size in this packet
+  uint32_t frame_id;  // session frame sequence
+  uint16_t frag_id;   // parity: first fragment covered
+  uint16_t num_frags; // data fragments in the frame (parity excluded)
+  uint16_t data_size; // payload size; parity: XOR of the covered sizes
+  uint8_t flags;
+  uint8_t fec_span; // parity: fragments covered
 };
 #pragma pack(pop)
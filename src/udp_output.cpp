@@ -0,0 +1,179 @@
+#include "udp_output.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+bool same_udp_address(const sockaddr_storage &a, const sockaddr_storage &b) {
+  if (a.ss_family != b.ss_family)
+    return false;
+  if (a.ss_family == AF_INET) {
+    const auto &x = reinterpret_cast<const sockaddr_in &>(a);
+    const auto &y = reinterpret_cast<const sockaddr_in &>(b);
+    return x.sin_port == y.sin_port && x.sin_addr.s_addr == y.sin_addr.s_addr;
+  }
+  const auto &x = reinterpret_cast<const sockaddr_in6 &>(a);
+  const auto &y = reinterpret_cast<const sockaddr_in6 &>(b);
+  return x.sin6_port == y.sin6_port &&
+         std::memcmp(&x.sin6_addr, &y.sin6_addr, sizeof(x.sin6_addr)) == 0;
+}
+
+bool UdpTargets::add(const sockaddr_storage &addr) {
+  std::lock_guard<std::mutex> lock(mu_);
+  if (ended_)
+    return false;
+  for (const auto &t : targets_) {
+    if (same_udp_address(t, addr))
+      return false;
+  }
+  targets_.push_back(addr);
+  return true;
+}
+
+bool UdpTargets::remove(const sockaddr_storage &addr) {
+  std::lock_guard<std::mutex> lock(mu_);
+  auto it = std::find_if(targets_.begin(), targets_.end(),
+                         [&](const auto &t) { return same_udp_address(t, addr); });
+  if (it == targets_.end())
+    return false;
+  targets_.erase(it);
+  if (targets_.empty())
+    ended_ = true;
+  return true;
+}
+
+bool UdpTargets::ended() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return ended_;
+}
+
+bool UdpTargets::contains(const sockaddr_storage &addr) const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return std::any_of(targets_.begin(), targets_.end(), [&](const auto &t) {
+    return same_udp_address(t, addr);
+  });
+}
+
+void UdpTargets::snapshot(std::vector<sockaddr_storage> &out) const {
+  std::lock_guard<std::mutex> lock(mu_);
+  out = targets_;
+}
+
+std::string UdpTargets::to_json() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  std::string out = "[";
+  for (size_t i = 0; i < targets_.size(); ++i) {
+    if (i > 0)
+      out += ",";
+    out += "\"" + format_udp_target(targets_[i]) + "\"";
+  }
+  return out + "]";
+}
+
+void UdpNacks::push(Request request) {
+  // Woken under the lock, so set_wake(nullptr) guarantees the old wake is
+  // no longer running.
+  std::lock_guard<std::mutex> lock(mu_);
+  if (pending_.size() >= kMaxPending)
+    pending_.pop_front();
+  pending_.push_back(std::move(request));
+  if (wake_)
+    wake_();
+}
+
+bool UdpNacks::pop(Request &out) {
+  std::lock_guard<std::mutex> lock(mu_);
+  if (pending_.empty())
+    return false;
+  out = std::move(pending_.front());
+  pending_.pop_front();
+  return true;
+}
+
+void UdpNacks::set_wake(std::function<void()> wake) {
+  std::lock_guard<std::mutex> lock(mu_);
+  wake_ = std::move(wake);
+}
+
+bool parse_udp_target(const std::string &ip, int port, sockaddr_storage &out) {
+  out = {};
+  if (port <= 0 || port > 65535)
+    return false;
+  auto &v4 = reinterpret_cast<sockaddr_in &>(out);
+  if (inet_pton(AF_INET, ip.c_str(), &v4.sin_addr) == 1) {
+    v4.sin_family = AF_INET;
+    v4.sin_port = htons(static_cast<uint16_t>(port));
+    return true;
+  }
+  auto &v6 = reinterpret_cast<sockaddr_in6 &>(out);
+  if (inet_pton(AF_INET6, ip.c_str(), &v6.sin6_addr) == 1) {
+    v6.sin6_family = AF_INET6;
+    v6.sin6_port = htons(static_cast<uint16_t>(port));
+    return true;
+  }
+  return false;
+}
+
+std::string format_udp_target(const sockaddr_storage &addr) {
+  char ip[INET6_ADDRSTRLEN] = {};
+  if (addr.ss_family == AF_INET6) {
+    const auto &v6 = reinterpret_cast<const sockaddr_in6 &>(addr);
+    inet_ntop(AF_INET6, &v6.sin6_addr, ip, sizeof(ip));
+    return "[" + std::string(ip) + "]:" + std::to_string(ntohs(v6.sin6_port));
+  }
+  const auto &v4 = reinterpret_cast<const sockaddr_in &>(addr);
+  inet_ntop(AF_INET, &v4.sin_addr, ip, sizeof(ip));
+  return std::string(ip) + ":" + std::to_string(ntohs(v4.sin_port));
+}
+
+int open_udp_output(int family, int ttl, const std::string &iface,
+                    std::string &error) {
+  int sock = socket(family, SOCK_DGRAM, 0);
+  if (sock < 0) {
+    error = "failed to open UDP socket";
+    return -1;
+  }
+  unsigned ifindex = 0;
+  if (!iface.empty()) {
+    ifindex = if_nametoindex(iface.c_str());
+    if (ifindex == 0) {
+      close(sock);
+      error = "unknown interface " + iface;
+      return -1;
+    }
+  }
+  bool ok = true;
+  if (family == AF_INET) {
+    ok &= setsockopt(sock, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl)) == 0;
+    ok &= setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) ==
+          0;
+    if (ifindex != 0) {
+#ifdef __linux__
+      ip_mreqn mreq{};
+      mreq.imr_ifindex = static_cast<int>(ifindex);
+      ok &= setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, &mreq,
+                       sizeof(mreq)) == 0;
+#else
+      ok = false; // IPv4 needs ip_mreqn to select by index
+#endif
+    }
+  } else {
+    ok &= setsockopt(sock, IPPROTO_IPV6, IPV6_UNICAST_HOPS, &ttl,
+                     sizeof(ttl)) == 0;
+    ok &= setsockopt(sock, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl,
+                     sizeof(ttl)) == 0;
+    if (ifindex != 0)
+      ok &= setsockopt(sock, IPPROTO_IPV6, IPV6_MULTICAST_IF, &ifindex,
+                       sizeof(ifindex)) == 0;
+  }
+  if (!ok) {
+    close(sock);
+    error = "invalid ttl or interface";
+    return -1;
+  }
+  return sock;
+}
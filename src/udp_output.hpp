@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+
+// Receivers of a persistent UDP output (/stream/{id}/udp). The API edits the
+// list while the engine sends; every receiver gets every datagram of the
+// one shared encode. The output ends once its last receiver is removed.
+class UdpTargets {
+public:
+  // False if the address is already listed, or the output has ended.
+  bool add(const sockaddr_storage &addr);
+  // False if the address was not listed. Removing the last one ends the
+  // output.
+  bool remove(const sockaddr_storage &addr);
+  bool ended() const;
+  bool contains(const sockaddr_storage &addr) const;
+  void snapshot(std::vector<sockaddr_storage> &out) const;
+  std::string to_json() const; // ["ip:port", ...]
+
+private:
+  mutable std::mutex mu_;
+  std::vector<sockaddr_storage> targets_;
+  bool ended_ = false;
+};
+
+// Fragments a receiver is missing, routed from the feedback API to every
+// H.264 UDP sender of the session. Each sender answers from its own ring of
+// recent frames and ignores frames (or targets) that are not its own.
+class UdpNacks {
+public:
+  struct Request {
+    uint32_t frame_id = 0;
+    std::vector<uint16_t> frags;
+    bool has_target = false; // else: whoever the sender serves
+    sockaddr_storage target{};
+  };
+
+  // Bounded: under a NACK storm the oldest requests are dropped, since an
+  // IDR request is the better answer by then.
+  void push(Request request);
+  bool pop(Request &out);
+  void set_wake(std::function<void()> wake);
+
+private:
+  static constexpr size_t kMaxPending = 64;
+
+  std::mutex mu_;
+  std::deque<Request> pending_;
+  std::function<void()> wake_;
+};
+
+// IPv4 or IPv6 literal plus port; false if `ip` is neither.
+bool parse_udp_target(const std::string &ip, int port, sockaddr_storage &out);
+std::string format_udp_target(const sockaddr_storage &addr);
+bool same_udp_address(const sockaddr_storage &a, const sockaddr_storage &b);
+
+// Unconnected UDP socket for `family` with the hop limit applied to both
+// unicast and multicast, and multicast sent out of `iface` when one is
+// named. -1 with `error` set on failure.
+int open_udp_output(int family, int ttl, const std::string &iface,
+                    std::string &error);
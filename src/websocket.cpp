@@ -0,0 +1,161 @@
+#include "websocket.hpp"
+
+#include <array>
+
+namespace ws {
+namespace {
+// SHA-1 is only needed for the handshake; a small local copy keeps the
+// binary free of a crypto dependency.
+std::array<uint8_t, 20> sha1(const std::string &msg) {
+  uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476,
+                   0xC3D2E1F0};
+  std::string data = msg;
+  const uint64_t bit_len = static_cast<uint64_t>(msg.size()) * 8;
+  data.push_back(static_cast<char>(0x80));
+  while (data.size() % 64 != 56)
+    data.push_back(0);
+  for (int i = 7; i >= 0; --i)
+    data.push_back(static_cast<char>((bit_len >> (i * 8)) & 0xFF));
+
+  auto rol = [](uint32_t v, int n) { return (v << n) | (v >> (32 - n)); };
+  for (size_t chunk = 0; chunk < data.size(); chunk += 64) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; ++i) {
+      const auto *p =
+          reinterpret_cast<const uint8_t *>(data.data() + chunk + i * 4);
+      w[i] = (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+             (uint32_t(p[2]) << 8) | p[3];
+    }
+    for (int i = 16; i < 80; ++i)
+      w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; ++i) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6;
+      }
+      const uint32_t t = rol(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = rol(b, 30);
+      b = a;
+      a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+  std::array<uint8_t, 20> out{};
+  for (int i = 0; i < 5; ++i) {
+    out[i * 4] = static_cast<uint8_t>(h[i] >> 24);
+    out[i * 4 + 1] = static_cast<uint8_t>(h[i] >> 16);
+    out[i * 4 + 2] = static_cast<uint8_t>(h[i] >> 8);
+    out[i * 4 + 3] = static_cast<uint8_t>(h[i]);
+  }
+  return out;
+}
+
+std::string base64(const uint8_t *data, size_t size) {
+  static const char kTable[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  for (size_t i = 0; i < size; i += 3) {
+    uint32_t v = uint32_t(data[i]) << 16;
+    if (i + 1 < size)
+      v |= uint32_t(data[i + 1]) << 8;
+    if (i + 2 < size)
+      v |= data[i + 2];
+    out.push_back(kTable[(v >> 18) & 0x3F]);
+    out.push_back(kTable[(v >> 12) & 0x3F]);
+    out.push_back(i + 1 < size ? kTable[(v >> 6) & 0x3F] : '=');
+    out.push_back(i + 2 < size ? kTable[v & 0x3F] : '=');
+  }
+  return out;
+}
+} // namespace
+
+std::string accept_key(const std::string &client_key) {
+  const auto digest =
+      sha1(client_key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11");
+  return base64(digest.data(), digest.size());
+}
+
+void append_frame(std::string &out, Opcode opcode, const char *header,
+                  size_t header_size, const char *payload, size_t size) {
+  const uint64_t len = header_size + size;
+  out.push_back(static_cast<char>(0x80 | opcode));
+  if (len < 126) {
+    out.push_back(static_cast<char>(len));
+  } else if (len <= 0xFFFF) {
+    out.push_back(126);
+    out.push_back(static_cast<char>(len >> 8));
+    out.push_back(static_cast<char>(len & 0xFF));
+  } else {
+    out.push_back(127);
+    for (int i = 7; i >= 0; --i)
+      out.push_back(static_cast<char>((len >> (i * 8)) & 0xFF));
+  }
+  out.append(header, header_size);
+  out.append(payload, size);
+}
+
+bool FrameReader::feed(const char *data, size_t size) {
+  buf_.append(data, size);
+  return buf_.size() <= kMaxFrame + 14;
+}
+
+bool FrameReader::next(Opcode &opcode, std::string &payload) {
+  if (buf_.size() < 2)
+    return false;
+  const auto *p = reinterpret_cast<const uint8_t *>(buf_.data());
+  const bool masked = p[1] & 0x80;
+  uint64_t len = p[1] & 0x7F;
+  size_t pos = 2;
+  if (len == 126) {
+    if (buf_.size() < 4)
+      return false;
+    len = (uint64_t(p[2]) << 8) | p[3];
+    pos = 4;
+  } else if (len == 127) {
+    if (buf_.size() < 10)
+      return false;
+    len = 0;
+    for (int i = 0; i < 8; ++i)
+      len = (len << 8) | p[2 + i];
+    pos = 10;
+  }
+  if (len > kMaxFrame) {
+    // feed() reports the overflow; never wait for an oversized frame.
+    buf_.clear();
+    opcode = kClose;
+    payload.clear();
+    return true;
+  }
+  const size_t mask_pos = pos;
+  if (masked)
+    pos += 4;
+  if (buf_.size() < pos + len)
+    return false;
+  opcode = static_cast<Opcode>(p[0] & 0x0F);
+  payload.assign(buf_, pos, len);
+  if (masked) {
+    for (size_t i = 0; i < payload.size(); ++i)
+      payload[i] = static_cast<char>(payload[i] ^ p[mask_pos + (i & 3)]);
+  }
+  buf_.erase(0, pos + len);
+  return true;
+}
+
+} // namespace ws
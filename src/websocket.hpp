@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Minimal RFC 6455 server side: handshake key, unmasked server frames and an
+// incremental parser for the (masked) frames a browser sends back.
+namespace ws {
+
+enum Opcode : uint8_t {
+  kContinuation = 0x0,
+  kText = 0x1,
+  kBinary = 0x2,
+  kClose = 0x8,
+  kPing = 0x9,
+  kPong = 0xA,
+};
+
+// Sec-WebSocket-Accept for a client's Sec-WebSocket-Key.
+std::string accept_key(const std::string &client_key);
+
+// Appends a single unfragmented server frame (FIN set, no mask) to `out`.
+// `header` goes in front of `payload` inside the same frame, which saves a
+// copy for messages with a small binary prefix.
+void append_frame(std::string &out, Opcode opcode, const char *header,
+                  size_t header_size, const char *payload, size_t size);
+
+// Feeds client bytes in; next() yields complete, unmasked messages.
+class FrameReader {
+public:
+  // Refuses (returns false from feed) client frames larger than this.
+  static constexpr size_t kMaxFrame = 64 * 1024;
+
+  // False on a protocol violation; the connection should then be dropped.
+  bool feed(const char *data, size_t size);
+  // Pops the next complete frame; false when none is buffered.
+  bool next(Opcode &opcode, std::string &payload);
+
+private:
+  std::string buf_;
+};
+
+} // namespace ws
@@ -0,0 +1,491 @@
+#include "yuv_convert.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SILKCAST_YUV_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define SILKCAST_YUV_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// Row kernels. A YUYV kernel handles one source row pair (one chroma row);
+// a UV kernel splits one interleaved NV12 chroma row. Each SIMD kernel runs
+// its vector loop and finishes the tail with the scalar code, so any even
+// width works.
+using YuyvPairFn = void (*)(const uint8_t *row1, const uint8_t *row2,
+                            int width, uint8_t *y1, uint8_t *y2, uint8_t *u,
+                            uint8_t *v);
+using UvRowFn = void (*)(const uint8_t *uv, int width, uint8_t *u,
+                         uint8_t *v);
+// 2x2 box filter: one output row of `width` pixels from two source rows.
+using HalveRowFn = void (*)(const uint8_t *row1, const uint8_t *row2,
+                            int width, uint8_t *dst);
+// Adds the sum of absolute differences of each 16-byte run of two rows to
+// sums[0..blocks).
+using SadRowFn = void (*)(const uint8_t *a, const uint8_t *b, int blocks,
+                          uint32_t *sums);
+
+struct Kernels {
+  YuyvPairFn yuyv_pair;
+  UvRowFn uv_row;
+  HalveRowFn halve_row;
+  SadRowFn sad_row;
+  const char *name;
+};
+
+// Rounds like pavgb/vrhadd so every backend produces identical output.
+inline uint8_t avg_round(uint8_t a, uint8_t b) {
+  return static_cast<uint8_t>((a + b + 1) >> 1);
+}
+
+void yuyv_pair_scalar_from(int x, const uint8_t *row1, const uint8_t *row2,
+                           int width, uint8_t *y1, uint8_t *y2, uint8_t *u,
+                           uint8_t *v) {
+  for (; x < width; x += 2) {
+    y1[x] = row1[2 * x + 0];
+    y1[x + 1] = row1[2 * x + 2];
+    y2[x] = row2[2 * x + 0];
+    y2[x + 1] = row2[2 * x + 2];
+    u[x / 2] = avg_round(row1[2 * x + 1], row2[2 * x + 1]);
+    v[x / 2] = avg_round(row1[2 * x + 3], row2[2 * x + 3]);
+  }
+}
+
+void uv_row_scalar_from(int x, const uint8_t *uv, int width, uint8_t *u,
+                        uint8_t *v) {
+  for (; x < width; x += 2) {
+    u[x / 2] = uv[x + 0];
+    v[x / 2] = uv[x + 1];
+  }
+}
+
+// Rows first, then columns, each step rounding like avg_round().
+void halve_row_scalar_from(int x, const uint8_t *row1, const uint8_t *row2,
+                           int width, uint8_t *dst) {
+  for (; x < width; ++x) {
+    dst[x] = avg_round(avg_round(row1[2 * x], row2[2 * x]),
+                       avg_round(row1[2 * x + 1], row2[2 * x + 1]));
+  }
+}
+
+void halve_row_scalar(const uint8_t *row1, const uint8_t *row2, int width,
+                      uint8_t *dst) {
+  halve_row_scalar_from(0, row1, row2, width, dst);
+}
+
+void yuyv_pair_scalar(const uint8_t *row1, const uint8_t *row2, int width,
+                      uint8_t *y1, uint8_t *y2, uint8_t *u, uint8_t *v) {
+  yuyv_pair_scalar_from(0, row1, row2, width, y1, y2, u, v);
+}
+
+void uv_row_scalar(const uint8_t *uv, int width, uint8_t *u, uint8_t *v) {
+  uv_row_scalar_from(0, uv, width, u, v);
+}
+
+void sad_row_scalar(const uint8_t *a, const uint8_t *b, int blocks,
+                    uint32_t *sums) {
+  for (int i = 0; i < blocks; ++i) {
+    uint32_t sum = 0;
+    for (int k = 0; k < 16; ++k)
+      sum += static_cast<uint32_t>(std::abs(a[16 * i + k] - b[16 * i + k]));
+    sums[i] += sum;
+  }
+}
+
+#ifdef SILKCAST_YUV_X86
+// SSE2 is part of the x86-64 baseline, so it needs no target attribute.
+
+// 16 pixels per row: split 32 bytes of YUYV into 16 Y and 8 interleaved
+// UV pairs, average the UV of both rows, then split U from V.
+void yuyv_pair_sse2(const uint8_t *row1, const uint8_t *row2, int width,
+                    uint8_t *y1, uint8_t *y2, uint8_t *u, uint8_t *v) {
+  const __m128i lo = _mm_set1_epi16(0x00ff);
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + 2 * x));
+    __m128i b1 =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + 2 * x + 16));
+    __m128i a2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row2 + 2 * x));
+    __m128i b2 =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(row2 + 2 * x + 16));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(y1 + x),
+                     _mm_packus_epi16(_mm_and_si128(a1, lo), _mm_and_si128(b1, lo)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(y2 + x),
+                     _mm_packus_epi16(_mm_and_si128(a2, lo), _mm_and_si128(b2, lo)));
+
+    __m128i c1 = _mm_packus_epi16(_mm_srli_epi16(a1, 8), _mm_srli_epi16(b1, 8));
+    __m128i c2 = _mm_packus_epi16(_mm_srli_epi16(a2, 8), _mm_srli_epi16(b2, 8));
+    __m128i c = _mm_avg_epu8(c1, c2); // u0 v0 u1 v1 ...
+    __m128i uu = _mm_packus_epi16(_mm_and_si128(c, lo), _mm_setzero_si128());
+    __m128i vv = _mm_packus_epi16(_mm_srli_epi16(c, 8), _mm_setzero_si128());
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(u + x / 2), uu);
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(v + x / 2), vv);
+  }
+  yuyv_pair_scalar_from(x, row1, row2, width, y1, y2, u, v);
+}
+
+void uv_row_sse2(const uint8_t *uv, int width, uint8_t *u, uint8_t *v) {
+  const __m128i lo = _mm_set1_epi16(0x00ff);
+  int x = 0;
+  for (; x + 32 <= width; x += 32) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(uv + x));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(uv + x + 16));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(u + x / 2),
+                     _mm_packus_epi16(_mm_and_si128(a, lo), _mm_and_si128(b, lo)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(v + x / 2),
+                     _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+  }
+  uv_row_scalar_from(x, uv, width, u, v);
+}
+
+// 16 output pixels: average the rows bytewise, then the even/odd columns
+// as 16-bit lanes (pavgw rounds the same way as pavgb).
+void halve_row_sse2(const uint8_t *row1, const uint8_t *row2, int width,
+                    uint8_t *dst) {
+  const __m128i lo = _mm_set1_epi16(0x00ff);
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    __m128i a = _mm_avg_epu8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + 2 * x)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(row2 + 2 * x)));
+    __m128i b = _mm_avg_epu8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + 2 * x + 16)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(row2 + 2 * x + 16)));
+    __m128i ha = _mm_avg_epu16(_mm_and_si128(a, lo), _mm_srli_epi16(a, 8));
+    __m128i hb = _mm_avg_epu16(_mm_and_si128(b, lo), _mm_srli_epi16(b, 8));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x),
+                     _mm_packus_epi16(ha, hb));
+  }
+  halve_row_scalar_from(x, row1, row2, width, dst);
+}
+
+// psadbw sums each 8-byte half; the two halves make one block.
+void sad_row_sse2(const uint8_t *a, const uint8_t *b, int blocks,
+                  uint32_t *sums) {
+  for (int i = 0; i < blocks; ++i) {
+    const __m128i sad = _mm_sad_epu8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + 16 * i)),
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + 16 * i)));
+    sums[i] += static_cast<uint32_t>(_mm_cvtsi128_si32(sad) +
+                                     _mm_extract_epi16(sad, 4));
+  }
+}
+
+// AVX2 packs within 128-bit lanes; permute4x64(0xD8) restores linear order.
+__attribute__((target("avx2"))) void
+yuyv_pair_avx2(const uint8_t *row1, const uint8_t *row2, int width,
+               uint8_t *y1, uint8_t *y2, uint8_t *u, uint8_t *v) {
+  const __m256i lo = _mm256_set1_epi16(0x00ff);
+  const __m256i zero = _mm256_setzero_si256();
+  int x = 0;
+  for (; x + 32 <= width; x += 32) {
+    __m256i a1 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row1 + 2 * x));
+    __m256i b1 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row1 + 2 * x + 32));
+    __m256i a2 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row2 + 2 * x));
+    __m256i b2 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row2 + 2 * x + 32));
+
+    __m256i ya = _mm256_packus_epi16(_mm256_and_si256(a1, lo),
+                                     _mm256_and_si256(b1, lo));
+    __m256i yb = _mm256_packus_epi16(_mm256_and_si256(a2, lo),
+                                     _mm256_and_si256(b2, lo));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(y1 + x),
+                        _mm256_permute4x64_epi64(ya, 0xD8));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(y2 + x),
+                        _mm256_permute4x64_epi64(yb, 0xD8));
+
+    __m256i c1 = _mm256_packus_epi16(_mm256_srli_epi16(a1, 8),
+                                     _mm256_srli_epi16(b1, 8));
+    __m256i c2 = _mm256_packus_epi16(_mm256_srli_epi16(a2, 8),
+                                     _mm256_srli_epi16(b2, 8));
+    // Lane order is the same for both rows, so average before reordering.
+    __m256i c = _mm256_permute4x64_epi64(_mm256_avg_epu8(c1, c2), 0xD8);
+    __m256i uu = _mm256_permute4x64_epi64(
+        _mm256_packus_epi16(_mm256_and_si256(c, lo), zero), 0xD8);
+    __m256i vv = _mm256_permute4x64_epi64(
+        _mm256_packus_epi16(_mm256_srli_epi16(c, 8), zero), 0xD8);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(u + x / 2),
+                     _mm256_castsi256_si128(uu));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(v + x / 2),
+                     _mm256_castsi256_si128(vv));
+  }
+  yuyv_pair_scalar_from(x, row1, row2, width, y1, y2, u, v);
+}
+
+__attribute__((target("avx2"))) void uv_row_avx2(const uint8_t *uv, int width,
+                                                 uint8_t *u, uint8_t *v) {
+  const __m256i lo = _mm256_set1_epi16(0x00ff);
+  int x = 0;
+  for (; x + 64 <= width; x += 64) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(uv + x));
+    __m256i b =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(uv + x + 32));
+    __m256i uu = _mm256_packus_epi16(_mm256_and_si256(a, lo),
+                                     _mm256_and_si256(b, lo));
+    __m256i vv = _mm256_packus_epi16(_mm256_srli_epi16(a, 8),
+                                     _mm256_srli_epi16(b, 8));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(u + x / 2),
+                        _mm256_permute4x64_epi64(uu, 0xD8));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(v + x / 2),
+                        _mm256_permute4x64_epi64(vv, 0xD8));
+  }
+  uv_row_sse2(uv + x, width - x, u + x / 2, v + x / 2);
+}
+
+__attribute__((target("avx2"))) void
+halve_row_avx2(const uint8_t *row1, const uint8_t *row2, int width,
+               uint8_t *dst) {
+  const __m256i lo = _mm256_set1_epi16(0x00ff);
+  int x = 0;
+  for (; x + 32 <= width; x += 32) {
+    __m256i a = _mm256_avg_epu8(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row1 + 2 * x)),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row2 + 2 * x)));
+    __m256i b = _mm256_avg_epu8(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row1 + 2 * x + 32)),
+        _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(row2 + 2 * x + 32)));
+    __m256i ha =
+        _mm256_avg_epu16(_mm256_and_si256(a, lo), _mm256_srli_epi16(a, 8));
+    __m256i hb =
+        _mm256_avg_epu16(_mm256_and_si256(b, lo), _mm256_srli_epi16(b, 8));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x),
+                        _mm256_permute4x64_epi64(_mm256_packus_epi16(ha, hb),
+                                                 0xD8));
+  }
+  halve_row_sse2(row1 + 2 * x, row2 + 2 * x, width - x, dst + x);
+}
+
+// Two blocks per step: 64-bit lanes 0-1 are the first, 2-3 the second.
+__attribute__((target("avx2"))) void sad_row_avx2(const uint8_t *a,
+                                                  const uint8_t *b, int blocks,
+                                                  uint32_t *sums) {
+  int i = 0;
+  for (; i + 2 <= blocks; i += 2) {
+    const __m256i sad = _mm256_sad_epu8(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + 16 * i)),
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + 16 * i)));
+    sums[i] += static_cast<uint32_t>(_mm256_extract_epi16(sad, 0) +
+                                     _mm256_extract_epi16(sad, 4));
+    sums[i + 1] += static_cast<uint32_t>(_mm256_extract_epi16(sad, 8) +
+                                         _mm256_extract_epi16(sad, 12));
+  }
+  sad_row_sse2(a + 16 * i, b + 16 * i, blocks - i, sums + i);
+}
+#endif // SILKCAST_YUV_X86
+
+#ifdef SILKCAST_YUV_NEON
+// vld2 de-interleaves Y from UV on load; vuzp then splits U from V.
+void yuyv_pair_neon(const uint8_t *row1, const uint8_t *row2, int width,
+                    uint8_t *y1, uint8_t *y2, uint8_t *u, uint8_t *v) {
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    uint8x16x2_t p1 = vld2q_u8(row1 + 2 * x);
+    uint8x16x2_t p2 = vld2q_u8(row2 + 2 * x);
+    vst1q_u8(y1 + x, p1.val[0]);
+    vst1q_u8(y2 + x, p2.val[0]);
+    uint8x16_t c = vrhaddq_u8(p1.val[1], p2.val[1]);
+    uint8x8x2_t split = vuzp_u8(vget_low_u8(c), vget_high_u8(c));
+    vst1_u8(u + x / 2, split.val[0]);
+    vst1_u8(v + x / 2, split.val[1]);
+  }
+  yuyv_pair_scalar_from(x, row1, row2, width, y1, y2, u, v);
+}
+
+void uv_row_neon(const uint8_t *uv, int width, uint8_t *u, uint8_t *v) {
+  int x = 0;
+  for (; x + 32 <= width; x += 32) {
+    uint8x16x2_t p = vld2q_u8(uv + x);
+    vst1q_u8(u + x / 2, p.val[0]);
+    vst1q_u8(v + x / 2, p.val[1]);
+  }
+  uv_row_scalar_from(x, uv, width, u, v);
+}
+
+void halve_row_neon(const uint8_t *row1, const uint8_t *row2, int width,
+                    uint8_t *dst) {
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    uint8x16x2_t p1 = vld2q_u8(row1 + 2 * x);
+    uint8x16x2_t p2 = vld2q_u8(row2 + 2 * x);
+    vst1q_u8(dst + x, vrhaddq_u8(vrhaddq_u8(p1.val[0], p2.val[0]),
+                                 vrhaddq_u8(p1.val[1], p2.val[1])));
+  }
+  halve_row_scalar_from(x, row1, row2, width, dst);
+}
+
+void sad_row_neon(const uint8_t *a, const uint8_t *b, int blocks,
+                  uint32_t *sums) {
+  for (int i = 0; i < blocks; ++i) {
+    const uint8x16_t d = vabdq_u8(vld1q_u8(a + 16 * i), vld1q_u8(b + 16 * i));
+    const uint64x2_t s = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(d)));
+    sums[i] += static_cast<uint32_t>(vgetq_lane_u64(s, 0) +
+                                     vgetq_lane_u64(s, 1));
+  }
+}
+#endif // SILKCAST_YUV_NEON
+
+Kernels select_kernels() {
+#ifdef SILKCAST_YUV_X86
+#if defined(__GNUC__) || defined(__clang__)
+  if (__builtin_cpu_supports("avx2"))
+    return {yuyv_pair_avx2, uv_row_avx2, halve_row_avx2, sad_row_avx2,
+            "avx2"};
+#endif
+  return {yuyv_pair_sse2, uv_row_sse2, halve_row_sse2, sad_row_sse2, "sse2"};
+#elif defined(SILKCAST_YUV_NEON)
+  // NEON is mandatory on AArch64 and a build-time choice on ARMv7.
+  return {yuyv_pair_neon, uv_row_neon, halve_row_neon, sad_row_neon, "neon"};
+#else
+  return {yuyv_pair_scalar, uv_row_scalar, halve_row_scalar, sad_row_scalar,
+          "scalar"};
+#endif
+}
+
+const Kernels &kernels() {
+  static const Kernels k = select_kernels();
+  return k;
+}
+
+} // namespace
+
+void yuyv_to_i420(const uint8_t *src, int src_stride, int width, int height,
+                  uint8_t *dst_y, int dst_y_stride, uint8_t *dst_u,
+                  int dst_u_stride, uint8_t *dst_v, int dst_v_stride) {
+  const YuyvPairFn pair = kernels().yuyv_pair;
+  for (int y = 0; y + 1 < height; y += 2) {
+    pair(src + y * src_stride, src + (y + 1) * src_stride, width,
+         dst_y + y * dst_y_stride, dst_y + (y + 1) * dst_y_stride,
+         dst_u + (y / 2) * dst_u_stride, dst_v + (y / 2) * dst_v_stride);
+  }
+}
+
+void nv12_to_i420(const uint8_t *src_y, int src_y_stride,
+                  const uint8_t *src_uv, int src_uv_stride, int width,
+                  int height, uint8_t *dst_y, int dst_y_stride, uint8_t *dst_u,
+                  int dst_u_stride, uint8_t *dst_v, int dst_v_stride) {
+  for (int y = 0; y < height; ++y)
+    std::memcpy(dst_y + y * dst_y_stride, src_y + y * src_y_stride, width);
+  const UvRowFn uv_row = kernels().uv_row;
+  for (int y = 0; y < height / 2; ++y) {
+    uv_row(src_uv + y * src_uv_stride, width, dst_u + y * dst_u_stride,
+           dst_v + y * dst_v_stride);
+  }
+}
+
+void scale_plane(const uint8_t *src, int src_stride, int src_width,
+                 int src_height, uint8_t *dst, int dst_stride, int dst_width,
+                 int dst_height, std::vector<uint8_t> &scratch) {
+  // Box-halve while a whole 2:1 step still fits; an odd last column or row
+  // is dropped. Intermediates ping-pong between two halves of `scratch`.
+  const HalveRowFn halve = kernels().halve_row;
+  int w = src_width;
+  int h = src_height;
+  int halvings = 0;
+  while (w / 2 >= dst_width && h / 2 >= dst_height) {
+    w /= 2;
+    h /= 2;
+    ++halvings;
+  }
+  // Sized once up front: intermediates, the blended row and the column
+  // table of the bilinear pass (which reads from the intermediates).
+  const size_t half = static_cast<size_t>(src_width / 2) * (src_height / 2);
+  const size_t row_at = 2 * half;
+  const size_t table_at =
+      (row_at + static_cast<size_t>(std::max(w, 2)) + 3) & ~size_t{3};
+  if (scratch.size() < table_at + 4 * static_cast<size_t>(dst_width))
+    scratch.resize(table_at + 4 * static_cast<size_t>(dst_width));
+  w = src_width;
+  h = src_height;
+  for (int i = 0; i < halvings; ++i) {
+    const int nw = w / 2;
+    const int nh = h / 2;
+    // The last step writes straight into dst when no resampling follows.
+    const bool last = i + 1 == halvings && nw == dst_width && nh == dst_height;
+    uint8_t *out = last ? dst : scratch.data() + (i % 2) * half;
+    const int out_stride = last ? dst_stride : nw;
+    for (int y = 0; y < nh; ++y)
+      halve(src + 2 * y * src_stride, src + (2 * y + 1) * src_stride, nw,
+            out + y * out_stride);
+    if (last)
+      return;
+    src = out;
+    src_stride = out_stride;
+    w = nw;
+    h = nh;
+  }
+  if (w == dst_width && h == dst_height) {
+    for (int y = 0; y < h; ++y)
+      std::memcpy(dst + y * dst_stride, src + y * src_stride, w);
+    return;
+  }
+
+  // Bilinear for the remaining (< 2:1) ratio in 8-bit fixed point with
+  // pixel centres aligned: a vertical blend into one row (vectorised by
+  // the compiler), then a horizontal pass driven by a per-column table.
+  uint8_t *row = scratch.data() + row_at;
+  auto *table = reinterpret_cast<uint32_t *>(scratch.data() + table_at);
+  auto source_pos = [](int i, int from, int to) {
+    const int64_t step = (static_cast<int64_t>(from) << 16) / to;
+    return std::max<int64_t>(0, i * step + step / 2 - 0x8000);
+  };
+  for (int x = 0; x < dst_width; ++x) {
+    const int64_t fx = source_pos(x, w, dst_width);
+    const auto x0 = static_cast<uint32_t>(std::min<int64_t>(fx >> 16, w - 2));
+    // x0 in the low 24 bits, the weight of x0 + 1 in the top 8.
+    table[x] = x0 | ((fx >> 16) >= w - 1 ? 0xffu << 24
+                                         : static_cast<uint32_t>(fx >> 8) << 24);
+  }
+  for (int y = 0; y < dst_height; ++y) {
+    const int64_t fy = source_pos(y, h, dst_height);
+    const int y0 = std::min(static_cast<int>(fy >> 16), h - 1);
+    const int y1 = std::min(y0 + 1, h - 1);
+    const unsigned wy = static_cast<unsigned>(fy >> 8) & 0xff;
+    const uint8_t *r0 = src + y0 * src_stride;
+    const uint8_t *r1 = src + y1 * src_stride;
+    for (int x = 0; x < w; ++x)
+      row[x] = static_cast<uint8_t>(
+          (r0[x] * (256 - wy) + r1[x] * wy + 128) >> 8);
+    uint8_t *out = dst + y * dst_stride;
+    for (int x = 0; x < dst_width; ++x) {
+      const uint32_t x0 = table[x] & 0xffffff;
+      const uint32_t wx = table[x] >> 24;
+      out[x] = static_cast<uint8_t>(
+          (row[x0] * (256 - wx) + row[x0 + 1] * wx + 128) >> 8);
+    }
+  }
+}
+
+bool blocks_differ(const uint8_t *a, int a_stride, const uint8_t *b,
+                   int b_stride, int bytes, int rows, int threshold,
+                   std::vector<uint32_t> &sums) {
+  const SadRowFn sad = kernels().sad_row;
+  const int blocks = bytes / 16;
+  if (blocks == 0)
+    return false;
+  for (int top = 0; top < rows; top += 16) {
+    const int bottom = std::min(rows, top + 16);
+    sums.assign(static_cast<size_t>(blocks), 0);
+    uint32_t sampled = 0;
+    for (int y = top; y < bottom; y += 2, ++sampled)
+      sad(a + static_cast<size_t>(y) * a_stride,
+          b + static_cast<size_t>(y) * b_stride, blocks, sums.data());
+    const uint32_t limit = static_cast<uint32_t>(threshold) * 16 * sampled;
+    for (uint32_t sum : sums)
+      if (sum > limit)
+        return true;
+  }
+  return false;
+}
+
+const char *yuv_convert_backend() { return kernels().name; }